@@ -0,0 +1,88 @@
+/*
+ *      File:      binlog.h
+ *
+ * On-disk format of the chatserver binary event log, shared by the
+ * chatserver (writer) and the chatlog tool (reader).
+ *
+ * The log is a sequence of segment files named <prefix>.<NNNNNN>.seg.
+ * Each segment is pre-allocated to BINLOG_SEGMENT_SIZE bytes and starts
+ * with a binlog_seg_hdr, followed by fixed-size 32-byte records. Unused
+ * record slots are all zero, so the first record with type EV_NONE marks
+ * the end of the segment. All fields are in host byte order.
+ *
+ * Events that introduce a member or a room name (EV_MEMBER_JOIN,
+ * EV_ROOM_CREATE) are immediately followed, in the same segment, by an
+ * EV_NAME record carrying the name.
+ */
+
+#ifndef _BINLOG_H
+#define _BINLOG_H
+
+#include <sys/types.h>
+
+#define BINLOG_MAGIC         0x474c4843     /* "CHLG" */
+#define BINLOG_VERSION       1
+#define BINLOG_SEGMENT_SIZE  (4 << 20)
+#define BINLOG_REC_SIZE      32
+
+/* event types */
+#define EV_NONE           0
+#define EV_CHAT           1   /* aux: number of copies sent, len: bytes */
+#define EV_CHAT_DROP      2   /* aux: DROP_* reason, len: bytes */
+#define EV_CTRL_RECV      3   /* aux: msg_type, len: msg_len */
+#define EV_CTRL_SEND      4   /* aux: msg_type, len: msg_len */
+#define EV_MEMBER_JOIN    5   /* followed by EV_NAME */
+#define EV_MEMBER_LEAVE   6   /* aux: LEAVE_* reason */
+#define EV_ROOM_SWITCH    7   /* member moved into room */
+#define EV_ROOM_CREATE    8   /* followed by EV_NAME */
+#define EV_ROOM_REMOVE    9
+#define EV_NAME          10
+#define EV_CHAT_NACK     11   /* aux: retransmitted, len: no longer kept */
+#define EV_CHAT_DIRECT   12   /* aux: chat_direct flags, len: bytes */
+#define EV_CHAT_BULK     13   /* aux: number of copies sent, len: bytes */
+#define EV_MAX           13
+
+/* EV_CHAT_DROP reasons */
+#define DROP_BAD_ID       1
+#define DROP_NO_ROOM      2
+#define DROP_FILTERED     3
+#define DROP_CORRUPT      4
+#define DROP_QUEUE_FULL   5
+#define DROP_SHED         6
+#define DROP_NO_MEMBER    7   /* direct message, no one to take it */
+#define DROP_NACK_LIMIT   8   /* NACK over the member's retransmission rate */
+
+/* EV_MEMBER_LEAVE reasons */
+#define LEAVE_QUIT        1
+#define LEAVE_SWEPT       2
+
+struct binlog_seg_hdr {
+	u_int32_t magic;
+	u_int16_t version;
+	u_int16_t rec_size;
+	u_int32_t seg_no;
+	u_int32_t reserved;
+	u_int64_t created_ns;
+	u_int64_t pad;
+} __attribute__ ((packed));
+
+struct binlog_rec {
+	u_int16_t type;
+	u_int16_t aux;
+	u_int32_t member_id;
+	u_int64_t ts_ns;       /* CLOCK_REALTIME */
+	u_int32_t room_id;
+	u_int32_t len;
+	u_int32_t peer_ip;     /* network byte order, control events only */
+	u_int32_t reserved;
+} __attribute__ ((packed));
+
+struct binlog_name_rec {
+	u_int16_t type;        /* EV_NAME */
+	char name[BINLOG_REC_SIZE - sizeof(u_int16_t)];
+} __attribute__ ((packed));
+
+#define BINLOG_RECS_PER_SEG \
+	((BINLOG_SEGMENT_SIZE - sizeof(struct binlog_seg_hdr)) / BINLOG_REC_SIZE)
+
+#endif
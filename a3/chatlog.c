@@ -0,0 +1,315 @@
+/*
+ *      File:      chatlog.c
+ *
+ * Offline decoder for the chatserver binary event log (chatserver -l).
+ *
+ *   chatlog [-t <event type>] [-m <member id|name>] [-r <room id|name>] [-a]
+ *           <segment file> ...
+ *
+ * Without -a every matching record is rendered as one line of text; with
+ * -a the matching records are aggregated into per type, per member and
+ * per room totals. Segment files should be given in order (the shell's
+ * sorting of <prefix>.*.seg does that).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "defs.h"
+#include "defs_ext.h"
+#include "binlog.h"
+
+#define NAME_SLOTS  4096    /* must be a power of two */
+
+char optstr[] = "t:m:r:a";
+
+static char *ev_names[] = {
+	"NONE", "CHAT", "CHAT_DROP", "CTRL_RECV", "CTRL_SEND", "MEMBER_JOIN",
+	"MEMBER_LEAVE", "ROOM_SWITCH", "ROOM_CREATE", "ROOM_REMOVE", "NAME",
+	"CHAT_NACK", "CHAT_DIRECT", "CHAT_BULK"
+};
+
+static char *ctrl_names[] = {
+	"dummy", "REGISTER_REQUEST", "REGISTER_SUCC", "REGISTER_FAIL",
+	"ROOM_LIST_REQUEST", "ROOM_LIST_SUCC", "ROOM_LIST_FAIL",
+	"MEMBER_LIST_REQUEST", "MEMBER_LIST_SUCC", "MEMBER_LIST_FAIL",
+	"SWITCH_ROOM_REQUEST", "SWITCH_ROOM_SUCC", "SWITCH_ROOM_FAIL",
+	"CREATE_ROOM_REQUEST", "CREATE_ROOM_SUCC", "CREATE_ROOM_FAIL",
+	"MEMBER_KEEP_ALIVE", "QUIT_REQUEST", "?", "?",
+	"SEARCH_REQUEST", "SEARCH_SUCC", "SEARCH_FAIL",
+	"FILTER_REQUEST", "FILTER_SUCC", "FILTER_FAIL",
+	"ROOM_REDIRECT",
+	"STANDBY_INFO", "MOVE_ROOM_REQUEST", "MOVE_ROOM_SUCC", "MOVE_ROOM_FAIL",
+	"ROOM_TRANSFER", "ROOM_TRANSFER_SUCC", "ROOM_TRANSFER_FAIL", "MEMBER_MOVED",
+	"SUBSCRIBE_REQUEST", "SUBSCRIBE_SUCC", "SUBSCRIBE_FAIL",
+	"UNSUBSCRIBE_REQUEST", "UNSUBSCRIBE_SUCC", "UNSUBSCRIBE_FAIL",
+	"DIRECTORY_REQUEST", "DIRECTORY_SUCC", "DIRECTORY_FAIL"
+};
+
+/* id -> name and running totals, one table for members, one for rooms */
+struct entity {
+	u_int32_t id;
+	int used;
+	char name[BINLOG_REC_SIZE];
+	unsigned long msgs;
+	unsigned long long bytes;
+	unsigned long long copies;
+	unsigned long drops;
+};
+
+static struct entity members[NAME_SLOTS];
+static struct entity rooms[NAME_SLOTS];
+
+static unsigned long type_count[EV_MAX + 1];
+
+/* filters */
+static int want_type = -1;
+static char *want_member;
+static char *want_room;
+static int aggregate;
+
+static void usage(char **argv) {
+	printf("usage:\n");
+	printf("%s [-t <event type>] [-m <member id|name>] [-r <room id|name>] [-a] <segment file> ...\n",
+	       argv[0]);
+	exit(1);
+}
+
+static struct entity *lookup(struct entity *table, u_int32_t id) {
+	u_int32_t h = id * 2654435761u;
+	int i;
+
+	for(i = 0; i < NAME_SLOTS; i++) {
+		struct entity *e = &table[(h + i) & (NAME_SLOTS - 1)];
+		if(!e->used) {
+			e->used = 1;
+			e->id = id;
+			return e;
+		}
+		if(e->id == id)
+			return e;
+	}
+	/* table full; totals for this id get merged into a neighbour */
+	return &table[h & (NAME_SLOTS - 1)];
+}
+
+static int matches(char *want, struct entity *table, u_int32_t id) {
+	char *end;
+	unsigned long n;
+
+	if(want == NULL)
+		return 1;
+	n = strtoul(want, &end, 10);
+	if(*end == '\0')
+		return n == id;
+	return id != 0 && !strcmp(lookup(table, id)->name, want);
+}
+
+static void render(struct binlog_rec *rec) {
+	char tbuf[32];
+	time_t secs = rec->ts_ns / 1000000000ULL;
+	struct in_addr ip;
+
+	strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", localtime(&secs));
+	printf("%s.%06llu %-12s", tbuf,
+	       (unsigned long long)(rec->ts_ns % 1000000000ULL) / 1000,
+	       ev_names[rec->type]);
+
+	if(rec->member_id != 0)
+		printf(" member=%u(%s)", rec->member_id,
+		       lookup(members, rec->member_id)->name);
+	if(rec->room_id != 0)
+		printf(" room=%u(%s)", rec->room_id,
+		       lookup(rooms, rec->room_id)->name);
+
+	switch(rec->type) {
+	case EV_CHAT:
+	case EV_CHAT_BULK:
+		printf(" len=%u copies=%u", rec->len, rec->aux);
+		break;
+	case EV_CHAT_DROP:
+		printf(" len=%u reason=%s", rec->len,
+		       rec->aux == DROP_BAD_ID ? "bad-id"
+		       : rec->aux == DROP_NO_ROOM ? "no-room"
+		       : rec->aux == DROP_FILTERED ? "filtered"
+		       : rec->aux == DROP_QUEUE_FULL ? "queue-full"
+		       : rec->aux == DROP_SHED ? "shed"
+		       : rec->aux == DROP_NO_MEMBER ? "no-member"
+		       : rec->aux == DROP_NACK_LIMIT ? "nack-limit" : "corrupt");
+		break;
+	case EV_CTRL_RECV:
+	case EV_CTRL_SEND:
+		ip.s_addr = rec->peer_ip;
+		printf(" %s len=%u peer=%s",
+		       rec->aux <= DIRECTORY_FAIL ? ctrl_names[rec->aux] : "?",
+		       rec->len, inet_ntoa(ip));
+		break;
+	case EV_MEMBER_LEAVE:
+		printf(" reason=%s", rec->aux == LEAVE_QUIT ? "quit" : "swept");
+		break;
+	case EV_CHAT_NACK:
+		printf(" retransmitted=%u too-old=%u", rec->aux, rec->len);
+		break;
+	case EV_CHAT_DIRECT:
+		printf(" len=%u%s%s", rec->len,
+		       (rec->aux & DIRECT_ACK) ? " ack" : "",
+		       (rec->aux & DIRECT_ACK_REQ) ? " ack-requested" : "");
+		break;
+	}
+	printf("\n");
+}
+
+static void account(struct binlog_rec *rec) {
+	struct entity *m = rec->member_id ? lookup(members, rec->member_id) : NULL;
+	struct entity *r = rec->room_id ? lookup(rooms, rec->room_id) : NULL;
+
+	type_count[rec->type]++;
+
+	if(rec->type == EV_CHAT && m != NULL && r != NULL) {
+		m->msgs++;
+		m->bytes += rec->len;
+		m->copies += rec->aux;
+		r->msgs++;
+		r->bytes += rec->len;
+		r->copies += rec->aux;
+	} else if(rec->type == EV_CHAT_DROP && m != NULL) {
+		m->drops++;
+	}
+}
+
+static void process_segment(char *file) {
+	struct binlog_seg_hdr *hdr;
+	struct binlog_rec *rec, *end;
+	struct stat st;
+	char *base;
+	int fd;
+
+	if((fd = open(file, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+		perror(file);
+		return;
+	}
+	if(st.st_size < sizeof(struct binlog_seg_hdr)) {
+		fprintf(stderr, "%s: too short\n", file);
+		close(fd);
+		return;
+	}
+
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(base == MAP_FAILED) {
+		perror(file);
+		return;
+	}
+
+	hdr = (struct binlog_seg_hdr *)base;
+	if(hdr->magic != BINLOG_MAGIC || hdr->version != BINLOG_VERSION
+	   || hdr->rec_size != BINLOG_REC_SIZE) {
+		fprintf(stderr, "%s: not a chatserver binary log segment\n", file);
+		munmap(base, st.st_size);
+		return;
+	}
+
+	rec = (struct binlog_rec *)(base + sizeof(struct binlog_seg_hdr));
+	end = (struct binlog_rec *)(base + st.st_size);
+
+	for( ; rec < end && rec->type != EV_NONE; rec++) {
+		if(rec->type > EV_MAX || rec->type == EV_NAME)
+			continue;
+
+		/* learn names before filtering, so filters by name work */
+		if((rec->type == EV_MEMBER_JOIN || rec->type == EV_ROOM_CREATE)
+		   && rec + 1 < end && rec[1].type == EV_NAME) {
+			struct binlog_name_rec *nrec = (struct binlog_name_rec *)(rec + 1);
+			struct entity *e = (rec->type == EV_MEMBER_JOIN) ?
+				lookup(members, rec->member_id) : lookup(rooms, rec->room_id);
+			memcpy(e->name, nrec->name, sizeof(nrec->name));
+		}
+
+		if(want_type >= 0 && rec->type != want_type)
+			continue;
+		if(!matches(want_member, members, rec->member_id))
+			continue;
+		if(!matches(want_room, rooms, rec->room_id))
+			continue;
+
+		if(aggregate)
+			account(rec);
+		else
+			render(rec);
+	}
+
+	munmap(base, st.st_size);
+}
+
+static void print_totals(char *what, struct entity *table) {
+	int i;
+
+	printf("\nchat by %s:\n", what);
+	printf("  %-10s %-24s %10s %12s %12s %8s\n",
+	       "id", "name", "msgs", "bytes", "copies", "drops");
+	for(i = 0; i < NAME_SLOTS; i++) {
+		struct entity *e = &table[i];
+		if(!e->used || (e->msgs == 0 && e->drops == 0))
+			continue;
+		printf("  %-10u %-24s %10lu %12llu %12llu %8lu\n", e->id, e->name,
+		       e->msgs, e->bytes, e->copies, e->drops);
+	}
+}
+
+int main(int argc, char **argv) {
+	int c, i;
+
+	while((c = getopt(argc, argv, optstr)) != -1) {
+		switch(c) {
+		case 't':
+			for(i = 1; i <= EV_MAX; i++) {
+				if(!strcasecmp(optarg, ev_names[i]))
+					want_type = i;
+			}
+			if(want_type < 0) {
+				printf("unknown event type %s\n", optarg);
+				usage(argv);
+			}
+			break;
+		case 'm':
+			want_member = optarg;
+			break;
+		case 'r':
+			want_room = optarg;
+			break;
+		case 'a':
+			aggregate = 1;
+			break;
+		default:
+			usage(argv);
+		}
+	}
+
+	if(optind == argc)
+		usage(argv);
+
+	for(i = optind; i < argc; i++)
+		process_segment(argv[i]);
+
+	if(aggregate) {
+		printf("events by type:\n");
+		for(i = 1; i <= EV_MAX; i++) {
+			if(type_count[i] != 0)
+				printf("  %-14s %lu\n", ev_names[i], type_count[i]);
+		}
+		print_totals("member", members);
+		print_totals("room", rooms);
+	}
+
+	return 0;
+}
@@ -0,0 +1,796 @@
+/*
+ *      File:      chatrelay.c
+ *
+ * Relay for a site whose chat clients all reach the chatserver through it.
+ *
+ *   chatrelay -t <tcp port> -u <udp port> -s <server host>:<tcp port>:<udp port>
+ *             [-n <relay name>] [-i <sweep interval(mins)>]
+ *
+ * Clients use the relay as they would use the chatserver. The relay keeps
+ * its own members, and is in each room they are in as one member of the
+ * server, named <relay name>.<n> and with CAP_RELAY (see defs_ext.h). The
+ * server sends it one copy of every message of the room, and the relay
+ * sends it on to its members in the room. Messages of its members go up
+ * under the relay's member of the room, with the writer's name, and come
+ * back down like any other.
+ *
+ * Room and member lists, room creation and searches are passed on to the
+ * server under a member of the relay's that is in its members' room, or
+ * else under one that stays in no room. The relay asks the server one
+ * thing at a time and waits for the answer, for at most RELAY_TIMEOUT
+ * seconds. Its members get the plain protocol of defs.h: none of the
+ * extensions reaches them, and a member joining a room the relay is
+ * already in does not get the room's history.
+ *
+ * Every RELAY_REPORT_SECS the relay prints how many room messages it got
+ * from the server and how many it sent on to its members.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#include "defs.h"
+#include "defs_ext.h"
+
+char optstr[] = "t:u:s:n:i:";
+
+#define RELAY_TIMEOUT           2       /* seconds to wait for the server */
+#define RELAY_KEEPALIVE_SECS    30
+#define RELAY_REPORT_SECS       60
+#define RELAY_NAME_MAX          16      /* leaves room for .<n> */
+#define RELAY_MAX_ROOMS         MAX_NUM_OF_ROOMS
+#define RELAY_MAX_MEMBERS       MAX_NUM_OF_MEMBERS
+
+struct relay_room;
+
+struct relay_member {
+	u_int16_t member_id;
+	char member_name[MAX_MEMBER_NAME_LEN];
+	struct sockaddr_in member_udp_addr;
+	struct relay_room *room;
+	int quiet_flag;
+	struct relay_member *next_member;
+};
+
+/* a room the relay is in; fd < 0 marks a free slot */
+struct relay_room {
+	char room_name[MAX_ROOM_NAME_LEN];
+	u_int16_t up_id;                        /* our member in it upstream */
+	char up_name[MAX_MEMBER_NAME_LEN];
+	int fd;                                 /* where the server sends it */
+	int num_of_members;
+};
+
+static struct relay_member *mem_list_head;
+static int total_num_of_members;
+static struct relay_room rooms[RELAY_MAX_ROOMS];
+
+static char relay_name[RELAY_NAME_MAX + 1] = "relay";
+static int up_count;
+static u_int16_t control_id;
+
+static struct sockaddr_in server_tcp_addr;
+static struct sockaddr_in server_udp_addr;
+static int tcp_socket_fd;
+static int udp_socket_fd;
+
+static unsigned long msgs_from_server;
+static unsigned long msgs_sent_on;
+static unsigned long msgs_sent_up;
+
+static void usage(char **argv) {
+	printf("usage:\n");
+	printf("%s -t <tcp port> -u <udp port> -s <server host>:<tcp port>:<udp port> [-n <relay name> -i <sweep interval(mins)>]\n", argv[0]);
+	exit(1);
+}
+
+/* A socket of the given type bound to the port, 0 for any. */
+static int create_socket(int type, u_int16_t port) {
+	struct sockaddr_in addr;
+	int fd, on = 1;
+
+	if((fd = socket(AF_INET, type, 0)) < 0) {
+		perror("socket");
+		exit(1);
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	bzero(&addr, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		exit(1);
+	}
+	if(type == SOCK_STREAM && listen(fd, 32) < 0) {
+		perror("listen");
+		exit(1);
+	}
+	return fd;
+}
+
+/* Fill in where the server is from <host>:<tcp port>:<udp port>. */
+static int parse_server(char *spec) {
+	char host[MAX_HOST_NAME_LEN];
+	struct hostent *hp;
+	char *p, *q;
+
+	if((p = strchr(spec, ':')) == NULL || (q = strchr(p + 1, ':')) == NULL
+	   || p - spec >= MAX_HOST_NAME_LEN) {
+		return -1;
+	}
+	bzero(host, MAX_HOST_NAME_LEN);
+	strncpy(host, spec, p - spec);
+
+	if((hp = gethostbyname(host)) == NULL) {
+		printf("Unknown server host %s\n", host);
+		return -1;
+	}
+
+	bzero(&server_tcp_addr, sizeof(server_tcp_addr));
+	server_tcp_addr.sin_family = AF_INET;
+	memcpy(&server_tcp_addr.sin_addr, hp->h_addr_list[0], hp->h_length);
+	server_udp_addr = server_tcp_addr;
+	server_tcp_addr.sin_port = htons(atoi(p + 1));
+	server_udp_addr.sin_port = htons(atoi(q + 1));
+	return 0;
+}
+
+/*
+ * Ask the server and wait for the answer, which is left in reply with the
+ * header in host byte order. Returns the answer's length, 0 if there was
+ * none, or -1 if the server could not be reached.
+ */
+static int ask_server(u_int16_t type, u_int16_t id, u_int16_t reserved,
+		      char *data, int len, char *reply) {
+	char req[MAX_MSG_LEN];
+	struct control_msghdr *cmh = (struct control_msghdr *)req;
+	struct timeval tv;
+	int fd, n = 0, got = 0;
+
+	if(len > MAX_MSG_LEN - sizeof(struct control_msghdr))
+		len = MAX_MSG_LEN - sizeof(struct control_msghdr);
+
+	cmh->msg_type = htons(type);
+	cmh->member_id = htons(id);
+	cmh->msg_len = htons(sizeof(struct control_msghdr) + len);
+	cmh->reserved = htons(reserved);
+	if(len > 0)
+		memcpy(cmh->msgdata, data, len);
+
+	if((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+		perror("socket");
+		return -1;
+	}
+	tv.tv_sec = RELAY_TIMEOUT;
+	tv.tv_usec = 0;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	if(connect(fd, (struct sockaddr *)&server_tcp_addr,
+		   sizeof(server_tcp_addr)) < 0
+	   || write(fd, req, sizeof(struct control_msghdr) + len) < 0) {
+		perror("chatserver");
+		close(fd);
+		return -1;
+	}
+
+	bzero(reply, MAX_MSG_LEN);
+	while(got < MAX_MSG_LEN - 1
+	      && (n = read(fd, reply + got, MAX_MSG_LEN - 1 - got)) > 0) {
+		got += n;
+	}
+	close(fd);
+	if(n < 0) {
+		perror("chatserver");
+		return -1;
+	}
+
+	if(got >= sizeof(struct control_msghdr)) {
+		cmh = (struct control_msghdr *)reply;
+		cmh->msg_type = ntohs(cmh->msg_type);
+		cmh->member_id = ntohs(cmh->member_id);
+		cmh->msg_len = ntohs(cmh->msg_len);
+		cmh->reserved = ntohs(cmh->reserved);
+	}
+	return got;
+}
+
+/* Answer a member's request; type and id in host byte order. */
+static void reply(int fd, u_int16_t type, u_int16_t id, char *data, int len) {
+	char buf[MAX_MSG_LEN];
+	struct control_msghdr *cmh = (struct control_msghdr *)buf;
+
+	if(len > MAX_MSG_LEN - sizeof(struct control_msghdr))
+		len = MAX_MSG_LEN - sizeof(struct control_msghdr);
+
+	cmh->msg_type = htons(type);
+	cmh->member_id = htons(id);
+	cmh->msg_len = htons(sizeof(struct control_msghdr) + len);
+	cmh->reserved = 0;
+	if(len > 0)
+		memcpy(cmh->msgdata, data, len);
+
+	if(write(fd, buf, sizeof(struct control_msghdr) + len) < 0)
+		perror("write");
+}
+
+static void reply_text(int fd, u_int16_t type, u_int16_t id, char *text) {
+	reply(fd, type, id, text, strlen(text));
+}
+
+/* Make the reply buffer a failure of the given type saying why. */
+static int fail(char *reply, u_int16_t type, char *why) {
+	struct control_msghdr *cmh = (struct control_msghdr *)reply;
+
+	bzero(reply, MAX_MSG_LEN);
+	cmh->msg_type = type;
+	strcpy((char *)cmh->msgdata, why);
+	cmh->msg_len = sizeof(struct control_msghdr) + strlen(why);
+	return cmh->msg_len;
+}
+
+/*
+ * Register a member of the relay's with the server, its chat messages to
+ * go to the udp port (network byte order). The name is the relay's name,
+ * or <relay name>.<n> for a member of a room or if the name is taken. Returns the member's id, or
+ * 0 with the reason left in reply.
+ */
+static u_int16_t register_upstream(u_int16_t udp_port, char *up_name,
+				   int for_room, char *reply) {
+	char data[sizeof(struct register_msgdata) + MAX_MEMBER_NAME_LEN];
+	struct register_msgdata *rdata = (struct register_msgdata *)data;
+	struct control_msghdr *cmh = (struct control_msghdr *)reply;
+	int tries, got;
+
+	for(tries = 0; tries < 8; tries++) {
+		bzero(up_name, MAX_MEMBER_NAME_LEN);
+		if(for_room || tries > 0)
+			snprintf(up_name, MAX_MEMBER_NAME_LEN, "%s.%d",
+				 relay_name, ++up_count);
+		else
+			strcpy(up_name, relay_name);
+
+		rdata->udp_port = udp_port;
+		strcpy((char *)rdata->member_name, up_name);
+
+		got = ask_server(REGISTER_REQUEST, 0, CAP_RELAY, data,
+				 sizeof(struct register_msgdata) + strlen(up_name) + 1,
+				 reply);
+		if(got < (int)sizeof(struct control_msghdr)) {
+			fail(reply, REGISTER_FAIL, "Chatserver cannot be reached!");
+			return 0;
+		}
+		if(cmh->msg_type == REGISTER_SUCC) {
+			if(!(cmh->reserved & CAP_RELAY))
+				printf("Chatserver does not know relays, messages go up under %s\n",
+				       up_name);
+			return cmh->member_id;
+		}
+		/* a member of an earlier run may still be there */
+		if(strstr((char *)cmh->msgdata, "already been used") == NULL)
+			return 0;
+	}
+	return 0;
+}
+
+/*
+ * Put the relay in a room upstream: the room's name and fd are set. Returns
+ * 0, or -1 with the server's answer, or a failure, left in reply.
+ */
+static int join_upstream(struct relay_room *rt, char *reply) {
+	struct control_msghdr *cmh = (struct control_msghdr *)reply;
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+	int got;
+
+	if(getsockname(rt->fd, (struct sockaddr *)&addr, &addr_len) < 0) {
+		perror("getsockname");
+		fail(reply, SWITCH_ROOM_FAIL, "Relay cannot take the room!");
+		return -1;
+	}
+
+	if((rt->up_id = register_upstream(addr.sin_port, rt->up_name, 1,
+					  reply)) == 0) {
+		cmh->msg_type = SWITCH_ROOM_FAIL;
+		return -1;
+	}
+
+	got = ask_server(SWITCH_ROOM_REQUEST, rt->up_id, 0, rt->room_name,
+			 strlen(rt->room_name) + 1, reply);
+	if(got < (int)sizeof(struct control_msghdr)
+	   || cmh->msg_type != SWITCH_ROOM_SUCC) {
+		char answer[MAX_MSG_LEN];
+
+		ask_server(QUIT_REQUEST, rt->up_id, 0, NULL, 0, answer);
+		if(got < (int)sizeof(struct control_msghdr))
+			fail(reply, SWITCH_ROOM_FAIL, "Chatserver cannot be reached!");
+		return -1;
+	}
+
+	printf("Joined room [%s] as [%s]\n", rt->room_name, rt->up_name);
+	return 0;
+}
+
+static struct relay_room *find_room(char *room_name) {
+	int i;
+
+	for(i = 0; i < RELAY_MAX_ROOMS; i++) {
+		if(rooms[i].fd >= 0 && !strcmp(rooms[i].room_name, room_name))
+			return &rooms[i];
+	}
+	return NULL;
+}
+
+/* Leave a room upstream when the last member of ours in it leaves. */
+static void leave_room(struct relay_room *rt) {
+	char answer[MAX_MSG_LEN];
+
+	if(--rt->num_of_members > 0)
+		return;
+
+	ask_server(QUIT_REQUEST, rt->up_id, 0, NULL, 0, answer);
+	printf("Left room [%s]\n", rt->room_name);
+	close(rt->fd);
+	rt->fd = -1;
+}
+
+/* Drop a room the server no longer has us in; its members are in none. */
+static void lose_room(struct relay_room *rt) {
+	struct relay_member *mt;
+
+	for(mt = mem_list_head; mt != NULL; mt = mt->next_member) {
+		if(mt->room == rt)
+			mt->room = NULL;
+	}
+	printf("Lost room [%s]\n", rt->room_name);
+	close(rt->fd);
+	rt->fd = -1;
+}
+
+static struct relay_member *find_member_with_id(u_int16_t member_id) {
+	struct relay_member *mt;
+
+	for(mt = mem_list_head; mt != NULL; mt = mt->next_member) {
+		if(mt->member_id == member_id)
+			return mt;
+	}
+	return NULL;
+}
+
+static void remove_member(struct relay_member *mt) {
+	struct relay_member **pp;
+
+	for(pp = &mem_list_head; *pp != NULL; pp = &(*pp)->next_member) {
+		if(*pp == mt) {
+			*pp = mt->next_member;
+			break;
+		}
+	}
+	if(mt->room != NULL)
+		leave_room(mt->room);
+	total_num_of_members--;
+	free(mt);
+}
+
+static void process_register_request(int fd, char *msg) {
+	struct register_msgdata *rdata;
+	struct relay_member *mt;
+	struct sockaddr_in peer_addr;
+	socklen_t peer_addr_len = sizeof(peer_addr);
+	char *name;
+	u_int16_t id;
+
+	rdata = (struct register_msgdata *)((struct control_msghdr *)msg)->msgdata;
+	name = (char *)rdata->member_name;
+
+	if(total_num_of_members == RELAY_MAX_MEMBERS) {
+		reply_text(fd, REGISTER_FAIL, 0, "Number of members reached maximum!");
+		return;
+	}
+	/* the name has to fit behind the id in chat messages going up */
+	if(name[0] == '\0' || strlen(name) >= RELAY_NAME_LEN) {
+		reply_text(fd, REGISTER_FAIL, 0, "Name is too long!");
+		return;
+	}
+	for(mt = mem_list_head; mt != NULL; mt = mt->next_member) {
+		if(!strcmp(mt->member_name, name)) {
+			reply_text(fd, REGISTER_FAIL, 0, "Name has already been used!");
+			return;
+		}
+	}
+	if(getpeername(fd, (struct sockaddr *)&peer_addr, &peer_addr_len) < 0) {
+		perror("getpeername");
+		return;
+	}
+
+	if((mt = (struct relay_member *)malloc(sizeof(struct relay_member))) == NULL) {
+		printf("Memory used up when try to create member!\n");
+		exit(1);
+	}
+	bzero(mt, sizeof(struct relay_member));
+
+	do {
+		id = 1 + (u_int16_t) (65535.0 * rand()/(RAND_MAX+1.0));
+	} while(find_member_with_id(id) != NULL);
+
+	mt->member_id = id;
+	strcpy(mt->member_name, name);
+	mt->member_udp_addr.sin_family = AF_INET;
+	mt->member_udp_addr.sin_addr = peer_addr.sin_addr;
+	mt->member_udp_addr.sin_port = rdata->udp_port;
+	mt->next_member = mem_list_head;
+	mem_list_head = mt;
+	total_num_of_members++;
+
+	/* no extensions: the relay passes room messages on as they come */
+	reply(fd, REGISTER_SUCC, id, NULL, 0);
+}
+
+static void process_switch_room_request(int fd, struct relay_member *mt,
+					char *msg) {
+	char room_name[MAX_ROOM_NAME_LEN];
+	char answer[MAX_MSG_LEN];
+	struct control_msghdr *cmh = (struct control_msghdr *)answer;
+	struct relay_room *rt;
+	int i;
+
+	bzero(room_name, MAX_ROOM_NAME_LEN);
+	strncpy(room_name, (char *)((struct control_msghdr *)msg)->msgdata,
+		MAX_ROOM_NAME_LEN - 1);
+
+	if((rt = find_room(room_name)) == NULL) {
+		for(i = 0; i < RELAY_MAX_ROOMS && rooms[i].fd >= 0; i++)
+			;
+		if(i == RELAY_MAX_ROOMS) {
+			reply_text(fd, SWITCH_ROOM_FAIL, mt->member_id,
+			      "Relay is in too many rooms!");
+			return;
+		}
+		rt = &rooms[i];
+		strcpy(rt->room_name, room_name);
+		rt->fd = create_socket(SOCK_DGRAM, 0);
+		rt->num_of_members = 0;
+
+		if(join_upstream(rt, answer) < 0) {
+			close(rt->fd);
+			rt->fd = -1;
+			reply(fd, cmh->msg_type, mt->member_id, (char *)cmh->msgdata,
+			      strlen((char *)cmh->msgdata));
+			return;
+		}
+	}
+
+	if(mt->room != rt) {
+		rt->num_of_members++;
+		if(mt->room != NULL)
+			leave_room(mt->room);
+		mt->room = rt;
+	}
+	reply(fd, SWITCH_ROOM_SUCC, mt->member_id, NULL, 0);
+}
+
+/*
+ * Pass a request on to the server under the member of the relay's in the
+ * member's room, or the one in no room, and its answer back. The members
+ * of ours in a room the relay is in are listed instead of the relay.
+ */
+static void pass_on(int fd, struct relay_member *mt, char *msg, int n) {
+	struct control_msghdr *req = (struct control_msghdr *)msg;
+	char answer[MAX_MSG_LEN];
+	struct control_msghdr *cmh = (struct control_msghdr *)answer;
+	char *list = (char *)cmh->msgdata;
+	struct relay_member *tmp_ptr;
+	struct relay_room *rt;
+	int got;
+
+	got = ask_server(req->msg_type,
+			 mt->room != NULL ? mt->room->up_id : control_id, 0,
+			 (char *)req->msgdata, n - sizeof(struct control_msghdr),
+			 answer);
+	if(got < (int)sizeof(struct control_msghdr)) {
+		reply_text(fd, req->msg_type + 2, mt->member_id,
+		      "Chatserver cannot be reached!");
+		return;
+	}
+
+	if(cmh->msg_type == MEMBER_LIST_SUCC
+	   && (rt = find_room((char *)req->msgdata)) != NULL) {
+		char token[MAX_MEMBER_NAME_LEN + 4];
+		char *p;
+
+		sprintf(token, "(%s)", rt->up_name);
+		if((p = strstr(list, token)) != NULL) {
+			memmove(p, p + strlen(token), strlen(p + strlen(token)) + 1);
+			if(*p == ' ')
+				memmove(p, p + 1, strlen(p + 1) + 1);
+			else if(p > list && p[-1] == ' ')
+				p[-1] = '\0';
+		}
+		for(tmp_ptr = mem_list_head; tmp_ptr != NULL;
+		    tmp_ptr = tmp_ptr->next_member) {
+			if(tmp_ptr->room != rt
+			   || strlen(list) + strlen(tmp_ptr->member_name) + 3
+			      >= MAX_MSG_LEN - sizeof(struct control_msghdr))
+				continue;
+			p = list + strlen(list);
+			sprintf(p, p == list ? "(%s)" : " (%s)",
+				tmp_ptr->member_name);
+		}
+		got = sizeof(struct control_msghdr) + strlen(list);
+	}
+
+	reply(fd, cmh->msg_type, mt->member_id, list,
+	      got - sizeof(struct control_msghdr));
+}
+
+static void process_control_msg(int fd) {
+	struct control_msghdr *cmh;
+	struct relay_member *mt;
+	char buf[MAX_MSG_LEN];
+	int n;
+
+	bzero(buf, MAX_MSG_LEN);
+
+	/* like the server, do one read */
+	if((n = read(fd, buf, MAX_MSG_LEN - 1)) < (int)sizeof(struct control_msghdr))
+		return;
+
+	cmh = (struct control_msghdr *)buf;
+	cmh->msg_type = ntohs(cmh->msg_type);
+	cmh->member_id = ntohs(cmh->member_id);
+	cmh->msg_len = ntohs(cmh->msg_len);
+
+	if(cmh->msg_type == REGISTER_REQUEST) {
+		process_register_request(fd, buf);
+		return;
+	}
+
+	if((mt = find_member_with_id(cmh->member_id)) == NULL) {
+		reply_text(fd, cmh->msg_type + 2, 0, "Member id invalid!");
+		return;
+	}
+	mt->quiet_flag = 0;
+
+	switch(cmh->msg_type) {
+	case ROOM_LIST_REQUEST:
+	case MEMBER_LIST_REQUEST:
+	case CREATE_ROOM_REQUEST:
+	case SEARCH_REQUEST:
+		pass_on(fd, mt, buf, n);
+		break;
+	case SWITCH_ROOM_REQUEST:
+		process_switch_room_request(fd, mt, buf);
+		break;
+	case MEMBER_KEEP_ALIVE:
+		break;
+	case QUIT_REQUEST:
+		remove_member(mt);
+		break;
+	default:
+		/* room wide settings are the server's to change */
+		reply_text(fd, cmh->msg_type + 2, mt->member_id,
+		      "Not available through a relay!");
+		break;
+	}
+}
+
+/* A chat message of one of ours goes up, under the relay's name for it. */
+static void process_chat_msg() {
+	char buf[MAX_MSG_LEN];
+	struct chat_msghdr *cmh = (struct chat_msghdr *)buf;
+	struct relay_member *mt;
+	int n;
+
+	if((n = recv(udp_socket_fd, buf, MAX_MSG_LEN, 0)) < (int)sizeof(struct chat_msghdr))
+		return;
+
+	if((mt = find_member_with_id(ntohs(cmh->sender.member_id))) == NULL
+	   || mt->room == NULL)
+		return;
+	mt->quiet_flag = 0;
+
+	cmh->sender.member_id = htons(mt->room->up_id);
+	bzero(cmh->sender.member_name + RELAY_NAME_OFFSET, RELAY_NAME_LEN);
+	strcpy(cmh->sender.member_name + RELAY_NAME_OFFSET, mt->member_name);
+
+	if(sendto(mt->room->fd, buf, n, 0, (struct sockaddr *)&server_udp_addr,
+		  sizeof(server_udp_addr)) == n)
+		msgs_sent_up++;
+}
+
+/* A message of a room goes to each of our members in it. */
+static void process_room_msg(struct relay_room *rt) {
+	char buf[MAX_MSG_LEN];
+	struct relay_member *mt;
+	int n;
+
+	if((n = recv(rt->fd, buf, MAX_MSG_LEN, 0)) <= 0)
+		return;
+	msgs_from_server++;
+
+	for(mt = mem_list_head; mt != NULL; mt = mt->next_member) {
+		if(mt->room != rt)
+			continue;
+		if(sendto(udp_socket_fd, buf, n, 0,
+			  (struct sockaddr *)&mt->member_udp_addr,
+			  sizeof(mt->member_udp_addr)) == n)
+			msgs_sent_on++;
+	}
+}
+
+/* Keep our members of the server from being swept, joining again if they were. */
+static void keep_alive() {
+	char answer[MAX_MSG_LEN];
+	struct control_msghdr *cmh = (struct control_msghdr *)answer;
+	char up_name[MAX_MEMBER_NAME_LEN];
+	int i, got;
+
+	got = ask_server(MEMBER_KEEP_ALIVE, control_id, 0, NULL, 0, answer);
+	if(got >= (int)sizeof(struct control_msghdr)
+	   && cmh->msg_type == MEMBER_KEEP_ALIVE + 2) {
+		control_id = register_upstream(htons(0), up_name, 0, answer);
+	}
+
+	for(i = 0; i < RELAY_MAX_ROOMS; i++) {
+		if(rooms[i].fd < 0)
+			continue;
+		got = ask_server(MEMBER_KEEP_ALIVE, rooms[i].up_id, 0, NULL, 0, answer);
+		if(got >= (int)sizeof(struct control_msghdr)
+		   && cmh->msg_type == MEMBER_KEEP_ALIVE + 2
+		   && join_upstream(&rooms[i], answer) < 0) {
+			lose_room(&rooms[i]);
+		}
+	}
+}
+
+/* Remove members not heard from since the last sweep. */
+static void sweep_members() {
+	struct relay_member *mt, *next;
+
+	for(mt = mem_list_head; mt != NULL; mt = next) {
+		next = mt->next_member;
+		if(mt->quiet_flag) {
+			printf("Member [%s] swept\n", mt->member_name);
+			remove_member(mt);
+		} else {
+			mt->quiet_flag = 1;
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	char answer[MAX_MSG_LEN];
+	char up_name[MAX_MEMBER_NAME_LEN];
+	char server_spec[MAX_HOST_NAME_LEN + 16];
+	u_int16_t tcp_port = 0, udp_port = 0;
+	int sweep_int = 0;
+	time_t now, next_keepalive, next_sweep, next_report;
+	unsigned long reported = 0;
+	fd_set rset;
+	struct timeval tv;
+	int c, i, maxfd, connect_fd;
+
+	bzero(server_spec, sizeof(server_spec));
+
+	while((c = getopt(argc, argv, optstr)) != -1) {
+		switch(c) {
+		case 't':
+			tcp_port = atoi(optarg);
+			break;
+		case 'u':
+			udp_port = atoi(optarg);
+			break;
+		case 's':
+			strncpy(server_spec, optarg, sizeof(server_spec) - 1);
+			break;
+		case 'n':
+			bzero(relay_name, sizeof(relay_name));
+			strncpy(relay_name, optarg, RELAY_NAME_MAX);
+			break;
+		case 'i':
+			sweep_int = atoi(optarg) * 60;
+			break;
+		default:
+			usage(argv);
+		}
+	}
+	if(tcp_port == 0 || udp_port == 0 || parse_server(server_spec) < 0)
+		usage(argv);
+
+	/* what happens to rooms and members is printed as it happens */
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	srand(time(NULL) ^ getpid());
+	for(i = 0; i < RELAY_MAX_ROOMS; i++)
+		rooms[i].fd = -1;
+
+	tcp_socket_fd = create_socket(SOCK_STREAM, tcp_port);
+	udp_socket_fd = create_socket(SOCK_DGRAM, udp_port);
+
+	/* the member that asks for what is not about a room of ours */
+	if((control_id = register_upstream(htons(0), up_name, 0, answer)) == 0) {
+		printf("Cannot register with the chatserver: %s\n",
+		       (char *)((struct control_msghdr *)answer)->msgdata);
+		exit(1);
+	}
+	printf("Relay [%s] ready on ports %hu/%hu\n", relay_name, tcp_port, udp_port);
+
+	now = time(NULL);
+	next_keepalive = now + RELAY_KEEPALIVE_SECS;
+	next_sweep = now + sweep_int;
+	next_report = now + RELAY_REPORT_SECS;
+
+	for(;;) {
+		FD_ZERO(&rset);
+		FD_SET(tcp_socket_fd, &rset);
+		FD_SET(udp_socket_fd, &rset);
+		maxfd = tcp_socket_fd > udp_socket_fd ? tcp_socket_fd : udp_socket_fd;
+		for(i = 0; i < RELAY_MAX_ROOMS; i++) {
+			if(rooms[i].fd < 0)
+				continue;
+			FD_SET(rooms[i].fd, &rset);
+			if(rooms[i].fd > maxfd)
+				maxfd = rooms[i].fd;
+		}
+
+		tv.tv_sec = 1;
+		tv.tv_usec = 0;
+		if(select(maxfd + 1, &rset, NULL, NULL, &tv) < 0) {
+			if(errno == EINTR)
+				continue;
+			perror("select");
+			exit(1);
+		}
+
+		for(i = 0; i < RELAY_MAX_ROOMS; i++) {
+			if(rooms[i].fd >= 0 && FD_ISSET(rooms[i].fd, &rset))
+				process_room_msg(&rooms[i]);
+		}
+		if(FD_ISSET(udp_socket_fd, &rset))
+			process_chat_msg();
+		if(FD_ISSET(tcp_socket_fd, &rset)) {
+			if((connect_fd = accept(tcp_socket_fd, NULL, NULL)) < 0) {
+				perror("accept");
+			} else {
+				process_control_msg(connect_fd);
+				close(connect_fd);
+			}
+		}
+
+		now = time(NULL);
+		if(now >= next_keepalive) {
+			keep_alive();
+			next_keepalive = now + RELAY_KEEPALIVE_SECS;
+		}
+		if(sweep_int > 0 && now >= next_sweep) {
+			sweep_members();
+			next_sweep = now + sweep_int;
+		}
+		if(now >= next_report) {
+			if(msgs_from_server != reported) {
+				printf("Relay: %lu room msgs from the server, %lu sent on (x%.1f), %lu sent up, %d members\n",
+				       msgs_from_server, msgs_sent_on,
+				       (double)msgs_sent_on / msgs_from_server,
+				       msgs_sent_up, total_num_of_members);
+				reported = msgs_from_server;
+			}
+			next_report = now + RELAY_REPORT_SECS;
+		}
+	}
+	return 0;
+}
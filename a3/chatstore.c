@@ -0,0 +1,340 @@
+/*
+ *      File:      chatstore.c
+ *
+ * Reader and compactor for the chatserver message store (chatserver -m).
+ *
+ *   chatstore [-f <first room seq>] [-n <count>] <room dir>
+ *   chatstore -c <room dir>
+ *
+ * The first form prints the stored messages of a room, one per line, from
+ * the given room sequence number on; the sparse index in each segment
+ * header is used to start reading close to it. The second form merges
+ * runs of adjacent sealed segments that together fit into one segment,
+ * such as the small ones left by quiet rooms, restarts and retention.
+ * It never touches the segment the server is writing. The direct messages
+ * are read from <store dir>/.direct like a room.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stddef.h>
+#include <time.h>
+#include <glob.h>
+#include <unistd.h>
+
+#include <sys/param.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "defs.h"
+#include "msgstore.h"
+
+#define SEG_PAYLOAD_MAX  (MSGSTORE_SEGMENT_SIZE - sizeof(struct msgstore_seg_hdr))
+
+char optstr[] = "f:n:c";
+
+static long long want_first = -1;
+static long long want_count = -1;
+static int compact;
+
+struct segment {
+	char *file;
+	char *base;
+	size_t size;
+	struct msgstore_seg_hdr *hdr;
+};
+
+static void usage(char **argv) {
+	printf("usage:\n");
+	printf("%s [-f <first room seq>] [-n <count>] <room dir>\n", argv[0]);
+	printf("%s -c <room dir>\n", argv[0]);
+	exit(1);
+}
+
+/* Map a segment read-only; returns 0, or -1 if it is not a valid segment. */
+static int map_segment(char *file, struct segment *seg) {
+	struct stat st;
+	int fd;
+
+	seg->file = file;
+	seg->base = NULL;
+
+	if((fd = open(file, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+		perror(file);
+		return -1;
+	}
+	if(st.st_size < sizeof(struct msgstore_seg_hdr)) {
+		fprintf(stderr, "%s: too short\n", file);
+		close(fd);
+		return -1;
+	}
+
+	seg->base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(seg->base == MAP_FAILED) {
+		perror(file);
+		seg->base = NULL;
+		return -1;
+	}
+	seg->size = st.st_size;
+	seg->hdr = (struct msgstore_seg_hdr *)seg->base;
+
+	if(seg->hdr->magic != MSGSTORE_MAGIC
+	   || seg->hdr->version != MSGSTORE_VERSION) {
+		fprintf(stderr, "%s: not a chatserver message store segment\n", file);
+		munmap(seg->base, seg->size);
+		seg->base = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+static void unmap_segment(struct segment *seg) {
+	if(seg->base != NULL)
+		munmap(seg->base, seg->size);
+	seg->base = NULL;
+}
+
+/* End of the records of a segment, as far as they are in the file. */
+static u_int32_t data_end(struct segment *seg) {
+	if(seg->hdr->data_end < seg->size)
+		return seg->hdr->data_end;
+	return seg->size;
+}
+
+/* Offset of the last indexed record at or before room sequence seq. */
+static u_int32_t index_lookup(struct msgstore_seg_hdr *hdr, u_int32_t seq) {
+	int lo = 0, hi = hdr->index_count - 1, mid;
+	u_int32_t off = sizeof(struct msgstore_seg_hdr);
+
+	while(lo <= hi) {
+		mid = (lo + hi) / 2;
+		if(hdr->index[mid].room_seq <= seq) {
+			off = hdr->index[mid].off;
+			lo = mid + 1;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	return off;
+}
+
+static void render(struct msgstore_rec *rec) {
+	char tbuf[32];
+	time_t secs = rec->ts_ns / 1000000000ULL;
+	char *text = rec->text;
+	int text_len = rec->text_len;
+
+	strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", localtime(&secs));
+	printf("%s.%06llu [%u] %.*s(%u)", tbuf,
+	       (unsigned long long)(rec->ts_ns % 1000000000ULL) / 1000,
+	       rec->room_seq, MAX_MEMBER_NAME_LEN, rec->sender, rec->member_id);
+
+	/* a direct message: the recipient's name comes first */
+	if((rec->flags & MSGSTORE_REC_DIRECT) && text_len >= MAX_MEMBER_NAME_LEN) {
+		printf(" -> %.*s", MAX_MEMBER_NAME_LEN, text);
+		text += MAX_MEMBER_NAME_LEN;
+		text_len -= MAX_MEMBER_NAME_LEN;
+	}
+
+	/* the text may or may not carry its terminating '\0' */
+	printf(": %.*s\n", (int)strnlen(text, text_len), text);
+}
+
+/* Print the wanted messages of one segment; returns 1 once done with all. */
+static int dump_segment(struct segment *seg) {
+	struct msgstore_seg_hdr *hdr = seg->hdr;
+	struct msgstore_rec *rec;
+	u_int32_t off = sizeof(struct msgstore_seg_hdr);
+	u_int32_t end = data_end(seg);
+
+	if(hdr->count == 0)
+		return 0;
+	if(want_first >= 0) {
+		if(hdr->last_seq < want_first)
+			return 0;
+		off = index_lookup(hdr, want_first);
+	}
+
+	while(off + sizeof(struct msgstore_rec) <= end) {
+		rec = (struct msgstore_rec *)(seg->base + off);
+		if(rec->rec_len == 0 || off + rec->rec_len > end)
+			break;
+		off += rec->rec_len;
+
+		if(want_first >= 0 && rec->room_seq < want_first)
+			continue;
+		if(want_count == 0)
+			return 1;
+		render(rec);
+		if(want_count > 0)
+			want_count--;
+	}
+	return want_count == 0;
+}
+
+/* Merge segs[0..n-1] into a single segment that replaces segs[0]. */
+static void merge_segments(struct segment *segs, int n) {
+	char tmp_name[MAXPATHLEN];
+	struct msgstore_seg_hdr *out;
+	struct msgstore_rec *rec;
+	char *buf;
+	u_int32_t off;
+	int fd, i;
+
+	if((buf = (char *)calloc(1, MSGSTORE_SEGMENT_SIZE)) == NULL) {
+		printf("Memory used up when trying to compact\n");
+		exit(1);
+	}
+	out = (struct msgstore_seg_hdr *)buf;
+	memcpy(out, segs[0].hdr, offsetof(struct msgstore_seg_hdr, index));
+	out->count = 0;
+	out->index_count = 0;
+	out->data_end = sizeof(struct msgstore_seg_hdr);
+
+	for(i = 0; i < n; i++) {
+		u_int32_t end = data_end(&segs[i]);
+
+		for(off = sizeof(struct msgstore_seg_hdr);
+		    off + sizeof(struct msgstore_rec) <= end; off += rec->rec_len) {
+			rec = (struct msgstore_rec *)(segs[i].base + off);
+			if(rec->rec_len == 0 || off + rec->rec_len > end)
+				break;
+
+			if(out->count % MSGSTORE_INDEX_EVERY == 0
+			   && out->index_count < MSGSTORE_INDEX_SLOTS) {
+				out->index[out->index_count].room_seq = rec->room_seq;
+				out->index[out->index_count].off = out->data_end;
+				out->index_count++;
+			}
+			memcpy(buf + out->data_end, rec, rec->rec_len);
+			out->data_end += rec->rec_len;
+			out->count++;
+		}
+		if(segs[i].hdr->count != 0) {
+			out->last_seq = segs[i].hdr->last_seq;
+			out->last_ns = segs[i].hdr->last_ns;
+		}
+	}
+
+	/* write it next to the first one, then swap it in */
+	snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", segs[0].file);
+	if((fd = open(tmp_name, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+		perror(tmp_name);
+		free(buf);
+		return;
+	}
+	if(write(fd, buf, out->data_end) != out->data_end || fsync(fd) < 0) {
+		perror(tmp_name);
+		close(fd);
+		unlink(tmp_name);
+		free(buf);
+		return;
+	}
+	close(fd);
+
+	if(rename(tmp_name, segs[0].file) < 0) {
+		perror(tmp_name);
+		unlink(tmp_name);
+		free(buf);
+		return;
+	}
+	for(i = 1; i < n; i++) {
+		if(unlink(segs[i].file) < 0)
+			perror(segs[i].file);
+	}
+
+	printf("merged %d segments (%u messages, %u bytes) into %s\n",
+	       n, out->count, out->data_end, segs[0].file);
+	free(buf);
+}
+
+/* Merge every run of adjacent sealed segments that fits into one. */
+static void compact_room(char **files, int nfiles) {
+	struct segment *run;
+	u_int32_t run_bytes = 0;
+	int n = 0, i;
+
+	if((run = (struct segment *)calloc(nfiles, sizeof(struct segment))) == NULL) {
+		printf("Memory used up when trying to compact\n");
+		exit(1);
+	}
+
+	for(i = 0; i <= nfiles; i++) {
+		struct segment seg;
+		u_int32_t bytes = 0;
+		int usable = 0;
+
+		if(i < nfiles && map_segment(files[i], &seg) == 0) {
+			bytes = data_end(&seg) - sizeof(struct msgstore_seg_hdr);
+			usable = (seg.hdr->flags & MSGSTORE_SEALED) != 0;
+		}
+
+		/* end of a run: merge it if there is something to merge */
+		if(!usable || run_bytes + bytes > SEG_PAYLOAD_MAX) {
+			if(n > 1)
+				merge_segments(run, n);
+			while(n > 0)
+				unmap_segment(&run[--n]);
+			run_bytes = 0;
+		}
+
+		if(usable) {
+			run[n++] = seg;
+			run_bytes += bytes;
+		} else if(i < nfiles) {
+			unmap_segment(&seg);
+		}
+	}
+	free(run);
+}
+
+int main(int argc, char **argv) {
+	char pattern[MAXPATHLEN];
+	struct segment seg;
+	glob_t g;
+	int c, i, done;
+
+	while((c = getopt(argc, argv, optstr)) != -1) {
+		switch(c) {
+		case 'f':
+			want_first = strtoul(optarg, NULL, 10);
+			break;
+		case 'n':
+			want_count = strtoul(optarg, NULL, 10);
+			break;
+		case 'c':
+			compact = 1;
+			break;
+		default:
+			usage(argv);
+		}
+	}
+
+	if(optind != argc - 1)
+		usage(argv);
+
+	/* six digit numbers: glob's sorting is the order they were written */
+	snprintf(pattern, sizeof(pattern), "%s/*.seg", argv[optind]);
+	if(glob(pattern, 0, NULL, &g) != 0) {
+		fprintf(stderr, "%s: no segments\n", argv[optind]);
+		return 1;
+	}
+
+	if(compact) {
+		compact_room(g.gl_pathv, g.gl_pathc);
+	} else {
+		for(i = 0, done = 0; i < g.gl_pathc && !done; i++) {
+			if(map_segment(g.gl_pathv[i], &seg) < 0)
+				continue;
+			done = dump_segment(&seg);
+			unmap_segment(&seg);
+		}
+	}
+
+	globfree(&g);
+	return 0;
+}
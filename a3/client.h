@@ -13,6 +13,7 @@
 #include <arpa/inet.h>
 
 #include "defs.h"
+#include "defs_ext.h"
 
 /*** Defines for client control <--> receiver communication ***/
 
@@ -39,6 +40,26 @@ typedef struct msgbuf {
 #define RECV_READY    1
 #define RECV_NOTREADY 2
 #define CHAT_QUIT     3
+#define SHOW_STATS    4 /* controller asks receiver to print its telemetry */
+#define MCAST_JOIN    5 /* controller passes on the multicast group of a room */
+
+/* follows the msg_t of MCAST_JOIN */
+struct mcast_join {
+  struct mcast_group group;   /* as the server sent it; group 0 to leave */
+  struct sockaddr_in server;  /* chat UDP address the join is reported to */
+};
+
+#define ROOM_FOLLOW   6 /* controller passes on a room followed, or no longer */
+
+/* follows the msg_t of ROOM_FOLLOW */
+struct room_follow {
+  u_int16_t room_id;                   /* as in the extended header */
+  u_int16_t following;                 /* 0 once it is no longer */
+  char room_name[MAX_ROOM_NAME_LEN];
+};
+
+/* rooms followed at once, as many as the server lets us (see defs_ext.h) */
+#define CLIENT_MAX_FOLLOWED 64
 
 /* Failure codes from receiver. */
 #define NO_SERVER     10
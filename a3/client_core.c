@@ -1,5 +1,8 @@
 #include "client_core.h"
 
+/* pages of the directory shown for one command, should it keep changing */
+#define DIR_MAX_PAGES 64
+
 pthread_t hb_thread;
 
 /* Given the member name, host name and ports to use, initialize a client_core
@@ -20,6 +23,7 @@ struct client_core* create_client_core(char* member_name, char* server_host_name
 
   cli_core->member_name = member_name;
   cli_core->receiver_manager = receiver_mgr;
+  cli_core->num_followed = 0;
 
   struct client_to_server_sender* client_to_server_sender =
     create_client_to_server_sender(server_host_name, server_tcp_port, server_udp_port);
@@ -56,18 +60,57 @@ void cli_core_shutdown(struct client_core* cli_core)
   free(cli_core);
 }
 
-/* Given a client_core, handle a request for a list of rooms */
-void cli_core_room_list_request(struct client_core* cli_core)
+/* Show the directory page by page, as many pages as it takes */
+static void show_directory(struct client_core* cli_core, u_int16_t what, u_int16_t order,
+    char* prefix, char* room_name)
+{
+  u_int32_t cursor = 0;
+  int pages = 0;
+
+  receiver_printf(cli_core->receiver_manager, "Sending directory request");
+  do
+  {
+    char* response = send_directory_request(cli_core->sender, cli_core->member_id,
+        what, order, prefix, room_name, &cursor);
+    receiver_printf(cli_core->receiver_manager, response);
+    free(response);
+  } while (cursor != 0 && ++pages < DIR_MAX_PAGES);
+}
+
+/* Given a client_core, handle a request for a list of rooms, those whose
+ * names start with prefix if the server can tell */
+void cli_core_room_list_request(struct client_core* cli_core, char* prefix)
 {
+  if (cli_core->sender->server_caps & CAP_DIRECTORY)
+  {
+    show_directory(cli_core, DIR_ROOMS, DIR_BY_NAME, prefix, "");
+    return;
+  }
   receiver_printf(cli_core->receiver_manager, "Sending room list request");
   char* response = send_room_list_request(cli_core->sender, cli_core->member_id);
   receiver_printf(cli_core->receiver_manager, response);
   free(response);
 }
 
+/* Given a client_core, list the rooms with the most members first */
+void cli_core_top_rooms_request(struct client_core* cli_core, char* prefix)
+{
+  if (!(cli_core->sender->server_caps & CAP_DIRECTORY))
+  {
+    receiver_printf(cli_core->receiver_manager, "The server does not sort its rooms");
+    return;
+  }
+  show_directory(cli_core, DIR_ROOMS, DIR_BY_SIZE, prefix, "");
+}
+
 /* Given a client_core, handle a request for a list of members within a specified room */
 void cli_core_member_list_request(struct client_core* cli_core, char* room_name)
 {
+  if (cli_core->sender->server_caps & CAP_DIRECTORY)
+  {
+    show_directory(cli_core, DIR_MEMBERS, DIR_BY_NAME, "", room_name);
+    return;
+  }
   receiver_printf(cli_core->receiver_manager, "Sending member list request");
   char* response = send_member_list_request(cli_core->sender, cli_core->member_id, room_name);
   receiver_printf(cli_core->receiver_manager, response);
@@ -92,6 +135,33 @@ void cli_core_create_room_request(struct client_core* cli_core, char* room_name)
   free(response);
 }
 
+/* Given a client_core, search the recent messages of the current room */
+void cli_core_search_request(struct client_core* cli_core, char* words)
+{
+  receiver_printf(cli_core->receiver_manager, "Sending search request");
+  char* response = send_search_request(cli_core->sender, cli_core->member_id, words);
+  receiver_printf(cli_core->receiver_manager, response);
+  free(response);
+}
+
+/* Given a client_core, set or remove the content filter of the current room */
+void cli_core_filter_request(struct client_core* cli_core, char* patterns)
+{
+  receiver_printf(cli_core->receiver_manager, "Sending filter request");
+  char* response = send_filter_request(cli_core->sender, cli_core->member_id, patterns);
+  receiver_printf(cli_core->receiver_manager, response);
+  free(response);
+}
+
+/* Given a client_core, move a room to another node of the cluster */
+void cli_core_move_room_request(struct client_core* cli_core, char* args)
+{
+  receiver_printf(cli_core->receiver_manager, "Sending move room request");
+  char* response = send_move_room_request(cli_core->sender, cli_core->member_id, args);
+  receiver_printf(cli_core->receiver_manager, response);
+  free(response);
+}
+
 /* Initialize and start the heartbeat thread */
 void start_hb_thread(struct client_core* cli_core)
 {
@@ -132,3 +202,110 @@ void cli_core_send_chatmsg(struct client_core* cli_core, char* chat_message)
 {
   send_chat_msg (cli_core->sender, chat_message, cli_core->member_id);
 }
+
+/* Send a direct message; args is "<member name or #id> <text>" */
+void cli_core_send_direct_msg(struct client_core* cli_core, char* args)
+{
+  char* text = strchr(args, ' ');
+
+  if (!(cli_core->sender->server_caps & CAP_DIRECT))
+  {
+    receiver_printf(cli_core->receiver_manager, "The server does not take direct messages");
+    return;
+  }
+  *text++ = '\0';
+  send_direct_msg(cli_core->sender, args, text, cli_core->member_id);
+}
+
+/* Send the file at path to our room as a bulk transfer, named by the last
+ * part of the path */
+void cli_core_send_bulk(struct client_core* cli_core, char* path)
+{
+  char* data;
+  char* name;
+  char note[BULK_NAME_LEN + 48];
+  FILE* fp;
+  int len;
+
+  if (!(cli_core->sender->server_caps & CAP_BULK))
+  {
+    receiver_printf(cli_core->receiver_manager, "The server does not take bulk transfers");
+    return;
+  }
+  if ((data = (char*)malloc(BULK_MAX_LEN + 1)) == NULL)
+  {
+    perror("client_core malloc");
+    return;
+  }
+  if ((fp = fopen(path, "r")) == NULL)
+  {
+    receiver_printf(cli_core->receiver_manager, "Cannot open that file");
+    free(data);
+    return;
+  }
+  // one byte more than may be sent, to tell a file that is too large
+  len = fread(data, 1, BULK_MAX_LEN + 1, fp);
+  fclose(fp);
+  if (len == 0 || len > BULK_MAX_LEN)
+  {
+    snprintf(note, sizeof(note), "Files of 1 to %d bytes only", BULK_MAX_LEN);
+    receiver_printf(cli_core->receiver_manager, note);
+    free(data);
+    return;
+  }
+
+  name = strrchr(path, '/') != NULL ? strrchr(path, '/') + 1 : path;
+  send_bulk(cli_core->sender, name, data, len, cli_core->member_id);
+  snprintf(note, sizeof(note), "Sent %.*s (%d bytes)", BULK_NAME_LEN - 1, name, len);
+  receiver_printf(cli_core->receiver_manager, note);
+  free(data);
+}
+
+/* Given a client_core, follow a room besides the one we are in */
+void cli_core_subscribe_request(struct client_core* cli_core, char* room_name)
+{
+  if (!(cli_core->sender->server_caps & CAP_SUBSCRIBE)
+      || !(cli_core->sender->server_caps & CAP_EXT_HDR))
+  {
+    receiver_printf(cli_core->receiver_manager, "The server does not take subscriptions");
+    return;
+  }
+  receiver_printf(cli_core->receiver_manager, "Sending subscribe request");
+  char* response = send_subscribe_request(cli_core->sender, cli_core->member_id, room_name);
+  receiver_printf(cli_core->receiver_manager, response);
+  free(response);
+}
+
+/* Given a client_core, stop following a room */
+void cli_core_unsubscribe_request(struct client_core* cli_core, char* room_name)
+{
+  receiver_printf(cli_core->receiver_manager, "Sending unsubscribe request");
+  char* response = send_unsubscribe_request(cli_core->sender, cli_core->member_id, room_name);
+  receiver_printf(cli_core->receiver_manager, response);
+  free(response);
+}
+
+/* Send a chat message to a room we follow; args is "<room name> <text>" */
+void cli_core_send_room_msg(struct client_core* cli_core, char* args)
+{
+  char* text = strchr(args, ' ');
+  int i;
+
+  *text++ = '\0';
+  for (i = 0; i < cli_core->num_followed; i++)
+  {
+    if (strncmp(cli_core->followed[i].room_name, args, MAX_ROOM_NAME_LEN) == 0)
+    {
+      send_chat_msg_to_room(cli_core->sender, text, cli_core->member_id,
+          cli_core->followed[i].room_id);
+      return;
+    }
+  }
+  receiver_printf(cli_core->receiver_manager, "Not following that room, see !j");
+}
+
+/* Ask the receiver to show the loss and delay of the messages it got */
+void cli_core_telemetry_request(struct client_core* cli_core)
+{
+  receiver_show_stats(cli_core->receiver_manager);
+}
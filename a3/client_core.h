@@ -16,8 +16,11 @@
 struct client_core {
   pthread_t *thread;
   char* member_name;
-  u_int16_t member_id;
+  u_int32_t member_id;
   char curr_room [MAX_MSG_LEN];
+  /* rooms followed besides curr_room, see defs_ext.h */
+  struct room_follow followed[CLIENT_MAX_FOLLOWED];
+  int num_followed;
   struct client_to_server_sender* sender;
   struct receiver_manager* receiver_manager;
 };
@@ -27,12 +30,22 @@ struct client_core* create_client_core(char* member_name, char* server_host_name
 void cli_core_shutdown(struct client_core* cli_core);
 
 /* fns for control requests, or a chat message */
-void cli_core_room_list_request(struct client_core* cli_core);
+void cli_core_room_list_request(struct client_core* cli_core, char* prefix);
+void cli_core_top_rooms_request(struct client_core* cli_core, char* prefix);
 void cli_core_member_list_request(struct client_core* cli_core, char* room_name);
 void cli_core_switch_room_request(struct client_core* cli_core, char* room_name);
 void cli_core_create_room_request(struct client_core* cli_core, char* room_name);
+void cli_core_search_request(struct client_core* cli_core, char* words);
+void cli_core_filter_request(struct client_core* cli_core, char* patterns);
+void cli_core_move_room_request(struct client_core* cli_core, char* args);
 void cli_core_quit(struct client_core* cli_core);
 void cli_core_send_chatmsg(struct client_core* cli_core, char* chat_message);
+void cli_core_send_direct_msg(struct client_core* cli_core, char* args);
+void cli_core_send_bulk(struct client_core* cli_core, char* path);
+void cli_core_subscribe_request(struct client_core* cli_core, char* room_name);
+void cli_core_unsubscribe_request(struct client_core* cli_core, char* room_name);
+void cli_core_send_room_msg(struct client_core* cli_core, char* args);
+void cli_core_telemetry_request(struct client_core* cli_core);
 
 /* heartbeat related functions */
 void* cli_core_heart_beat(void* param);
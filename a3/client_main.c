@@ -103,16 +103,79 @@ char* validate_and_extract_data_from_ctrl_command(char cmd, char* line)
   switch(cmd)
   {
     case 'r':
+    case 'o':
+      /* nothing, or a space and the start of the room names */
+      if (line[0] != ' ' && line[0] != '\0')
+      {
+        printf("Error in command format: !%c should be followed by nothing, or a space and the start of a room name.\n",cmd);
+        return NULL;
+      }
+      if (strlen(line) > MAX_ROOM_NAME_LEN)
+      {
+        printf("Error in command format: name must not exceed %d characters.\n",MAX_ROOM_NAME_LEN);
+        return NULL;
+      }
+      return line[0] == '\0' ? line : line + 1;
     case 'q':
+    case 't':
       if (strlen(line) != 0)
       {
         printf("Error in command format: !%c should not be followed by anything.\n",cmd);
         return NULL;
       }
       break;
+    case 'f':
+      if (line[0] != ' ' || line[1] == '\0')
+      {
+        printf("Error in command format: !%c should be followed by a space and the words to search for.\n",cmd);
+        return NULL;
+      }
+      return line + 1;
+    case 'd':
+      /* a member, by name or as #<id>, and the text */
+      if (line[0] != ' ' || line[1] == ' ' || strchr(line + 1, ' ') == NULL)
+      {
+        printf("Error in command format: !%c should be followed by a space, a member name or #id, a space and the message.\n",cmd);
+        return NULL;
+      }
+      return line + 1;
+    case 'p':
+      /* a room we follow and the text */
+      if (line[0] != ' ' || line[1] == ' ' || strchr(line + 1, ' ') == NULL)
+      {
+        printf("Error in command format: !%c should be followed by a space, a room name, a space and the message.\n",cmd);
+        return NULL;
+      }
+      return line + 1;
+    case 'b':
+      /* the file to send */
+      if (line[0] != ' ' || line[1] == '\0')
+      {
+        printf("Error in command format: !%c should be followed by a space and a file name.\n",cmd);
+        return NULL;
+      }
+      return line + 1;
+    case 'v':
+      /* a room and the node to move it to */
+      if (line[0] != ' ' || strchr(line + 1, ' ') == NULL)
+      {
+        printf("Error in command format: !%c should be followed by a space, a room name, a space and a node name.\n",cmd);
+        return NULL;
+      }
+      return line + 1;
+    case 'k':
+      /* no patterns removes the filter */
+      if (line[0] != ' ' && line[0] != '\0')
+      {
+        printf("Error in command format: !%c should be followed by nothing, or a space and the patterns to filter.\n",cmd);
+        return NULL;
+      }
+      return line[0] == '\0' ? line : line + 1;
     case 'c':
     case 'm':
     case 's':
+    case 'j':
+    case 'l':
       allowed_len = MAX_ROOM_NAME_LEN;
 
       if (line[0] != ' ')
@@ -152,7 +215,10 @@ bool send_ctrl_request(struct client_core* cli_core, char cmd, char* msgdata)
   switch(cmd)
   {
     case 'r':
-      cli_core_room_list_request(cli_core);
+      cli_core_room_list_request(cli_core, msgdata);
+      return TRUE;
+    case 'o':
+      cli_core_top_rooms_request(cli_core, msgdata);
       return TRUE;
     case 'c':
       cli_core_create_room_request(cli_core, msgdata);
@@ -163,6 +229,33 @@ bool send_ctrl_request(struct client_core* cli_core, char cmd, char* msgdata)
     case 's':
       cli_core_switch_room_request(cli_core, msgdata);
       return TRUE;
+    case 't':
+      cli_core_telemetry_request(cli_core);
+      return TRUE;
+    case 'f':
+      cli_core_search_request(cli_core, msgdata);
+      return TRUE;
+    case 'k':
+      cli_core_filter_request(cli_core, msgdata);
+      return TRUE;
+    case 'v':
+      cli_core_move_room_request(cli_core, msgdata);
+      return TRUE;
+    case 'd':
+      cli_core_send_direct_msg(cli_core, msgdata);
+      return TRUE;
+    case 'b':
+      cli_core_send_bulk(cli_core, msgdata);
+      return TRUE;
+    case 'j':
+      cli_core_subscribe_request(cli_core, msgdata);
+      return TRUE;
+    case 'l':
+      cli_core_unsubscribe_request(cli_core, msgdata);
+      return TRUE;
+    case 'p':
+      cli_core_send_room_msg(cli_core, msgdata);
+      return TRUE;
     case 'q':
       return FALSE;
     default:
@@ -114,6 +114,16 @@ void init_receiver(struct client_receiver_context* ctx)
   /* 1. Make sure we can talk to parent (client control process) */
   open_client_channel(ctx);
 
+  ctx->mcast_fd = -1;
+  ctx->names = NULL;
+  ctx->num_names = 0;
+  ctx->num_followed = 0;
+
+  if ((ctx->telemetry = create_recv_telemetry()) == NULL)
+  {
+    exit(1);
+  }
+
   /* 2. Initialize UDP socket for receiving chat messages. */
   u_int16_t ret = init_udp_socket(ctx);
 
@@ -136,6 +146,493 @@ void handle_received_msg(char *buf)
   printf("%s: %s\n", cmh->sender.member_name, (char*)(cmh->msgdata));
 }
 
+/* Display a chat message that carries the extended header. */
+void print_ext_msg(char *buf)
+{
+  struct chat_msghdr* cmh = (struct chat_msghdr *)buf;
+  struct chat_ext_hdr* ext = (struct chat_ext_hdr *)(cmh->msgdata);
+  printf("%s: %s\n", cmh->sender.member_name, (char*)(ext->msgdata));
+}
+
+/* Replace the compressed text of a chat datagram of len bytes with the text
+ * itself (see msgzip.h), the text starting at offset text_off. Return the
+ * new length of the datagram, -1 if the text does not decompress. */
+ssize_t unzip_chat_datagram(struct client_receiver_context* ctx, char *buf, ssize_t len,
+    int text_off)
+{
+  struct chat_msghdr* cmh = (struct chat_msghdr *)buf;
+  char text[MAX_MSG_LEN];
+  struct timespec start, end;
+  int text_len;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  text_len = msgzip_decompress(buf + text_off, len - text_off, text,
+      MAX_MSG_LEN - text_off);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  if (text_len < 0)
+  {
+    return -1;
+  }
+
+  telemetry_record_unzip(ctx->telemetry, len - text_off, text_len,
+      (end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec));
+
+  memcpy(buf + text_off, text, text_len + 1);
+  cmh->msg_len = htons((ntohs(cmh->msg_len) & ~(CHAT_ZIP_FLAG | CHAT_LEN_MASK)) | text_len);
+  return text_off + text_len;
+}
+
+void handle_chat_datagram(struct client_receiver_context* ctx, char *buf, ssize_t len,
+    struct sockaddr_in *from);
+
+/* Take a bundle of len bytes (see defs_ext.h) apart and deal with each of
+ * the chat messages in it in turn. */
+void handle_bundle(struct client_receiver_context* ctx, char *buf, ssize_t len,
+    struct sockaddr_in *from)
+{
+  struct chat_msghdr* cmh = (struct chat_msghdr *)buf;
+  int count = ntohs(cmh->msg_len) & CHAT_LEN_MASK;
+  char* p = (char*)(cmh->msgdata);
+  char* end = buf + len;
+  char msg[MAX_MSG_LEN];
+  u_int16_t msg_len;
+
+  telemetry_record_bundle(ctx->telemetry, count);
+
+  while (count-- > 0 && p + sizeof(u_int16_t) <= end)
+  {
+    memcpy(&msg_len, p, sizeof(u_int16_t));
+    msg_len = ntohs(msg_len);
+    p += sizeof(u_int16_t);
+    if (msg_len > end - p || msg_len >= MAX_MSG_LEN)
+    {
+      /* cut short, the rest is lost */
+      return;
+    }
+
+    /* a copy of its own: terminated, and free to be kept or rewritten */
+    bzero(msg, MAX_MSG_LEN);
+    memcpy(msg, p, msg_len);
+    p += msg_len;
+    handle_chat_datagram(ctx, msg, msg_len, from);
+  }
+}
+
+/* Read a varint (see defs_ext.h) at p, ending before end, into v. Return
+ * its length, -1 if it runs past end. */
+int get_varint(char *p, char *end, u_int32_t *v)
+{
+  int n = 0;
+
+  *v = 0;
+  while (p + n < end && n < VARINT_MAX_LEN)
+  {
+    *v |= (u_int32_t)(p[n] & 0x7f) << (7 * n);
+    if ((p[n++] & 0x80) == 0)
+    {
+      return n;
+    }
+  }
+  return -1;
+}
+
+/* Remember name as the name of the member in the given slot of our room. */
+void remember_name(struct client_receiver_context* ctx, u_int32_t slot, char *name)
+{
+  if (slot >= MAX_NUM_OF_MEMBERS)
+  {
+    /* not a slot any server gives */
+    return;
+  }
+  if (slot >= ctx->num_names)
+  {
+    int num_names = slot + MAX_NUM_OF_MEMBERS_PER_ROOM;
+    char (*names)[MAX_MEMBER_NAME_LEN] = realloc(ctx->names, num_names * MAX_MEMBER_NAME_LEN);
+    if (names == NULL)
+    {
+      perror("client_recv realloc");
+      return;
+    }
+    bzero(names + ctx->num_names, (num_names - ctx->num_names) * MAX_MEMBER_NAME_LEN);
+    ctx->names = names;
+    ctx->num_names = num_names;
+  }
+  strncpy(ctx->names[slot], name, MAX_MEMBER_NAME_LEN - 1);
+}
+
+/* Take in the names of a name announcement of len bytes. */
+void handle_names(struct client_receiver_context* ctx, char *buf, ssize_t len)
+{
+  char* p = buf + 2;
+  char* end = buf + len;
+  u_int32_t slot;
+  int n;
+
+  if ((buf[1] & CHAT_COMPACT_RESET) && ctx->names != NULL)
+  {
+    bzero(ctx->names, ctx->num_names * MAX_MEMBER_NAME_LEN);
+  }
+  while ((n = get_varint(p, end, &slot)) > 0)
+  {
+    p += n;
+    char* nul = memchr(p, '\0', end - p);
+    if (nul == NULL)
+    {
+      return;
+    }
+    remember_name(ctx, slot, p);
+    p = nul + 1;
+  }
+}
+
+/* Deal with a datagram of len bytes that starts with the compact header
+ * (see defs_ext.h): put the chat_msghdr back in its place, with the name
+ * behind the slot, and go on as with any other chat message. */
+void handle_compact(struct client_receiver_context* ctx, char *buf, ssize_t len,
+    struct sockaddr_in *from)
+{
+  char msg[MAX_MSG_LEN];
+  struct chat_msghdr* cmh = (struct chat_msghdr *)msg;
+  char* p = buf + 2;
+  char* end = buf + len;
+  u_int32_t slot;
+  int n, text_len;
+
+  if (len < 2)
+  {
+    return;
+  }
+  if (buf[1] & CHAT_COMPACT_NAMES)
+  {
+    handle_names(ctx, buf, len);
+    return;
+  }
+  if ((n = get_varint(p, end, &slot)) < 0)
+  {
+    return;
+  }
+  p += n;
+  if (buf[1] & CHAT_COMPACT_NAME)
+  {
+    char* nul = memchr(p, '\0', end - p);
+    if (nul == NULL)
+    {
+      return;
+    }
+    remember_name(ctx, slot, p);
+    p = nul + 1;
+  }
+
+  text_len = end - p;
+  if (buf[1] & CHAT_COMPACT_EXT)
+  {
+    text_len -= sizeof(struct chat_ext_hdr);
+  }
+  if (text_len < 0 || sizeof(struct chat_msghdr) + (end - p) >= MAX_MSG_LEN)
+  {
+    return;
+  }
+
+  bzero(msg, MAX_MSG_LEN);
+  if (slot < ctx->num_names && ctx->names[slot][0] != '\0')
+  {
+    strncpy(cmh->sender.member_name, ctx->names[slot], MAX_MEMBER_NAME_LEN - 1);
+  }
+  else
+  {
+    /* its announcement got lost; the name comes again after the next join */
+    snprintf(cmh->sender.member_name, MAX_MEMBER_NAME_LEN, "#%u", slot);
+  }
+  cmh->msg_len = htons(text_len
+      | ((buf[1] & CHAT_COMPACT_EXT) ? CHAT_EXT_FLAG : 0)
+      | ((buf[1] & CHAT_COMPACT_ZIP) ? CHAT_ZIP_FLAG : 0));
+  memcpy(cmh->msgdata, p, end - p);
+
+  telemetry_record_compact(ctx->telemetry, p - buf);
+  handle_chat_datagram(ctx, msg, sizeof(struct chat_msghdr) + (end - p), from);
+}
+
+/* Deal with a chat datagram of len bytes from the server at from, which may
+ * carry the extended header (see defs_ext.h) in front of the text. */
+/* Show a direct message of len bytes (see defs_ext.h), or the ack of one
+ * we sent. If the sender asked for an ack, send it back through from. */
+void handle_direct(struct client_receiver_context* ctx, char *buf, ssize_t len,
+    struct sockaddr_in *from)
+{
+  struct chat_msghdr* cmh = (struct chat_msghdr *)buf;
+  struct chat_direct* dm = (struct chat_direct *)(cmh->msgdata);
+  u_int16_t flags;
+
+  if (len < sizeof(struct chat_msghdr) + sizeof(struct chat_direct))
+  {
+    return;
+  }
+  flags = ntohs(dm->flags);
+  dm->member_name[MAX_MEMBER_NAME_LEN - 1] = '\0';
+  cmh->sender.member_name[MAX_MEMBER_NAME_LEN - 1] = '\0';
+
+  if (flags & DIRECT_UNREACHABLE)
+  {
+    printf("(direct message %hu could not be delivered: no member %s)\n", ntohs(dm->seq),
+        dm->member_id != 0 ? "with that id" : dm->member_name);
+    return;
+  }
+  if (flags & DIRECT_ACK)
+  {
+    printf("(direct message %hu delivered to %s)\n", ntohs(dm->seq), cmh->sender.member_name);
+    return;
+  }
+
+  /* the text ends where the datagram does; buf has room for the null */
+  buf[len] = '\0';
+  printf("%s (direct, #%u): %s\n", cmh->sender.member_name, ntohl(dm->member_id),
+      (char*)(dm->msgdata));
+
+  if (flags & DIRECT_ACK_REQ)
+  {
+    bzero(cmh, sizeof(struct chat_msghdr));
+    cmh->msg_len = htons(CHAT_DIRECT_FLAG);
+    dm->flags = htons(flags | DIRECT_ACK);
+    if (sendto(ctx->udp_fd, buf, sizeof(struct chat_msghdr) + sizeof(struct chat_direct), 0,
+          (struct sockaddr *)from, sizeof(*from)) < 0)
+    {
+      perror("client_recv direct ack");
+    }
+  }
+}
+
+/* Show the payload of a bulk transfer: as it is if it is text, else only
+ * what it is. */
+void print_bulk(char *sender, char *name, char *data, int len)
+{
+  int i;
+
+  for (i = 0; i < len; i++)
+  {
+    if (!isprint((unsigned char)data[i]) && !isspace((unsigned char)data[i]))
+    {
+      printf("%s sent %s (%d bytes, not text)\n", sender, name, len);
+      return;
+    }
+  }
+  printf("%s sent %s (%d bytes):\n%s%s", sender, name, len, data,
+      data[len - 1] == '\n' ? "" : "\n");
+}
+
+/* The room we follow with id room_id, NULL if we do not. */
+struct room_follow* followed_room(struct client_receiver_context* ctx, u_int16_t room_id)
+{
+  int i;
+
+  for (i = 0; i < ctx->num_followed; i++)
+  {
+    if (ctx->followed[i].room_id == room_id)
+    {
+      return &ctx->followed[i];
+    }
+  }
+  return NULL;
+}
+
+/* Take note of a room followed, or no longer followed. */
+void follow_room(struct client_receiver_context* ctx, struct room_follow* follow)
+{
+  struct room_follow* known = followed_room(ctx, follow->room_id);
+
+  if (!follow->following)
+  {
+    if (known != NULL)
+    {
+      *known = ctx->followed[--ctx->num_followed];
+    }
+    return;
+  }
+  if (known == NULL && ctx->num_followed < CLIENT_MAX_FOLLOWED)
+  {
+    known = &ctx->followed[ctx->num_followed++];
+  }
+  if (known != NULL)
+  {
+    *known = *follow;
+  }
+}
+
+void handle_chat_datagram(struct client_receiver_context* ctx, char *buf, ssize_t len,
+    struct sockaddr_in *from)
+{
+  struct chat_msghdr* cmh = (struct chat_msghdr *)buf;
+
+  if (len > 0 && (u_int8_t)buf[0] == CHAT_COMPACT_MARK)
+  {
+    handle_compact(ctx, buf, len, from);
+    return;
+  }
+
+  /* marked by two flags, either of which means something else alone */
+  if (len >= sizeof(struct chat_msghdr)
+      && (ntohs(cmh->msg_len) & CHAT_BULK_FLAGS) == CHAT_BULK_FLAGS)
+  {
+    bulk_receive(ctx->bulk, buf, len);
+    return;
+  }
+
+  if (len >= sizeof(struct chat_msghdr) && (ntohs(cmh->msg_len) & CHAT_DIRECT_FLAG))
+  {
+    handle_direct(ctx, buf, len, from);
+    return;
+  }
+
+  if (ntohs(cmh->msg_len) & CHAT_BUNDLE_FLAG)
+  {
+    handle_bundle(ctx, buf, len, from);
+    return;
+  }
+
+  if ((ntohs(cmh->msg_len) & CHAT_EXT_FLAG) == 0)
+  {
+    if ((ntohs(cmh->msg_len) & CHAT_ZIP_FLAG)
+        && (len = unzip_chat_datagram(ctx, buf, len, sizeof(struct chat_msghdr))) < 0)
+    {
+      return;
+    }
+    telemetry_record_plain(ctx->telemetry);
+    handle_received_msg(buf);
+    return;
+  }
+
+  if (len < sizeof(struct chat_msghdr) + sizeof(struct chat_ext_hdr))
+  {
+    /* truncated, nothing to show */
+    return;
+  }
+
+  /* compressed by the sender; shown, kept and passed on as plain text */
+  if ((ntohs(cmh->msg_len) & CHAT_ZIP_FLAG)
+      && (len = unzip_chat_datagram(ctx, buf, len,
+          sizeof(struct chat_msghdr) + sizeof(struct chat_ext_hdr))) < 0)
+  {
+    return;
+  }
+
+  struct chat_ext_hdr* ext = (struct chat_ext_hdr *)(cmh->msgdata);
+
+  /* backlog sent on joining a room: old news, keep it out of the stats
+   * and out of sequence tracking */
+  if (ntohs(ext->flags) & CHAT_FLAG_HISTORY)
+  {
+    printf("(earlier) %s: %s\n", cmh->sender.member_name, (char*)(ext->msgdata));
+    return;
+  }
+
+  telemetry_record(ctx->telemetry, cmh->sender.member_name, ext);
+
+  /* from a room we follow: shown as it comes, the room's order is kept
+   * only for the room we are in */
+  struct room_follow* follow = followed_room(ctx, ntohs(ext->room_id));
+  if (follow != NULL)
+  {
+    printf("[%s] %s: %s\n", follow->room_name, cmh->sender.member_name,
+        (char*)(ext->msgdata));
+    return;
+  }
+
+  if (ntohs(ext->flags) & CHAT_FLAG_RELIABLE)
+  {
+    reorder_receive(ctx->reorder, buf, len, from);
+    return;
+  }
+  print_ext_msg(buf);
+}
+
+/* Tell the server that we listen to the group of the room (see defs_ext.h),
+ * from the port it sends our unicast copies to. */
+void send_mcast_report(struct client_receiver_context* ctx)
+{
+  char buf[sizeof(struct chat_msghdr) + sizeof(struct chat_nack)];
+  struct chat_msghdr* cmh = (struct chat_msghdr *)buf;
+  struct chat_nack* nack = (struct chat_nack *)(cmh->msgdata);
+
+  bzero(buf, sizeof(buf));
+  cmh->msg_len = htons(CHAT_NACK_FLAG);
+  nack->room_id = ctx->mcast.room_id;
+  nack->flags = htons(NACK_MCAST_JOINED);
+
+  if (sendto(ctx->udp_fd, buf, sizeof(buf), 0,
+        (struct sockaddr *)&ctx->mcast_server, sizeof(ctx->mcast_server)) < 0)
+  {
+    perror("client_recv mcast report");
+  }
+  ctx->mcast_report_time = time(NULL);
+}
+
+/* Leave the multicast group we listen to, if any, and join the one in join,
+ * if it names one. If anything goes wrong we stay out of the group, and
+ * the server goes on sending us the room's messages by unicast. */
+void join_mcast_group(struct client_receiver_context* ctx, struct mcast_join* join)
+{
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  struct ip_mreq mreq;
+  int fd, on = 1;
+
+  if (ctx->mcast_fd >= 0)
+  {
+    /* closing the socket drops the membership */
+    close(ctx->mcast_fd);
+    ctx->mcast_fd = -1;
+  }
+  if (join->group.group == 0)
+  {
+    return;
+  }
+
+  /* listen on the interface we reach the server through */
+  if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+  {
+    perror("client_recv mcast socket");
+    return;
+  }
+  if (connect(fd, (struct sockaddr *)&join->server, sizeof(join->server)) < 0
+      || getsockname(fd, (struct sockaddr *)&addr, &addr_len) < 0)
+  {
+    perror("client_recv mcast interface");
+    close(fd);
+    return;
+  }
+  close(fd);
+
+  bzero(&mreq, sizeof(mreq));
+  mreq.imr_multiaddr.s_addr = join->group.group;
+  mreq.imr_interface = addr.sin_addr;
+
+  if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+  {
+    perror("client_recv mcast socket");
+    return;
+  }
+
+  bzero(&addr, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = join->group.group;
+  addr.sin_port = join->group.port;
+
+  /* other receivers on this host listen to the same port */
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0
+      || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+      || setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+  {
+    perror("client_recv mcast join");
+    close(fd);
+    return;
+  }
+
+  ctx->mcast_fd = fd;
+  ctx->mcast = join->group;
+  ctx->mcast_server = join->server;
+  ctx->mcast_confirmed = 0;
+  send_mcast_report(ctx);
+}
+
 /* Handle the chatclient's communication channel by checking for messages
  * and responding accordingly. */
 int handle_chatclient(struct client_receiver_context* ctx, char *buf)
@@ -164,12 +661,61 @@ int handle_chatclient(struct client_receiver_context* ctx, char *buf)
     return 1;
   }
 
+  if (msg->body.status == SHOW_STATS)
+  {
+    telemetry_print(ctx->telemetry, stdout);
+    reorder_print(ctx->reorder, stdout);
+    bulk_print(ctx->bulk, stdout);
+    return 0;
+  }
+
+  if (msg->body.status == MCAST_JOIN)
+  {
+    join_mcast_group(ctx, (struct mcast_join*)(buf + sizeof(msg_t)));
+    return 0;
+  }
+
+  if (msg->body.status == ROOM_FOLLOW)
+  {
+    follow_room(ctx, (struct room_follow*)(buf + sizeof(msg_t)));
+    return 0;
+  }
+
   // else it's a simple message. get the chat_msg struct that falls
   // after the msg_t header information.
   handle_received_msg((char*)(buf + sizeof(msg_t)));
   return 0;
 }
 
+/* Take a datagram off the multicast group of the room. It is dealt with as
+ * if the server had sent it to us, so NACKs still go to the chat port. */
+void handle_mcast_datagram(struct client_receiver_context* ctx, char *buf)
+{
+  struct sockaddr_in from;
+  socklen_t from_len = sizeof(from);
+  ssize_t msg_len;
+
+  bzero(buf, MAX_MSG_LEN);
+  msg_len = recvfrom(ctx->mcast_fd, buf, MAX_MSG_LEN - 1, 0,
+      (struct sockaddr *)&from, &from_len);
+  if (msg_len <= 0)
+  {
+    perror("client_recv mcast recvfrom");
+    return;
+  }
+
+  /* anyone on the network may send to the group */
+  if (ctx->mcast.source != 0 && from.sin_addr.s_addr != ctx->mcast.source)
+  {
+    return;
+  }
+
+  ctx->mcast_confirmed = 1;
+  telemetry_record_mcast(ctx->telemetry);
+  handle_chat_datagram(ctx, buf, msg_len, &ctx->mcast_server);
+  bzero(buf, MAX_MSG_LEN);
+}
+
 /* Handle the chatserver's communication channel by checking for messages
  * and responding accordingly */
 void handle_chatserver(struct client_receiver_context* ctx, char *buf)
@@ -177,27 +723,48 @@ void handle_chatserver(struct client_receiver_context* ctx, char *buf)
   fd_set fds;
   FD_ZERO(&fds);
   FD_SET(ctx->udp_fd, &fds);
+  if (ctx->mcast_fd >= 0)
+  {
+    FD_SET(ctx->mcast_fd, &fds);
+  }
 
   ssize_t msg_len = 0;
+  struct sockaddr_in from;
+  socklen_t from_len = sizeof(from);
   struct timeval tv;
   tv.tv_sec = 0;
   tv.tv_usec= 100;
 
   bzero(buf, MAX_MSG_LEN);
   // check the UDP connection for any incoming messages with select.
-  msg_len = select(ctx->udp_fd + 1, &fds, NULL, NULL, &tv);
+  msg_len = select((ctx->mcast_fd > ctx->udp_fd ? ctx->mcast_fd : ctx->udp_fd) + 1,
+      &fds, NULL, NULL, &tv);
   if (msg_len < 0)
   {
     perror("client_recv select()");
     return;
   }
 
+  if (ctx->mcast_fd >= 0 && FD_ISSET(ctx->mcast_fd, &fds))
+  {
+    handle_mcast_datagram(ctx, buf);
+  }
+
   if(!FD_ISSET(ctx->udp_fd, &fds))
   {
     return;
   }
 
-  msg_len = recvfrom(ctx->udp_fd, buf, MAX_MSG_LEN, 0, NULL, 0);
+  /* still getting unicast: the server may have missed our report */
+  if (ctx->mcast_fd >= 0 && !ctx->mcast_confirmed
+      && time(NULL) - ctx->mcast_report_time >= MCAST_REPORT_INT)
+  {
+    send_mcast_report(ctx);
+  }
+
+  /* leave room for a terminating null after the text */
+  msg_len = recvfrom(ctx->udp_fd, buf, MAX_MSG_LEN - 1, 0,
+      (struct sockaddr *)&from, &from_len);
   // Check if we failed to grab a message
   if(msg_len <= 0)
   {
@@ -206,7 +773,7 @@ void handle_chatserver(struct client_receiver_context* ctx, char *buf)
   }
   else // we got a message
   {
-    handle_received_msg(buf);
+    handle_chat_datagram(ctx, buf, msg_len, &from);
   }
 }
 
@@ -233,14 +800,31 @@ void receive_msgs(struct client_receiver_context* ctx)
     exit(1);
   }
 
+  if ((ctx->reorder = create_reorder_buffer(ctx->udp_fd, print_ext_msg)) == NULL)
+  {
+    close(ctx->udp_fd);
+    exit(1);
+  }
+
+  if ((ctx->bulk = create_bulk_reassembly(print_bulk)) == NULL)
+  {
+    close(ctx->udp_fd);
+    exit(1);
+  }
+
   while(TRUE)
   {
     handle_chatserver(ctx, buf);
+    reorder_tick(ctx->reorder);
+    bulk_tick(ctx->bulk);
     if(handle_chatclient(ctx, buf)) break;
   }
 
   /* Cleanup */
   free(buf);
+  destroy_recv_telemetry(ctx->telemetry);
+  destroy_reorder_buffer(ctx->reorder);
+  destroy_bulk_reassembly(ctx->bulk);
   return;
 }
 
@@ -4,13 +4,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <unistd.h>
 #include <netdb.h>
+#include <time.h>
 
 #include "client.h"
+#include "recv_telemetry.h"
+#include "recv_reorder.h"
+#include "recv_bulk.h"
+#include "msgzip.h"
 
 static char *option_string = "f:";
 
+/* seconds between reports of joining a multicast group, until it works */
+#define MCAST_REPORT_INT 1
+
 struct client_receiver_context {
   /* vars for UDP socket connection */
   int udp_fd;
@@ -19,6 +28,33 @@ struct client_receiver_context {
   /* For communication with chat client control process */
   int ctrl2rcvr_qid;
   char ctrl2rcvr_fname[MAX_FILE_NAME_LEN];
+
+  /* loss and latency of the chat messages we receive */
+  struct recv_telemetry* telemetry;
+
+  /* puts the messages of reliable rooms in order */
+  struct reorder_buffer* reorder;
+
+  /* puts the payloads of bulk transfers together */
+  struct bulk_reassembly* bulk;
+
+  /* socket on the multicast group of the current room, -1 if none */
+  int mcast_fd;
+  struct mcast_group mcast;
+  struct sockaddr_in mcast_server;
+  /* whether anything came through the group yet, and when we last told
+   * the server we joined it */
+  int mcast_confirmed;
+  time_t mcast_report_time;
+
+  /* names of the members of our room by slot, for compact chat messages
+   * (see defs_ext.h); empty where we were not told */
+  char (*names)[MAX_MEMBER_NAME_LEN];
+  int num_names;
+
+  /* rooms we follow besides our own, as the controller passed them on */
+  struct room_follow followed[CLIENT_MAX_FOLLOWED];
+  int num_followed;
 };
 
 #endif
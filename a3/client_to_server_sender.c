@@ -9,17 +9,19 @@
  *      The message header.
  *    u_int16_t msg_type:
  *      The message type.
- *    u_int16_t member_id:
- *      The member id.
+ *    u_int32_t member_id:
+ *      The member id. The high half of a wide one goes in the reserved
+ *      field, see defs_ext.h.
  *    u_int16_t msg_len:
  *      The message length.
  */
 void encode_control_msghdr(struct control_msghdr* msghdr, u_int16_t msg_type,
-    u_int16_t member_id, u_int16_t msg_len)
+    u_int32_t member_id, u_int16_t msg_len)
 {
   msghdr->msg_type = htons(msg_type);
-  msghdr->member_id = htons(member_id);
+  msghdr->member_id = htons(member_id & 0xffff);
   msghdr->msg_len = htons(msg_len);
+  msghdr->reserved = htons(member_id >> 16);
 }
 
 /*
@@ -51,7 +53,11 @@ char* process_response (char* resp, u_int16_t resp_len, char* extra)
   struct control_msghdr* resp_hdr = (struct control_msghdr*) resp;
   u_int16_t msg_len = resp_len - sizeof(struct control_msghdr) + 1;
 
-  if (msg_len <= 1) // there will be a null char
+  // there will be a null char; a SWITCH_ROOM_SUCC may carry a multicast
+  // group, a ROOM_REDIRECT a server and a SUBSCRIBE_SUCC a room id, but no text
+  if (msg_len <= 1 || ntohs(resp_hdr->msg_type) == SWITCH_ROOM_SUCC
+      || ntohs(resp_hdr->msg_type) == ROOM_REDIRECT
+      || ntohs(resp_hdr->msg_type) == SUBSCRIBE_SUCC)
     msg_len = 100+MAX_ROOM_NAME_LEN; // want to returm a msg, so allocate some space
 
   char* msg = (char*) malloc(msg_len);
@@ -68,14 +74,36 @@ char* process_response (char* resp, u_int16_t resp_len, char* extra)
     case MEMBER_LIST_FAIL:
     case SWITCH_ROOM_FAIL:
     case CREATE_ROOM_FAIL:
-      strncpy(msg, (char*)(resp_hdr->msgdata), msg_len);
+    case SEARCH_SUCC:
+    case SEARCH_FAIL:
+    case FILTER_SUCC:
+    case FILTER_FAIL:
+    case MOVE_ROOM_SUCC:
+    case MOVE_ROOM_FAIL:
+    case SUBSCRIBE_FAIL:
+    case UNSUBSCRIBE_SUCC:
+    case UNSUBSCRIBE_FAIL:
+    case DIRECTORY_FAIL:
+      strncpy(msg, (char*)(resp_hdr->msgdata), msg_len - 1);
       break;
     case SWITCH_ROOM_SUCC:
       snprintf(msg, msg_len, "Successfully switched to room %s", extra);
       break;
+    case ROOM_REDIRECT:
+      snprintf(msg, msg_len, "Room %s is on another server", extra);
+      break;
     case CREATE_ROOM_SUCC:
       snprintf(msg, msg_len, "Successfully created room %s", extra);
       break;
+    case SUBSCRIBE_SUCC:
+      snprintf(msg, msg_len, "Now following room %s", extra);
+      break;
+    case DIRECTORY_SUCC:
+      if (resp_len > sizeof(struct control_msghdr) + sizeof(struct directory_reply))
+      {
+        strncpy(msg, ((struct directory_reply*)(resp_hdr->msgdata))->entries, msg_len - 1);
+      }
+      break;
   }
 
   return msg;
@@ -110,6 +138,69 @@ void re_register_func(struct client_to_server_sender* sender)
   }
 }
 
+/* Move over to the standby of a server that cannot be reached (see
+ * defs_ext.h). The standby knows our member id and room, so there is nothing
+ * to redo there. Return 1 if there was a standby to move to. */
+int fail_over_to_standby(struct client_to_server_sender* sender)
+{
+  struct chatserver_manager* chatserver_manager = sender->chatserver_manager;
+  char msg[MAX_HOST_NAME_LEN + 32];
+
+  if (sender->standby.host_name[0] == '\0')
+  {
+    return 0;
+  }
+
+  strncpy(chatserver_manager->host_name, sender->standby.host_name, MAX_HOST_NAME_LEN);
+  chatserver_manager->tcp_port = sender->standby.tcp_port;
+  chatserver_manager->udp_port = sender->standby.udp_port;
+  // only once; the standby names its own standby, if it gets one
+  bzero(sender->standby.host_name, MAX_HOST_NAME_LEN);
+
+  snprintf(msg, sizeof(msg), "Failed over to server %s:%hu", chatserver_manager->host_name,
+      chatserver_manager->tcp_port);
+  receiver_printf(sender->cli_core->receiver_manager, msg);
+  return 1;
+}
+
+/* Move over to the server named in a MEMBER_MOVED response (see defs_ext.h):
+ * our room went there, and we have the id in the response header there. The
+ * request is changed to carry the new id. Return 0 once moved, -1 if the
+ * response names no server. */
+int follow_member_moved(struct client_to_server_sender* sender, char* request,
+    char* response, u_int16_t response_len)
+{
+  struct control_msghdr* cmh = (struct control_msghdr*) response;
+  struct room_redirect* rd = (struct room_redirect*)(cmh->msgdata);
+  struct chatserver_manager* chatserver_manager = sender->chatserver_manager;
+  char msg[MAX_HOST_NAME_LEN + 32];
+
+  if (response_len <= sizeof(struct control_msghdr) + sizeof(struct room_redirect))
+  {
+    return -1;
+  }
+  response[response_len - 1] = '\0';
+  if (strlen(rd->host_name) >= MAX_HOST_NAME_LEN)
+  {
+    return -1;
+  }
+
+  strncpy(chatserver_manager->host_name, rd->host_name, MAX_HOST_NAME_LEN);
+  chatserver_manager->tcp_port = ntohs(rd->tcp_port);
+  chatserver_manager->udp_port = ntohs(rd->udp_port);
+  bzero(sender->standby.host_name, MAX_HOST_NAME_LEN);
+
+  sender->cli_core->member_id = ntohs(cmh->member_id) | (u_int32_t) ntohs(cmh->reserved) << 16;
+  ((struct control_msghdr*) request)->member_id = cmh->member_id;
+  ((struct control_msghdr*) request)->reserved = cmh->reserved;
+  // our session stays behind on the old server
+  sender->session_key = 0;
+
+  snprintf(msg, sizeof(msg), "Room moved to server %s:%hu", rd->host_name, ntohs(rd->tcp_port));
+  receiver_printf(sender->cli_core->receiver_manager, msg);
+  return 0;
+}
+
 /*
  * Send a control message given the sender, the message and the size of the
  * the message. If the chatserver cannot be reach, the function will evoke the
@@ -145,6 +236,10 @@ char* send_control_msg(struct client_to_server_sender* sender, char* request,
     struct tcp_connection* tcp_con = create_tcp_connection(host_name, tcp_port, &nerror);
     if (tcp_con == NULL)
     {
+      if (fail_over_to_standby(sender))
+      {
+        continue;
+      }
       refresh_chatserver(chatserver_manager);
       if(re_register)
       {
@@ -165,6 +260,10 @@ char* send_control_msg(struct client_to_server_sender* sender, char* request,
     if (response == NULL)
     {
       close_tcp_connection(tcp_con);
+      if (fail_over_to_standby(sender))
+      {
+        continue;
+      }
       refresh_chatserver(chatserver_manager);
       if(re_register)
       {
@@ -182,6 +281,15 @@ char* send_control_msg(struct client_to_server_sender* sender, char* request,
     }
 
     close_tcp_connection(tcp_con);
+
+    // Our room went to another server; ask there
+    if (*response_size >= sizeof(struct control_msghdr)
+        && ntohs(((struct control_msghdr*) response)->msg_type) == MEMBER_MOVED
+        && follow_member_moved(sender, request, response, *response_size) == 0)
+    {
+      free(response);
+      continue;
+    }
     break;
   }
 
@@ -191,7 +299,7 @@ char* send_control_msg(struct client_to_server_sender* sender, char* request,
 
 /* Prepare a client request that is meant to be sent to the chat server. However
  * this request will contain no data. Return the prepared request */
-char* prepare_request_with_no_data(u_int16_t msg_type, u_int16_t member_id,
+char* prepare_request_with_no_data(u_int16_t msg_type, u_int32_t member_id,
     u_int16_t* request_len)
 {
   *request_len = sizeof(struct control_msghdr);
@@ -202,7 +310,7 @@ char* prepare_request_with_no_data(u_int16_t msg_type, u_int16_t member_id,
 }
 
 /* Return a prepared request, which contains data. */
-char* prepare_request_with_data(u_int16_t msg_type, u_int16_t member_id,
+char* prepare_request_with_data(u_int16_t msg_type, u_int32_t member_id,
     u_int16_t* request_len, char* msgdata, u_int16_t msg_len)
 {
   *request_len = sizeof(struct control_msghdr) + msg_len;
@@ -214,7 +322,10 @@ char* prepare_request_with_data(u_int16_t msg_type, u_int16_t member_id,
 }
 
 
-char* prepare_register_request(u_int16_t udp_port, char* member_name, u_int16_t* request_len)
+/* Prepare a REGISTER_REQUEST. With a session key, it asks to resume the
+ * session of member_id (see defs_ext.h). */
+char* prepare_register_request(u_int16_t udp_port, char* member_name, u_int32_t member_id,
+    u_int32_t session_key, u_int16_t* request_len)
 {
 #ifdef DBUG
   printf("%s\n", member_name);
@@ -222,10 +333,22 @@ char* prepare_register_request(u_int16_t udp_port, char* member_name, u_int16_t*
 
   u_int16_t member_name_size = strnlen(member_name, MAX_MEMBER_NAME_LEN);
   u_int16_t msg_len = sizeof(struct register_msgdata) + member_name_size;
+  if (session_key != 0)
+  {
+    msg_len += 1 + sizeof(struct session_resume);
+  }
   struct register_msgdata* msgdata = (struct register_msgdata*)malloc(msg_len);
 
   msgdata->udp_port = htons(udp_port);
   strncpy((char*)msgdata->member_name, member_name, member_name_size);
+  if (session_key != 0)
+  {
+    struct session_resume resume;
+    resume.member_id = htonl(member_id);
+    resume.session_key = htonl(session_key);
+    msgdata->member_name[member_name_size] = '\0';
+    memcpy((char*)msgdata->member_name + member_name_size + 1, &resume, sizeof(resume));
+  }
 
 #ifdef DBUG
   printf("%s\n", (char*)msgdata->member_name);
@@ -233,12 +356,18 @@ char* prepare_register_request(u_int16_t udp_port, char* member_name, u_int16_t*
 
   char* response = prepare_request_with_data(REGISTER_REQUEST, 0, request_len, (char*)msgdata, msg_len);
   free(msgdata);
+
+  // Ask for the extended chat header, compression, bundles, multicast, room
+  // redirects, news of the standby, wide ids, sessions, the compact header,
+  // direct messages, subscriptions and the directory, see defs_ext.h
+  ((struct control_msghdr*)response)->reserved = htons(CLIENT_CAPS);
   return response;
 }
 
 /* Given the response from the chat server from a control request, handle the
  * response accordingly */
-char* handle_register_response(char* response, u_int16_t response_len, u_int16_t* member_id)
+char* handle_register_response(char* response, u_int16_t response_len, u_int32_t* member_id,
+    u_int16_t* server_caps, u_int32_t* session_key)
 {
   struct control_msghdr* msghdr = (struct control_msghdr*)(response);
   decode_control_msghdr(msghdr, msghdr->msg_type, msghdr->member_id, msghdr->msg_len);
@@ -257,6 +386,21 @@ char* handle_register_response(char* response, u_int16_t response_len, u_int16_t
 #endif
 
     *member_id = msghdr->member_id;
+    // An older server leaves this zero, so we fall back to the plain header
+    *server_caps = ntohs(msghdr->reserved) & CLIENT_CAPS;
+    *session_key = 0;
+
+    // Protocol v2: the whole id, and the key to resume the session with
+    if ((*server_caps & (CAP_WIDE_ID | CAP_SESSION))
+        && response_len >= sizeof(struct control_msghdr) + sizeof(struct register_v2))
+    {
+      struct register_v2* rv = (struct register_v2*)(msghdr->msgdata);
+      *member_id = ntohl(rv->member_id);
+      if (*server_caps & CAP_SESSION)
+      {
+        *session_key = ntohl(rv->session_key);
+      }
+    }
   }
   return NULL;
 }
@@ -264,10 +408,11 @@ char* handle_register_response(char* response, u_int16_t response_len, u_int16_t
 /* Send a request to register the client with the chatserver. Return the
  * chatserver's response. */
 char* send_register_request(struct client_to_server_sender* sender, char* member_name,
-    u_int16_t udp_port, u_int16_t* member_id)
+    u_int16_t udp_port, u_int32_t* member_id)
 {
   u_int16_t request_len;
-  char* request = prepare_register_request(udp_port, member_name, &request_len);
+  char* request = prepare_register_request(udp_port, member_name, *member_id,
+      sender->session_key, &request_len);
 
   // We should always get back a response since if the chatserver fail
   // "send_control_msg" will try to poke location server for a new chatserver.
@@ -275,7 +420,8 @@ char* send_register_request(struct client_to_server_sender* sender, char* member
   char* response = send_control_msg(sender, request, request_len, &response_len, FALSE);
 
   // Handle the the response
-  char* error_msg = handle_register_response(response, response_len, member_id);
+  char* error_msg = handle_register_response(response, response_len, member_id,
+      &sender->server_caps, &sender->session_key);
 
   free(request);
   free(response);
@@ -284,7 +430,7 @@ char* send_register_request(struct client_to_server_sender* sender, char* member
 
 /* Send a request to list all the rooms in the chatserver. Return the
  * chatserver's response. */
-char* send_room_list_request(struct client_to_server_sender* sender, u_int16_t member_id)
+char* send_room_list_request(struct client_to_server_sender* sender, u_int32_t member_id)
 {
   u_int16_t request_len;
   char* request = prepare_request_with_no_data(ROOM_LIST_REQUEST, member_id, &request_len);
@@ -298,9 +444,46 @@ char* send_room_list_request(struct client_to_server_sender* sender, u_int16_t m
   return msg;
 }
 
+/* Send a request for a page of the directory (see defs_ext.h): the rooms,
+ * or the members of room_name, or of the server if it is empty, whose names
+ * start with prefix. *cursor names the page, and is set to the one after it,
+ * 0 after the last. Return the chatserver's response. */
+char* send_directory_request(struct client_to_server_sender* sender, u_int32_t member_id,
+    u_int16_t what, u_int16_t order, char* prefix, char* room_name, u_int32_t* cursor)
+{
+  struct directory_request req;
+  u_int16_t request_len;
+
+  bzero(&req, sizeof(req));
+  req.what = htons(what);
+  req.order = htons(order);
+  req.cursor = htonl(*cursor);
+  strncpy(req.prefix, prefix, MAX_ROOM_NAME_LEN - 1);
+  strncpy(req.room_name, room_name, MAX_ROOM_NAME_LEN - 1);
+
+  char* request = prepare_request_with_data(DIRECTORY_REQUEST, member_id, &request_len,
+      (char*)&req, sizeof(req));
+
+  u_int16_t response_len;
+  char* response = send_control_msg(sender, request, request_len, &response_len, TRUE);
+
+  struct control_msghdr* cmh = (struct control_msghdr*) response;
+  *cursor = 0;
+  if (ntohs(cmh->msg_type) == DIRECTORY_SUCC
+      && response_len >= sizeof(struct control_msghdr) + sizeof(struct directory_reply))
+  {
+    *cursor = ntohl(((struct directory_reply*)(cmh->msgdata))->next_cursor);
+  }
+
+  char * msg = process_response (response, response_len, "\0");
+  free(request);
+  free(response);
+  return msg;
+}
+
 /* Send a request to list all the members in a rooms in the chatserver. Return the
  * chatserver's response. */
-char* send_member_list_request(struct client_to_server_sender* sender, u_int16_t member_id, char* room_name)
+char* send_member_list_request(struct client_to_server_sender* sender, u_int32_t member_id, char* room_name)
 {
   u_int16_t request_len;
   u_int16_t room_name_len = strnlen(room_name, MAX_ROOM_NAME_LEN);
@@ -316,22 +499,172 @@ char* send_member_list_request(struct client_to_server_sender* sender, u_int16_t
   return msg;
 }
 
+/* Tell the receiver about the multicast group named in a SWITCH_ROOM_SUCC
+ * response (see defs_ext.h). Without one, the receiver only leaves the group
+ * of the old room and gets the new room's messages by unicast. */
+void pass_on_mcast_group(struct client_to_server_sender* sender, char* response,
+    u_int16_t response_len)
+{
+  struct control_msghdr* cmh = (struct control_msghdr*) response;
+  struct chatserver_manager* chatserver_manager = sender->chatserver_manager;
+  struct mcast_group group;
+  struct sockaddr_in server;
+  struct hostent* host_entry;
+
+  bzero(&group, sizeof(group));
+  if (response_len >= sizeof(struct control_msghdr) + sizeof(struct mcast_group))
+  {
+    memcpy(&group, cmh->msgdata, sizeof(group));
+  }
+
+  /* the receiver reports the join from its own port, to the chat port */
+  bzero(&server, sizeof(server));
+  if (group.group != 0)
+  {
+    if ((host_entry = gethostbyname(chatserver_manager->host_name)) == NULL)
+    {
+      return;
+    }
+    server.sin_family = AF_INET;
+    server.sin_addr = *(struct in_addr *) host_entry->h_addr_list[0];
+    server.sin_port = htons(chatserver_manager->udp_port);
+  }
+
+  receiver_mcast_join(sender->cli_core->receiver_manager, &group, &server);
+}
+
+/* Move over to the server named in a ROOM_REDIRECT response (see
+ * defs_ext.h): leave the current server, point the chatserver manager at the
+ * new one and register there. Return 0 once registered, -1 if the response
+ * names no server. */
+int follow_room_redirect(struct client_to_server_sender* sender, char* response,
+    u_int16_t response_len)
+{
+  struct control_msghdr* cmh = (struct control_msghdr*) response;
+  struct room_redirect* rd = (struct room_redirect*)(cmh->msgdata);
+  struct chatserver_manager* chatserver_manager = sender->chatserver_manager;
+  char msg[MAX_HOST_NAME_LEN + 32];
+
+  if (response_len <= sizeof(struct control_msghdr) + sizeof(struct room_redirect))
+  {
+    return -1;
+  }
+  response[response_len - 1] = '\0';
+  if (strlen(rd->host_name) >= MAX_HOST_NAME_LEN)
+  {
+    return -1;
+  }
+
+  send_quit_request(sender, sender->cli_core->member_id);
+
+  strncpy(chatserver_manager->host_name, rd->host_name, MAX_HOST_NAME_LEN);
+  chatserver_manager->tcp_port = ntohs(rd->tcp_port);
+  chatserver_manager->udp_port = ntohs(rd->udp_port);
+  // the old server's standby does not know us there
+  bzero(sender->standby.host_name, MAX_HOST_NAME_LEN);
+
+  re_register_func(sender);
+  snprintf(msg, sizeof(msg), "Moved to server %s:%hu", rd->host_name, ntohs(rd->tcp_port));
+  receiver_printf(sender->cli_core->receiver_manager, msg);
+  return 0;
+}
+
+/* Forget about following room_name, and have the receiver forget too. */
+void forget_followed_room(struct client_to_server_sender* sender, char* room_name)
+{
+  struct client_core* cli_core = sender->cli_core;
+  int i;
+
+  for (i = 0; i < cli_core->num_followed; i++)
+  {
+    if (strncmp(cli_core->followed[i].room_name, room_name, MAX_ROOM_NAME_LEN) == 0)
+    {
+      cli_core->followed[i].following = 0;
+      receiver_room_follow(cli_core->receiver_manager, &cli_core->followed[i]);
+      cli_core->followed[i] = cli_core->followed[--cli_core->num_followed];
+      return;
+    }
+  }
+}
+
+/* Send a room request (msg_type is CREATE_ROOM_REQUEST or SWITCH_ROOM_REQUEST)
+ * for room_name. If the room lives on another server, move there and ask
+ * again, once. Return the last response. */
+char* send_room_request(struct client_to_server_sender* sender, u_int16_t msg_type,
+    u_int32_t member_id, char* room_name, u_int16_t* response_len)
+{
+  u_int16_t request_len;
+  u_int16_t room_name_len = strnlen(room_name, MAX_ROOM_NAME_LEN);
+
+  char* request = prepare_request_with_data(msg_type, member_id, &request_len, room_name, room_name_len);
+  char* response = send_control_msg(sender, request, request_len, response_len, TRUE);
+  free(request);
+
+  struct control_msghdr* cmh = (struct control_msghdr*) response;
+  if (ntohs(cmh->msg_type) == ROOM_REDIRECT
+      && follow_room_redirect(sender, response, *response_len) == 0)
+  {
+    free(response);
+    // registering there gave us a new member id
+    request = prepare_request_with_data(msg_type, sender->cli_core->member_id, &request_len,
+        room_name, room_name_len);
+    response = send_control_msg(sender, request, request_len, response_len, TRUE);
+    free(request);
+  }
+  return response;
+}
+
 /* Send a request to switch to a specified rooms in the chatserver. Return the
  * chatserver's response. */
-char* send_switch_room_request(struct client_to_server_sender* sender, u_int16_t member_id, char* room_name)
+char* send_switch_room_request(struct client_to_server_sender* sender, u_int32_t member_id, char* room_name)
 {
+  u_int16_t response_len;
+  char* response = send_room_request(sender, SWITCH_ROOM_REQUEST, member_id, room_name,
+      &response_len);
+
+  struct control_msghdr* cmh = (struct control_msghdr*) response;
+  if (ntohs(cmh->msg_type) == SWITCH_ROOM_SUCC)
+  {
+    strncpy(sender->cli_core->curr_room, room_name, MAX_ROOM_NAME_LEN);
+    // the server ended our subscription, if we had one
+    forget_followed_room(sender, room_name);
+    if (sender->server_caps & CAP_MCAST)
+    {
+      pass_on_mcast_group(sender, response, response_len);
+    }
+  }
+
+  char * msg = process_response (response, response_len, room_name);
+  free(response);
+  return msg;
+}
+
+/* Send a request to follow a room besides the one we are in (see
+ * defs_ext.h). Return the chatserver's response. */
+char* send_subscribe_request(struct client_to_server_sender* sender, u_int32_t member_id, char* room_name)
+{
+  struct client_core* cli_core = sender->cli_core;
   u_int16_t request_len;
   u_int16_t room_name_len = strnlen(room_name, MAX_ROOM_NAME_LEN);
 
-  char* request = prepare_request_with_data(SWITCH_ROOM_REQUEST, member_id, &request_len, room_name, room_name_len);
+  char* request = prepare_request_with_data(SUBSCRIBE_REQUEST, member_id, &request_len, room_name, room_name_len);
 
   u_int16_t response_len;
   char* response = send_control_msg(sender, request, request_len, &response_len, TRUE);
 
+  // the room id names the room in the messages we send it and get from it
   struct control_msghdr* cmh = (struct control_msghdr*) response;
-  if (ntohs(cmh->msg_type) == SWITCH_ROOM_SUCC)
+  if (ntohs(cmh->msg_type) == SUBSCRIBE_SUCC
+      && response_len >= sizeof(struct control_msghdr) + sizeof(u_int16_t)
+      && cli_core->num_followed < CLIENT_MAX_FOLLOWED)
   {
-    strncpy(sender->cli_core->curr_room, room_name, MAX_ROOM_NAME_LEN);
+    struct room_follow* follow = &cli_core->followed[cli_core->num_followed++];
+
+    bzero(follow, sizeof(*follow));
+    follow->room_id = ntohs(*(u_int16_t*)(cmh->msgdata));
+    follow->following = 1;
+    strncpy(follow->room_name, room_name, MAX_ROOM_NAME_LEN - 1);
+    receiver_room_follow(cli_core->receiver_manager, follow);
   }
 
   char * msg = process_response (response, response_len, room_name);
@@ -340,14 +673,83 @@ char* send_switch_room_request(struct client_to_server_sender* sender, u_int16_t
   return msg;
 }
 
+/* Send a request to stop following a room. Return the chatserver's response. */
+char* send_unsubscribe_request(struct client_to_server_sender* sender, u_int32_t member_id, char* room_name)
+{
+  u_int16_t request_len;
+  u_int16_t room_name_len = strnlen(room_name, MAX_ROOM_NAME_LEN);
+
+  char* request = prepare_request_with_data(UNSUBSCRIBE_REQUEST, member_id, &request_len, room_name, room_name_len);
+
+  u_int16_t response_len;
+  char* response = send_control_msg(sender, request, request_len, &response_len, TRUE);
+
+  // gone on our side either way
+  forget_followed_room(sender, room_name);
+
+  char * msg = process_response (response, response_len, "\0");
+  free(request);
+  free(response);
+  return msg;
+}
+
 /* Send a request to create a specified rooms in the chatserver. Return the
  * chatserver's response. */
-char* send_create_room_request(struct client_to_server_sender* sender, u_int16_t member_id, char* room_name)
+char* send_create_room_request(struct client_to_server_sender* sender, u_int32_t member_id, char* room_name)
+{
+  u_int16_t response_len;
+  char* response = send_room_request(sender, CREATE_ROOM_REQUEST, member_id, room_name,
+      &response_len);
+
+  char * msg = process_response (response, response_len, "\0");
+  free(response);
+  return msg;
+}
+
+/* Send a request to search the recent messages of the current room for the
+ * given words. Return the chatserver's response. */
+char* send_search_request(struct client_to_server_sender* sender, u_int32_t member_id, char* words)
 {
   u_int16_t request_len;
-  u_int16_t room_name_len = strnlen(room_name, MAX_ROOM_NAME_LEN);
+  u_int16_t words_len = strnlen(words, MAX_MSG_LEN - sizeof(struct control_msghdr));
+
+  char* request = prepare_request_with_data(SEARCH_REQUEST, member_id, &request_len, words, words_len);
+
+  u_int16_t response_len;
+  char* response = send_control_msg(sender, request, request_len, &response_len, TRUE);
+
+  char * msg = process_response (response, response_len, "\0");
+  free(request);
+  free(response);
+  return msg;
+}
+
+/* Send a request to set the content filter of the current room to the
+ * given patterns, none to remove it. Return the chatserver's response. */
+char* send_filter_request(struct client_to_server_sender* sender, u_int32_t member_id, char* patterns)
+{
+  u_int16_t request_len;
+  u_int16_t patterns_len = strnlen(patterns, MAX_MSG_LEN - sizeof(struct control_msghdr));
+
+  char* request = prepare_request_with_data(FILTER_REQUEST, member_id, &request_len, patterns, patterns_len);
+
+  u_int16_t response_len;
+  char* response = send_control_msg(sender, request, request_len, &response_len, TRUE);
 
-  char* request = prepare_request_with_data(CREATE_ROOM_REQUEST, member_id, &request_len, room_name, room_name_len);
+  char * msg = process_response (response, response_len, "\0");
+  free(request);
+  free(response);
+  return msg;
+}
+
+/* Send a request to move a room to another node of the cluster; args is
+ * "<room name> <node name>". Return the chatserver's response. */
+char* send_move_room_request(struct client_to_server_sender* sender, u_int32_t member_id, char* args)
+{
+  u_int16_t request_len;
+  u_int16_t args_len = strnlen(args, MAX_MSG_LEN - sizeof(struct control_msghdr));
+
+  char* request = prepare_request_with_data(MOVE_ROOM_REQUEST, member_id, &request_len, args, args_len);
 
   u_int16_t response_len;
   char* response = send_control_msg(sender, request, request_len, &response_len, TRUE);
@@ -359,7 +761,7 @@ char* send_create_room_request(struct client_to_server_sender* sender, u_int16_t
 }
 
 /* Send a request to the chatserver that the client is quitting.*/
-void send_quit_request(struct client_to_server_sender* sender, u_int16_t member_id)
+void send_quit_request(struct client_to_server_sender* sender, u_int32_t member_id)
 {
   u_int16_t request_len;
   char* request = prepare_request_with_no_data(QUIT_REQUEST, member_id, &request_len);
@@ -372,8 +774,8 @@ void send_quit_request(struct client_to_server_sender* sender, u_int16_t member_
 }
 
 /* Send a heart beat message from the client to the chatserver. Handle the
- * response accordingly. */
-void send_heart_beat(struct client_to_server_sender* sender, u_int16_t member_id)
+ * response accordingly: a server with a hot standby names it. */
+void send_heart_beat(struct client_to_server_sender* sender, u_int32_t member_id)
 {
   u_int16_t request_len;
   char* request = prepare_request_with_no_data(MEMBER_KEEP_ALIVE, member_id, &request_len);
@@ -381,6 +783,22 @@ void send_heart_beat(struct client_to_server_sender* sender, u_int16_t member_id
   u_int16_t response_len;
   char* response = send_control_msg(sender, request, request_len, &response_len, TRUE);
 
+  struct control_msghdr* cmh = (struct control_msghdr*) response;
+  struct room_redirect* rd = (struct room_redirect*)(cmh->msgdata);
+
+  bzero(sender->standby.host_name, MAX_HOST_NAME_LEN);
+  if (response_len > sizeof(struct control_msghdr) + sizeof(struct room_redirect)
+      && ntohs(cmh->msg_type) == STANDBY_INFO)
+  {
+    response[response_len - 1] = '\0';
+    if (strlen(rd->host_name) < MAX_HOST_NAME_LEN)
+    {
+      strcpy(sender->standby.host_name, rd->host_name);
+      sender->standby.tcp_port = ntohs(rd->tcp_port);
+      sender->standby.udp_port = ntohs(rd->udp_port);
+    }
+  }
+
   free(response);
   free(request);
 }
@@ -402,6 +820,12 @@ struct client_to_server_sender* create_client_to_server_sender(char* server_host
   if(ctrl_sender == NULL)
     return NULL;
 
+  ctrl_sender->server_caps = 0;
+  ctrl_sender->chat_seq = 0;
+  ctrl_sender->direct_seq = 0;
+  ctrl_sender->bulk_seq = 0;
+  ctrl_sender->session_key = 0;
+  bzero(&ctrl_sender->standby, sizeof(ctrl_sender->standby));
   ctrl_sender->chatserver_manager = create_chatserver_manager(server_host_name,
       server_tcp_port, server_udp_port);
 
@@ -426,7 +850,15 @@ void destroy_client_to_server_sender(struct client_to_server_sender* sender)
 
 
 /* Given the ctos sender and the chat message to be sent, send the chat message */
-void send_chat_msg (struct client_to_server_sender* sender, char* cmsg, u_int16_t member_id)
+void send_chat_msg (struct client_to_server_sender* sender, char* cmsg, u_int32_t member_id)
+{
+  send_chat_msg_to_room(sender, cmsg, member_id, 0);
+}
+
+/* Send a chat message to the room with id room_id, one we follow (see
+ * defs_ext.h), or to the room we are in if room_id is 0. */
+void send_chat_msg_to_room (struct client_to_server_sender* sender, char* cmsg,
+    u_int32_t member_id, u_int16_t room_id)
 {
   uint8_t* msg = (uint8_t*) malloc(MAX_MSG_LEN);
   if (msg == NULL)
@@ -439,12 +871,42 @@ void send_chat_msg (struct client_to_server_sender* sender, char* cmsg, u_int16_
    * the msg_t header. therefore, just set up the chat_msghdr */
   bzero(msg, MAX_MSG_LEN);
   struct chat_msghdr* cmh = (struct chat_msghdr*) (msg);
-  u_int16_t cmsg_len = strnlen(cmsg, MAX_MSG_LEN - sizeof(struct chat_msghdr));
-  u_int16_t msg_len = sizeof(struct chat_msghdr) + cmsg_len;
+  char* text = (char*)(cmh->msgdata);
+  u_int16_t len_flags = 0;
+
+  // With the extended header, number our messages so receivers can count
+  // what got lost on the way. The server fills in the other fields.
+  if (sender->server_caps & CAP_EXT_HDR)
+  {
+    struct chat_ext_hdr* ext = (struct chat_ext_hdr*)(cmh->msgdata);
+    ext->sender_seq = htonl(++sender->chat_seq);
+    ext->room_id = htons(room_id);
+    text = (char*)(ext->msgdata);
+    len_flags = CHAT_EXT_FLAG;
+  }
+
+  u_int16_t cmsg_len = strnlen(cmsg, MAX_MSG_LEN - (text - (char*)msg));
+  int zip_len = -1;
+
+  // Compressed only if that makes it shorter, which short texts may not be
+  if (sender->server_caps & CAP_COMPRESS)
+  {
+    zip_len = msgzip_compress(cmsg, cmsg_len, text, MAX_MSG_LEN - (text - (char*)msg));
+  }
+  if (zip_len > 0)
+  {
+    cmsg_len = zip_len;
+    len_flags |= CHAT_ZIP_FLAG;
+  }
+  else
+  {
+    memcpy(text, cmsg, cmsg_len);
+  }
+  u_int16_t msg_len = (text - (char*)msg) + cmsg_len;
 
-  memcpy(cmh->msgdata, cmsg, cmsg_len);
-  cmh->sender.member_id = htons(member_id);
-  cmh->msg_len = htons(cmsg_len);
+  cmh->sender.member_id = htons(member_id & 0xffff);
+  ((struct chat_sender_v2*) &cmh->sender)->member_id_hi = htons(member_id >> 16);
+  cmh->msg_len = htons(len_flags | cmsg_len);
 
   int nerror;
   struct chatserver_manager* chatserver_manager = sender->chatserver_manager;
@@ -457,3 +919,88 @@ void send_chat_msg (struct client_to_server_sender* sender, char* cmsg, u_int16_
 
   free(msg);
 }
+
+/* Send a direct message to the member named by to, a name or "#<id>", asking
+ * for an ack (see defs_ext.h). The receiver shows the ack when it comes. */
+void send_direct_msg (struct client_to_server_sender* sender, char* to, char* cmsg,
+    u_int32_t member_id)
+{
+  char msg[MAX_MSG_LEN];
+  struct chat_msghdr* cmh = (struct chat_msghdr*) msg;
+  struct chat_direct* dm = (struct chat_direct*)(cmh->msgdata);
+  char* text = (char*)(dm->msgdata);
+  char note[MAX_MEMBER_NAME_LEN + 48];
+
+  bzero(msg, sizeof(struct chat_msghdr) + sizeof(struct chat_direct));
+  if (to[0] == '#')
+  {
+    dm->member_id = htonl(strtoul(to + 1, NULL, 10));
+  }
+  else
+  {
+    strncpy(dm->member_name, to, MAX_MEMBER_NAME_LEN - 1);
+  }
+  dm->flags = htons(DIRECT_ACK_REQ);
+  dm->seq = htons(++sender->direct_seq);
+
+  // the text goes as typed, without its newline
+  u_int16_t cmsg_len = strcspn(cmsg, "\n");
+  if (cmsg_len > MAX_MSG_LEN - (text - msg))
+  {
+    cmsg_len = MAX_MSG_LEN - (text - msg);
+  }
+  memcpy(text, cmsg, cmsg_len);
+
+  cmh->sender.member_id = htons(member_id & 0xffff);
+  ((struct chat_sender_v2*) &cmh->sender)->member_id_hi = htons(member_id >> 16);
+  cmh->msg_len = htons(CHAT_DIRECT_FLAG | cmsg_len);
+
+  int nerror;
+  struct chatserver_manager* chatserver_manager = sender->chatserver_manager;
+  struct udp_connection* udp_con = create_udp_connection(chatserver_manager->host_name,
+      chatserver_manager->udp_port, &nerror);
+  send_udp_request(udp_con, msg, (text - msg) + cmsg_len, &nerror);
+  close_udp_connection(udp_con);
+
+  snprintf(note, sizeof(note), "Direct message %hu sent to %s", sender->direct_seq, to);
+  receiver_printf(sender->cli_core->receiver_manager, note);
+}
+
+/* Send len bytes of data, at most BULK_MAX_LEN, to our room as a bulk
+ * transfer named name (see defs_ext.h): BULK_CHUNK_LEN bytes at a time,
+ * BULK_PACE_US apart. */
+void send_bulk (struct client_to_server_sender* sender, char* name, char* data, int len,
+    u_int32_t member_id)
+{
+  char msg[sizeof(struct chat_msghdr) + sizeof(struct bulk_chunk) + BULK_CHUNK_LEN];
+  struct chat_msghdr* cmh = (struct chat_msghdr*) msg;
+  struct bulk_chunk* bc = (struct bulk_chunk*)(cmh->msgdata);
+  char* chunk = (char*)(bc->msgdata);
+  int offset, chunk_len;
+
+  bzero(msg, chunk - msg);
+  cmh->sender.member_id = htons(member_id & 0xffff);
+  ((struct chat_sender_v2*) &cmh->sender)->member_id_hi = htons(member_id >> 16);
+  bc->transfer_id = htonl(++sender->bulk_seq);
+  bc->total_len = htonl(len);
+  strncpy(bc->name, name, BULK_NAME_LEN - 1);
+
+  int nerror;
+  struct chatserver_manager* chatserver_manager = sender->chatserver_manager;
+  struct udp_connection* udp_con = create_udp_connection(chatserver_manager->host_name,
+      chatserver_manager->udp_port, &nerror);
+
+  for (offset = 0; offset < len; offset += chunk_len)
+  {
+    if (offset != 0)
+    {
+      usleep(BULK_PACE_US);
+    }
+    chunk_len = (len - offset < BULK_CHUNK_LEN) ? len - offset : BULK_CHUNK_LEN;
+    cmh->msg_len = htons(CHAT_BULK_FLAGS | chunk_len);
+    bc->offset = htonl(offset);
+    memcpy(chunk, data + offset, chunk_len);
+    send_udp_request(udp_con, msg, (chunk - msg) + chunk_len, &nerror);
+  }
+  close_udp_connection(udp_con);
+}
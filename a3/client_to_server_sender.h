@@ -6,11 +6,21 @@
 #include <stdio.h>
 
 #include "defs.h"
+#include "defs_ext.h"
+#include "msgzip.h"
 #include "client_core.h"
 #include "tcp_connection.h"
 #include "udp_connection.h"
 #include "chatserver_manager.h"
 
+/* protocol extensions the client asks for at registration, see defs_ext.h */
+#define CLIENT_CAPS (CAP_EXT_HDR | CAP_COMPRESS | CAP_BUNDLE | CAP_MCAST | CAP_CLUSTER \
+    | CAP_STANDBY | CAP_WIDE_ID | CAP_SESSION | CAP_COMPACT | CAP_DIRECT | CAP_SUBSCRIBE | CAP_DIRECTORY \
+    | CAP_BULK)
+
+/* gap between the chunks of a bulk transfer, so they do not come in a burst */
+#define BULK_PACE_US 2000
+
 /*
  * This struct is used to send and receive all control requests and for
  * attempts to restore connection if current connection is not alive
@@ -19,6 +29,19 @@ struct client_to_server_sender {
   pthread_mutex_t sender_lock;
   struct client_core* cli_core;
   struct chatserver_manager* chatserver_manager;
+
+  /* protocol extensions the server accepted at registration (defs_ext.h) */
+  u_int16_t server_caps;
+  /* sequence number of the last chat message sent */
+  u_int32_t chat_seq;
+  /* number of the last direct message sent, for telling the acks apart */
+  u_int16_t direct_seq;
+  /* id of the last bulk transfer sent */
+  u_int32_t bulk_seq;
+  /* the server's hot standby, host name empty if it has none (STANDBY_INFO) */
+  struct chatserver_manager standby;
+  /* key to resume our session with when registering again, 0 if none */
+  u_int32_t session_key;
 };
 
 struct client_to_server_sender* create_client_to_server_sender(char* server_host_name,
@@ -27,15 +50,29 @@ void destroy_client_to_server_sender(struct client_to_server_sender* sender);
 
 char* process_response (char* resp, u_int16_t resp_len, char* extra);
 char* send_register_request(struct client_to_server_sender* sender,
-    char* member_name, u_int16_t udp_port, u_int16_t* member_id);
+    char* member_name, u_int16_t udp_port, u_int32_t* member_id);
 
-char* send_room_list_request(struct client_to_server_sender* sender, u_int16_t member_id);
-char* send_member_list_request(struct client_to_server_sender* sender, u_int16_t member_id, char* room_name);
-char* send_switch_room_request(struct client_to_server_sender* sender, u_int16_t member_id, char* room_name);
-char* send_create_room_request(struct client_to_server_sender* sender, u_int16_t member_id, char* room_name);
-void send_quit_request(struct client_to_server_sender* sender, u_int16_t member_id);
-void send_heart_beat(struct client_to_server_sender* sender, u_int16_t member_id);
+char* send_room_list_request(struct client_to_server_sender* sender, u_int32_t member_id);
+char* send_directory_request(struct client_to_server_sender* sender, u_int32_t member_id,
+    u_int16_t what, u_int16_t order, char* prefix, char* room_name, u_int32_t* cursor);
+char* send_member_list_request(struct client_to_server_sender* sender, u_int32_t member_id, char* room_name);
+char* send_switch_room_request(struct client_to_server_sender* sender, u_int32_t member_id, char* room_name);
+char* send_create_room_request(struct client_to_server_sender* sender, u_int32_t member_id, char* room_name);
+char* send_search_request(struct client_to_server_sender* sender, u_int32_t member_id, char* words);
+char* send_filter_request(struct client_to_server_sender* sender, u_int32_t member_id, char* patterns);
+char* send_move_room_request(struct client_to_server_sender* sender, u_int32_t member_id, char* args);
+char* send_subscribe_request(struct client_to_server_sender* sender, u_int32_t member_id, char* room_name);
+char* send_unsubscribe_request(struct client_to_server_sender* sender, u_int32_t member_id, char* room_name);
+void forget_followed_room(struct client_to_server_sender* sender, char* room_name);
+void send_quit_request(struct client_to_server_sender* sender, u_int32_t member_id);
+void send_heart_beat(struct client_to_server_sender* sender, u_int32_t member_id);
 
-void send_chat_msg (struct client_to_server_sender* sender, char* cmsg, u_int16_t member_id);
+void send_chat_msg (struct client_to_server_sender* sender, char* cmsg, u_int32_t member_id);
+void send_chat_msg_to_room (struct client_to_server_sender* sender, char* cmsg,
+    u_int32_t member_id, u_int16_t room_id);
+void send_direct_msg (struct client_to_server_sender* sender, char* to, char* cmsg,
+    u_int32_t member_id);
+void send_bulk (struct client_to_server_sender* sender, char* name, char* data, int len,
+    u_int32_t member_id);
 
 #endif
@@ -0,0 +1,452 @@
+/*
+ *      File:      defs_ext.h
+ *
+ * Protocol extensions shared by the chatserver and the chat client.
+ * defs.h is the assignment's frozen protocol definition, so everything
+ * added on top of it lives here. Every extension is negotiated: a peer
+ * that never asks for it sees exactly the protocol in defs.h.
+ *
+ * Negotiation: the client sets capability bits in the "reserved" field
+ * of its REGISTER_REQUEST header (network byte order). The server
+ * answers with the subset it accepted in the "reserved" field of
+ * REGISTER_SUCC. Only accepted capabilities may be used.
+ *
+ * Protocol v2 is a client asking for at least PROTO_V2_CAPS, see below.
+ */
+
+#ifndef _DEFS_EXT_H
+#define _DEFS_EXT_H
+
+#include <sys/types.h>
+
+#include "defs.h"
+
+/* capability bits */
+#define CAP_EXT_HDR         0x0001  /* chat_ext_hdr on chat messages */
+#define CAP_COMPRESS        0x0002  /* chat text may be compressed */
+#define CAP_BUNDLE          0x0004  /* chat messages may come in bundles */
+#define CAP_MCAST           0x0008  /* room messages may come by multicast */
+#define CAP_CLUSTER         0x0010  /* rooms may be redirected to other servers */
+#define CAP_STANDBY         0x0020  /* the server names its hot standby */
+#define CAP_RELAY           0x0040  /* the member is a relay, see below */
+#define CAP_WIDE_ID         0x0080  /* 32 bit member ids, see below */
+#define CAP_SESSION         0x0100  /* registration may resume a session */
+#define CAP_COMPACT         0x0200  /* chat messages may come compact, see below */
+#define CAP_DIRECT          0x0400  /* direct messages between members, see below */
+#define CAP_SUBSCRIBE       0x0800  /* rooms may be followed besides the current one */
+#define CAP_DIRECTORY       0x1000  /* rooms and members listed a page at a time */
+#define CAP_BULK            0x2000  /* large payloads sent in chunks, see below */
+
+/*
+ * Protocol v2 - 32 bit member ids and sessions, on top of the extended
+ * header and compression. A member that negotiated CAP_WIDE_ID gets an
+ * id of 0x10000 or more; everyone else keeps a 16 bit one. The low half
+ * of the id goes where defs.h puts the id, the high half:
+ *   - in "reserved" of control requests and replies, except in
+ *     REGISTER_REQUEST and REGISTER_SUCC, where it holds the capabilities;
+ *   - in chat messages, in the two bytes after sender.member_id, see
+ *     chat_sender_v2.
+ * The server never hands out a wide id whose low half is the id of a v1
+ * member, so whatever a v1 client leaves in those places is harmless.
+ *
+ * REGISTER_SUCC to a member that negotiated CAP_WIDE_ID or CAP_SESSION
+ * carries a register_v2 with its whole id, and the key of its session.
+ * A REGISTER_REQUEST with CAP_SESSION may carry a session_resume after
+ * the member name and its '\0': if the server still has that member and
+ * the key matches, the member keeps its id, name and room, and only its
+ * chat address changes. Otherwise it registers anew. A session lasts as
+ * long as the member does on the server, until it quits or is swept.
+ */
+#define PROTO_V2_CAPS       (CAP_EXT_HDR | CAP_COMPRESS | CAP_WIDE_ID | CAP_SESSION)
+
+#define V2_MIN_MEMBER_ID    0x10000
+
+struct chat_sender_v2 {
+    u_int16_t member_id;    /* low half */
+    u_int16_t member_id_hi;
+    char unused[MAX_MEMBER_NAME_LEN - 2 * sizeof(u_int16_t)];
+} __attribute__ ((packed));
+
+struct register_v2 {
+    u_int32_t member_id;
+    u_int32_t session_key;
+} __attribute__ ((packed));
+
+struct session_resume {
+    u_int32_t member_id;
+    u_int32_t session_key;
+} __attribute__ ((packed));
+
+/*
+ * Flag bits carried in the top bits of chat_msghdr.msg_len. The text
+ * is shorter than MAX_MSG_LEN, so it always fits in the low bits.
+ */
+#define CHAT_EXT_FLAG       0x8000  /* a chat_ext_hdr follows the header */
+#define CHAT_NACK_FLAG      0x4000  /* datagram is a NACK, see chat_nack */
+#define CHAT_ZIP_FLAG       0x2000  /* text is compressed, see msgzip.h */
+#define CHAT_BUNDLE_FLAG    0x1000  /* datagram is a bundle, see below */
+#define CHAT_DIRECT_FLAG    0x0800  /* datagram is a direct message, see below */
+#define CHAT_LEN_MASK       0x07ff
+
+/*
+ * Extended chat header - 20 bytes, all fields in network byte order.
+ * When CHAT_EXT_FLAG is set it sits between the chat_msghdr and the
+ * message text. A sender fills in sender_seq (1, 2, 3, ... for each
+ * message it sends) and leaves the rest zero, but for room_id when it
+ * writes to a room it follows (see Subscriptions below); the server
+ * fills in the rest before distributing the message.
+ */
+struct chat_ext_hdr {
+    u_int32_t sender_seq;   /* per sender, 0 if the sender did not say */
+    u_int32_t room_seq;     /* per room, counts messages the server sent */
+    u_int16_t room_id;
+    u_int16_t flags;
+    u_int64_t server_ts;    /* server ingress time, ns since the epoch */
+    caddr_t   msgdata[0];
+} __attribute__ ((packed));
+
+/* chat_ext_hdr flags */
+#define CHAT_FLAG_RELIABLE  0x0001  /* reliable room: NACK gaps in room_seq */
+#define CHAT_FLAG_RETRANS   0x0002  /* retransmitted in answer to a NACK */
+#define CHAT_FLAG_HISTORY   0x0004  /* room history, sent on joining the room */
+
+/*
+ * NACK - sent by a receiver, from its chat UDP port to the server's chat
+ * UDP port, to ask for messages of a reliable room it did not get. It is
+ * a chat_msghdr with a zero sender and msg_len set to CHAT_NACK_FLAG |
+ * <number of ranges>, followed by a chat_nack. The server identifies the
+ * member by the source address. Fields in network byte order.
+ */
+#define CHAT_MAX_NACK_RANGES 32
+
+struct chat_nack_range {
+    u_int32_t first_seq;
+    u_int32_t count;
+} __attribute__ ((packed));
+
+struct chat_nack {
+    u_int16_t room_id;
+    u_int16_t flags;
+    struct chat_nack_range ranges[0];
+} __attribute__ ((packed));
+
+/* chat_nack flags */
+#define NACK_MCAST_JOINED   0x0001  /* joined the room's group, see below */
+
+/*
+ * Direct message - to one member rather than a room, between members that
+ * both negotiated CAP_DIRECT. It is a chat_msghdr with msg_len set to
+ * CHAT_DIRECT_FLAG | <text length>, followed by a chat_direct and the
+ * text, plain and without a chat_ext_hdr. Fields in network byte order.
+ *   - From a member, the sender is its id as in a chat message, and the
+ *     chat_direct names the recipient: by id, or by name with a zero id.
+ *     With DIRECT_ACK_REQ the sender asks to hear that it arrived; seq is
+ *     for it to tell its messages apart.
+ *   - To the recipient, the sender is the name of the member that wrote
+ *     it, member_id its id (to answer to) and member_name the name of the
+ *     recipient itself.
+ *   - A recipient asked for an ack sends back the chat_direct it got with
+ *     DIRECT_ACK set, a zero sender and no text, from the port the message
+ *     came to. The server passes it on to member_id with the recipient's
+ *     name as the sender.
+ *   - A message the server has no one to give to comes back to a sender
+ *     that asked for an ack with DIRECT_ACK | DIRECT_UNREACHABLE, a zero
+ *     sender, and the chat_direct as it named the recipient.
+ * Direct messages go out at once, to the one member, whatever room either
+ * is in. With the message store on, the ones sent on are kept in it too,
+ * with their sender and recipient (see msgstore.h).
+ */
+struct chat_direct {
+    u_int32_t member_id;
+    u_int16_t flags;
+    u_int16_t seq;
+    char member_name[MAX_MEMBER_NAME_LEN];
+    caddr_t   msgdata[0];
+} __attribute__ ((packed));
+
+/* chat_direct flags */
+#define DIRECT_ACK_REQ      0x0001  /* the sender wants an ack */
+#define DIRECT_ACK          0x0002  /* this is the ack */
+#define DIRECT_UNREACHABLE  0x0004  /* ack: no such member, or it cannot get it */
+
+/*
+ * Bulk transfer - a payload too large for a chat message (a file, a long
+ * paste) sent to the room in chunks, between members that negotiated
+ * CAP_BULK. A chunk is a chat_msghdr with msg_len set to CHAT_BULK_FLAGS |
+ * <chunk length>, followed by a bulk_chunk and the bytes, without a
+ * chat_ext_hdr. No msg_len bit is left for it: a direct message is never
+ * a bundle, so the two flags together mark a chunk. The payload is cut
+ * into chunks of BULK_CHUNK_LEN bytes, the last one shorter, and is at
+ * most BULK_MAX_LEN bytes. Fields in network byte order.
+ *   - From a member, the sender is its id as in a chat message, and
+ *     transfer_id tells its transfers apart. It paces its chunks rather
+ *     than sending them all at once.
+ *   - To the other members of its room that negotiated CAP_BULK, the
+ *     sender is the name of the member that sent it.
+ * The server sends chunks on only while no chat message is waiting, and
+ * drops them rather than hold more than a set amount per room (see
+ * server_bulk.h), so a receiver puts a payload together from whatever
+ * chunks come, by offset, and gives up on one whose chunks stop coming.
+ */
+#define CHAT_BULK_FLAGS     (CHAT_DIRECT_FLAG | CHAT_BUNDLE_FLAG)
+
+#define BULK_CHUNK_LEN      1024
+#define BULK_MAX_LEN        (64 * 1024)
+#define BULK_NAME_LEN       32
+
+struct bulk_chunk {
+    u_int32_t transfer_id;
+    u_int32_t total_len;    /* of the whole payload */
+    u_int32_t offset;       /* of this chunk in it, a multiple of BULK_CHUNK_LEN */
+    char name[BULK_NAME_LEN];   /* what it is, e.g. a file name, '\0' terminated */
+    caddr_t   msgdata[0];
+} __attribute__ ((packed));
+
+/*
+ * Bundle - several chat messages to one member in a single datagram, sent
+ * by the server to members that negotiated CAP_BUNDLE. It is a chat_msghdr
+ * with a zero sender and msg_len set to CHAT_BUNDLE_FLAG | <number of
+ * messages>, followed by the messages, each a 2 byte length in network
+ * byte order and the message as it would have been sent on its own.
+ */
+
+/*
+ * Compact header - to a member that negotiated CAP_COMPACT, the server
+ * sends the chat messages of its room with this in place of the 26 byte
+ * chat_msghdr:
+ *   CHAT_COMPACT_MARK, which no chat_msghdr the server sends starts with
+ *   one byte of CHAT_COMPACT_* flags
+ *   the sender's slot, a varint: 7 bits a byte, low bits first, the top
+ *     bit set on all bytes but the last
+ *   with CHAT_COMPACT_NAME, the sender's name, '\0' terminated
+ *   with CHAT_COMPACT_EXT, the chat_ext_hdr
+ *   the text, to the end of the datagram, compressed with CHAT_COMPACT_ZIP
+ * A slot is the number the server gives a member in a room, the lowest
+ * one free when it joins. Receivers learn the names behind the slots from
+ * announcements: a datagram with the mark and CHAT_COMPACT_NAMES, then
+ * pairs of slot and '\0' terminated name to the end. A member joining a
+ * room gets all of its names, the first datagram with CHAT_COMPACT_RESET
+ * to forget the names of the room it left; the others get its name. In
+ * case an announcement was lost, each member's first message after
+ * someone joined carries its name too.
+ *
+ * Multicast copies, retransmissions, room history and messages a relay
+ * passes on under its own members' names keep the chat_msghdr.
+ */
+#define CHAT_COMPACT_MARK   0xff
+
+#define CHAT_COMPACT_EXT    0x01    /* a chat_ext_hdr follows */
+#define CHAT_COMPACT_ZIP    0x02    /* text is compressed, see msgzip.h */
+#define CHAT_COMPACT_NAME   0x04    /* the sender's name follows its slot */
+#define CHAT_COMPACT_NAMES  0x08    /* a name announcement */
+#define CHAT_COMPACT_RESET  0x10    /* announcement: forget earlier names */
+
+/* longest varint of a 32 bit value */
+#define VARINT_MAX_LEN      5
+
+/*
+ * Multicast - a server that has multicast set up gives every room a group.
+ * To a member that negotiated CAP_MCAST (and CAP_EXT_HDR), SWITCH_ROOM_SUCC
+ * carries an mcast_group naming the group of the room, fields in network
+ * byte order. The member joins the group and says so with a NACK of no
+ * ranges with NACK_MCAST_JOINED set. From then on the server sends it the
+ * room's messages through the group, one datagram for all such members,
+ * with the extended header and uncompressed. Until the report arrives, or
+ * if it never does, the member gets them by unicast as before. Any later
+ * SWITCH_ROOM_SUCC ends the membership: a member leaves the old group
+ * before joining the new one, if any.
+ */
+struct mcast_group {
+    u_int32_t group;        /* the group address */
+    u_int16_t port;
+    u_int16_t room_id;
+    u_int32_t source;       /* interface the server sends from, 0 if any */
+} __attribute__ ((packed));
+
+/*
+ * Relay - a chatrelay joins each room its own members are in as one member
+ * that negotiated CAP_RELAY, and passes the room's messages on to them.
+ * When it passes on a message of one of its members, it puts the member's
+ * id upstream in sender.member_id as usual and the name of the member that
+ * wrote it, '\0' terminated, in the rest of the sender field (bytes 2 to
+ * 23). The server sends the message under that name, unless it is empty
+ * or the name of another member of the server. A relay is therefore
+ * never given CAP_WIDE_ID.
+ */
+#define RELAY_NAME_OFFSET   sizeof(u_int16_t)
+#define RELAY_NAME_LEN      (MAX_MEMBER_NAME_LEN - RELAY_NAME_OFFSET)
+
+/*
+ * Additional control message types. Numbered so that, like the ones in
+ * defs.h, the failure reply to a request is request + 2. 18 and 19 are
+ * left out: the server answers an invalid id on MEMBER_KEEP_ALIVE and
+ * QUIT_REQUEST with them.
+ *
+ * SEARCH_REQUEST carries the search words. The server looks them up in
+ * the recent history of the sender's current room and answers
+ * SEARCH_SUCC with the newest matching messages, one per line, or
+ * SEARCH_FAIL with the reason.
+ */
+#define SEARCH_REQUEST      20
+#define SEARCH_SUCC         21
+#define SEARCH_FAIL         22
+
+/*
+ * FILTER_REQUEST sets the content filter of the sender's current room to
+ * the white space separated patterns it carries, or removes the filter
+ * if there are none. A message containing a pattern that starts with '!'
+ * is dropped; other patterns are overwritten with '*' in the message.
+ * Only the member that created the room may do so, and only while it
+ * stays registered: the filters of rooms from the room file, of rooms a
+ * standby or another node took over, and of rooms whose creator left can
+ * no longer be changed.
+ */
+#define FILTER_REQUEST      23
+#define FILTER_SUCC         24
+#define FILTER_FAIL         25
+
+/*
+ * ROOM_REDIRECT answers CREATE_ROOM_REQUEST and SWITCH_ROOM_REQUEST from
+ * a member that negotiated CAP_CLUSTER, when the room lives on another
+ * server of the cluster. It carries a room_redirect naming that server.
+ * The client registers there, and asks again; its member id on the old
+ * server is of no use for the room.
+ */
+#define ROOM_REDIRECT       26
+
+struct room_redirect {
+    u_int16_t tcp_port;     /* network byte order */
+    u_int16_t udp_port;
+    char host_name[0];      /* '\0' terminated */
+} __attribute__ ((packed));
+
+/*
+ * STANDBY_INFO answers MEMBER_KEEP_ALIVE from a member that negotiated
+ * CAP_STANDBY, while the server has a hot standby following it. It carries
+ * a room_redirect naming the standby. Should the server go away, the
+ * client sends its requests to the standby instead, with the member id
+ * it has: the standby knows the member and its room, there is no need to
+ * register again. Without a standby the keep-alive is not answered.
+ */
+#define STANDBY_INFO        27
+
+/*
+ * MOVE_ROOM_REQUEST moves a room to another node of a cluster. It carries
+ * "<room name> <node name>"; the room must live on the server it is sent
+ * to. The server hands the room over with ROOM_TRANSFER requests of its
+ * own, and answers with a text saying how long it took.
+ *
+ * ROOM_TRANSFER, from one node to another, carries a room_transfer:
+ * ROOM_TRANSFER_MEMBERS creates the room with the members listed, each a
+ * member_transfer; ROOM_TRANSFER_SUCC answers with the members' ids on
+ * the new node, four bytes each in the same order. ROOM_TRANSFER_HISTORY
+ * adds kept messages to the room, each a two byte length then the message
+ * with the extended header. All in network byte order.
+ *
+ * MEMBER_MOVED answers any request of a member whose room was moved, if
+ * it negotiated CAP_CLUSTER. The header carries the member's new id, the
+ * high half of a wide one in "reserved", and the data a room_redirect
+ * naming its new server; the client sends the request there again with
+ * the new id. The requests of other members are
+ * passed on by the old server, and so are everyone's chat messages until
+ * they move.
+ */
+#define MOVE_ROOM_REQUEST   28
+#define MOVE_ROOM_SUCC      29
+#define MOVE_ROOM_FAIL      30
+#define ROOM_TRANSFER       31
+#define ROOM_TRANSFER_SUCC  32
+#define ROOM_TRANSFER_FAIL  33
+#define MEMBER_MOVED        34
+
+#define ROOM_TRANSFER_MEMBERS   1
+#define ROOM_TRANSFER_HISTORY   2
+
+struct room_transfer {
+    u_int8_t part;
+    u_int8_t reserved;
+    u_int16_t count;        /* members or messages that follow */
+    u_int32_t room_seq;     /* last sequence number the room handed out */
+    char room_name[MAX_ROOM_NAME_LEN + 72];   /* with options, '\0' terminated */
+    char entries[0];
+} __attribute__ ((packed));
+
+struct member_transfer {
+    u_int32_t member_id;
+    u_int16_t caps;
+    u_int32_t addr;         /* where its chat messages go */
+    u_int16_t port;
+    char member_name[MAX_MEMBER_NAME_LEN];
+} __attribute__ ((packed));
+
+/*
+ * Subscriptions - besides the room it is in, a member that negotiated
+ * CAP_SUBSCRIBE and CAP_EXT_HDR may follow other rooms of the server.
+ * SUBSCRIBE_REQUEST names the room; SUBSCRIBE_SUCC carries its id, two
+ * bytes in network byte order. UNSUBSCRIBE_REQUEST names it again.
+ *
+ * The messages of a followed room come with the extended header, whose
+ * room_id tells them apart from those of the current room, and are never
+ * compact, bundled, retransmitted or sent by multicast. To write to a
+ * followed room, a member puts its id in room_id of the chat_ext_hdr of
+ * its message; with zero there, or the id of the current room, the
+ * message goes to the current room as before, and with the id of a room
+ * it does not follow it is dropped.
+ *
+ * A subscription ends when the member switches into the room, and when
+ * the room goes away or moves to another node of a cluster.
+ */
+#define SUBSCRIBE_REQUEST   35
+#define SUBSCRIBE_SUCC      36
+#define SUBSCRIBE_FAIL      37
+#define UNSUBSCRIBE_REQUEST 38
+#define UNSUBSCRIBE_SUCC    39
+#define UNSUBSCRIBE_FAIL    40
+
+/*
+ * Directory - the rooms of the server, or the members of a room or of the
+ * server, a page at a time, for members that negotiated CAP_DIRECTORY.
+ * DIRECTORY_REQUEST carries a directory_request, DIRECTORY_SUCC a
+ * directory_reply, both in network byte order.
+ *
+ * Only names starting with the prefix are listed. Rooms come in name
+ * order, or by their number of members, most first (DIR_BY_SIZE, "the
+ * most popular rooms"); the members of a room in the order they joined
+ * it, and those of the server in name order. A page holds page_size
+ * entries, or fewer if they would not fit in DIRECTORY_PAGE_BYTES, so the
+ * reply always fits in the client's buffer. Its next_cursor asks for the
+ * page after it; rooms or members coming and going in between may shift
+ * entries across pages.
+ */
+#define DIRECTORY_REQUEST   41
+#define DIRECTORY_SUCC      42
+#define DIRECTORY_FAIL      43
+
+#define DIRECTORY_PAGE_BYTES    512
+
+/* what is listed */
+#define DIR_ROOMS           1
+#define DIR_MEMBERS         2
+
+/* in what order */
+#define DIR_BY_NAME         0
+#define DIR_BY_SIZE         1       /* rooms only */
+
+struct directory_request {
+    u_int16_t what;
+    u_int16_t order;
+    u_int16_t page_size;    /* 0 for as many as fit */
+    u_int16_t reserved;
+    u_int32_t cursor;       /* 0 for the first page */
+    char prefix[MAX_ROOM_NAME_LEN];     /* '\0' terminated, empty for all */
+    char room_name[MAX_ROOM_NAME_LEN];  /* DIR_MEMBERS: empty for the server's */
+} __attribute__ ((packed));
+
+struct directory_reply {
+    u_int32_t next_cursor;  /* 0 if this is the last page */
+    u_int16_t count;        /* entries on this page */
+    u_int16_t total;        /* entries on all pages */
+    char entries[0];        /* "[room (members)] ..." or "(member) ...", '\0' terminated */
+} __attribute__ ((packed));
+
+#endif
@@ -0,0 +1,85 @@
+/*
+ *      File:      msgstore.h
+ *
+ * On-disk format of the chatserver message store (chatserver -m), shared
+ * by the chatserver (writer) and the chatstore tool (reader).
+ *
+ * Every room has a directory <store dir>/<room name> holding segment files
+ * named <NNNNNN>.seg, numbered in the order they were written. A segment
+ * starts with a msgstore_seg_hdr, followed by message records back to
+ * back, each MSGSTORE_REC_ALIGN aligned. The header carries a sparse index
+ * with the offset of every MSGSTORE_INDEX_EVERY'th record, so a reader
+ * can start near a given room sequence number without scanning.
+ *
+ * The segment being written is pre-allocated to MSGSTORE_SEGMENT_SIZE
+ * bytes. Once sealed it is no longer written to, and is cut down to
+ * data_end bytes. Room sequence numbers keep counting across segments and
+ * server restarts. All fields are in host byte order.
+ *
+ * Direct messages (see defs_ext.h) are stored the same way, in the
+ * directory <store dir>/MSGSTORE_DIRECT_DIR, which no room can have as
+ * its name starts with a '.'. Their records carry MSGSTORE_REC_DIRECT,
+ * room_seq numbers the direct messages instead, and the text is preceded
+ * by the recipient's name, MAX_MEMBER_NAME_LEN bytes counted in text_len.
+ */
+
+#ifndef _MSGSTORE_H
+#define _MSGSTORE_H
+
+#include <sys/types.h>
+
+#include "defs.h"
+
+#define MSGSTORE_MAGIC         0x534d4843     /* "CHMS" */
+#define MSGSTORE_VERSION       1
+#define MSGSTORE_SEGMENT_SIZE  (4 << 20)
+#define MSGSTORE_REC_ALIGN     8
+#define MSGSTORE_INDEX_EVERY   64
+#define MSGSTORE_INDEX_SLOTS   2048
+
+/* msgstore_seg_hdr flags */
+#define MSGSTORE_SEALED        0x0001
+
+/* msgstore_rec flags */
+#define MSGSTORE_REC_DIRECT    0x0001
+
+#define MSGSTORE_DIRECT_DIR    ".direct"
+
+struct msgstore_index_ent {
+	u_int32_t room_seq;
+	u_int32_t off;         /* from the start of the segment */
+} __attribute__ ((packed));
+
+struct msgstore_seg_hdr {
+	u_int32_t magic;
+	u_int16_t version;
+	u_int16_t flags;
+	u_int32_t seg_no;
+	u_int32_t count;       /* records in the segment */
+	u_int32_t first_seq;
+	u_int32_t last_seq;
+	u_int64_t first_ns;    /* CLOCK_REALTIME of the first and last record */
+	u_int64_t last_ns;
+	u_int32_t data_end;    /* offset just past the last record */
+	u_int32_t index_count;
+	char room_name[32];
+	struct msgstore_index_ent index[MSGSTORE_INDEX_SLOTS];
+} __attribute__ ((packed));
+
+struct msgstore_rec {
+	u_int32_t rec_len;     /* whole record including padding */
+	u_int32_t room_seq;
+	u_int64_t ts_ns;       /* server ingress time, CLOCK_REALTIME */
+	u_int16_t member_id;   /* low half of a wide one, see defs_ext.h */
+	u_int16_t text_len;
+	char sender[MAX_MEMBER_NAME_LEN];
+	u_int16_t flags;
+	u_int16_t reserved;
+	char text[0];
+} __attribute__ ((packed));
+
+#define MSGSTORE_REC_LEN(text_len) \
+	((sizeof(struct msgstore_rec) + (text_len) + MSGSTORE_REC_ALIGN - 1) \
+	 & ~(MSGSTORE_REC_ALIGN - 1))
+
+#endif
@@ -0,0 +1,213 @@
+/*
+ *      File:      msgzip.c
+ *
+ * Chat text compression, see msgzip.h.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "msgzip.h"
+
+/*
+ * Text that matches may point into. Changing it changes the meaning of
+ * compressed messages, so every program of a session must agree on it.
+ */
+static const char dict[] =
+	"hello hi hey everyone, how are you doing? I'm good thanks, and you? "
+	"yes no maybe okay ok sure lol haha :) :( ;) I think that is "
+	"what do you mean? I don't know, I'm not sure about that. "
+	"can you please send me the link to the file? "
+	"just a moment, I will be right back. brb gtg bye see you later "
+	"tomorrow today tonight morning afternoon evening this week "
+	"the meeting starts at, let's talk about it in the room. "
+	"did you see the message I sent you yesterday? "
+	"thank you very much, that would be great. "
+	"sorry, I was away. are we still on for the call? "
+	"anyone here? who is in the chat right now? "
+	"there they their this that with from have been would could should "
+	"because about which when where there's it's that's what's ";
+
+#define DICT_LEN        (sizeof(dict) - 1)
+
+#define HASH_BITS       11
+#define HASH_SIZE       (1 << HASH_BITS)
+
+/* dictionary followed by the text being compressed */
+static char window[DICT_LEN + MSGZIP_MAX_TEXT];
+
+/* positions of the 4 byte strings of the dictionary, copied per text */
+static u_int16_t dict_table[HASH_SIZE];
+static int dict_ready;
+
+static unsigned int hash4(const char *p) {
+	u_int32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static void dict_init() {
+	int i;
+
+	memcpy(window, dict, DICT_LEN);
+	for(i = 0; i + MSGZIP_MIN_MATCH <= DICT_LEN; i++)
+		dict_table[hash4(window + i)] = i;
+	dict_ready = 1;
+}
+
+/* Write a count beyond 15 as bytes of 255 and a last one below 255. */
+static char *put_count(char *op, int n) {
+	while(n >= 255) {
+		*op++ = (char)255;
+		n -= 255;
+	}
+	*op++ = n;
+	return op;
+}
+
+/* Emit literals from window[anchor..] and, if mlen, a match at off. */
+static char *put_sequence(char *op, char *end, int anchor, int lit,
+			  int off, int mlen) {
+	int ml = mlen ? mlen - MSGZIP_MIN_MATCH : 0;
+
+	if(op + 1 + lit + lit / 255 + 1 + 2 + ml / 255 + 1 > end)
+		return NULL;
+
+	*op++ = ((lit >= 15 ? 15 : lit) << 4) | (ml >= 15 ? 15 : ml);
+	if(lit >= 15)
+		op = put_count(op, lit - 15);
+	memcpy(op, window + anchor, lit);
+	op += lit;
+
+	if(mlen) {
+		*op++ = off >> 8;
+		*op++ = off & 0xff;
+		if(ml >= 15)
+			op = put_count(op, ml - 15);
+	}
+	return op;
+}
+
+int
+msgzip_compress(const char *src, int len, char *dst, int cap) {
+	u_int16_t table[HASH_SIZE];
+	char *op = dst + 2, *end;
+	int ip, anchor, last, ref, mlen;
+	unsigned int h;
+
+	if(len <= 0 || len > MSGZIP_MAX_TEXT)
+		return -1;
+	if(!dict_ready)
+		dict_init();
+
+	/* no use being longer than the text */
+	if(cap > len)
+		cap = len;
+	end = dst + cap;
+	if(cap < 3)
+		return -1;
+	dst[0] = len >> 8;
+	dst[1] = len & 0xff;
+
+	memcpy(window + DICT_LEN, src, len);
+	memcpy(table, dict_table, sizeof(table));
+
+	ip = anchor = DICT_LEN;
+	last = DICT_LEN + len;
+
+	while(ip + MSGZIP_MIN_MATCH <= last) {
+		h = hash4(window + ip);
+		ref = table[h];
+		table[h] = ip;
+
+		if(memcmp(window + ref, window + ip, MSGZIP_MIN_MATCH) != 0) {
+			ip++;
+			continue;
+		}
+
+		mlen = MSGZIP_MIN_MATCH;
+		while(ip + mlen < last && window[ref + mlen] == window[ip + mlen])
+			mlen++;
+
+		if((op = put_sequence(op, end, anchor, ip - anchor, ip - ref, mlen)) == NULL)
+			return -1;
+
+		/* later matches may start inside this one */
+		for(ip++, mlen--; mlen > 0 && ip + MSGZIP_MIN_MATCH <= last; ip++, mlen--)
+			table[hash4(window + ip)] = ip;
+		ip += mlen;
+		anchor = ip;
+	}
+
+	if((op = put_sequence(op, end, anchor, last - anchor, 0, 0)) == NULL)
+		return -1;
+	if(op - dst >= len)
+		return -1;
+	return op - dst;
+}
+
+/* Read a count continued past 15; -1 if the input runs out. */
+static int get_count(const unsigned char **ip, const unsigned char *end, int n) {
+	if(n < 15)
+		return n;
+	do {
+		if(*ip >= end)
+			return -1;
+		n += **ip;
+	} while(*(*ip)++ == 255);
+	return n;
+}
+
+int
+msgzip_decompress(const char *src, int len, char *dst, int cap) {
+	const unsigned char *ip = (const unsigned char *)src + 2;
+	const unsigned char *end = (const unsigned char *)src + len;
+	int raw_len, op = 0, lit, mlen, off, i;
+
+	if(len < 3)
+		return -1;
+	raw_len = ((unsigned char)src[0] << 8) | (unsigned char)src[1];
+	if(raw_len > MSGZIP_MAX_TEXT || raw_len >= cap)
+		return -1;
+
+	for( ; ; ) {
+		if(ip >= end)
+			return -1;
+		lit = *ip >> 4;
+		mlen = *ip++ & 0x0f;
+
+		if((lit = get_count(&ip, end, lit)) < 0
+		   || lit > end - ip || op + lit > raw_len)
+			return -1;
+		memcpy(dst + op, ip, lit);
+		ip += lit;
+		op += lit;
+
+		if(ip == end)
+			break;
+
+		if(end - ip < 2)
+			return -1;
+		off = (ip[0] << 8) | ip[1];
+		ip += 2;
+		if((mlen = get_count(&ip, end, mlen)) < 0)
+			return -1;
+		mlen += MSGZIP_MIN_MATCH;
+		if(off == 0 || off > op + DICT_LEN || op + mlen > raw_len)
+			return -1;
+
+		/* byte by byte: the match may overlap what it produces */
+		for(i = 0; i < mlen; i++, op++) {
+			int from = op - off;
+
+			dst[op] = from < 0 ? dict[DICT_LEN + from] : dst[from];
+		}
+	}
+
+	if(op != raw_len)
+		return -1;
+	dst[op] = '\0';
+	return op;
+}
@@ -0,0 +1,67 @@
+/*
+ *      File:      msgzip.h
+ *
+ * Compression of chat message text, shared by chatserver, chatclient and
+ * receiver. Used on chat messages that carry CHAT_ZIP_FLAG (defs_ext.h),
+ * between members and a server that agreed on CAP_COMPRESS.
+ *
+ * The coder is LZ77 in the manner of LZ4, with matches that may also
+ * point into a dictionary of common chat text built into every program,
+ * so that short messages shrink as well. A compressed text is:
+ *
+ *   raw length                     2 bytes, network order
+ *   sequences, each of
+ *     token                        literal count << 4
+ *                                  | (match length - MSGZIP_MIN_MATCH)
+ *     more literal count           if the count in the token is 15: bytes
+ *                                  added to it, up to one below 255
+ *     literals
+ *     match offset                 2 bytes, network order, back from the
+ *                                  current position into dictionary and
+ *                                  text decoded so far
+ *     more match length            as for the literal count
+ *
+ * The last sequence ends after its literals.
+ */
+
+#ifndef _MSGZIP_H
+#define _MSGZIP_H
+
+#define MSGZIP_MIN_MATCH   4
+
+/* largest text that is compressed, as the length fits in CHAT_LEN_MASK */
+#define MSGZIP_MAX_TEXT    0x07ff
+
+/*
+ *  FUNCTION: msgzip_compress
+ *
+ *  SYNOPSIS: compress a chat text
+ *
+ *  PASS:     src ==> the text
+ *            len ==> its length, at most MSGZIP_MAX_TEXT
+ *            dst ==> filled in with the compressed text
+ *            cap ==> size of dst
+ *
+ *  RETURN:   length of the compressed text, -1 if it would not be shorter
+ *            than the text itself
+ *
+ */
+int msgzip_compress(const char *src, int len, char *dst, int cap);
+
+/*
+ *  FUNCTION: msgzip_decompress
+ *
+ *  SYNOPSIS: decompress a chat text
+ *
+ *  PASS:     src ==> the compressed text, as received
+ *            len ==> its length
+ *            dst ==> filled in with the text, '\0' terminated
+ *            cap ==> size of dst
+ *
+ *  RETURN:   length of the text, -1 if src is not a valid compressed
+ *            text or the text does not fit
+ *
+ */
+int msgzip_decompress(const char *src, int len, char *dst, int cap);
+
+#endif
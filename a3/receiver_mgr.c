@@ -185,6 +185,68 @@ void receiver_printf(struct receiver_manager* receiver_manager, char* message)
   free(data);
 }
 
+/* Use the IPC channel in the receiver_manager to tell the chat receiver to
+ * print its delivery telemetry */
+void receiver_show_stats(struct receiver_manager* receiver_manager)
+{
+  msg_t msg;
+  msg.mtype = RECV_TYPE;
+  msg.body.status = SHOW_STATS;
+  msg.body.value = 0;
+  if (msgsnd(receiver_manager->ctrl2rcvr_qid, &msg, sizeof(struct body_s), 0) < 0)
+  {
+    perror("receiver_show_stats msgsnd");
+  }
+}
+
+/* Use the IPC channel in the receiver_manager to tell the chat receiver to
+ * join the multicast group of the room just joined, or only to leave the
+ * group it is in if group->group is 0 */
+void receiver_mcast_join(struct receiver_manager* receiver_manager,
+    struct mcast_group* group, struct sockaddr_in* server)
+{
+  struct
+  {
+    msg_t hdr;
+    struct mcast_join join;
+  } msg;
+
+  bzero(&msg, sizeof(msg));
+  msg.hdr.mtype = RECV_TYPE;
+  msg.hdr.body.status = MCAST_JOIN;
+  msg.join.group = *group;
+  msg.join.server = *server;
+
+  if (msgsnd(receiver_manager->ctrl2rcvr_qid, &msg,
+        sizeof(msg) - sizeof(long), 0) < 0)
+  {
+    perror("receiver_mcast_join msgsnd");
+  }
+}
+
+/* Use the IPC channel in the receiver_manager to tell the chat receiver that
+ * we follow a room, or no longer do, so it shows the room's messages as such */
+void receiver_room_follow(struct receiver_manager* receiver_manager,
+    struct room_follow* follow)
+{
+  struct
+  {
+    msg_t hdr;
+    struct room_follow follow;
+  } msg;
+
+  bzero(&msg, sizeof(msg));
+  msg.hdr.mtype = RECV_TYPE;
+  msg.hdr.body.status = ROOM_FOLLOW;
+  msg.follow = *follow;
+
+  if (msgsnd(receiver_manager->ctrl2rcvr_qid, &msg,
+        sizeof(msg) - sizeof(long), 0) < 0)
+  {
+    perror("receiver_room_follow msgsnd");
+  }
+}
+
 /* When quitting the chat client, proceed to kill the client receiver as well.*/
 void shutdown_receiver(struct receiver_manager* receiver_manager)
 {
@@ -30,6 +30,11 @@ struct receiver_manager {
 
 struct receiver_manager* create_receiver_manager();
 void receiver_printf(struct receiver_manager* receiver_manager, char* message);
+void receiver_show_stats(struct receiver_manager* receiver_manager);
+void receiver_mcast_join(struct receiver_manager* receiver_manager,
+    struct mcast_group* group, struct sockaddr_in* server);
+void receiver_room_follow(struct receiver_manager* receiver_manager,
+    struct room_follow* follow);
 void destroy_receiver_manager(struct receiver_manager* receiver_manager);
 
 #endif
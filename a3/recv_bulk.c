@@ -0,0 +1,168 @@
+#include "recv_bulk.h"
+
+#include <time.h>
+#include <arpa/inet.h>
+
+static long long now_ms()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Return an empty reassembly, or NULL if out of memory. Whole payloads
+ * will be handed to deliver. */
+struct bulk_reassembly* create_bulk_reassembly(void (*deliver)(char* sender, char* name,
+      char* data, int len))
+{
+  struct bulk_reassembly* br = (struct bulk_reassembly*)malloc(sizeof(struct bulk_reassembly));
+  int i;
+
+  if (br == NULL)
+  {
+    perror("recv_bulk malloc");
+    return NULL;
+  }
+  bzero(br, sizeof(struct bulk_reassembly));
+
+  for (i = 0; i < BULK_MAX_TRANSFERS; i++)
+  {
+    if ((br->transfers[i].data = (char*)malloc(BULK_MAX_LEN + 1)) == NULL)
+    {
+      perror("recv_bulk malloc");
+      destroy_bulk_reassembly(br);
+      return NULL;
+    }
+  }
+  br->deliver = deliver;
+  return br;
+}
+
+void destroy_bulk_reassembly(struct bulk_reassembly* br)
+{
+  int i;
+
+  for (i = 0; i < BULK_MAX_TRANSFERS; i++)
+  {
+    free(br->transfers[i].data);
+  }
+  free(br);
+}
+
+/* The buffer of the transfer a chunk belongs to, a free one if it is the
+ * first chunk we see of it; NULL if all are taken. */
+static struct bulk_transfer* transfer_of(struct bulk_reassembly* br, char* sender,
+    struct bulk_chunk* bc)
+{
+  struct bulk_transfer* free_bt = NULL;
+  struct bulk_transfer* bt;
+  int i;
+
+  for (i = 0; i < BULK_MAX_TRANSFERS; i++)
+  {
+    bt = &br->transfers[i];
+    if (!bt->busy)
+    {
+      if (free_bt == NULL)
+      {
+        free_bt = bt;
+      }
+    }
+    else if (bt->transfer_id == ntohl(bc->transfer_id)
+        && strncmp(bt->sender, sender, MAX_MEMBER_NAME_LEN) == 0)
+    {
+      return bt;
+    }
+  }
+  if (free_bt == NULL)
+  {
+    return NULL;
+  }
+
+  bt = free_bt;
+  bt->busy = 1;
+  strncpy(bt->sender, sender, MAX_MEMBER_NAME_LEN);
+  bt->transfer_id = ntohl(bc->transfer_id);
+  strncpy(bt->name, bc->name, BULK_NAME_LEN);
+  bt->name[BULK_NAME_LEN - 1] = '\0';
+  bt->total_len = ntohl(bc->total_len);
+  bt->got_len = 0;
+  bzero(bt->got, sizeof(bt->got));
+  return bt;
+}
+
+/* Take in a chunk of len bytes, and hand its payload on if it is whole. */
+void bulk_receive(struct bulk_reassembly* br, char* msg, int len)
+{
+  struct chat_msghdr* cmh = (struct chat_msghdr*)msg;
+  struct bulk_chunk* bc = (struct bulk_chunk*)(cmh->msgdata);
+  struct bulk_transfer* bt;
+  int chunk_len = len - (int)(sizeof(struct chat_msghdr) + sizeof(struct bulk_chunk));
+  u_int32_t offset;
+
+  offset = ntohl(bc->offset);
+  if (chunk_len <= 0 || chunk_len > BULK_CHUNK_LEN || offset % BULK_CHUNK_LEN != 0
+      || ntohl(bc->total_len) > BULK_MAX_LEN || offset >= ntohl(bc->total_len)
+      || offset + chunk_len > ntohl(bc->total_len))
+  {
+    return;
+  }
+  cmh->sender.member_name[MAX_MEMBER_NAME_LEN - 1] = '\0';
+
+  if ((bt = transfer_of(br, cmh->sender.member_name, bc)) == NULL)
+  {
+    br->dropped++;
+    return;
+  }
+  if (bt->total_len != ntohl(bc->total_len))
+  {
+    return;
+  }
+
+  bt->last_ms = now_ms();
+  if (bt->got[offset / BULK_CHUNK_LEN])
+  {
+    return;
+  }
+  bt->got[offset / BULK_CHUNK_LEN] = 1;
+  memcpy(bt->data + offset, bc->msgdata, chunk_len);
+  bt->got_len += chunk_len;
+
+  if (bt->got_len == bt->total_len)
+  {
+    bt->data[bt->total_len] = '\0';
+    br->deliver(bt->sender, bt->name, bt->data, bt->total_len);
+    bt->busy = 0;
+    br->delivered++;
+  }
+}
+
+/* Give up on the transfers whose chunks stopped coming. */
+void bulk_tick(struct bulk_reassembly* br)
+{
+  struct bulk_transfer* bt;
+  long long now = now_ms();
+  int i;
+
+  for (i = 0; i < BULK_MAX_TRANSFERS; i++)
+  {
+    bt = &br->transfers[i];
+    if (bt->busy && now - bt->last_ms >= BULK_TIMEOUT_MS)
+    {
+      printf("(%s from %s given up on: %u of %u bytes came)\n", bt->name, bt->sender,
+          bt->got_len, bt->total_len);
+      bt->busy = 0;
+      br->timed_out++;
+    }
+  }
+}
+
+void bulk_print(struct bulk_reassembly* br, FILE* out)
+{
+  if (br->delivered == 0 && br->timed_out == 0 && br->dropped == 0)
+  {
+    return;
+  }
+  fprintf(out, "bulk transfers: %lu received, %lu given up, %lu chunks dropped\n",
+      br->delivered, br->timed_out, br->dropped);
+}
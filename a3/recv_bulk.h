@@ -0,0 +1,59 @@
+#ifndef _RECV_BULK_H
+#define _RECV_BULK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "defs.h"
+#include "defs_ext.h"
+
+/* transfers put together at the same time; chunks of more are dropped */
+#define BULK_MAX_TRANSFERS 4
+
+/* give up on a transfer when no chunk of it came for this long */
+#define BULK_TIMEOUT_MS 5000
+
+/*
+ * Puts the payloads of bulk transfers (see struct bulk_chunk) together
+ * from their chunks, which may come in any order, in at most
+ * BULK_MAX_TRANSFERS buffers of BULK_MAX_LEN bytes. A transfer is keyed
+ * by its sender and transfer id. The server drops chunks rather than
+ * delay chat with them, so a transfer that stops getting chunks is given
+ * up on after BULK_TIMEOUT_MS.
+ */
+struct bulk_transfer {
+  int busy;
+  char sender[MAX_MEMBER_NAME_LEN];
+  u_int32_t transfer_id;
+  char name[BULK_NAME_LEN];
+  u_int32_t total_len;
+  u_int32_t got_len;
+  /* which chunks came, by offset / BULK_CHUNK_LEN */
+  unsigned char got[BULK_MAX_LEN / BULK_CHUNK_LEN];
+  long long last_ms;
+  char* data;
+};
+
+struct bulk_reassembly {
+  /* called with each payload that came whole */
+  void (*deliver)(char* sender, char* name, char* data, int len);
+
+  struct bulk_transfer transfers[BULK_MAX_TRANSFERS];
+
+  /* counters shown with the telemetry */
+  unsigned long delivered;
+  unsigned long timed_out;
+  unsigned long dropped;    /* chunks with no buffer to go to */
+};
+
+struct bulk_reassembly* create_bulk_reassembly(void (*deliver)(char* sender, char* name,
+      char* data, int len));
+void destroy_bulk_reassembly(struct bulk_reassembly* br);
+
+void bulk_receive(struct bulk_reassembly* br, char* msg, int len);
+void bulk_tick(struct bulk_reassembly* br);
+void bulk_print(struct bulk_reassembly* br, FILE* out);
+
+#endif
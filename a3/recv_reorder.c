@@ -0,0 +1,278 @@
+#include "recv_reorder.h"
+
+#include <time.h>
+#include <arpa/inet.h>
+
+static long long now_ms()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static struct chat_ext_hdr* ext_of(char* msg)
+{
+  return (struct chat_ext_hdr*)(((struct chat_msghdr*)msg)->msgdata);
+}
+
+static char* slot_msg(struct reorder_buffer* rb, u_int32_t seq)
+{
+  return rb->slots + (seq & (REORDER_WINDOW - 1)) * MAX_MSG_LEN;
+}
+
+/* Is message seq held in the buffer? */
+static int is_held(struct reorder_buffer* rb, u_int32_t seq)
+{
+  int slot = seq & (REORDER_WINDOW - 1);
+  return rb->slot_len[slot] != 0 && rb->slot_seq[slot] == seq;
+}
+
+/* Return an empty reorder buffer, or NULL if out of memory. NACKs will be
+ * sent on udp_fd, messages handed to deliver. */
+struct reorder_buffer* create_reorder_buffer(int udp_fd, void (*deliver)(char* msg))
+{
+  struct reorder_buffer* rb = (struct reorder_buffer*)malloc(sizeof(struct reorder_buffer));
+  if (rb == NULL)
+  {
+    perror("recv_reorder malloc");
+    return NULL;
+  }
+  bzero(rb, sizeof(struct reorder_buffer));
+
+  rb->slots = (char*)malloc(REORDER_WINDOW * MAX_MSG_LEN);
+  if (rb->slots == NULL)
+  {
+    perror("recv_reorder malloc");
+    free(rb);
+    return NULL;
+  }
+
+  rb->udp_fd = udp_fd;
+  rb->deliver = deliver;
+  return rb;
+}
+
+void destroy_reorder_buffer(struct reorder_buffer* rb)
+{
+  free(rb->slots);
+  free(rb);
+}
+
+/* Hand the message in seq's slot to the display and free the slot. */
+static void deliver_slot(struct reorder_buffer* rb, u_int32_t seq)
+{
+  char* msg = slot_msg(rb, seq);
+
+  if (ntohs(ext_of(msg)->flags) & CHAT_FLAG_RETRANS)
+  {
+    rb->recovered++;
+  }
+  rb->deliver(msg);
+  rb->slot_len[seq & (REORDER_WINDOW - 1)] = 0;
+  rb->delivered++;
+}
+
+/* Deliver held messages from next_seq on, up to the first gap. */
+static void deliver_ready(struct reorder_buffer* rb)
+{
+  while (is_held(rb, rb->next_seq))
+  {
+    deliver_slot(rb, rb->next_seq);
+    rb->next_seq++;
+  }
+}
+
+/* Stop waiting for anything older than seq: deliver what we hold of it and
+ * count the rest as given up. */
+static void skip_to(struct reorder_buffer* rb, u_int32_t seq)
+{
+  u_int32_t gap = seq - rb->next_seq;
+  u_int32_t i;
+
+  if ((int32_t)gap <= 0)
+  {
+    return;
+  }
+
+  /* only the first REORDER_WINDOW of them can be held */
+  for (i = 0; i < gap && i < REORDER_WINDOW; i++)
+  {
+    if (is_held(rb, rb->next_seq + i))
+    {
+      deliver_slot(rb, rb->next_seq + i);
+    }
+    else
+    {
+      rb->given_up++;
+    }
+  }
+  rb->given_up += gap - i;
+  rb->next_seq = seq;
+}
+
+/* Arm the NACK timer when there is a gap, disarm it when there is none. */
+static void update_nack_timer(struct reorder_buffer* rb)
+{
+  if ((int32_t)(rb->high_seq - rb->next_seq) >= 0)
+  {
+    if (rb->nack_due_ms == 0)
+    {
+      rb->nack_due_ms = now_ms() + NACK_DELAY_MS;
+      rb->nack_tries = 0;
+    }
+  }
+  else
+  {
+    rb->nack_due_ms = 0;
+    rb->nack_tries = 0;
+  }
+}
+
+/* Send one NACK covering every missing message between next_seq and
+ * high_seq, as far as CHAT_MAX_NACK_RANGES ranges go. */
+static void send_nack(struct reorder_buffer* rb)
+{
+  char buf[sizeof(struct chat_msghdr) + sizeof(struct chat_nack)
+    + CHAT_MAX_NACK_RANGES * sizeof(struct chat_nack_range)];
+  struct chat_msghdr* cmh = (struct chat_msghdr*)buf;
+  struct chat_nack* nack = (struct chat_nack*)(cmh->msgdata);
+  u_int32_t seq = rb->next_seq;
+  int nranges = 0;
+
+  bzero(buf, sizeof(buf));
+  while ((int32_t)(rb->high_seq - seq) >= 0 && nranges < CHAT_MAX_NACK_RANGES)
+  {
+    if (is_held(rb, seq))
+    {
+      seq++;
+      continue;
+    }
+
+    u_int32_t first = seq;
+    while ((int32_t)(rb->high_seq - seq) >= 0 && !is_held(rb, seq))
+    {
+      seq++;
+    }
+    nack->ranges[nranges].first_seq = htonl(first);
+    nack->ranges[nranges].count = htonl(seq - first);
+    nranges++;
+  }
+
+  cmh->msg_len = htons(CHAT_NACK_FLAG | nranges);
+  nack->room_id = htons(rb->room_id);
+
+  int len = sizeof(struct chat_msghdr) + sizeof(struct chat_nack)
+    + nranges * sizeof(struct chat_nack_range);
+  if (sendto(rb->udp_fd, buf, len, 0, (struct sockaddr*)&rb->server_addr,
+        sizeof(rb->server_addr)) < 0)
+  {
+    perror("recv_reorder sendto");
+    return;
+  }
+  rb->nacks_sent++;
+}
+
+/* Take a message of a reliable room, received from the server at from.
+ * msg must carry the extended header. */
+void reorder_receive(struct reorder_buffer* rb, char* msg, int len,
+    struct sockaddr_in* from)
+{
+  struct chat_ext_hdr* ext = ext_of(msg);
+  u_int32_t seq = ntohl(ext->room_seq);
+  u_int16_t room_id = ntohs(ext->room_id);
+  u_int32_t old_next;
+
+  rb->server_addr = *from;
+
+  if (!rb->synced || room_id != rb->room_id)
+  {
+    /* new room: flush what we held of the old one, and start from here */
+    if (rb->synced)
+    {
+      skip_to(rb, rb->high_seq + 1);
+    }
+    rb->synced = 1;
+    rb->room_id = room_id;
+    rb->next_seq = seq;
+    rb->high_seq = seq;
+    rb->nack_due_ms = 0;
+  }
+
+  if ((int32_t)(seq - rb->next_seq) < 0 || is_held(rb, seq))
+  {
+    rb->duplicates++;
+    return;
+  }
+
+  /* too far ahead to hold everything in between: give up on the oldest */
+  if (seq - rb->next_seq >= REORDER_WINDOW)
+  {
+    skip_to(rb, seq - REORDER_WINDOW + 1);
+  }
+
+  if (len >= MAX_MSG_LEN)
+  {
+    len = MAX_MSG_LEN - 1;
+  }
+  memcpy(slot_msg(rb, seq), msg, len);
+  slot_msg(rb, seq)[len] = '\0';
+  rb->slot_seq[seq & (REORDER_WINDOW - 1)] = seq;
+  rb->slot_len[seq & (REORDER_WINDOW - 1)] = len;
+
+  if ((int32_t)(seq - rb->high_seq) > 0)
+  {
+    rb->high_seq = seq;
+  }
+
+  old_next = rb->next_seq;
+  deliver_ready(rb);
+  if (rb->next_seq != old_next)
+  {
+    /* the oldest gap got filled, the next one gets a fresh set of tries */
+    rb->nack_tries = 0;
+  }
+  update_nack_timer(rb);
+}
+
+/* Called regularly from the receive loop to send NACKs that are due, and
+ * give up on gaps that stayed open too long. */
+void reorder_tick(struct reorder_buffer* rb)
+{
+  long long now;
+
+  if (rb->nack_due_ms == 0 || (now = now_ms()) < rb->nack_due_ms)
+  {
+    return;
+  }
+
+  if (rb->nack_tries >= NACK_MAX_TRIES)
+  {
+    /* the server no longer has it: move on to the next message we hold */
+    u_int32_t seq = rb->next_seq;
+    while ((int32_t)(rb->high_seq - seq) >= 0 && !is_held(rb, seq))
+    {
+      seq++;
+    }
+    skip_to(rb, seq);
+    deliver_ready(rb);
+    rb->nack_due_ms = 0;
+    update_nack_timer(rb);
+    return;
+  }
+
+  send_nack(rb);
+  rb->nack_tries++;
+  rb->nack_due_ms = now + NACK_INTERVAL_MS;
+}
+
+void reorder_print(struct reorder_buffer* rb, FILE* out)
+{
+  if (!rb->synced)
+  {
+    return;
+  }
+  fprintf(out, "reliable room %u: %lu delivered in order, %lu recovered, %lu given up, "
+      "%lu duplicates dropped, %lu NACKs sent\n",
+      rb->room_id, rb->delivered, rb->recovered, rb->given_up,
+      rb->duplicates, rb->nacks_sent);
+}
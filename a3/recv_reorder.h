@@ -0,0 +1,70 @@
+#ifndef _RECV_REORDER_H
+#define _RECV_REORDER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "defs.h"
+#include "defs_ext.h"
+
+/* messages held back while waiting for a gap to fill, must be a power of 2 */
+#define REORDER_WINDOW 64
+
+/* wait this long after seeing a gap before the first NACK, in case the
+ * missing message was merely reordered */
+#define NACK_DELAY_MS 5
+/* then repeat the NACK this often ... */
+#define NACK_INTERVAL_MS 30
+/* ... this many times, before giving up on the oldest missing message */
+#define NACK_MAX_TRIES 5
+
+/*
+ * In order, duplicate free delivery of the messages of a reliable room
+ * (CHAT_FLAG_RELIABLE). Messages are keyed by the room sequence number of
+ * the extended header. Messages behind a gap are held until the gap is
+ * filled by a retransmission or given up on; the gaps are NACKed to the
+ * server (see struct chat_nack).
+ */
+struct reorder_buffer {
+  /* where NACKs go: our chat socket, and the server's chat address */
+  int udp_fd;
+  struct sockaddr_in server_addr;
+
+  /* called with each message, in room sequence order */
+  void (*deliver)(char* msg);
+
+  int synced;
+  u_int16_t room_id;
+  u_int32_t next_seq;   /* oldest message not yet delivered */
+  u_int32_t high_seq;   /* newest message seen */
+
+  /* REORDER_WINDOW held messages of MAX_MSG_LEN bytes, slot_len 0 if empty */
+  char* slots;
+  u_int32_t slot_seq[REORDER_WINDOW];
+  int slot_len[REORDER_WINDOW];
+
+  /* when to NACK next, 0 if there is no gap */
+  long long nack_due_ms;
+  int nack_tries;
+
+  /* counters shown with the telemetry */
+  unsigned long delivered;
+  unsigned long duplicates;
+  unsigned long recovered;
+  unsigned long given_up;
+  unsigned long nacks_sent;
+};
+
+struct reorder_buffer* create_reorder_buffer(int udp_fd, void (*deliver)(char* msg));
+void destroy_reorder_buffer(struct reorder_buffer* rb);
+
+void reorder_receive(struct reorder_buffer* rb, char* msg, int len,
+    struct sockaddr_in* from);
+void reorder_tick(struct reorder_buffer* rb);
+void reorder_print(struct reorder_buffer* rb, FILE* out);
+
+#endif
@@ -0,0 +1,234 @@
+#include "recv_telemetry.h"
+
+#include <endian.h>
+#include <arpa/inet.h>
+
+/* Return a zeroed telemetry struct, or NULL if out of memory. */
+struct recv_telemetry* create_recv_telemetry()
+{
+  struct recv_telemetry* tel = (struct recv_telemetry*)malloc(sizeof(struct recv_telemetry));
+  if (tel == NULL)
+  {
+    perror("recv_telemetry malloc");
+    return NULL;
+  }
+
+  bzero(tel, sizeof(struct recv_telemetry));
+  return tel;
+}
+
+void destroy_recv_telemetry(struct recv_telemetry* tel)
+{
+  free(tel);
+}
+
+/* Account for one message with sequence number seq in the stream st. */
+static void seq_update(struct seq_track* st, u_int32_t seq)
+{
+  if (st->msgs++ == 0 || seq == st->last_seq + 1)
+  {
+    st->last_seq = seq;
+  }
+  else if (seq > st->last_seq)
+  {
+    st->lost += seq - st->last_seq - 1;
+    st->last_seq = seq;
+  }
+  else
+  {
+    st->late++;
+  }
+}
+
+/* Find the entry for a sender, recycling the least recently heard one if
+ * the sender is new. */
+static struct sender_telemetry* find_sender(struct recv_telemetry* tel, char* name)
+{
+  struct sender_telemetry* oldest = &tel->senders[0];
+  int i;
+
+  for (i = 0; i < TELEMETRY_MAX_SENDERS; i++)
+  {
+    struct sender_telemetry* s = &tel->senders[i];
+    if (s->seq.msgs != 0 && strncmp(s->name, name, MAX_MEMBER_NAME_LEN) == 0)
+    {
+      return s;
+    }
+    if (s->last_heard < oldest->last_heard)
+    {
+      oldest = s;
+    }
+  }
+
+  bzero(oldest, sizeof(struct sender_telemetry));
+  strncpy(oldest->name, name, MAX_MEMBER_NAME_LEN - 1);
+  return oldest;
+}
+
+static void record_owd(struct recv_telemetry* tel, long long owd_us)
+{
+  int i = 0;
+
+  if (owd_us > 0)
+  {
+    i = 64 - __builtin_clzll(owd_us);
+  }
+  if (i >= TELEMETRY_OWD_BUCKETS)
+  {
+    i = TELEMETRY_OWD_BUCKETS - 1;
+  }
+  tel->owd_hist[i]++;
+
+  if (tel->owd_count == 0 || owd_us < tel->owd_min)
+  {
+    tel->owd_min = owd_us;
+  }
+  if (tel->owd_count == 0 || owd_us > tel->owd_max)
+  {
+    tel->owd_max = owd_us;
+  }
+  tel->owd_count++;
+  tel->owd_sum += owd_us;
+}
+
+/* Upper bound, in microseconds, of the delay below which fraction p of the
+ * messages arrived. */
+static long long owd_percentile(struct recv_telemetry* tel, double p)
+{
+  unsigned long target = (unsigned long)(p * tel->owd_count);
+  unsigned long seen = 0;
+  int i;
+
+  if (target >= tel->owd_count)
+  {
+    target = tel->owd_count - 1;
+  }
+  for (i = 0; i < TELEMETRY_OWD_BUCKETS; i++)
+  {
+    seen += tel->owd_hist[i];
+    if (seen > target)
+    {
+      return 1LL << i;
+    }
+  }
+  return tel->owd_max;
+}
+
+/* Account for a chat message that carried the extended header. */
+void telemetry_record(struct recv_telemetry* tel, char* sender_name,
+    struct chat_ext_hdr* ext)
+{
+  struct timespec ts;
+  u_int32_t sender_seq = ntohl(ext->sender_seq);
+  u_int16_t room_id = ntohs(ext->room_id);
+  long long server_ns = be64toh(ext->server_ts);
+  long long now_ns;
+
+  /* room sequence numbers only mean something within one room */
+  if (room_id != tel->room_id)
+  {
+    tel->room_id = room_id;
+    bzero(&tel->room, sizeof(tel->room));
+  }
+  seq_update(&tel->room, ntohl(ext->room_seq));
+
+  if (sender_seq != 0)
+  {
+    struct sender_telemetry* s = find_sender(tel, sender_name);
+    s->last_heard = time(NULL);
+    seq_update(&s->seq, sender_seq);
+  }
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  now_ns = (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+  record_owd(tel, (now_ns - server_ns) / 1000);
+}
+
+/* Account for a chat message without the extended header. */
+void telemetry_record_plain(struct recv_telemetry* tel)
+{
+  tel->plain_msgs++;
+}
+
+void telemetry_record_bundle(struct recv_telemetry* tel, int count)
+{
+  tel->bundles++;
+  tel->bundled_msgs += count;
+}
+
+void telemetry_record_mcast(struct recv_telemetry* tel)
+{
+  tel->mcast_msgs++;
+}
+
+void telemetry_record_compact(struct recv_telemetry* tel, int hdr_len)
+{
+  tel->compact_msgs++;
+  tel->compact_hdr_bytes += hdr_len;
+}
+
+void telemetry_record_unzip(struct recv_telemetry* tel, int zlen, int len,
+    long long ns)
+{
+  tel->zip_msgs++;
+  tel->zip_bytes += zlen;
+  tel->zip_raw_bytes += len;
+  tel->zip_ns += ns;
+}
+
+void telemetry_print(struct recv_telemetry* tel, FILE* out)
+{
+  int i;
+
+  fprintf(out, "--- Delivery telemetry ---\n");
+  if (tel->plain_msgs != 0)
+  {
+    fprintf(out, "%lu messages without sequence numbers (server without extended header support)\n",
+        tel->plain_msgs);
+  }
+  if (tel->bundles != 0)
+  {
+    fprintf(out, "%lu messages came in %lu bundles (%.1f per datagram)\n",
+        tel->bundled_msgs, tel->bundles, (double)tel->bundled_msgs / tel->bundles);
+  }
+  if (tel->mcast_msgs != 0)
+  {
+    fprintf(out, "%lu messages came by multicast\n", tel->mcast_msgs);
+  }
+  if (tel->compact_msgs != 0)
+  {
+    fprintf(out, "%lu messages came with the compact header (%.1f bytes)\n",
+        tel->compact_msgs, (double)tel->compact_hdr_bytes / tel->compact_msgs);
+  }
+  if (tel->zip_msgs != 0)
+  {
+    fprintf(out, "%lu compressed messages: %llu bytes for %llu bytes of text (%.0f%%), %.0fns each to decompress\n",
+        tel->zip_msgs, tel->zip_bytes, tel->zip_raw_bytes,
+        tel->zip_bytes * 100.0 / tel->zip_raw_bytes, (double)tel->zip_ns / tel->zip_msgs);
+  }
+
+  if (tel->room.msgs == 0)
+  {
+    fprintf(out, "No sequenced messages received in this room yet.\n");
+    return;
+  }
+
+  fprintf(out, "room %u: %lu msgs, %lu lost, %lu late\n",
+      tel->room_id, tel->room.msgs, tel->room.lost, tel->room.late);
+
+  for (i = 0; i < TELEMETRY_MAX_SENDERS; i++)
+  {
+    struct sender_telemetry* s = &tel->senders[i];
+    if (s->seq.msgs != 0)
+    {
+      fprintf(out, "  from %s: %lu msgs, %lu lost, %lu late\n",
+          s->name, s->seq.msgs, s->seq.lost, s->seq.late);
+    }
+  }
+
+  /* the delay includes any offset between the server's clock and ours */
+  fprintf(out, "one-way delay from server: %lu msgs, min %lldus, mean %lldus, "
+      "p50 <%lldus, p99 <%lldus, max %lldus\n",
+      tel->owd_count, tel->owd_min, tel->owd_sum / (long long)tel->owd_count,
+      owd_percentile(tel, 0.50), owd_percentile(tel, 0.99), tel->owd_max);
+}
@@ -0,0 +1,89 @@
+#ifndef _RECV_TELEMETRY_H
+#define _RECV_TELEMETRY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "defs.h"
+#include "defs_ext.h"
+
+/* number of senders tracked at once; the least recently heard is recycled */
+#define TELEMETRY_MAX_SENDERS (2 * MAX_NUM_OF_MEMBERS_PER_ROOM)
+
+/* one-way delay histogram: bucket i counts delays below 2^i microseconds */
+#define TELEMETRY_OWD_BUCKETS 32
+
+/*
+ * Sequence tracking for one stream of numbered messages. Numbers above
+ * the next expected one count as lost; numbers at or below the highest
+ * seen count as late (reordered or duplicated) instead.
+ */
+struct seq_track {
+  u_int32_t last_seq;
+  unsigned long msgs;
+  unsigned long lost;
+  unsigned long late;
+};
+
+struct sender_telemetry {
+  char name[MAX_MEMBER_NAME_LEN];
+  time_t last_heard;
+  struct seq_track seq;
+};
+
+/*
+ * Loss and latency telemetry computed by the receiver from the extended
+ * chat header (see defs_ext.h).
+ */
+struct recv_telemetry {
+  /* messages that arrived without the extended header */
+  unsigned long plain_msgs;
+
+  /* messages that arrived compressed, and what it took to decompress them */
+  unsigned long zip_msgs;
+  unsigned long long zip_bytes;
+  unsigned long long zip_raw_bytes;
+  long long zip_ns;
+
+  /* datagrams that carried several messages, and how many they carried */
+  unsigned long bundles;
+  unsigned long bundled_msgs;
+
+  /* messages that came through the room's multicast group */
+  unsigned long mcast_msgs;
+
+  /* messages that came with the compact header, and its bytes */
+  unsigned long compact_msgs;
+  unsigned long long compact_hdr_bytes;
+
+  /* per room sequence, tracks the room we are currently getting */
+  u_int16_t room_id;
+  struct seq_track room;
+
+  /* per sender sequence */
+  struct sender_telemetry senders[TELEMETRY_MAX_SENDERS];
+
+  /* one-way delay from server ingress to us, in microseconds */
+  unsigned long owd_hist[TELEMETRY_OWD_BUCKETS];
+  unsigned long owd_count;
+  long long owd_sum;
+  long long owd_min;
+  long long owd_max;
+};
+
+struct recv_telemetry* create_recv_telemetry();
+void destroy_recv_telemetry(struct recv_telemetry* tel);
+
+void telemetry_record(struct recv_telemetry* tel, char* sender_name,
+    struct chat_ext_hdr* ext);
+void telemetry_record_plain(struct recv_telemetry* tel);
+void telemetry_record_bundle(struct recv_telemetry* tel, int count);
+void telemetry_record_mcast(struct recv_telemetry* tel);
+void telemetry_record_compact(struct recv_telemetry* tel, int hdr_len);
+void telemetry_record_unzip(struct recv_telemetry* tel, int zlen, int len,
+    long long ns);
+void telemetry_print(struct recv_telemetry* tel, FILE* out);
+
+#endif
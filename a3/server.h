@@ -26,6 +26,7 @@
 #include <errno.h>
 
 #include "defs.h"
+#include "defs_ext.h"
 
 /* defines */
 
@@ -37,30 +38,127 @@
 /* max length of a line in room config file */
 #define MAX_LINE_LEN    256 
 
+/* max number of chat messages taken off the UDP socket in one go */
+#define CHAT_BATCH      16
+
+/* protocol extensions this server accepts, see defs_ext.h */
+#define SERVER_CAPS     (CAP_EXT_HDR | CAP_COMPRESS | CAP_BUNDLE | CAP_MCAST \
+			 | CAP_CLUSTER | CAP_STANDBY | CAP_RELAY | CAP_WIDE_ID \
+			 | CAP_SESSION | CAP_COMPACT | CAP_DIRECT | CAP_SUBSCRIBE \
+			 | CAP_DIRECTORY | CAP_BULK)
+
+/* busy polling socket options, missing from older headers */
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL         46
+#endif
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL  69
+#endif
+#ifndef SO_BUSY_POLL_BUDGET
+#define SO_BUSY_POLL_BUDGET  70
+#endif
+
+/* room flags, set with room options (see create_room) */
+#define ROOM_RELIABLE   0x0001  /* retransmit on NACK, see server_reliable.h */
+#define ROOM_LOW_LATENCY 0x0002 /* never coalesce, see server_coalesce.h */
+
+/* buckets of the member indexes of a tenant, a power of 2 */
+#define MEMBER_HASH_SIZE 1024
+
+/* buckets of the subscription index of a tenant, a power of 2 */
+#define SUB_HASH_SIZE   2048
+
+/* longest room options string that is kept */
+#define ROOM_OPTS_LEN   64
+
 /* data structures */
 
 struct room_type;
+struct chat_ring;
+struct room_history;
+struct room_store;
+struct room_index;
+struct chat_filter;
+struct chat_bundle;
+struct sched_queue;
+struct bulk_queue;
+struct room_sub;
+
+/* options given after the room name, as in "name:opt,opt" */
+struct room_opts {
+	int flags;
+	int history_msgs;       /* -1 if not given */
+	int history_bytes;      /* 0 if not given */
+	int coalesce_usecs;     /* -1 if not given */
+	int weight;             /* 0 if not given */
+	int bulk_bytes;         /* -1 if not given */
+};
 
 struct member_type {
 	
-	u_int16_t member_id;
+	/* 0x10000 and up if it negotiated CAP_WIDE_ID, see defs_ext.h */
+	u_int32_t member_id;
 	char member_name[MAX_MEMBER_NAME_LEN];
 	char member_host_name[MAX_HOST_NAME_LEN];
 	
 	int quiet_flag;
 
+	/* protocol extensions negotiated at registration */
+	u_int16_t caps;
+
+	/* to resume its session with, if it negotiated CAP_SESSION */
+	u_int32_t session_key;
+
 	/* contains member's ip address and udp port*/
 	struct sockaddr_in member_udp_addr;  
 
+	/* chat messages held to be sent together, NULL if never */
+	struct chat_bundle *bundle;
+
+	/* gets the messages of its room through the room's multicast group */
+	int mcast;
+
+	/* its slot in its room, and the room's names_gen when it last sent
+	 * its name with a compact message, see server_names.h */
+	int room_slot;
+	u_int32_t name_gen;
+
+	/* when it may send again under the rate it is held to while the
+	 * server sheds load, see server_overload.h */
+	long long shed_tat;
+
+	/* the same for the messages NACKs have retransmitted to it, see
+	 * server_reliable.h */
+	long long retrans_tat;
+
+	/* the other rooms it follows, see server_subs.h */
+	struct room_sub *subs;
+	int num_subs;
+
+	/* its room went to another node, where it has this id; 0 if not */
+	u_int32_t moved_id;
+	int moved_node;
+
 	int num_chat_msgs;
 	int num_bytes_rcved;
 	float bw_usage;
+
+	/* rooms it created, for remove_member() to disown them */
+	int rooms_created;
+
+	/* direct messages it sent, apart from the above, see server_direct.h */
+	int num_direct_msgs;
+	int num_direct_bytes;
     
 	int num_control_msgs;
 
 	struct member_type *next_member;
 	struct member_type *prev_member;
 
+	/* next in its buckets of the tenant's member indexes */
+	struct member_type *next_id_hash;
+	struct member_type *next_name_hash;
+
 	struct member_type *next_room_member;
 	struct member_type *prev_room_member;
 
@@ -70,37 +168,178 @@ struct member_type {
 struct room_type {
 
 	char room_name[MAX_ROOM_NAME_LEN];
+	/* the options it was created with, as given */
+	char room_opts[ROOM_OPTS_LEN];
+	u_int16_t room_id;
 	struct room_type *next_room;
 
+	/* sequence number of the last chat message sent to the room */
+	u_int32_t room_seq;
+	/* the last one the standby was told of, see server_standby.h */
+	u_int32_t standby_seq;
+
+	int flags;
+
+	/* how long messages may be held to be sent together, 0 if not */
+	long long coalesce_ns;
+
+	/* recent messages kept for retransmission, reliable rooms only */
+	struct chat_ring *ring;
+
+	/* recent messages sent to members joining the room, NULL if none */
+	struct room_history *history;
+
+	/* word index over the history, for SEARCH_REQUEST */
+	struct room_index *index;
+
+	/* where the room's messages are stored, NULL if they are not */
+	struct room_store *store;
+
+	/* content filter run on every message, NULL if none */
+	struct chat_filter *filter;
+	/* the member that created the room, the only one that may set its
+	 * filter; 0 once it left, and for rooms it did not create */
+	u_int32_t owner_id;
+
+	/* messages waiting to be sent on, and its share, see server_sched.h */
+	struct sched_queue *sched;
+	int sched_weight;
+
+	/* bulk chunks waiting, and how many bytes of them it may hold, see
+	 * server_bulk.h */
+	struct bulk_queue *bulk;
+	int bulk_max_bytes;
+
 	int num_of_members;
 
+	/* counts members joining, see server_names.h */
+	u_int32_t names_gen;
+
+	/* members that get the messages through the multicast group */
+	int num_mcast_members;
+
 	int empty_flag;
 
 	/* pointer points to all the members within this room */
 	struct member_type *member_list_head;
 	struct member_type *member_list_tail;
+
+	/* members that follow it from other rooms, see server_subs.h */
+	struct room_sub *subs;
+	int num_subs;
+
+	/* where it is in the tenant's dir_heap, see server_dir.h */
+	int dir_pos;
+};
+
+/*
+ * A chat message ready to be distributed. msg[] and len[] hold a copy of
+ * it per format, indexed by an OR of CHAT_FMT_* flags: the extended
+ * header (defs_ext.h) or the plain defs.h one, compressed text or plain,
+ * the compact header or the chat_msghdr. At most the copy the sender sent
+ * is there from the start; chat_msg_fmt() builds the others once a
+ * member needs them, NULL until then.
+ */
+#define CHAT_FMT_EXT    1
+#define CHAT_FMT_ZIP    2
+#define CHAT_FMT_COMPACT 4
+#define CHAT_FMTS       8
+
+struct chat_out {
+	struct chat_msghdr *hdr;   /* as received */
+	struct room_type *rt;      /* the room it goes to */
+	char *name;                /* the sender's, put in hdr once needed */
+	int named;                 /* whether hdr has it yet */
+	int slot;                  /* the sender's, -1 if not sent compact */
+	int name_inline;           /* compact copies carry the name too */
+	int compact_hdr_len;
+	char *msg[CHAT_FMTS];
+	int len[CHAT_FMTS];
+	char *text;                /* plain text, '\0' terminated */
+	int text_len;
+	char *ztext;               /* as compressed by the sender, NULL if not */
+	int ztext_len;
+	struct chat_ext_hdr ext;
 };
 
 
+/*
+ * A tenant is one virtual chatserver: its own port pair, members, rooms,
+ * limits and counts. A chatserver serves one, or more given with -T (see
+ * server_tenant.h), from the same loop. Everything that works on members
+ * and rooms works on the current one, the global "tenant".
+ */
+#define TENANT_NAME_LEN     32
+
+struct tenant {
+	char name[TENANT_NAME_LEN];
+
+	u_int16_t server_tcp_port;
+	u_int16_t server_udp_port;
+	int tcp_socket_fd;
+	int udp_socket_fd;
+
+	char room_file_name[MAX_FILE_NAME_LEN];
+
+	struct member_type *mem_list_head;
+	struct member_type *mem_list_tail;
+
+	/* the members again, by id and by name, see index_member() */
+	struct member_type *id_hash[MEMBER_HASH_SIZE];
+	struct member_type *name_hash[MEMBER_HASH_SIZE];
+
+	/* who follows what, by member and room, see server_subs.h */
+	struct room_sub *sub_hash[SUB_HASH_SIZE];
+
+	/* the directory, see server_dir.h: names sorted, rooms by size */
+	char *dir_room_names[MAX_NUM_OF_ROOMS];
+	char *dir_member_names[MAX_NUM_OF_MEMBERS];
+	struct room_type *dir_heap[MAX_NUM_OF_ROOMS];
+	int dir_num_rooms;
+	int dir_num_members;
+
+	struct room_type *room_list_head;
+	struct room_type *room_list_tail;
+
+	int total_num_of_members;
+	int total_num_of_rooms;
+
+	/* id handed to the most recently created room */
+	u_int16_t last_room_id;
+
+	/* limits, at most MAX_NUM_OF_MEMBERS and MAX_NUM_OF_ROOMS */
+	int max_members;
+	int max_rooms;
+
+	/* counts for the stats report, see tenant_report() */
+	unsigned long chat_msgs;
+	unsigned long chat_bytes;
+	unsigned long control_msgs;
+	unsigned long refused;          /* registrations and rooms over the limits */
+	unsigned long direct_msgs;      /* see direct_report() */
+	unsigned long direct_bytes;
+	unsigned long direct_acks;
+	unsigned long direct_unreachable;
+
+	struct tenant *next_tenant;
+};
+
 /* global variables */
 
 extern char optstr[];
 extern char *optarg;
 
-u_int16_t server_tcp_port;
-u_int16_t server_udp_port;
-
-int tcp_socket_fd;
-int udp_socket_fd;
+/* the tenant whose members and rooms are being worked on */
+struct tenant *tenant;
 
 int fd_table[MAX_CONTROL_SESSIONS];
+struct tenant *fd_tenant[MAX_CONTROL_SESSIONS];   /* whose port it came in on */
 int max_fd_idx;
 
 char log_file_name[MAX_FILE_NAME_LEN];
 int log_flag;
 FILE *logfp;
 
-char room_file_name[MAX_FILE_NAME_LEN];
 FILE *rfp;
 
 time_t now;
@@ -109,15 +348,6 @@ int sweep_int;
 
 char info_str[MAX_HOST_NAME_LEN + 40];
 
-struct member_type *mem_list_head;
-struct member_type *mem_list_tail;
-
-struct room_type *room_list_head;
-struct room_type *room_list_tail;
-
-int total_num_of_members;
-int total_num_of_rooms;
-
 /* scratch memory used for building messages */
 char msg_buf[MAX_MSG_LEN];
 int msg_len;
@@ -147,15 +377,27 @@ int create_server(int type, u_int16_t server_port);
  *
  *  SYNOPSIS: Create a chat room
  *
- *  PASS:     room_name ==> string that contains the room name
+ *  PASS:     room_name ==> string that contains the room name, optionally
+ *                          followed by ':' and a comma separated list of
+ *                          room options:
+ *                            reliable  retransmit lost messages on NACK
+ *                            history=<n>, histbytes=<n>[k]
+ *                                      history size, see server_history.h
+ *                            weight=<n> share of the send path, see
+ *                                      server_sched.h
+ *                            bulk=<n>[k] bulk bytes the room may hold,
+ *                                      see server_bulk.h
  *
  *  RETURN:   if success, return 0
  *            else return > 0
  *              1: room name too long
  *              2: number of rooms reach maximum
  *              3: room exists
+ *              4: unknown room option
+ *              5: no room left in the history arena
+ *              6: the room lives on another node, see server_cluster.h
  *
- *  NOTE:     Information will be logged.
+ *  NOTE:     Information will be logged. room_name is modified in place.
  *           
  */
 int create_room(char *room_name);
@@ -165,8 +407,8 @@ int create_room(char *room_name);
  *
  *  SYNOPSIS: Initialize chat server, do the following:
  *
- *            create tcp and udp server; 
  *            initialize fd_table; 
+ *            for every tenant: create tcp and udp server; 
  *            member, room list
  *            initialization; 
  *            create rooms if room config file is presented. 
@@ -175,7 +417,8 @@ int create_room(char *room_name);
  *
  *  RETURN:   void
  *
- *  NOTE:     Information will be logged.
+ *  NOTE:     Information will be logged. The default tenant is the
+ *            current one afterwards.
  *           
  */
 void init_server();
@@ -205,10 +448,102 @@ void get_peer_info(int fd, char *str);
  *  RETURN:   if found returns the member pointer 
  *            else return NULL
  *
- *  NOTE:     
+ *  NOTE:     Looks in the id index of the tenant, see index_member().
  *           
  */
-struct member_type *find_member_with_id(u_int16_t member_id);
+struct member_type *find_member_with_id(u_int32_t member_id);
+
+/*
+ *  FUNCTION: find_member_with_name
+ *
+ *  SYNOPSIS: locate the member of the current tenant with the given name
+ *
+ *  PASS:     name ==> the name, '\0' terminated
+ *
+ *  RETURN:   if found returns the member pointer
+ *            else return NULL
+ *
+ */
+struct member_type *find_member_with_name(char *name);
+
+/*
+ *  FUNCTION: index_member
+ *
+ *  SYNOPSIS: enter a member into the id and name indexes of the tenant
+ *
+ *  PASS:     mt ==> the member, with its id and name set
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     Every member in the member list is in the indexes: whoever
+ *            puts one in the list, or takes one out (see remove_member),
+ *            does the same with the indexes.
+ *
+ */
+void index_member(struct member_type *mt);
+
+/*
+ *  FUNCTION: unindex_member
+ *
+ *  SYNOPSIS: take a member out of the id and name indexes of the tenant
+ *
+ *  PASS:     mt ==> the member
+ *
+ *  RETURN:   void
+ *
+ */
+void unindex_member(struct member_type *mt);
+
+/*
+ *  FUNCTION: find_sender
+ *
+ *  SYNOPSIS: locate the member that sent a message by the id in it
+ *
+ *  PASS:     id ==> the low half of the id, where defs.h puts it
+ *            id_hi ==> the high half, see defs_ext.h; whatever a v1
+ *                      client left there
+ *
+ *  RETURN:   if found returns the member pointer
+ *            else return NULL
+ *
+ */
+struct member_type *find_sender(u_int16_t id, u_int16_t id_hi);
+
+/*
+ *  FUNCTION: new_member_id
+ *
+ *  SYNOPSIS: pick an unused member id
+ *
+ *  PASS:     caps ==> the protocol extensions of the member it is for
+ *            wanted ==> the id to keep if it is free and of the right
+ *                       width, 0 if none
+ *
+ *  RETURN:   a wide id if caps has CAP_WIDE_ID, else a 16 bit one
+ *
+ *  NOTE:     No wide id handed out shares its low half with a 16 bit
+ *            one in use, so that find_sender() cannot mistake them.
+ *
+ */
+u_int32_t new_member_id(u_int16_t caps, u_int32_t wanted);
+
+/*
+ *  FUNCTION: add_member
+ *
+ *  SYNOPSIS: put a member known elsewhere into the member list
+ *
+ *  PASS:     member_id ==> its id, not in use here
+ *            member_name ==> its name
+ *            caps ==> its protocol extensions
+ *            udp_addr ==> where its chat messages go
+ *
+ *  RETURN:   the member, in no room
+ *
+ *  NOTE:     For members that registered with another server; the
+ *            caller journals it for the standby.
+ *
+ */
+struct member_type *add_member(u_int32_t member_id, char *member_name,
+			       u_int16_t caps, struct sockaddr_in *udp_addr);
 
 /*
  *  FUNCTION: remove_member 
@@ -224,6 +559,22 @@ struct member_type *find_member_with_id(u_int16_t member_id);
  */
 void remove_member(struct member_type *mt);
 
+/*
+ *  FUNCTION: move_member
+ *
+ *  SYNOPSIS: take a member out of its current room, if any, and put it
+ *            in another
+ *
+ *  PASS:     mt ==> the member
+ *            rt ==> the room it moves to
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     No checks: the caller makes sure the room can take it.
+ *
+ */
+void move_member(struct member_type *mt, struct room_type *rt);
+
 /*
  *  FUNCTION: remove_room 
  *
@@ -238,6 +589,18 @@ void remove_member(struct member_type *mt);
  */
 void remove_room(struct room_type *rt);
 
+/*
+ *  FUNCTION: free_room
+ *
+ *  SYNOPSIS: free a room taken off the room list, with what it holds
+ *
+ *  PASS:     rt ==> the room
+ *
+ *  RETURN:   void
+ *
+ */
+void free_room(struct room_type *rt);
+
 
 /*
  *  FUNCTION: dump_control_msg 
@@ -255,10 +618,93 @@ void remove_room(struct room_type *rt);
  */
 void dump_control_msg(int fd, char *buf, int type);
 
+/*
+ *  FUNCTION: admit_chat_msg
+ *
+ *  SYNOPSIS: validate a received chat message, stamp the sender's name into
+ *            the header and update the sender's statistics
+ *
+ *  PASS:     buf ==> the chat message as received
+ *            n ==> number of bytes received
+ *            rx_ts ==> kernel receive time, NULL if not known
+ *            co ==> filled in with the message to distribute
+ *
+ *  RETURN:   the sending member if the message should be distributed to
+ *            co->rt, its current room or one it follows, else NULL
+ *
+ *  NOTE:     Shared by the socket and the AF_XDP receive paths. Assigns
+ *            the room sequence number and the server timestamp, so only
+ *            call it once per message. Use chat_msg_for() to get the
+ *            copy to send to each member.
+ *
+ */
+struct member_type *admit_chat_msg(char *buf, int n, struct timespec *rx_ts,
+				   struct chat_out *co);
+
+/*
+ *  FUNCTION: chat_msg_for
+ *
+ *  SYNOPSIS: pick the copy of an admitted chat message a member can read
+ *
+ *  PASS:     co ==> the message, as set up by admit_chat_msg()
+ *            mt ==> the receiving member
+ *            msg ==> set to the message to send
+ *
+ *  RETURN:   length of *msg
+ *
+ *  NOTE:     Copies other than the one the sender sent are built on first
+ *            use in static buffers, valid until the next admit_chat_msg().
+ *            A compressed message is sent on compressed, as it came, to
+ *            members that negotiated CAP_COMPRESS.
+ *
+ */
+int chat_msg_for(struct chat_out *co, struct member_type *mt, char **msg);
+
+/*
+ *  FUNCTION: chat_msg_fmt
+ *
+ *  SYNOPSIS: same as chat_msg_for, by header format instead of member
+ *
+ *  PASS:     co ==> the message, as set up by admit_chat_msg()
+ *            fmt ==> 0 for the plain header, or CHAT_FMT_EXT for the
+ *                    extended header, with CHAT_FMT_ZIP for the text as
+ *                    the sender compressed it if it did, and
+ *                    CHAT_FMT_COMPACT for the compact header
+ *            msg ==> set to the message to send
+ *
+ *  RETURN:   length of *msg
+ *
+ *  NOTE:     The sender's name is only put in the header once a copy
+ *            other than a compact one is asked for.
+ *
+ */
+int chat_msg_fmt(struct chat_out *co, int fmt, char **msg);
+
+/*
+ *  FUNCTION: forward_chat_msg
+ *
+ *  SYNOPSIS: admit a received chat message and send it to everyone in
+ *            the room, or answer a NACK
+ *
+ *  PASS:     udp_socket_fd ==> the socket it came in on
+ *            buf ==> the message, '\0' terminated
+ *            n ==> its length
+ *            rx_ts ==> kernel receive timestamp, NULL if none
+ *            from ==> where it came from
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     Called by the scheduler when the room's turn comes, see
+ *            server_sched.h.
+ *
+ */
+void forward_chat_msg(int udp_socket_fd, char *buf, int n,
+		      struct timespec *rx_ts, struct sockaddr_in *from);
+
 /*
  *  FUNCTION: process_chat_msg
  *
- *  SYNOPSIS: receive chat message and distribute to the members in the room 
+ *  SYNOPSIS: receive chat message and queue it for the members in the room
  *
  *  PASS:     udp_socket_fd ==> the socket that chat message is received.
  *
@@ -269,6 +715,54 @@ void dump_control_msg(int fd, char *buf, int type);
  */
 void process_chat_msg(int udp_socket_fd);
 
+/*
+ *  FUNCTION: process_chat_batch
+ *
+ *  SYNOPSIS: receive up to CHAT_BATCH chat messages with one recvmmsg()
+ *            call, without blocking, and queue each of them
+ *
+ *  PASS:     udp_socket_fd ==> the socket that chat messages are received.
+ *
+ *  RETURN:   number of messages received, 0 if none were pending
+ *
+ *  NOTE:     Used by the event loop through sched_ingest(); sched_run()
+ *            sends them on.
+ *
+ */
+int process_chat_batch(int udp_socket_fd);
+
+/*
+ *  FUNCTION: set_busy_poll
+ *
+ *  SYNOPSIS: ask the kernel to busy poll the device queue of a socket
+ *            instead of waiting for interrupts
+ *
+ *  PASS:     fd ==> the socket
+ *            usecs ==> SO_BUSY_POLL time budget
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     Failures are reported but not fatal; raising SO_BUSY_POLL
+ *            above net.core.busy_read needs CAP_NET_ADMIN.
+ *
+ */
+void set_busy_poll(int fd, int usecs);
+
+/*
+ *  FUNCTION: sweep_members_and_rooms
+ *
+ *  SYNOPSIS: remove members that have been quiet for more than one sweep
+ *            interval, and rooms that have been empty for as long
+ *
+ *  PASS:     none
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     Information will be logged.
+ *
+ */
+void sweep_members_and_rooms();
+
 /*
  *  FUNCTION: process_control_msg
  *
@@ -300,7 +794,39 @@ void process_control_msg(int fd);
  *
  */
 void send_control_msg_reply(int fd,
-                            u_int16_t type, u_int16_t id, char *data);
+                            u_int16_t type, u_int32_t id, char *data);
+
+/*
+ *  FUNCTION: send_control_reply_caps
+ *
+ *  SYNOPSIS: send a control msg reply carrying capability bits
+ *
+ *  PASS:     same as send_control_msg_reply, plus
+ *            caps ==> capability bits for the reserved field, host order
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     send_control_msg_reply() is this with caps 0. Only
+ *            REGISTER_SUCC carries caps; other replies carry the high
+ *            half of a wide id there instead, see defs_ext.h.
+ *
+ */
+void send_control_reply_caps(int fd, u_int16_t type, u_int32_t id,
+			     u_int16_t caps, char *data);
+
+/*
+ *  FUNCTION: send_control_reply_data
+ *
+ *  SYNOPSIS: send a control msg reply carrying binary data
+ *
+ *  PASS:     same as send_control_reply_caps, plus
+ *            len ==> number of bytes of data
+ *
+ *  RETURN:   void
+ *
+ */
+void send_control_reply_data(int fd, u_int16_t type, u_int32_t id,
+			     u_int16_t caps, char *data, int len);
 
 /*
  * The following functions process each message request and call the above
@@ -313,5 +839,7 @@ void process_room_list_request(int fd, struct member_type *mt, char *buf);
 void process_switch_room_request(int fd, struct member_type *mt, char *buf);
 void process_member_list_request(int fd, struct member_type *mt, char *buf);
 void process_quit_request(int fd, struct member_type *mt, char *buf);
+void process_search_request(int fd, struct member_type *mt, char *buf);
+void process_filter_request(int fd, struct member_type *mt, char *buf);
 
 #endif
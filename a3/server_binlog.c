@@ -0,0 +1,170 @@
+/*
+ *      File:      server_binlog.c
+ *
+ * Binary event log writer, see server_binlog.h and binlog.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <glob.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+
+#include "server.h"
+#include "server_stats.h"
+#include "server_binlog.h"
+
+static char seg_prefix[MAX_FILE_NAME_LEN];
+static u_int32_t seg_no;
+
+/* currently mapped segment, NULL if the binary log is off */
+static char *seg_base;
+static unsigned long seg_next;        /* next free record slot */
+
+static void binlog_disable(char *why) {
+	perror(why);
+	if(log_flag) {
+		fprintf(logfp, "Binary log disabled: %s: %s\n", why, strerror(errno));
+		fflush(logfp);
+	}
+	if(seg_base != NULL)
+		munmap(seg_base, BINLOG_SEGMENT_SIZE);
+	seg_base = NULL;
+}
+
+/* Map a fresh, pre-allocated segment. */
+static int binlog_new_segment() {
+	char name[MAX_FILE_NAME_LEN + 16];
+	struct binlog_seg_hdr *hdr;
+	int fd;
+
+	if(seg_base != NULL) {
+		msync(seg_base, BINLOG_SEGMENT_SIZE, MS_ASYNC);
+		munmap(seg_base, BINLOG_SEGMENT_SIZE);
+		seg_base = NULL;
+	}
+
+	seg_no++;
+	snprintf(name, sizeof(name), "%s.%06u.seg", seg_prefix, seg_no);
+
+	if((fd = open(name, O_RDWR | O_CREAT | O_EXCL, 0644)) < 0) {
+		binlog_disable(name);
+		return -1;
+	}
+
+	/* allocate all blocks now, so appends never wait for the fs */
+	if(posix_fallocate(fd, 0, BINLOG_SEGMENT_SIZE) != 0
+	   && ftruncate(fd, BINLOG_SEGMENT_SIZE) < 0) {
+		close(fd);
+		binlog_disable("binlog ftruncate");
+		return -1;
+	}
+
+	seg_base = mmap(NULL, BINLOG_SEGMENT_SIZE, PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	close(fd);
+	if(seg_base == MAP_FAILED) {
+		seg_base = NULL;
+		binlog_disable("binlog mmap");
+		return -1;
+	}
+
+	hdr = (struct binlog_seg_hdr *)seg_base;
+	hdr->magic = BINLOG_MAGIC;
+	hdr->version = BINLOG_VERSION;
+	hdr->rec_size = BINLOG_REC_SIZE;
+	hdr->seg_no = seg_no;
+	hdr->created_ns = wall_ns();
+
+	seg_next = 0;
+	return 0;
+}
+
+int binlog_open(char *prefix) {
+	char pattern[MAX_FILE_NAME_LEN + 16];
+	glob_t g;
+	int i;
+
+	strncpy(seg_prefix, prefix, MAX_FILE_NAME_LEN - 1);
+
+	/* continue numbering after the newest existing segment */
+	seg_no = 0;
+	snprintf(pattern, sizeof(pattern), "%s.*.seg", seg_prefix);
+	if(glob(pattern, 0, NULL, &g) == 0) {
+		for(i = 0; i < g.gl_pathc; i++) {
+			char *num = g.gl_pathv[i] + strlen(seg_prefix) + 1;
+			u_int32_t n = strtoul(num, NULL, 10);
+			if(n > seg_no)
+				seg_no = n;
+		}
+		globfree(&g);
+	}
+
+	if(binlog_new_segment() < 0)
+		return -1;
+
+	if(log_flag) {
+		fprintf(logfp, "Binary log: %s.%06u.seg\n", seg_prefix, seg_no);
+		fflush(logfp);
+	}
+	return 0;
+}
+
+/* Return the next n free record slots, rolling over to a new segment. */
+static struct binlog_rec *binlog_slots(int n) {
+	struct binlog_rec *rec;
+
+	if(seg_base == NULL)
+		return NULL;
+
+	if(seg_next + n > BINLOG_RECS_PER_SEG && binlog_new_segment() < 0)
+		return NULL;
+
+	rec = (struct binlog_rec *)(seg_base + sizeof(struct binlog_seg_hdr))
+		+ seg_next;
+	seg_next += n;
+	return rec;
+}
+
+static void fill_rec(struct binlog_rec *rec, u_int16_t type, u_int16_t aux,
+		     u_int32_t member_id, u_int32_t room_id, u_int32_t len,
+		     u_int32_t peer_ip) {
+	rec->aux = aux;
+	rec->member_id = member_id;
+	rec->ts_ns = wall_ns();
+	rec->room_id = room_id;
+	rec->len = len;
+	rec->peer_ip = peer_ip;
+	/* type last: a non-zero type marks the slot as used */
+	rec->type = type;
+}
+
+void binlog_event(u_int16_t type, u_int16_t aux, u_int32_t member_id,
+		  u_int32_t room_id, u_int32_t len, u_int32_t peer_ip) {
+	struct binlog_rec *rec;
+
+	if((rec = binlog_slots(1)) == NULL)
+		return;
+
+	fill_rec(rec, type, aux, member_id, room_id, len, peer_ip);
+}
+
+void binlog_named_event(u_int16_t type, u_int32_t member_id,
+			u_int32_t room_id, char *name) {
+	struct binlog_rec *rec;
+	struct binlog_name_rec *nrec;
+
+	if((rec = binlog_slots(2)) == NULL)
+		return;
+
+	nrec = (struct binlog_name_rec *)(rec + 1);
+	strncpy(nrec->name, name, sizeof(nrec->name) - 1);
+	nrec->type = EV_NAME;
+
+	fill_rec(rec, type, 0, member_id, room_id, strlen(name), 0);
+}
@@ -0,0 +1,63 @@
+/*
+ *      File:      server_binlog.h
+ *
+ * Binary structured event log writer. Records are appended to memory
+ * mapped, pre-allocated segment files (see binlog.h for the format), so
+ * logging an event is a handful of stores and never a system call, a
+ * ctime() or a printf(). Use the chatlog tool to read the log.
+ */
+
+#ifndef _SERVER_BINLOG_H
+#define _SERVER_BINLOG_H
+
+#include "binlog.h"
+
+/*
+ *  FUNCTION: binlog_open
+ *
+ *  SYNOPSIS: start logging to segment files <prefix>.<NNNNNN>.seg
+ *
+ *  PASS:     prefix ==> path prefix of the segment files
+ *
+ *  RETURN:   0 on success, -1 on failure
+ *
+ *  NOTE:     Numbering continues after the highest existing segment, so
+ *            a restarted server never overwrites an older log.
+ *
+ */
+int binlog_open(char *prefix);
+
+/*
+ *  FUNCTION: binlog_event
+ *
+ *  SYNOPSIS: append one event record
+ *
+ *  PASS:     type ==> one of the EV_* event types
+ *            aux ==> event specific value, see binlog.h
+ *            member_id, room_id ==> ids the event refers to, 0 if none
+ *            len ==> message length in bytes, if any
+ *            peer_ip ==> peer address of a control connection, if any
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     Does nothing if binlog_open() has not succeeded.
+ *
+ */
+void binlog_event(u_int16_t type, u_int16_t aux, u_int32_t member_id,
+		  u_int32_t room_id, u_int32_t len, u_int32_t peer_ip);
+
+/*
+ *  FUNCTION: binlog_named_event
+ *
+ *  SYNOPSIS: append an event record followed by an EV_NAME record
+ *
+ *  PASS:     same as binlog_event, plus
+ *            name ==> member or room name the event introduces
+ *
+ *  RETURN:   void
+ *
+ */
+void binlog_named_event(u_int16_t type, u_int32_t member_id,
+			u_int32_t room_id, char *name);
+
+#endif
@@ -0,0 +1,330 @@
+/*
+ *      File:      server_bulk.c
+ *
+ * Bulk transfers on their own queues, see server_bulk.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "server.h"
+#include "server_binlog.h"
+#include "server_migrate.h"
+#include "server_overload.h"
+#include "server_filter.h"
+#include "server_sched.h"
+#include "server_bulk.h"
+
+#define BULK_HDR_LEN    (sizeof(struct chat_msghdr) + sizeof(struct bulk_chunk))
+
+struct bulk_msg {
+	struct bulk_msg *next;
+	u_int32_t sender_id;    /* not sent back to it */
+	int n;
+	char buf[BULK_HDR_LEN + BULK_CHUNK_LEN];
+};
+
+struct bulk_queue {
+	struct room_type *rt;
+	struct tenant *tenant;
+
+	struct bulk_msg *head;
+	struct bulk_msg *tail;
+	int bytes;
+
+	int active;
+	struct bulk_queue *next_active;
+
+	/* since the last bulk_report() */
+	unsigned long chunks;
+	unsigned long chunk_bytes;
+	unsigned long copies;
+	unsigned long dropped;
+};
+
+/* rooms with chunks waiting, the one whose turn it is first */
+static struct bulk_queue *active_head;
+static struct bulk_queue *active_tail;
+
+/* chunks sent on, kept for reuse */
+static struct bulk_msg *free_msgs;
+
+int
+is_chat_bulk(char *buf, int n) {
+	struct chat_msghdr *cmh = (struct chat_msghdr *)buf;
+
+	return n >= sizeof(struct chat_msghdr)
+		&& (ntohs(cmh->msg_len) & (CHAT_BULK_FLAGS | CHAT_NACK_FLAG)) == CHAT_BULK_FLAGS;
+}
+
+static struct bulk_queue *room_queue(struct room_type *rt) {
+	struct bulk_queue *q = rt->bulk;
+
+	if(q == NULL) {
+		if((q = (struct bulk_queue *)calloc(1, sizeof(struct bulk_queue))) == NULL) {
+			printf("Memory used up when trying to queue a bulk chunk\n");
+			exit(1);
+		}
+		q->rt = rt;
+		q->tenant = tenant;
+		rt->bulk = q;
+	}
+	return q;
+}
+
+static void activate(struct bulk_queue *q) {
+	q->active = 1;
+	q->next_active = NULL;
+	if(active_head == NULL)
+		active_head = q;
+	else
+		active_tail->next_active = q;
+	active_tail = q;
+}
+
+static struct bulk_queue *pop_active() {
+	struct bulk_queue *q = active_head;
+
+	active_head = q->next_active;
+	if(active_head == NULL)
+		active_tail = NULL;
+	q->active = 0;
+	return q;
+}
+
+static void unlink_active(struct bulk_queue *q) {
+	struct bulk_queue **pp;
+
+	if(!q->active)
+		return;
+	if(q == active_head) {
+		pop_active();
+		return;
+	}
+	for(pp = &active_head; *pp != NULL; pp = &(*pp)->next_active) {
+		if((*pp)->next_active == q) {
+			(*pp)->next_active = q->next_active;
+			if(active_tail == q)
+				active_tail = *pp;
+			break;
+		}
+	}
+	q->active = 0;
+}
+
+/* Whether a chunk holds together: one piece of a payload no larger than
+ * BULK_MAX_LEN, cut where the sender must cut it. */
+static int chunk_ok(char *buf, int n) {
+	struct chat_msghdr *cmh = (struct chat_msghdr *)buf;
+	struct bulk_chunk *bc = (struct bulk_chunk *)cmh->msgdata;
+	u_int32_t total, offset;
+	int len;
+
+	if(n <= BULK_HDR_LEN)
+		return 0;
+	len = ntohs(cmh->msg_len) & CHAT_LEN_MASK;
+	total = ntohl(bc->total_len);
+	offset = ntohl(bc->offset);
+	return len == n - BULK_HDR_LEN && len <= BULK_CHUNK_LEN
+		&& total <= BULK_MAX_LEN && offset % BULK_CHUNK_LEN == 0
+		&& offset < total && offset + len <= total
+		&& (len == BULK_CHUNK_LEN || offset + len == total);
+}
+
+void
+process_bulk_chunk(char *buf, int n) {
+	struct chat_msghdr *cmh = (struct chat_msghdr *)buf;
+	struct member_type *mt;
+	struct room_type *rt;
+	struct bulk_queue *q;
+	struct bulk_msg *m;
+
+	if((mt = find_sender(ntohs(cmh->sender.member_id),
+			     ntohs(((struct chat_sender_v2 *)&cmh->sender)->member_id_hi))) == NULL
+	   || !(mt->caps & CAP_BULK)) {
+		binlog_event(EV_CHAT_DROP, DROP_BAD_ID, ntohs(cmh->sender.member_id), 0, n, 0);
+		if(log_flag) {
+			fprintf(logfp,
+				"Bulk chunk is discarded because the sender's member id is invalid!\n");
+			fflush(logfp);
+		}
+		return;
+	}
+	mt->quiet_flag = 0;
+
+	if(mt->moved_id != 0) {
+		migrate_forward(buf, n, mt);
+		return;
+	}
+	if(!chunk_ok(buf, n)) {
+		binlog_event(EV_CHAT_DROP, DROP_CORRUPT, mt->member_id, 0, n, 0);
+		return;
+	}
+	if((rt = mt->current_room) == NULL) {
+		binlog_event(EV_CHAT_DROP, DROP_NO_ROOM, mt->member_id, 0, n, 0);
+		return;
+	}
+	if(rt->filter != NULL
+	   && filter_bulk_chunk(rt, buf + BULK_HDR_LEN, n - BULK_HDR_LEN) == FILTER_BLOCK) {
+		binlog_event(EV_CHAT_DROP, DROP_FILTERED, mt->member_id, rt->room_id, n, 0);
+		if(log_flag) {
+			fprintf(logfp,
+				"Bulk chunk is discarded by the filter of room [%s]!\n",
+				rt->room_name);
+			fflush(logfp);
+		}
+		return;
+	}
+
+	/* the first thing to go when the server is behind */
+	if(overload_state() != OVERLOAD_NONE) {
+		binlog_event(EV_CHAT_DROP, DROP_SHED, mt->member_id, rt->room_id, n, 0);
+		return;
+	}
+	q = room_queue(rt);
+	if(q->bytes + n > rt->bulk_max_bytes) {
+		q->dropped++;
+		binlog_event(EV_CHAT_DROP, DROP_QUEUE_FULL, mt->member_id,
+			     rt->room_id, n, 0);
+		if(log_flag) {
+			fprintf(logfp,
+				"Bulk chunk from [%s] is discarded because room [%s] holds too much!\n",
+				mt->member_name, rt->room_name);
+			fflush(logfp);
+		}
+		return;
+	}
+
+	if((m = free_msgs) != NULL) {
+		free_msgs = m->next;
+	} else if((m = (struct bulk_msg *)malloc(sizeof(struct bulk_msg))) == NULL) {
+		printf("Memory used up when trying to queue a bulk chunk\n");
+		exit(1);
+	}
+
+	/* ready to go, under the sender's name */
+	m->next = NULL;
+	m->sender_id = mt->member_id;
+	m->n = n;
+	memcpy(m->buf, buf, n);
+	bzero(m->buf, sizeof(struct chat_msghdr));
+	strncpy(((struct chat_msghdr *)m->buf)->sender.member_name, mt->member_name,
+		MAX_MEMBER_NAME_LEN);
+	((struct chat_msghdr *)m->buf)->msg_len = htons(CHAT_BULK_FLAGS | (n - BULK_HDR_LEN));
+
+	if(q->tail == NULL)
+		q->head = m;
+	else
+		q->tail->next = m;
+	q->tail = m;
+	q->bytes += n;
+
+	if(!q->active)
+		activate(q);
+}
+
+/* Send the first chunk of a room on; returns the copies sent. */
+static int send_head(int udp_socket_fd, struct bulk_queue *q) {
+	struct bulk_msg *m = q->head;
+	struct member_type *mt;
+	int copies = 0;
+
+	q->head = m->next;
+	if(q->head == NULL)
+		q->tail = NULL;
+	q->bytes -= m->n;
+
+	for(mt = q->rt->member_list_head; mt != NULL; mt = mt->next_room_member) {
+		if(!(mt->caps & CAP_BULK) || mt->member_id == m->sender_id)
+			continue;
+		if(sendto(udp_socket_fd, m->buf, m->n, 0,
+			  (struct sockaddr *)&mt->member_udp_addr,
+			  sizeof(struct sockaddr_in)) < 0) {
+			perror("send to");
+			break;
+		}
+		copies++;
+	}
+
+	q->chunks++;
+	q->chunk_bytes += m->n;
+	q->copies += copies;
+	binlog_event(EV_CHAT_BULK, copies, m->sender_id, q->rt->room_id, m->n, 0);
+
+	m->next = free_msgs;
+	free_msgs = m;
+	return copies;
+}
+
+void
+bulk_run() {
+	struct tenant *current = tenant;
+	struct bulk_queue *q;
+	int budget = BULK_ROUND_COPIES;
+
+	if(sched_pending())
+		return;
+
+	/* a chunk a turn; a room with more goes to the back */
+	while(active_head != NULL && budget > 0) {
+		q = pop_active();
+		tenant = q->tenant;
+		budget -= 1 + send_head(tenant->udp_socket_fd, q);
+		if(q->head != NULL)
+			activate(q);
+	}
+
+	tenant = current;
+}
+
+int
+bulk_pending() {
+	return active_head != NULL;
+}
+
+void
+bulk_free(struct room_type *rt) {
+	struct bulk_queue *q = rt->bulk;
+	struct bulk_msg *m;
+
+	if(q == NULL)
+		return;
+	unlink_active(q);
+	while((m = q->head) != NULL) {
+		q->head = m->next;
+		m->next = free_msgs;
+		free_msgs = m;
+	}
+	free(q);
+	rt->bulk = NULL;
+}
+
+void
+bulk_report() {
+	FILE *fp = log_flag ? logfp : stdout;
+	struct room_type *rt;
+	struct bulk_queue *q;
+
+	for(rt = tenant->room_list_head; rt != NULL; rt = rt->next_room) {
+		if((q = rt->bulk) == NULL)
+			continue;
+
+		if(q->chunks != 0 || q->dropped != 0) {
+			fprintf(fp, "Bulk of room [%s]: %lu chunks (%lu bytes) sent as %lu copies, "
+				"%d bytes waiting, %lu dropped\n",
+				rt->room_name, q->chunks, q->chunk_bytes, q->copies,
+				q->bytes, q->dropped);
+			fflush(fp);
+		}
+
+		q->chunks = 0;
+		q->chunk_bytes = 0;
+		q->copies = 0;
+		q->dropped = 0;
+	}
+}
@@ -0,0 +1,127 @@
+/*
+ *      File:      server_bulk.h
+ *
+ * Bulk transfers (see defs_ext.h): large payloads sent to a room in
+ * chunks, on a side channel that chat never waits behind. Chunks are not
+ * sent on as they come in but queued on their room, apart from the chat
+ * messages of server_sched.h, and the queues are drained only when no
+ * chat message is waiting: at most BULK_ROUND_COPIES copies between two
+ * looks at the sockets, the rooms taking turns a chunk at a time. A chat
+ * message coming in while chunks are going out thus waits for one round
+ * of them at most.
+ *
+ * A room holds at most so many bytes of chunks not yet sent on; more are
+ * dropped, as are all chunks while the server is overloaded (see
+ * server_overload.h). The receivers give up on the payloads they do not
+ * get whole. The limit is set per room with the room options (see
+ * create_room):
+ *   bulk=<n>[k]       n bytes (n KB), up to BULK_ROOM_MAX_BYTES; 0 takes
+ *                     no bulk transfers in the room
+ * Rooms that do not say hold BULK_ROOM_BYTES.
+ *
+ * Chunks go to the members of the sender's room that negotiated CAP_BULK,
+ * but the sender itself, and not to those following the room (see
+ * server_subs.h) nor through its multicast group. A chunk with one of
+ * the blocking patterns of the room's content filter (see server_filter.h)
+ * is dropped; redacting patterns are not applied, and a pattern cut
+ * across two chunks is not seen, so the filter is no more than a check
+ * on what is plainly there.
+ */
+
+#ifndef _SERVER_BULK_H
+#define _SERVER_BULK_H
+
+#include "server.h"
+
+/* bytes of chunks a room holds, by default and at most */
+#define BULK_ROOM_BYTES         (128 * 1024)
+#define BULK_ROOM_MAX_BYTES     (1024 * 1024)
+
+/* copies sent per round of the event loop, at most */
+#define BULK_ROUND_COPIES       64
+
+/*
+ *  FUNCTION: is_chat_bulk
+ *
+ *  SYNOPSIS: tell whether a chat datagram is a bulk chunk
+ *
+ *  PASS:     buf ==> the datagram
+ *            n ==> its length
+ *
+ *  RETURN:   non-zero if it is one
+ *
+ */
+int is_chat_bulk(char *buf, int n);
+
+/*
+ *  FUNCTION: process_bulk_chunk
+ *
+ *  SYNOPSIS: queue a bulk chunk from a member on its room
+ *
+ *  PASS:     buf ==> the chunk
+ *            n ==> its length
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     Sent on later, with the tenant's chat socket. Dropped if
+ *            malformed, if the room's filter blocks it, if the room
+ *            holds too much already, or while the server is overloaded.
+ *            A chunk for a room that moved is passed on to its node.
+ *
+ */
+void process_bulk_chunk(char *buf, int n);
+
+/*
+ *  FUNCTION: bulk_run
+ *
+ *  SYNOPSIS: send on a round of the chunks waiting, if no chat message is
+ *
+ *  PASS:     nothing
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     Called from the event loop right after sched_run().
+ *
+ */
+void bulk_run();
+
+/*
+ *  FUNCTION: bulk_pending
+ *
+ *  SYNOPSIS: tell whether any chunks are waiting
+ *
+ *  PASS:     nothing
+ *
+ *  RETURN:   non-zero if some are, for the event loop not to sleep
+ *
+ */
+int bulk_pending();
+
+/*
+ *  FUNCTION: bulk_free
+ *
+ *  SYNOPSIS: drop the chunks of a room that goes away
+ *
+ *  PASS:     rt ==> the room
+ *
+ *  RETURN:   void
+ *
+ */
+void bulk_free(struct room_type *rt);
+
+/*
+ *  FUNCTION: bulk_report
+ *
+ *  SYNOPSIS: report the bulk transfers of the current tenant's rooms
+ *            since the last report
+ *
+ *  PASS:     nothing
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     Called every STATS_REPORT_INT seconds, once per tenant.
+ *
+ */
+void bulk_report();
+
+#endif
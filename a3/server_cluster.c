@@ -0,0 +1,300 @@
+/*
+ *      File:      server_cluster.c
+ *
+ * Rooms sharded over a cluster of chatservers, see server_cluster.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <netinet/in.h>
+#include <netdb.h>
+
+#include "server.h"
+#include "server_cluster.h"
+
+struct cluster_node {
+	char name[CLUSTER_NODE_NAME_LEN];
+	char host_name[MAX_HOST_NAME_LEN];
+	u_int16_t tcp_port;
+	u_int16_t udp_port;
+};
+
+/* a room moved off the node its name hashes to */
+struct moved_room {
+	char room_name[MAX_ROOM_NAME_LEN + 1];
+	int node;
+};
+
+struct ring_point {
+	u_int32_t hash;
+	int node;
+};
+
+static struct cluster_node nodes[CLUSTER_MAX_NODES];
+static int num_nodes;
+static int self = -1;
+
+/* sorted by hash; a name belongs to the first point at or after its hash */
+static struct ring_point ring[CLUSTER_MAX_NODES * CLUSTER_VNODES];
+static int num_points;
+
+/* looked at before the ring, the oldest entry goes when full */
+static struct moved_room moved[CLUSTER_MAX_MOVED];
+static int num_moved;
+static int next_moved;
+
+/* FNV-1a, over len bytes of s */
+static u_int32_t ring_hash(const char *s, int len) {
+	u_int32_t h = 2166136261u;
+
+	while(len-- > 0) {
+		h ^= (unsigned char)*s++;
+		h *= 16777619u;
+	}
+	/* spread the low bits, FNV leaves short keys clustered */
+	h ^= h >> 15;
+	h *= 0x2c1b3c6d;
+	h ^= h >> 12;
+	return h;
+}
+
+static int cmp_points(const void *a, const void *b) {
+	const struct ring_point *pa = a, *pb = b;
+
+	if(pa->hash != pb->hash)
+		return pa->hash < pb->hash ? -1 : 1;
+	return pa->node - pb->node;
+}
+
+static int read_cluster_file(char *file_name) {
+	FILE *fp;
+	char line[MAX_LINE_LEN];
+	struct cluster_node *n;
+	int lineno = 0;
+
+	if((fp = fopen(file_name, "r")) == NULL) {
+		perror("fopen cluster file");
+		return -1;
+	}
+
+	while(fgets(line, MAX_LINE_LEN, fp) != NULL) {
+		char name[CLUSTER_NODE_NAME_LEN], host[MAX_HOST_NAME_LEN];
+		unsigned int tcp_port, udp_port;
+		char *p = line;
+
+		lineno++;
+		while(*p == ' ' || *p == '\t')
+			p++;
+		if(*p == '#' || *p == '\n' || *p == '\0')
+			continue;
+
+		if(sscanf(p, "%31s %79s %u %u", name, host, &tcp_port, &udp_port) != 4
+		   || tcp_port == 0 || tcp_port > 65535 || udp_port == 0 || udp_port > 65535) {
+			fprintf(stderr, "%s:%d: expected <name> <host> <tcp port> <udp port>\n",
+				file_name, lineno);
+			fclose(fp);
+			return -1;
+		}
+		if(num_nodes == CLUSTER_MAX_NODES) {
+			fprintf(stderr, "%s: more than %d nodes\n", file_name, CLUSTER_MAX_NODES);
+			fclose(fp);
+			return -1;
+		}
+
+		n = &nodes[num_nodes++];
+		strcpy(n->name, name);
+		strcpy(n->host_name, host);
+		n->tcp_port = tcp_port;
+		n->udp_port = udp_port;
+	}
+	fclose(fp);
+	return 0;
+}
+
+int
+cluster_init(char *spec) {
+	char file_name[MAX_FILE_NAME_LEN];
+	char point[CLUSTER_NODE_NAME_LEN + 8];
+	char *self_name;
+	int i, v;
+
+	strncpy(file_name, spec, MAX_FILE_NAME_LEN - 1);
+	file_name[MAX_FILE_NAME_LEN - 1] = '\0';
+	if((self_name = strchr(file_name, ':')) != NULL)
+		*self_name++ = '\0';
+
+	if(read_cluster_file(file_name) < 0)
+		return -1;
+
+	for(i = 0; i < num_nodes; i++) {
+		if(self_name != NULL ? strcmp(nodes[i].name, self_name) == 0
+		   : (nodes[i].tcp_port == tenant->server_tcp_port
+		      && nodes[i].udp_port == tenant->server_udp_port)) {
+			self = i;
+			break;
+		}
+	}
+	if(self < 0) {
+		fprintf(stderr, "This server is not in cluster file %s\n", file_name);
+		return -1;
+	}
+
+	for(i = 0; i < num_nodes; i++) {
+		for(v = 0; v < CLUSTER_VNODES; v++) {
+			sprintf(point, "%s#%d", nodes[i].name, v);
+			ring[num_points].hash = ring_hash(point, strlen(point));
+			ring[num_points].node = i;
+			num_points++;
+		}
+	}
+	qsort(ring, num_points, sizeof(struct ring_point), cmp_points);
+
+	if(log_flag) {
+		fprintf(logfp, "Cluster of %d nodes, this is [%s]\n", num_nodes, nodes[self].name);
+		fflush(logfp);
+	}
+	return 0;
+}
+
+/* The node a room lives on; the name ends at the options, if any. */
+static int cluster_owner(char *room_name) {
+	char *opts = strchr(room_name, ':');
+	int len = opts ? opts - room_name : strlen(room_name);
+	u_int32_t h;
+	int lo = 0, hi = num_points;
+	int i;
+
+	for(i = 0; i < num_moved; i++) {
+		if(strlen(moved[i].room_name) == len
+		   && !strncmp(moved[i].room_name, room_name, len))
+			return moved[i].node;
+	}
+
+	h = ring_hash(room_name, len);
+
+	/* first point with a hash >= h, wrapping around to the first */
+	while(lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if(ring[mid].hash < h)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return ring[lo == num_points ? 0 : lo].node;
+}
+
+int
+cluster_owns(char *room_name) {
+	if(num_nodes == 0)
+		return 1;
+	return cluster_owner(room_name) == self;
+}
+
+int
+cluster_find_node(char *name) {
+	int i;
+
+	for(i = 0; i < num_nodes; i++) {
+		if(!strcmp(nodes[i].name, name))
+			return i;
+	}
+	return -1;
+}
+
+int
+cluster_self() {
+	return self;
+}
+
+char *
+cluster_node_name(int node) {
+	return nodes[node].name;
+}
+
+int
+cluster_node_addr(int node, int type, struct sockaddr_in *addr) {
+	struct hostent *hp;
+
+	if((hp = gethostbyname(nodes[node].host_name)) == NULL)
+		return -1;
+	bzero(addr, sizeof(struct sockaddr_in));
+	addr->sin_family = AF_INET;
+	addr->sin_port = htons(type == SOCK_STREAM ? nodes[node].tcp_port
+			       : nodes[node].udp_port);
+	memcpy(&addr->sin_addr, hp->h_addr_list[0], sizeof(addr->sin_addr));
+	return 0;
+}
+
+int
+cluster_is_node(struct in_addr *addr) {
+	struct sockaddr_in node_addr;
+	int i;
+
+	for(i = 0; i < num_nodes; i++) {
+		if(cluster_node_addr(i, SOCK_STREAM, &node_addr) == 0
+		   && node_addr.sin_addr.s_addr == addr->s_addr)
+			return 1;
+	}
+	return 0;
+}
+
+int
+cluster_fill_redirect(int node, char *buf) {
+	struct room_redirect *rd = (struct room_redirect *)buf;
+
+	rd->tcp_port = htons(nodes[node].tcp_port);
+	rd->udp_port = htons(nodes[node].udp_port);
+	strcpy(rd->host_name, nodes[node].host_name);
+	return sizeof(struct room_redirect) + strlen(rd->host_name) + 1;
+}
+
+void
+cluster_move(char *room_name, int node) {
+	int i;
+
+	for(i = 0; i < num_moved; i++) {
+		if(!strcmp(moved[i].room_name, room_name)) {
+			moved[i].node = node;
+			return;
+		}
+	}
+
+	strncpy(moved[next_moved].room_name, room_name, MAX_ROOM_NAME_LEN);
+	moved[next_moved].node = node;
+	next_moved = (next_moved + 1) % CLUSTER_MAX_MOVED;
+	if(num_moved < CLUSTER_MAX_MOVED)
+		num_moved++;
+}
+
+int
+cluster_redirect(int fd, struct member_type *mt, char *room_name,
+		 u_int16_t fail_type) {
+	char buf[sizeof(struct room_redirect) + MAX_HOST_NAME_LEN];
+	struct cluster_node *n;
+	char err[MAX_HOST_NAME_LEN + 64];
+	int owner;
+
+	if(num_nodes == 0 || (owner = cluster_owner(room_name)) == self)
+		return 0;
+	n = &nodes[owner];
+
+	if(!(mt->caps & CAP_CLUSTER)) {
+		snprintf(err, sizeof(err), "Room is on server %s:%hu!", n->host_name, n->tcp_port);
+		send_control_msg_reply(fd, fail_type, mt->member_id, err);
+		return 1;
+	}
+
+	send_control_reply_data(fd, ROOM_REDIRECT, mt->member_id, 0, buf,
+				cluster_fill_redirect(owner, buf));
+
+	if(log_flag) {
+		fprintf(logfp, "Member [%s] sent to node [%s] for room [%s].\n",
+			mt->member_name, n->name, room_name);
+		fflush(logfp);
+	}
+	return 1;
+}
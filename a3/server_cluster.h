@@ -0,0 +1,171 @@
+/*
+ *      File:      server_cluster.h
+ *
+ * Several chatservers sharing the rooms. With chatserver -k <cluster file>
+ * every node reads the same list of nodes, one per line:
+ *
+ *   <node name> <host> <tcp port> <udp port>
+ *
+ * (blank lines and lines starting with '#' are skipped). Room names are
+ * placed on a consistent hash ring with CLUSTER_VNODES points per node,
+ * and a room lives on the node owning its name. Adding or removing a
+ * node only moves the rooms of the ring segments it takes or gives up.
+ *
+ * A member registers with any node. Asked to create or switch to a room
+ * another node owns, a node answers ROOM_REDIRECT naming the owner (see
+ * defs_ext.h), and the client moves over to it; members without
+ * CAP_CLUSTER get a failure naming the owner instead. Rooms in the room
+ * file are only created on their owner, so every node may be given the
+ * same one.
+ *
+ * A node finds itself in the list by the name given as -k <file>:<name>,
+ * or else by its tcp and udp ports, which is enough to run the whole
+ * cluster on one host.
+ *
+ * A room may also be moved off the node it hashes to (see
+ * server_migrate.h). The two nodes remember where it went, ahead of the
+ * ring; the others still send members to the node the room hashes to,
+ * which sends them on.
+ */
+
+#ifndef _SERVER_CLUSTER_H
+#define _SERVER_CLUSTER_H
+
+#include "server.h"
+
+#define CLUSTER_MAX_NODES       32
+#define CLUSTER_VNODES          64      /* ring points per node */
+#define CLUSTER_NODE_NAME_LEN   32
+#define CLUSTER_MAX_MOVED       64      /* rooms remembered as moved */
+
+/*
+ *  FUNCTION: cluster_init
+ *
+ *  SYNOPSIS: read the cluster file and build the hash ring
+ *
+ *  PASS:     spec ==> <cluster file>[:<node name>]
+ *
+ *  RETURN:   0 on success, -1 on failure (reported)
+ *
+ *  NOTE:     Call before init_server(), which creates the rooms of the
+ *            room file. Without it the server owns every room.
+ *
+ */
+int cluster_init(char *spec);
+
+/*
+ *  FUNCTION: cluster_owns
+ *
+ *  SYNOPSIS: tell whether a room lives on this node
+ *
+ *  PASS:     room_name ==> the room name, without options
+ *
+ *  RETURN:   non-zero if it does
+ *
+ */
+int cluster_owns(char *room_name);
+
+/*
+ *  FUNCTION: cluster_redirect
+ *
+ *  SYNOPSIS: send a member asking for a room to the node that owns it
+ *
+ *  PASS:     fd ==> the control connection
+ *            mt ==> the member
+ *            room_name ==> the room asked for, options may follow a ':'
+ *            fail_type ==> reply type for members without CAP_CLUSTER
+ *
+ *  RETURN:   1 if the room lives elsewhere and the reply is sent, 0 if it
+ *            lives here and the caller goes on
+ *
+ */
+int cluster_redirect(int fd, struct member_type *mt, char *room_name,
+		     u_int16_t fail_type);
+
+/*
+ *  FUNCTION: cluster_find_node
+ *
+ *  SYNOPSIS: look up a node by name
+ *
+ *  PASS:     name ==> the node name
+ *
+ *  RETURN:   the node, -1 if there is none by that name
+ *
+ */
+int cluster_find_node(char *name);
+
+/*
+ *  FUNCTION: cluster_self
+ *
+ *  SYNOPSIS: tell which node this server is
+ *
+ *  RETURN:   the node, -1 outside a cluster
+ *
+ */
+int cluster_self();
+
+/*
+ *  FUNCTION: cluster_node_name
+ *
+ *  SYNOPSIS: get the name of a node, for the log
+ *
+ *  PASS:     node ==> the node
+ *
+ *  RETURN:   the name
+ *
+ */
+char *cluster_node_name(int node);
+
+/*
+ *  FUNCTION: cluster_node_addr
+ *
+ *  SYNOPSIS: look up the address of a node's tcp or udp port
+ *
+ *  PASS:     node ==> the node
+ *            type ==> SOCK_STREAM or SOCK_DGRAM
+ *            addr ==> filled in
+ *
+ *  RETURN:   0 on success, -1 if its host name does not resolve
+ *
+ */
+int cluster_node_addr(int node, int type, struct sockaddr_in *addr);
+
+/*
+ *  FUNCTION: cluster_is_node
+ *
+ *  SYNOPSIS: tell whether an address is that of a node
+ *
+ *  PASS:     addr ==> the address
+ *
+ *  RETURN:   non-zero if it is
+ *
+ */
+int cluster_is_node(struct in_addr *addr);
+
+/*
+ *  FUNCTION: cluster_fill_redirect
+ *
+ *  SYNOPSIS: fill in a room_redirect naming a node (see defs_ext.h)
+ *
+ *  PASS:     node ==> the node
+ *            buf ==> sizeof(struct room_redirect) + MAX_HOST_NAME_LEN bytes
+ *
+ *  RETURN:   the length filled in
+ *
+ */
+int cluster_fill_redirect(int node, char *buf);
+
+/*
+ *  FUNCTION: cluster_move
+ *
+ *  SYNOPSIS: remember that a room now lives on another node
+ *
+ *  PASS:     room_name ==> the room name, without options
+ *            node ==> the node it lives on
+ *
+ *  RETURN:   void
+ *
+ */
+void cluster_move(char *room_name, int node);
+
+#endif
@@ -0,0 +1,196 @@
+/*
+ *      File:      server_coalesce.c
+ *
+ * Per-member coalescing of outgoing chat messages, see server_coalesce.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "server.h"
+#include "server_stats.h"
+#include "server_coalesce.h"
+
+struct chat_bundle {
+	struct member_type *mt;
+	struct tenant *tenant;     /* the member's, whose port it goes out of */
+	struct chat_bundle *next_pending;
+	int pending;
+	long long deadline;
+	int count;
+	int len;                   /* bytes of buf used, header included */
+	char buf[COALESCE_MTU];
+};
+
+static int default_usecs;
+
+/* bundles holding messages, and the earliest of their deadlines */
+static struct chat_bundle *pending_list;
+static long long next_deadline;
+
+void
+coalesce_init(int usecs) {
+	if(usecs > COALESCE_MAX_USECS)
+		usecs = COALESCE_MAX_USECS;
+	default_usecs = (usecs > 0) ? usecs : 0;
+
+	if(log_flag && default_usecs != 0) {
+		fprintf(logfp, "Coalescing window: %d us\n", default_usecs);
+		fflush(logfp);
+	}
+}
+
+long long
+coalesce_room_window(struct room_opts *opts) {
+	if(opts->flags & ROOM_LOW_LATENCY)
+		return 0;
+	if(opts->coalesce_usecs >= 0)
+		return opts->coalesce_usecs * 1000LL;
+	return default_usecs * 1000LL;
+}
+
+/* Send what a bundle holds, as its member's tenant; a lone message goes
+ * out as it is. */
+static void send_bundle(struct chat_bundle *b) {
+	struct tenant *current = tenant;
+	char *msg = b->buf;
+	int len = b->len;
+
+	if(b->count == 0)
+		return;
+
+	if(b->count == 1) {
+		msg = b->buf + sizeof(struct chat_msghdr) + sizeof(u_int16_t);
+		len -= sizeof(struct chat_msghdr) + sizeof(u_int16_t);
+	} else {
+		((struct chat_msghdr *)b->buf)->msg_len = htons(CHAT_BUNDLE_FLAG | b->count);
+	}
+
+	tenant = b->tenant;
+	if(sendto(tenant->udp_socket_fd, msg, len, 0,
+		  (struct sockaddr *)&b->mt->member_udp_addr,
+		  sizeof(struct sockaddr_in)) < 0)
+		perror("send to");
+	stats_record_bundle(b->count);
+	tenant = current;
+
+	b->count = 0;
+	b->len = sizeof(struct chat_msghdr);
+}
+
+/* Take a bundle off the pending list, if it is on it. */
+static void unlink_pending(struct chat_bundle *b) {
+	struct chat_bundle **pp;
+
+	if(!b->pending)
+		return;
+	for(pp = &pending_list; *pp != NULL; pp = &(*pp)->next_pending) {
+		if(*pp == b) {
+			*pp = b->next_pending;
+			break;
+		}
+	}
+	b->pending = 0;
+}
+
+int
+coalesce_add(struct member_type *mt, char *msg, int len) {
+	struct chat_bundle *b = mt->bundle;
+	long long window = mt->current_room->coalesce_ns;
+
+	if(window == 0 || !(mt->caps & CAP_BUNDLE)) {
+		if(b != NULL && b->count != 0)
+			coalesce_flush_member(mt);
+		return 0;
+	}
+
+	/* too big to share a datagram: it goes alone, after what is held */
+	if(sizeof(struct chat_msghdr) + sizeof(u_int16_t) + len > COALESCE_MTU) {
+		if(b != NULL && b->count != 0)
+			coalesce_flush_member(mt);
+		return 0;
+	}
+
+	if(b == NULL) {
+		if((b = (struct chat_bundle *)calloc(1, sizeof(struct chat_bundle))) == NULL) {
+			printf("Memory used up when trying to coalesce\n");
+			exit(1);
+		}
+		b->mt = mt;
+		b->tenant = tenant;
+		b->len = sizeof(struct chat_msghdr);
+		mt->bundle = b;
+	}
+
+	if(b->len + sizeof(u_int16_t) + len > COALESCE_MTU)
+		send_bundle(b);
+
+	if(!b->pending) {
+		b->deadline = mono_ns() + window;
+		b->pending = 1;
+		b->next_pending = pending_list;
+		pending_list = b;
+		if(b->next_pending == NULL || b->deadline < next_deadline)
+			next_deadline = b->deadline;
+	}
+
+	*(u_int16_t *)(b->buf + b->len) = htons(len);
+	memcpy(b->buf + b->len + sizeof(u_int16_t), msg, len);
+	b->len += sizeof(u_int16_t) + len;
+	b->count++;
+	return 1;
+}
+
+void
+coalesce_flush_due() {
+	struct chat_bundle **pp, *b;
+	long long now;
+
+	if(pending_list == NULL || (now = mono_ns()) < next_deadline)
+		return;
+
+	next_deadline = 0;
+	for(pp = &pending_list; (b = *pp) != NULL; ) {
+		if(b->deadline <= now) {
+			send_bundle(b);
+			*pp = b->next_pending;
+			b->pending = 0;
+			continue;
+		}
+		if(next_deadline == 0 || b->deadline < next_deadline)
+			next_deadline = b->deadline;
+		pp = &b->next_pending;
+	}
+}
+
+long long
+coalesce_wait_ns(long long now) {
+	if(pending_list == NULL)
+		return -1;
+	return (next_deadline > now) ? next_deadline - now : 0;
+}
+
+void
+coalesce_flush_member(struct member_type *mt) {
+	struct chat_bundle *b = mt->bundle;
+
+	if(b == NULL)
+		return;
+	send_bundle(b);
+	/* next_deadline may now be early, which only costs a wakeup */
+	unlink_pending(b);
+}
+
+void
+coalesce_drop(struct member_type *mt) {
+	if(mt->bundle == NULL)
+		return;
+	unlink_pending(mt->bundle);
+	free(mt->bundle);
+	mt->bundle = NULL;
+}
@@ -0,0 +1,127 @@
+/*
+ *      File:      server_coalesce.h
+ *
+ * Coalescing of chat messages on the way out. In a room with a window,
+ * the copies for a member that negotiated CAP_BUNDLE are not sent one by
+ * one: the first is held for up to the window, and what else comes for
+ * the member in the meantime is packed into the same datagram (a bundle,
+ * see defs_ext.h), up to COALESCE_MTU bytes. A busy room then costs each
+ * member one datagram, and one wakeup, per window instead of per message.
+ *
+ * The window is set per room with the room options (see create_room):
+ *   coalesce=<usecs>  hold messages for up to usecs microseconds
+ *   lowlat            never hold messages, whatever the server default
+ * Rooms that say neither get the server default (chatserver -w), which
+ * is no window at all unless given.
+ */
+
+#ifndef _SERVER_COALESCE_H
+#define _SERVER_COALESCE_H
+
+#include "server.h"
+
+/* the UDP payload of a datagram on a 1500 byte Ethernet MTU */
+#define COALESCE_MTU            1472
+
+/* longest window a room may ask for */
+#define COALESCE_MAX_USECS      5000
+
+/*
+ *  FUNCTION: coalesce_init
+ *
+ *  SYNOPSIS: set the window of rooms that do not choose one
+ *
+ *  PASS:     usecs ==> the window in microseconds, 0 for none
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     Must be called before any room is created.
+ *
+ */
+void coalesce_init(int usecs);
+
+/*
+ *  FUNCTION: coalesce_room_window
+ *
+ *  SYNOPSIS: work out the window of a new room
+ *
+ *  PASS:     opts ==> the room options
+ *
+ *  RETURN:   the window in nanoseconds, 0 for none
+ *
+ */
+long long coalesce_room_window(struct room_opts *opts);
+
+/*
+ *  FUNCTION: coalesce_add
+ *
+ *  SYNOPSIS: hold a chat message for a member, to be sent with others
+ *
+ *  PASS:     mt ==> the receiving member
+ *            msg ==> the message, as chat_msg_for() made it for mt
+ *            len ==> its length
+ *
+ *  RETURN:   1 if the message is held, 0 if the caller is to send it
+ *
+ *  NOTE:     Whatever is held for the member is sent first when the
+ *            message has to go on its own, so the order is kept.
+ *
+ */
+int coalesce_add(struct member_type *mt, char *msg, int len);
+
+/*
+ *  FUNCTION: coalesce_flush_due
+ *
+ *  SYNOPSIS: send the bundles whose window is over
+ *
+ *  PASS:     none
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     Cheap when nothing is held; the event loop calls it on
+ *            every round.
+ *
+ */
+void coalesce_flush_due();
+
+/*
+ *  FUNCTION: coalesce_wait_ns
+ *
+ *  SYNOPSIS: time until the next bundle is due
+ *
+ *  PASS:     now ==> mono_ns() of the caller
+ *
+ *  RETURN:   nanoseconds, 0 if one is due already, -1 if none is held
+ *
+ */
+long long coalesce_wait_ns(long long now);
+
+/*
+ *  FUNCTION: coalesce_flush_member
+ *
+ *  SYNOPSIS: send what is held for a member now
+ *
+ *  PASS:     mt ==> the member
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     Called when the member switches rooms, so the messages of
+ *            the old room arrive before anything of the new one.
+ *
+ */
+void coalesce_flush_member(struct member_type *mt);
+
+/*
+ *  FUNCTION: coalesce_drop
+ *
+ *  SYNOPSIS: throw away what is held for a member that leaves, and its
+ *            bundle buffer
+ *
+ *  PASS:     mt ==> the member
+ *
+ *  RETURN:   void
+ *
+ */
+void coalesce_drop(struct member_type *mt);
+
+#endif
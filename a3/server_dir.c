@@ -0,0 +1,347 @@
+/*
+ *      File:      server_dir.c
+ *
+ * The directory of rooms and members, see server_dir.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "server.h"
+#include "server_dir.h"
+
+#define ROOM_OF(name)   ((struct room_type *)((name) - offsetof(struct room_type, room_name)))
+#define MEMBER_OF(name) ((struct member_type *)((name) - offsetof(struct member_type, member_name)))
+
+/* a page being built */
+struct dir_page {
+	struct directory_reply *reply;
+	int used;               /* bytes of entries */
+	int count;
+	int max;                /* entries asked for */
+};
+
+/*
+ * Sorted arrays of names
+ */
+
+/* The first of n sorted names not before key. */
+static int lower_bound(char **names, int n, char *key) {
+	int lo = 0, hi = n, mid;
+
+	while(lo < hi) {
+		mid = (lo + hi) / 2;
+		if(strcmp(names[mid], key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* The names starting with prefix, from *lo up to but not including *hi. */
+static void prefix_range(char **names, int n, char *prefix, int *lo, int *hi) {
+	int len = strlen(prefix);
+	int l, h, mid;
+
+	*lo = l = lower_bound(names, n, prefix);
+	h = n;
+	while(l < h) {
+		mid = (l + h) / 2;
+		if(strncmp(names[mid], prefix, len) <= 0)
+			l = mid + 1;
+		else
+			h = mid;
+	}
+	*hi = l;
+}
+
+static void name_insert(char **names, int *n, char *name) {
+	int i = lower_bound(names, *n, name);
+
+	memmove(&names[i + 1], &names[i], (*n - i) * sizeof(char *));
+	names[i] = name;
+	(*n)++;
+}
+
+static void name_remove(char **names, int *n, char *name) {
+	int i;
+
+	/* names are unique, but look for this one all the same */
+	for(i = lower_bound(names, *n, name); i < *n && names[i] != name; i++)
+		;
+	if(i == *n)
+		return;
+	memmove(&names[i], &names[i + 1], (*n - i - 1) * sizeof(char *));
+	(*n)--;
+}
+
+/*
+ * The heap of rooms, most members first
+ */
+
+/* Whether room a comes before room b by size; ties go by name. */
+static int bigger(struct room_type *a, struct room_type *b) {
+	if(a->num_of_members != b->num_of_members)
+		return a->num_of_members > b->num_of_members;
+	return strcmp(a->room_name, b->room_name) < 0;
+}
+
+static void heap_set(int i, struct room_type *rt) {
+	tenant->dir_heap[i] = rt;
+	rt->dir_pos = i;
+}
+
+static void sift_up(int i) {
+	struct room_type *rt = tenant->dir_heap[i];
+
+	while(i > 0 && bigger(rt, tenant->dir_heap[(i - 1) / 2])) {
+		heap_set(i, tenant->dir_heap[(i - 1) / 2]);
+		i = (i - 1) / 2;
+	}
+	heap_set(i, rt);
+}
+
+static void sift_down(int i) {
+	struct room_type *rt = tenant->dir_heap[i];
+	int n = tenant->dir_num_rooms;
+	int c;
+
+	while((c = 2 * i + 1) < n) {
+		if(c + 1 < n && bigger(tenant->dir_heap[c + 1], tenant->dir_heap[c]))
+			c++;
+		if(!bigger(tenant->dir_heap[c], rt))
+			break;
+		heap_set(i, tenant->dir_heap[c]);
+		i = c;
+	}
+	heap_set(i, rt);
+}
+
+/*
+ * The first k rooms by size, in order. The heap is not touched: a second
+ * one holds the candidates, the children of the rooms taken so far.
+ */
+static int top_rooms(struct room_type **out, int k) {
+	int cand[MAX_NUM_OF_ROOMS];
+	int num_cand = 0, num_out = 0;
+	int i, c, top;
+
+	if(tenant->dir_num_rooms == 0)
+		return 0;
+	cand[num_cand++] = 0;
+
+	while(num_out < k && num_cand > 0) {
+		top = cand[0];
+		out[num_out++] = tenant->dir_heap[top];
+
+		/* take the best candidate off, then put its children on */
+		cand[0] = cand[--num_cand];
+		for(i = 0; (c = 2 * i + 1) < num_cand; i = c) {
+			if(c + 1 < num_cand
+			   && bigger(tenant->dir_heap[cand[c + 1]], tenant->dir_heap[cand[c]]))
+				c++;
+			if(!bigger(tenant->dir_heap[cand[c]], tenant->dir_heap[cand[i]]))
+				break;
+			top = cand[i]; cand[i] = cand[c]; cand[c] = top;
+		}
+		for(c = 2 * (out[num_out - 1]->dir_pos) + 1;
+		    c <= 2 * (out[num_out - 1]->dir_pos) + 2; c++) {
+			if(c >= tenant->dir_num_rooms)
+				break;
+			for(i = num_cand++; i > 0
+				    && bigger(tenant->dir_heap[c], tenant->dir_heap[cand[(i - 1) / 2]]);
+			    i = (i - 1) / 2)
+				cand[i] = cand[(i - 1) / 2];
+			cand[i] = c;
+		}
+	}
+	return num_out;
+}
+
+static int size_order(const void *a, const void *b) {
+	return bigger(*(struct room_type **)b, *(struct room_type **)a)
+		- bigger(*(struct room_type **)a, *(struct room_type **)b);
+}
+
+void
+dir_add_room(struct room_type *rt) {
+	if(tenant->dir_num_rooms >= MAX_NUM_OF_ROOMS)
+		return;
+	name_insert(tenant->dir_room_names, &tenant->dir_num_rooms, rt->room_name);
+	heap_set(tenant->dir_num_rooms - 1, rt);
+	sift_up(rt->dir_pos);
+}
+
+void
+dir_remove_room(struct room_type *rt) {
+	struct room_type *last;
+	int i = rt->dir_pos;
+	int n = tenant->dir_num_rooms;
+
+	if(i >= n || tenant->dir_heap[i] != rt)
+		return;
+	name_remove(tenant->dir_room_names, &tenant->dir_num_rooms, rt->room_name);
+
+	/* the last room takes its place, and goes up or down from there */
+	if(i != n - 1) {
+		last = tenant->dir_heap[n - 1];
+		heap_set(i, last);
+		sift_up(i);
+		sift_down(last->dir_pos);
+	}
+}
+
+void
+dir_room_resized(struct room_type *rt) {
+	if(rt->dir_pos >= tenant->dir_num_rooms || tenant->dir_heap[rt->dir_pos] != rt)
+		return;
+	sift_up(rt->dir_pos);
+	sift_down(rt->dir_pos);
+}
+
+void
+dir_add_member(struct member_type *mt) {
+	if(tenant->dir_num_members >= MAX_NUM_OF_MEMBERS)
+		return;
+	name_insert(tenant->dir_member_names, &tenant->dir_num_members, mt->member_name);
+}
+
+void
+dir_remove_member(struct member_type *mt) {
+	name_remove(tenant->dir_member_names, &tenant->dir_num_members, mt->member_name);
+}
+
+/* Add an entry to a page. Returns -1 once the page is full. */
+static int page_add(struct dir_page *pg, char *fmt, char *name, int n) {
+	char entry[MAX_ROOM_NAME_LEN + MAX_MEMBER_NAME_LEN + 16];
+	int len;
+
+	if(pg->count == pg->max)
+		return -1;
+	len = snprintf(entry, sizeof(entry), fmt, name, n);
+	if(pg->used + (pg->count != 0) + len > DIRECTORY_PAGE_BYTES)
+		return -1;
+
+	if(pg->count != 0)
+		pg->reply->entries[pg->used++] = ' ';
+	memcpy(pg->reply->entries + pg->used, entry, len);
+	pg->used += len;
+	pg->count++;
+	return 0;
+}
+
+/* The page of the rooms starting at cursor; the total is returned. */
+static int list_rooms(struct dir_page *pg, struct directory_request *req, int cursor) {
+	struct room_type *rooms[MAX_NUM_OF_ROOMS];
+	int lo, hi, n, i;
+
+	prefix_range(tenant->dir_room_names, tenant->dir_num_rooms, req->prefix, &lo, &hi);
+
+	if(ntohs(req->order) == DIR_BY_NAME) {
+		for(i = lo + cursor; i < hi; i++) {
+			if(page_add(pg, "[%s (%d)]", tenant->dir_room_names[i],
+				    ROOM_OF(tenant->dir_room_names[i])->num_of_members) < 0)
+				break;
+		}
+		return hi - lo;
+	}
+
+	/* by size: all of them from the heap, or those with the prefix sorted */
+	if(req->prefix[0] == '\0') {
+		n = top_rooms(rooms, (pg->max < hi - lo - cursor) ? cursor + pg->max : hi - lo);
+	} else {
+		for(n = 0, i = lo; i < hi; i++)
+			rooms[n++] = ROOM_OF(tenant->dir_room_names[i]);
+		qsort(rooms, n, sizeof(struct room_type *), size_order);
+	}
+	for(i = cursor; i < n; i++) {
+		if(page_add(pg, "[%s (%d)]", rooms[i]->room_name, rooms[i]->num_of_members) < 0)
+			break;
+	}
+	return hi - lo;
+}
+
+/* The page of the members starting at cursor; the total is returned, -1 if
+ * there is no such room. */
+static int list_members(struct dir_page *pg, struct directory_request *req, int cursor) {
+	struct member_type *mt;
+	int len = strlen(req->prefix);
+	int lo, hi, i, total;
+
+	if(req->room_name[0] == '\0') {
+		prefix_range(tenant->dir_member_names, tenant->dir_num_members, req->prefix,
+			     &lo, &hi);
+		for(i = lo + cursor; i < hi; i++) {
+			if(page_add(pg, "(%s)", tenant->dir_member_names[i], 0) < 0)
+				break;
+		}
+		return hi - lo;
+	}
+
+	i = lower_bound(tenant->dir_room_names, tenant->dir_num_rooms, req->room_name);
+	if(i == tenant->dir_num_rooms || strcmp(tenant->dir_room_names[i], req->room_name))
+		return -1;
+
+	/* in the order they joined; a room has few enough to count them all */
+	total = 0;
+	for(mt = ROOM_OF(tenant->dir_room_names[i])->member_list_head; mt != NULL;
+	    mt = mt->next_room_member) {
+		if(strncmp(mt->member_name, req->prefix, len))
+			continue;
+		if(total++ >= cursor)
+			page_add(pg, "(%s)", mt->member_name, 0);
+	}
+	return total;
+}
+
+void
+process_directory_request(int fd, struct member_type *mt, char *msg) {
+	struct control_msghdr *cmh = (struct control_msghdr *)msg;
+	struct directory_request *req = (struct directory_request *)cmh->msgdata;
+	char buf[sizeof(struct directory_reply) + DIRECTORY_PAGE_BYTES + 1];
+	struct dir_page pg;
+	int cursor, total;
+
+	if(cmh->msg_len < sizeof(struct control_msghdr) + sizeof(struct directory_request)
+	   || memchr(req->prefix, '\0', MAX_ROOM_NAME_LEN) == NULL
+	   || memchr(req->room_name, '\0', MAX_ROOM_NAME_LEN) == NULL
+	   || (ntohs(req->what) != DIR_ROOMS && ntohs(req->what) != DIR_MEMBERS)
+	   || (ntohs(req->order) != DIR_BY_NAME
+	       && (ntohs(req->order) != DIR_BY_SIZE || ntohs(req->what) != DIR_ROOMS))) {
+		strcpy(err_str, "Bad directory request!");
+		send_control_msg_reply(fd, DIRECTORY_FAIL, mt->member_id, err_str);
+		return;
+	}
+
+	bzero(buf, sizeof(buf));
+	pg.reply = (struct directory_reply *)buf;
+	pg.used = 0;
+	pg.count = 0;
+	pg.max = (ntohs(req->page_size) != 0) ? ntohs(req->page_size) : DIRECTORY_PAGE_BYTES;
+	/* unsigned, for a cursor past 2^31 not to turn into a negative index */
+	if(ntohl(req->cursor) > MAX_NUM_OF_MEMBERS)
+		cursor = MAX_NUM_OF_MEMBERS;
+	else
+		cursor = ntohl(req->cursor);
+
+	if(ntohs(req->what) == DIR_ROOMS)
+		total = list_rooms(&pg, req, cursor);
+	else if((total = list_members(&pg, req, cursor)) < 0) {
+		strcpy(err_str, "Room not found!");
+		send_control_msg_reply(fd, DIRECTORY_FAIL, mt->member_id, err_str);
+		return;
+	}
+
+	pg.reply->next_cursor = htonl(cursor + pg.count < total ? cursor + pg.count : 0);
+	pg.reply->count = htons(pg.count);
+	pg.reply->total = htons(total);
+	send_control_reply_data(fd, DIRECTORY_SUCC, mt->member_id, 0, buf,
+				sizeof(struct directory_reply) + pg.used + 1);
+}
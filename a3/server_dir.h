@@ -0,0 +1,94 @@
+/*
+ *      File:      server_dir.h
+ *
+ * The directory of rooms and members (see defs_ext.h), listed a page at a
+ * time. Each tenant keeps the names of its rooms and of its members in
+ * sorted arrays, so the names with a prefix are found by binary search,
+ * and its rooms in a heap by number of members, kept up to date as members
+ * come and go: the K most popular rooms take O(K log K) to list, without
+ * looking at the others. Rooms and members are put in and taken out of
+ * the directory where they are linked into and out of the tenant.
+ */
+
+#ifndef _SERVER_DIR_H
+#define _SERVER_DIR_H
+
+#include "server.h"
+
+/*
+ *  FUNCTION: dir_add_room
+ *
+ *  SYNOPSIS: put a new room in the directory
+ *
+ *  PASS:     rt ==> the room, with its name
+ *
+ *  RETURN:   void
+ *
+ */
+void dir_add_room(struct room_type *rt);
+
+/*
+ *  FUNCTION: dir_remove_room
+ *
+ *  SYNOPSIS: take a room that goes away out of the directory
+ *
+ *  PASS:     rt ==> the room
+ *
+ *  RETURN:   void
+ *
+ */
+void dir_remove_room(struct room_type *rt);
+
+/*
+ *  FUNCTION: dir_room_resized
+ *
+ *  SYNOPSIS: move a room in the heap after its number of members changed
+ *
+ *  PASS:     rt ==> the room
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     O(log n) in the number of rooms.
+ *
+ */
+void dir_room_resized(struct room_type *rt);
+
+/*
+ *  FUNCTION: dir_add_member
+ *
+ *  SYNOPSIS: put a new member in the directory
+ *
+ *  PASS:     mt ==> the member, with its name
+ *
+ *  RETURN:   void
+ *
+ */
+void dir_add_member(struct member_type *mt);
+
+/*
+ *  FUNCTION: dir_remove_member
+ *
+ *  SYNOPSIS: take a member that goes away out of the directory
+ *
+ *  PASS:     mt ==> the member
+ *
+ *  RETURN:   void
+ *
+ */
+void dir_remove_member(struct member_type *mt);
+
+/*
+ *  FUNCTION: process_directory_request
+ *
+ *  SYNOPSIS: answer a DIRECTORY_REQUEST with a page of the directory
+ *
+ *  PASS:     fd ==> the control connection, to answer on
+ *            mt ==> the member asking
+ *            msg ==> the request, header in host byte order
+ *
+ *  RETURN:   void
+ *
+ */
+void process_directory_request(int fd, struct member_type *mt, char *msg);
+
+#endif
@@ -0,0 +1,196 @@
+/*
+ *      File:      server_direct.c
+ *
+ * Direct messages between members, see server_direct.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "server.h"
+#include "server_binlog.h"
+#include "server_migrate.h"
+#include "server_overload.h"
+#include "server_msgstore.h"
+#include "server_direct.h"
+
+#define DIRECT_HDR_LEN  (sizeof(struct chat_msghdr) + sizeof(struct chat_direct))
+
+static char out[MAX_MSG_LEN];
+
+int
+is_chat_direct(char *buf, int n) {
+	struct chat_msghdr *cmh = (struct chat_msghdr *)buf;
+
+	return n >= sizeof(struct chat_msghdr)
+		&& (ntohs(cmh->msg_len) & (CHAT_DIRECT_FLAG | CHAT_NACK_FLAG | CHAT_BUNDLE_FLAG))
+		== CHAT_DIRECT_FLAG;
+}
+
+static void send_direct(int udp_socket_fd, char *msg, int len, struct member_type *to) {
+	if(sendto(udp_socket_fd, msg, len, 0, (struct sockaddr *)&to->member_udp_addr,
+		  sizeof(struct sockaddr_in)) < 0)
+		perror("send to");
+}
+
+/* The recipient named in a direct message, if it can take one. */
+static struct member_type *recipient(struct chat_direct *dm) {
+	struct member_type *to;
+
+	if(dm->member_id != 0)
+		to = find_member_with_id(ntohl(dm->member_id));
+	else if(memchr(dm->member_name, '\0', MAX_MEMBER_NAME_LEN) != NULL)
+		to = find_member_with_name(dm->member_name);
+	else
+		to = NULL;
+
+	if(to == NULL || !(to->caps & CAP_DIRECT) || to->moved_id != 0)
+		return NULL;
+	return to;
+}
+
+/* Drop a message nobody can take, and tell the sender if it asked. */
+static void unreachable(int udp_socket_fd, char *buf, int n, struct member_type *mt) {
+	struct chat_msghdr *cmh = (struct chat_msghdr *)out;
+	struct chat_direct *dm = (struct chat_direct *)cmh->msgdata;
+
+	tenant->direct_unreachable++;
+	binlog_event(EV_CHAT_DROP, DROP_NO_MEMBER, mt->member_id, 0, n, 0);
+	if(log_flag) {
+		fprintf(logfp,
+			"Direct message from [%s] is discarded because there is no one to take it!\n",
+			mt->member_name);
+		fflush(logfp);
+	}
+
+	if(!(ntohs(((struct chat_direct *)((struct chat_msghdr *)buf)->msgdata)->flags)
+	     & DIRECT_ACK_REQ))
+		return;
+
+	bzero(out, DIRECT_HDR_LEN);
+	memcpy(dm, ((struct chat_msghdr *)buf)->msgdata, sizeof(struct chat_direct));
+	dm->flags |= htons(DIRECT_ACK | DIRECT_UNREACHABLE);
+	cmh->msg_len = htons(CHAT_DIRECT_FLAG);
+	send_direct(udp_socket_fd, out, DIRECT_HDR_LEN, mt);
+}
+
+/* Pass an ack on from the recipient of a message to its sender. */
+static void pass_on_ack(int udp_socket_fd, char *buf, int n, struct sockaddr_in *from) {
+	struct chat_direct *dm = (struct chat_direct *)((struct chat_msghdr *)buf)->msgdata;
+	struct chat_msghdr *cmh = (struct chat_msghdr *)out;
+	struct member_type *acker, *to;
+
+	/* from the recipient, where it gets its messages */
+	if(memchr(dm->member_name, '\0', MAX_MEMBER_NAME_LEN) == NULL
+	   || (acker = find_member_with_name(dm->member_name)) == NULL
+	   || acker->member_udp_addr.sin_addr.s_addr != from->sin_addr.s_addr
+	   || acker->member_udp_addr.sin_port != from->sin_port)
+		return;
+	acker->quiet_flag = 0;
+
+	if((to = find_member_with_id(ntohl(dm->member_id))) == NULL
+	   || !(to->caps & CAP_DIRECT) || to->moved_id != 0)
+		return;
+
+	bzero(out, DIRECT_HDR_LEN);
+	strncpy(cmh->sender.member_name, acker->member_name, MAX_MEMBER_NAME_LEN);
+	cmh->msg_len = htons(CHAT_DIRECT_FLAG);
+	memcpy(cmh->msgdata, dm, sizeof(struct chat_direct));
+	send_direct(udp_socket_fd, out, DIRECT_HDR_LEN, to);
+
+	tenant->direct_acks++;
+	binlog_event(EV_CHAT_DIRECT, ntohs(dm->flags), acker->member_id, 0, n, 0);
+}
+
+void
+process_direct_msg(int udp_socket_fd, char *buf, int n,
+		   struct sockaddr_in *from) {
+	struct chat_msghdr *cmh = (struct chat_msghdr *)buf;
+	struct chat_direct *dm = (struct chat_direct *)cmh->msgdata;
+	struct chat_direct *out_dm = (struct chat_direct *)((struct chat_msghdr *)out)->msgdata;
+	struct member_type *mt, *to;
+	int text_len;
+
+	if(n < DIRECT_HDR_LEN)
+		return;
+	if(ntohs(dm->flags) & DIRECT_ACK) {
+		pass_on_ack(udp_socket_fd, buf, n, from);
+		return;
+	}
+
+	if((mt = find_sender(ntohs(cmh->sender.member_id),
+			     ntohs(((struct chat_sender_v2 *)&cmh->sender)->member_id_hi))) == NULL
+	   || !(mt->caps & CAP_DIRECT)) {
+		binlog_event(EV_CHAT_DROP, DROP_BAD_ID, ntohs(cmh->sender.member_id), 0, n, 0);
+		if(log_flag) {
+			fprintf(logfp,
+				"Direct message is discarded because the sender's member id is invalid!\n");
+			fflush(logfp);
+		}
+		return;
+	}
+	mt->quiet_flag = 0;
+
+	/* the recipient may well be there, or be known there */
+	if(mt->moved_id != 0) {
+		migrate_forward(buf, n, mt);
+		return;
+	}
+	if(overload_shed(mt, n)) {
+		binlog_event(EV_CHAT_DROP, DROP_SHED, mt->member_id, 0, n, 0);
+		return;
+	}
+
+	mt->num_direct_msgs++;
+	mt->num_direct_bytes += n;
+	tenant->direct_msgs++;
+	tenant->direct_bytes += n;
+
+	if((to = recipient(dm)) == NULL) {
+		unreachable(udp_socket_fd, buf, n, mt);
+		return;
+	}
+
+	/* under the sender's name, telling the recipient who it is to */
+	text_len = n - DIRECT_HDR_LEN;
+	memcpy(out, buf, n);
+	bzero(out, sizeof(struct chat_msghdr));
+	strncpy(((struct chat_msghdr *)out)->sender.member_name, mt->member_name,
+		MAX_MEMBER_NAME_LEN);
+	((struct chat_msghdr *)out)->msg_len = htons(CHAT_DIRECT_FLAG | text_len);
+	out_dm->member_id = htonl(mt->member_id);
+	out_dm->flags &= htons(DIRECT_ACK_REQ);
+	strncpy(out_dm->member_name, to->member_name, MAX_MEMBER_NAME_LEN);
+	send_direct(udp_socket_fd, out, n, to);
+	msgstore_append_direct(mt, to, buf + DIRECT_HDR_LEN, text_len);
+
+	binlog_event(EV_CHAT_DIRECT, ntohs(out_dm->flags), mt->member_id, 0, n, 0);
+	if(log_flag) {
+		fprintf(logfp, "Direct message from [%s %d] to [%s %d].\n",
+			mt->member_name, mt->member_id, to->member_name, to->member_id);
+		fprintf(logfp, "Received %d direct messages(%d bytes) from this member.\n",
+			mt->num_direct_msgs, mt->num_direct_bytes);
+		fflush(logfp);
+	}
+}
+
+void
+direct_report() {
+	FILE *fp = log_flag ? logfp : stdout;
+
+	if(tenant->direct_msgs != 0 || tenant->direct_acks != 0) {
+		fprintf(fp, "Direct messages: %lu (%lu bytes), %lu acks, %lu unreachable\n",
+			tenant->direct_msgs, tenant->direct_bytes, tenant->direct_acks,
+			tenant->direct_unreachable);
+		fflush(fp);
+	}
+	tenant->direct_msgs = 0;
+	tenant->direct_bytes = 0;
+	tenant->direct_acks = 0;
+	tenant->direct_unreachable = 0;
+}
@@ -0,0 +1,74 @@
+/*
+ *      File:      server_direct.h
+ *
+ * Direct messages between members (see defs_ext.h). A direct message is
+ * not queued on a room, filtered, kept or coalesced: the recipient is
+ * looked up in the id or name index of the tenant (see index_member) and
+ * gets the one copy at once. What the sender wrote is counted apart from
+ * its chat messages, in num_direct_msgs and num_direct_bytes of its
+ * member_type, and for the tenant in the report every STATS_REPORT_INT
+ * seconds.
+ *
+ * Acks are passed on from the recipient to the sender as they come,
+ * if they come from the address the recipient gets its messages at. A
+ * message nobody can take - no such member, one without CAP_DIRECT, or
+ * one whose room moved to another node - is dropped, and the sender told
+ * so if it asked for an ack.
+ *
+ * While the server is overloaded, direct messages are shed like chat
+ * messages, see server_overload.h.
+ */
+
+#ifndef _SERVER_DIRECT_H
+#define _SERVER_DIRECT_H
+
+#include "server.h"
+
+/*
+ *  FUNCTION: is_chat_direct
+ *
+ *  SYNOPSIS: tell whether a datagram received on the chat port is a
+ *            direct message or an ack of one
+ *
+ *  PASS:     buf ==> the datagram
+ *            n ==> its length
+ *
+ *  RETURN:   1 if it is, 0 if not
+ *
+ */
+int is_chat_direct(char *buf, int n);
+
+/*
+ *  FUNCTION: process_direct_msg
+ *
+ *  SYNOPSIS: give a direct message to its recipient, or pass an ack on
+ *            to the member it is for
+ *
+ *  PASS:     udp_socket_fd ==> the socket it came in on, to send with
+ *            buf ==> the datagram
+ *            n ==> its length
+ *            from ==> where it came from
+ *
+ *  RETURN:   void
+ *
+ */
+void process_direct_msg(int udp_socket_fd, char *buf, int n,
+			struct sockaddr_in *from);
+
+/*
+ *  FUNCTION: direct_report
+ *
+ *  SYNOPSIS: log the direct messages of the current tenant since the last
+ *            report, then start a new window
+ *
+ *  PASS:     none
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     Called every STATS_REPORT_INT seconds, next to stats_report().
+ *            Prints nothing if there were none.
+ *
+ */
+void direct_report();
+
+#endif
@@ -0,0 +1,271 @@
+/*
+ *      File:      server_filter.c
+ *
+ * Aho-Corasick content filter, see server_filter.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include <netinet/in.h>
+
+#include "server.h"
+#include "server_stats.h"
+#include "server_filter.h"
+
+struct chat_filter {
+	int num_patterns;
+
+	/* characters that occur in no pattern all map to class 0 */
+	u_int8_t cls[256];
+	int num_cls;
+
+	/*
+	 * the automaton: go[state * num_cls + class] is the next state,
+	 * state 0 is the root; out_len is the length of the longest
+	 * pattern ending in a state, block whether a blocking one does
+	 */
+	int num_states;
+	u_int16_t *go;
+	u_int16_t *out_len;
+	u_int8_t *block;
+
+	/* cost counters, since the last filter_report() */
+	unsigned long msgs;
+	unsigned long long bytes;
+	unsigned long blocked;
+	unsigned long redacted;
+	long long ns;
+};
+
+static void *filter_alloc(size_t size) {
+	void *p;
+
+	if((p = calloc(1, size)) == NULL) {
+		printf("Memory used up when trying to set a filter\n");
+		exit(1);
+	}
+	return p;
+}
+
+void
+filter_free(struct chat_filter *f) {
+	if(f == NULL)
+		return;
+	free(f->go);
+	free(f->out_len);
+	free(f->block);
+	free(f);
+}
+
+/*
+ * Compile white space separated patterns. Returns NULL with *count 0
+ * for an empty list, or with *count -1 if it is over the limits.
+ */
+static struct chat_filter *filter_compile(char *spec, int *count) {
+	char *pats[FILTER_MAX_PATTERNS];
+	int blocks[FILTER_MAX_PATTERNS];
+	char *pat, *save;
+	struct chat_filter *f;
+	u_int16_t *fail, *queue;
+	int chars = 0, n = 0;
+	int i, s, c, t, head, tail;
+	unsigned char *p;
+
+	*count = 0;
+	for(pat = strtok_r(spec, " \t\r\n", &save); pat != NULL;
+	    pat = strtok_r(NULL, " \t\r\n", &save)) {
+		int block = (*pat == '!');
+
+		if(block)
+			pat++;
+		if(*pat == '\0')
+			continue;
+		if(n == FILTER_MAX_PATTERNS
+		   || (chars += strlen(pat)) > FILTER_MAX_CHARS) {
+			*count = -1;
+			return NULL;
+		}
+		pats[n] = pat;
+		blocks[n] = block;
+		n++;
+	}
+	if(n == 0)
+		return NULL;
+
+	f = (struct chat_filter *)filter_alloc(sizeof(struct chat_filter));
+	f->num_patterns = n;
+
+	/* one class per distinct character, case folded */
+	f->num_cls = 1;
+	for(i = 0; i < n; i++) {
+		for(p = (unsigned char *)pats[i]; *p != '\0'; p++) {
+			c = tolower(*p);
+			if(f->cls[c] == 0) {
+				f->cls[c] = f->num_cls++;
+				f->cls[toupper(c)] = f->cls[c];
+			}
+		}
+	}
+
+	/* the trie; a zero transition means none yet, as nothing goes to 0 */
+	f->go = (u_int16_t *)filter_alloc((chars + 1) * f->num_cls * sizeof(u_int16_t));
+	f->out_len = (u_int16_t *)filter_alloc((chars + 1) * sizeof(u_int16_t));
+	f->block = (u_int8_t *)filter_alloc(chars + 1);
+	f->num_states = 1;
+
+	for(i = 0; i < n; i++) {
+		s = 0;
+		for(p = (unsigned char *)pats[i]; *p != '\0'; p++) {
+			u_int16_t *g = &f->go[s * f->num_cls + f->cls[*p]];
+
+			if(*g == 0)
+				*g = f->num_states++;
+			s = *g;
+		}
+		f->out_len[s] = strlen(pats[i]);
+		f->block[s] |= blocks[i];
+	}
+
+	/*
+	 * Breadth first, fill in the failure transitions, so that every
+	 * state has a transition on every class. A state also reports the
+	 * matches of the state its failure link points to.
+	 */
+	fail = (u_int16_t *)filter_alloc(f->num_states * sizeof(u_int16_t));
+	queue = (u_int16_t *)filter_alloc(f->num_states * sizeof(u_int16_t));
+	head = tail = 0;
+
+	for(c = 0; c < f->num_cls; c++) {
+		if((t = f->go[c]) != 0)
+			queue[tail++] = t;
+	}
+	while(head < tail) {
+		s = queue[head++];
+		for(c = 0; c < f->num_cls; c++) {
+			u_int16_t *g = &f->go[s * f->num_cls + c];
+			u_int16_t via_fail = f->go[fail[s] * f->num_cls + c];
+
+			if(*g == 0) {
+				*g = via_fail;
+				continue;
+			}
+			t = *g;
+			fail[t] = via_fail;
+			if(f->out_len[via_fail] > f->out_len[t])
+				f->out_len[t] = f->out_len[via_fail];
+			f->block[t] |= f->block[via_fail];
+			queue[tail++] = t;
+		}
+	}
+
+	free(fail);
+	free(queue);
+
+	*count = n;
+	return f;
+}
+
+int
+filter_set(struct room_type *rt, char *spec) {
+	struct chat_filter *f, *old = rt->filter;
+	int count;
+
+	f = filter_compile(spec, &count);
+	if(count < 0)
+		return -1;
+
+	if(f != NULL && old != NULL) {
+		f->msgs = old->msgs;
+		f->bytes = old->bytes;
+		f->blocked = old->blocked;
+		f->redacted = old->redacted;
+		f->ns = old->ns;
+	}
+
+	/* fully built before it is put in place */
+	rt->filter = f;
+	filter_free(old);
+
+	if(log_flag) {
+		fprintf(logfp, "Filter of room [%s]: %d patterns, %d states, %d classes.\n",
+			rt->room_name, count, f ? f->num_states : 0, f ? f->num_cls : 0);
+		fflush(logfp);
+	}
+	return count;
+}
+
+/*
+ * Run len bytes through a filter, redacting them in place if redact is
+ * set; stops at a '\0' if nul_ends is.
+ */
+static int filter_bytes(struct chat_filter *f, unsigned char *text, int len,
+			int nul_ends, int redact) {
+	long long start = mono_ns();
+	int i, j, n, s = 0, redacted = 0, blocked = 0;
+
+	for(i = 0; i < len && !(nul_ends && text[i] == '\0'); i++) {
+		s = f->go[s * f->num_cls + f->cls[text[i]]];
+		if(f->out_len[s] == 0)
+			continue;
+		if(f->block[s]) {
+			blocked = 1;
+			break;
+		}
+		if(!redact)
+			continue;
+		/* overwrite the longest match ending here */
+		n = f->out_len[s];
+		for(j = i - n + 1; j <= i; j++)
+			text[j] = FILTER_REDACT_CHAR;
+		redacted = 1;
+	}
+
+	f->msgs++;
+	f->bytes += i;
+	f->blocked += blocked;
+	f->redacted += redacted && !blocked;
+	f->ns += mono_ns() - start;
+
+	if(blocked)
+		return FILTER_BLOCK;
+	return redacted ? FILTER_REDACTED : FILTER_PASS;
+}
+
+int
+filter_chat_msg(struct room_type *rt, struct chat_out *co) {
+	return filter_bytes(rt->filter, (unsigned char *)co->text, co->text_len, 1, 1);
+}
+
+int
+filter_bulk_chunk(struct room_type *rt, char *data, int len) {
+	return filter_bytes(rt->filter, (unsigned char *)data, len, 0, 0);
+}
+
+void
+filter_report() {
+	FILE *fp = log_flag ? logfp : stdout;
+	struct room_type *rt;
+	struct chat_filter *f;
+
+	for(rt = tenant->room_list_head; rt != NULL; rt = rt->next_room) {
+		if((f = rt->filter) == NULL || f->msgs == 0)
+			continue;
+
+		fprintf(fp, "Filter of room [%s]: %lu msgs %llu bytes, %lu blocked %lu redacted, "
+			"%.0fns/msg %.1fMB/s\n",
+			rt->room_name, f->msgs, f->bytes, f->blocked, f->redacted,
+			(double)f->ns / f->msgs,
+			f->ns > 0 ? f->bytes * 1000.0 / f->ns : 0.0);
+		fflush(fp);
+
+		f->msgs = 0;
+		f->bytes = 0;
+		f->blocked = 0;
+		f->redacted = 0;
+		f->ns = 0;
+	}
+}
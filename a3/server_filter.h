@@ -0,0 +1,112 @@
+/*
+ *      File:      server_filter.h
+ *
+ * Per-room content filter, applied to every chat message before it is
+ * numbered, kept or sent on. A room's patterns are set with
+ * FILTER_REQUEST (see defs_ext.h): a pattern starting with '!' blocks
+ * messages that contain it, any other pattern is redacted, overwritten
+ * with FILTER_REDACT_CHAR. Matching is on substrings, ignoring case.
+ *
+ * The patterns are compiled into an Aho-Corasick automaton, a full
+ * transition table over the characters that occur in the patterns, so
+ * a message is filtered in one pass whatever the number of patterns.
+ * The automaton is built when the patterns are set, never while
+ * forwarding, and replaces the old one in one pointer store.
+ */
+
+#ifndef _SERVER_FILTER_H
+#define _SERVER_FILTER_H
+
+#include "server.h"
+
+/* limits on the patterns of one room */
+#define FILTER_MAX_PATTERNS   64
+#define FILTER_MAX_CHARS      1024
+
+#define FILTER_REDACT_CHAR    '*'
+
+/* filter_chat_msg() results */
+#define FILTER_PASS           0
+#define FILTER_BLOCK          1
+#define FILTER_REDACTED       2
+
+/*
+ *  FUNCTION: filter_set
+ *
+ *  SYNOPSIS: compile a pattern list and make it the filter of a room
+ *
+ *  PASS:     rt ==> the room
+ *            spec ==> white space separated patterns, empty to remove
+ *                     the filter
+ *
+ *  RETURN:   number of patterns, -1 if over the limits (the old filter
+ *            stays in place)
+ *
+ *  NOTE:     The room's cost counters carry over to the new filter.
+ *
+ */
+int filter_set(struct room_type *rt, char *spec);
+
+/*
+ *  FUNCTION: filter_free
+ *
+ *  SYNOPSIS: free a room's filter, NULL is ignored
+ *
+ *  PASS:     f ==> the filter
+ *
+ *  RETURN:   void
+ *
+ */
+void filter_free(struct chat_filter *f);
+
+/*
+ *  FUNCTION: filter_chat_msg
+ *
+ *  SYNOPSIS: run an admitted chat message through its room's filter,
+ *            redacting it in place
+ *
+ *  PASS:     rt ==> the room, which has a filter
+ *            co ==> the message, text located by admit_chat_msg()
+ *
+ *  RETURN:   FILTER_PASS, FILTER_REDACTED if the text was changed, or
+ *            FILTER_BLOCK
+ *
+ */
+int filter_chat_msg(struct room_type *rt, struct chat_out *co);
+
+/*
+ *  FUNCTION: filter_bulk_chunk
+ *
+ *  SYNOPSIS: look for blocking patterns in the payload bytes of a bulk
+ *            chunk
+ *
+ *  PASS:     rt ==> the room, which has a filter
+ *            data ==> the bytes, binary: a '\0' does not end them
+ *            len ==> their number
+ *
+ *  RETURN:   FILTER_PASS or FILTER_BLOCK
+ *
+ *  NOTE:     Nothing is redacted, as that would corrupt what may be a
+ *            binary file. Each chunk is looked at on its own, as they
+ *            may come in any order, so a pattern cut across two chunks
+ *            is not seen.
+ *
+ */
+int filter_bulk_chunk(struct room_type *rt, char *data, int len);
+
+/*
+ *  FUNCTION: filter_report
+ *
+ *  SYNOPSIS: log the cost of filtering of each room since the last
+ *            report, then start a new window
+ *
+ *  PASS:     none
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     Called every STATS_REPORT_INT seconds, next to stats_report().
+ *
+ */
+void filter_report();
+
+#endif
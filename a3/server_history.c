@@ -0,0 +1,334 @@
+/*
+ *      File:      server_history.c
+ *
+ * Per-room message history in a shared arena, see server_history.h.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "server.h"
+#include "server_history.h"
+
+/* arena regions are handed out in multiples of this */
+#define HISTORY_ALIGN   64
+
+/* free extents of the arena; each room holds one region at most */
+#define HISTORY_MAX_EXTENTS  (MAX_NUM_OF_ROOMS + 2)
+
+struct extent {
+	int off;
+	int len;
+};
+
+static char *arena;
+static struct extent free_ext[HISTORY_MAX_EXTENTS];
+static int num_free_ext;
+
+/* where one message sits in a room's data area */
+struct hist_ent {
+	int off;
+	int len;
+};
+
+struct room_history {
+	/* the arena region: max_msgs index entries, then the data area */
+	int region_off;
+	int region_len;
+
+	struct hist_ent *ents;     /* circular, oldest at ents[first] */
+	int max_msgs;
+	int first;
+	int count;
+
+	char *data;                /* messages, written circularly */
+	int size;
+	int head;                  /* where the next message goes */
+};
+
+int
+history_init(int kbytes) {
+	int len = kbytes * 1024;
+
+	/* no arena, no history */
+	if(kbytes <= 0)
+		return 0;
+
+	arena = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(arena == MAP_FAILED) {
+		perror("history arena mmap");
+		arena = NULL;
+		return -1;
+	}
+
+	free_ext[0].off = 0;
+	free_ext[0].len = len;
+	num_free_ext = 1;
+
+	if(log_flag) {
+		fprintf(logfp, "Room history arena: %d KB\n", kbytes);
+		fflush(logfp);
+	}
+	return 0;
+}
+
+/* First fit allocation of len bytes of the arena; -1 if none is free. */
+static int arena_alloc(int len) {
+	int i, off;
+
+	for(i = 0; i < num_free_ext; i++) {
+		if(free_ext[i].len < len)
+			continue;
+		off = free_ext[i].off;
+		free_ext[i].off += len;
+		free_ext[i].len -= len;
+		if(free_ext[i].len == 0) {
+			memmove(&free_ext[i], &free_ext[i + 1],
+				(num_free_ext - i - 1) * sizeof(struct extent));
+			num_free_ext--;
+		}
+		return off;
+	}
+	return -1;
+}
+
+/* Return a region to the free list, merging it with its neighbours. */
+static void arena_free(int off, int len) {
+	int i;
+
+	/* the list is sorted by offset */
+	for(i = 0; i < num_free_ext && free_ext[i].off < off; i++)
+		;
+
+	if(i > 0 && free_ext[i - 1].off + free_ext[i - 1].len == off) {
+		free_ext[i - 1].len += len;
+		if(i < num_free_ext && off + len == free_ext[i].off) {
+			free_ext[i - 1].len += free_ext[i].len;
+			memmove(&free_ext[i], &free_ext[i + 1],
+				(num_free_ext - i - 1) * sizeof(struct extent));
+			num_free_ext--;
+		}
+		return;
+	}
+	if(i < num_free_ext && off + len == free_ext[i].off) {
+		free_ext[i].off = off;
+		free_ext[i].len += len;
+		return;
+	}
+
+	/* can't overflow: live regions and free extents alternate */
+	memmove(&free_ext[i + 1], &free_ext[i],
+		(num_free_ext - i) * sizeof(struct extent));
+	free_ext[i].off = off;
+	free_ext[i].len = len;
+	num_free_ext++;
+}
+
+struct room_history *
+history_create(int max_msgs, int max_bytes) {
+	struct room_history *rh;
+	int len, off;
+
+	if(arena == NULL || max_msgs <= 0)
+		return NULL;
+	if(max_msgs > HISTORY_MAX_MSGS)
+		max_msgs = HISTORY_MAX_MSGS;
+	if(max_bytes <= 0)
+		max_bytes = max_msgs * HISTORY_AVG_MSG_LEN;
+
+	len = max_msgs * sizeof(struct hist_ent) + max_bytes;
+	len = (len + HISTORY_ALIGN - 1) & ~(HISTORY_ALIGN - 1);
+	if((off = arena_alloc(len)) < 0)
+		return NULL;
+
+	if((rh = (struct room_history *)malloc(sizeof(struct room_history))) == NULL) {
+		printf("Memory used up when trying to create room\n");
+		exit(1);
+	}
+	bzero(rh, sizeof(struct room_history));
+
+	rh->region_off = off;
+	rh->region_len = len;
+	rh->ents = (struct hist_ent *)(arena + off);
+	rh->max_msgs = max_msgs;
+	rh->data = arena + off + max_msgs * sizeof(struct hist_ent);
+	rh->size = len - max_msgs * sizeof(struct hist_ent);
+
+	return rh;
+}
+
+void
+history_free(struct room_history *rh) {
+	if(rh == NULL)
+		return;
+	arena_free(rh->region_off, rh->region_len);
+	free(rh);
+}
+
+static struct hist_ent *hist_ent(struct room_history *rh, int i) {
+	return &rh->ents[(rh->first + i) % rh->max_msgs];
+}
+
+void
+history_store(struct room_history *rh, struct chat_out *co) {
+	char *msg;
+	int len;
+
+	len = chat_msg_fmt(co, CHAT_FMT_EXT, &msg);
+	history_put(rh, msg, len);
+}
+
+void
+history_put(struct room_history *rh, char *msg, int len) {
+	struct chat_ext_hdr *ext;
+	struct hist_ent *e;
+	int start;
+
+	if(len > rh->size)
+		return;
+
+	/* messages are never split: wrap to the start if it won't fit */
+	start = rh->head;
+	if(start + len > rh->size)
+		start = 0;
+
+	/*
+	 * messages are laid out in order, so the ones in the way are
+	 * always the oldest ones
+	 */
+	while(rh->count > 0) {
+		e = hist_ent(rh, 0);
+		if(rh->count < rh->max_msgs
+		   && (e->off >= start + len || start >= e->off + e->len))
+			break;
+		rh->first = (rh->first + 1) % rh->max_msgs;
+		rh->count--;
+	}
+
+	memcpy(rh->data + start, msg, len);
+	ext = (struct chat_ext_hdr *)((struct chat_msghdr *)(rh->data + start))->msgdata;
+	ext->flags |= htons(CHAT_FLAG_HISTORY);
+
+	e = hist_ent(rh, rh->count);
+	e->off = start;
+	e->len = len;
+	rh->count++;
+	rh->head = start + len;
+}
+
+/* Room sequence number of the i'th oldest kept message. */
+static u_int32_t hist_seq(struct room_history *rh, int i) {
+	struct chat_msghdr *cmh;
+
+	cmh = (struct chat_msghdr *)(rh->data + hist_ent(rh, i)->off);
+	return ntohl(((struct chat_ext_hdr *)cmh->msgdata)->room_seq);
+}
+
+u_int32_t
+history_oldest_seq(struct room_history *rh, struct room_type *rt) {
+	if(rh->count == 0)
+		return rt->room_seq + 1;
+	return hist_seq(rh, 0);
+}
+
+struct chat_msghdr *
+history_msg(struct room_history *rh, int i, int *len) {
+	if(i >= rh->count)
+		return NULL;
+	*len = hist_ent(rh, i)->len;
+	return (struct chat_msghdr *)(rh->data + hist_ent(rh, i)->off);
+}
+
+struct chat_msghdr *
+history_find(struct room_history *rh, u_int32_t seq) {
+	int lo = 0, hi = rh->count - 1, mid;
+	int32_t d;
+
+	/* kept in room sequence order */
+	while(lo <= hi) {
+		mid = (lo + hi) / 2;
+		d = (int32_t)(hist_seq(rh, mid) - seq);
+		if(d == 0)
+			return (struct chat_msghdr *)(rh->data + hist_ent(rh, mid)->off);
+		if(d < 0)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	return NULL;
+}
+
+int
+history_catch_up(int udp_socket_fd, struct member_type *mt,
+		 struct room_type *rt) {
+	static struct mmsghdr msgs[HISTORY_MAX_MSGS];
+	static struct iovec iovs[HISTORY_MAX_MSGS][2];
+	static struct chat_msghdr hdrs[HISTORY_MAX_MSGS];
+	struct room_history *rh = rt->history;
+	int use_ext = (mt->caps & CAP_EXT_HDR) != 0;
+	int bytes = 0;
+	int i, n, first, sent, ret;
+
+	if(rh == NULL || rh->count == 0)
+		return 0;
+
+	/* the newest messages that fit into one burst */
+	for(n = 0; n < rh->count; n++) {
+		struct hist_ent *e = hist_ent(rh, rh->count - 1 - n);
+		if(bytes + e->len > HISTORY_BURST_BYTES)
+			break;
+		bytes += e->len;
+	}
+	first = rh->count - n;
+
+	bzero(msgs, n * sizeof(struct mmsghdr));
+	for(i = 0; i < n; i++) {
+		struct hist_ent *e = hist_ent(rh, first + i);
+		char *rec = rh->data + e->off;
+
+		msgs[i].msg_hdr.msg_name = &mt->member_udp_addr;
+		msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+		msgs[i].msg_hdr.msg_iov = iovs[i];
+
+		if(use_ext) {
+			iovs[i][0].iov_base = rec;
+			iovs[i][0].iov_len = e->len;
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		} else {
+			/* plain header in front of the stored text */
+			memcpy(&hdrs[i], rec, sizeof(struct chat_msghdr));
+			hdrs[i].msg_len = htons(ntohs(hdrs[i].msg_len) & CHAT_LEN_MASK);
+			iovs[i][0].iov_base = &hdrs[i];
+			iovs[i][0].iov_len = sizeof(struct chat_msghdr);
+			iovs[i][1].iov_base = rec + sizeof(struct chat_msghdr)
+				+ sizeof(struct chat_ext_hdr);
+			iovs[i][1].iov_len = e->len - sizeof(struct chat_msghdr)
+				- sizeof(struct chat_ext_hdr);
+			msgs[i].msg_hdr.msg_iovlen = 2;
+		}
+	}
+
+	for(sent = 0; sent < n; sent += ret) {
+		if((ret = sendmmsg(udp_socket_fd, msgs + sent, n - sent, 0)) < 0) {
+			perror("sendmmsg");
+			break;
+		}
+	}
+
+	if(log_flag) {
+		fprintf(logfp, "Sent %d history messages(%d bytes) of room [%s] to [%s].\n",
+			sent, bytes, rt->room_name, mt->member_name);
+		fflush(logfp);
+	}
+	return sent;
+}
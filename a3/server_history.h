@@ -0,0 +1,165 @@
+/*
+ *      File:      server_history.h
+ *
+ * Per-room message history. Each room with history keeps its most recent
+ * messages, bounded both in number and in bytes, in a region carved out
+ * of one arena shared by all rooms. A member that switches into a room
+ * is sent the backlog, oldest first, in a single sendmmsg() burst.
+ *
+ * The size is set per room with the room options (see create_room):
+ *   history=<n>       keep the last n messages (0 turns history off)
+ *   histbytes=<n>[k]  keep at most n bytes (or n KB) of messages
+ */
+
+#ifndef _SERVER_HISTORY_H
+#define _SERVER_HISTORY_H
+
+#include "server.h"
+
+/* default size of the arena shared by all rooms, in KB */
+#define HISTORY_ARENA_KB        4096
+
+/* history of a room created without history options */
+#define HISTORY_DEFAULT_MSGS    20
+
+/* most messages a room may keep, and thus send to a joiner at once */
+#define HISTORY_MAX_MSGS        256
+
+/* bytes set aside per message when only a message count is given */
+#define HISTORY_AVG_MSG_LEN     512
+
+/*
+ * A catch-up burst never exceeds this many bytes, so it fits into a
+ * default socket receive buffer; older messages beyond it are not sent.
+ */
+#define HISTORY_BURST_BYTES     (128 * 1024)
+
+/*
+ *  FUNCTION: history_init
+ *
+ *  SYNOPSIS: set up the history arena
+ *
+ *  PASS:     kbytes ==> arena size in KB, 0 turns room history off
+ *
+ *  RETURN:   0 on success, -1 on failure
+ *
+ *  NOTE:     Must be called before any room is created.
+ *
+ */
+int history_init(int kbytes);
+
+/*
+ *  FUNCTION: history_create
+ *
+ *  SYNOPSIS: allocate the history of a room from the arena
+ *
+ *  PASS:     max_msgs ==> number of messages to keep
+ *            max_bytes ==> bytes of messages to keep, 0 for the default
+ *
+ *  RETURN:   the history, NULL if the arena has no room left
+ *
+ */
+struct room_history *history_create(int max_msgs, int max_bytes);
+
+/*
+ *  FUNCTION: history_free
+ *
+ *  SYNOPSIS: give a room's history back to the arena, NULL is ignored
+ *
+ *  PASS:     rh ==> the history
+ *
+ *  RETURN:   void
+ *
+ */
+void history_free(struct room_history *rh);
+
+/*
+ *  FUNCTION: history_store
+ *
+ *  SYNOPSIS: append an admitted chat message, dropping the oldest ones
+ *            as needed to stay within the room's limits
+ *
+ *  PASS:     rh ==> the room's history
+ *            co ==> the message, as set up by admit_chat_msg()
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     The stored copy is marked CHAT_FLAG_HISTORY.
+ *
+ */
+void history_store(struct room_history *rh, struct chat_out *co);
+
+/*
+ *  FUNCTION: history_put
+ *
+ *  SYNOPSIS: append a message that already has the extended header,
+ *            as history_store() does
+ *
+ *  PASS:     rh ==> the room's history
+ *            msg ==> the message, as returned by history_msg()
+ *            len ==> its length
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     For history brought over from another server; the room
+ *            sequence numbers must keep going up.
+ *
+ */
+void history_put(struct room_history *rh, char *msg, int len);
+
+/*
+ *  FUNCTION: history_msg
+ *
+ *  SYNOPSIS: get a kept message by age
+ *
+ *  PASS:     rh ==> the room's history
+ *            i ==> 0 for the oldest kept message, 1 for the next, ...
+ *            len ==> set to the length of the message
+ *
+ *  RETURN:   the message, with the extended header, NULL past the newest
+ *
+ */
+struct chat_msghdr *history_msg(struct room_history *rh, int i, int *len);
+
+/*
+ *  FUNCTION: history_oldest_seq
+ *
+ *  SYNOPSIS: room sequence number of the oldest message still kept
+ *
+ *  PASS:     rh ==> the room's history
+ *            rt ==> the room
+ *
+ *  RETURN:   the sequence number, the next one to come if none is kept
+ *
+ */
+u_int32_t history_oldest_seq(struct room_history *rh, struct room_type *rt);
+
+/*
+ *  FUNCTION: history_find
+ *
+ *  SYNOPSIS: look up a kept message by room sequence number
+ *
+ *  PASS:     rh ==> the room's history
+ *            seq ==> the room sequence number
+ *
+ *  RETURN:   the message, with the extended header, NULL if not kept
+ *
+ */
+struct chat_msghdr *history_find(struct room_history *rh, u_int32_t seq);
+
+/*
+ *  FUNCTION: history_catch_up
+ *
+ *  SYNOPSIS: send a member that just joined a room the room's backlog
+ *
+ *  PASS:     udp_socket_fd ==> the socket to send from
+ *            mt ==> the member, already in rt
+ *            rt ==> the room
+ *
+ *  RETURN:   number of messages sent
+ *
+ */
+int history_catch_up(int udp_socket_fd, struct member_type *mt,
+		     struct room_type *rt);
+
+#endif
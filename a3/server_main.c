@@ -19,22 +19,51 @@
  *   Please report bugs/comments to bogdan@cs.toronto.edu
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sched.h>
 
 #include <netinet/in.h>
 #include <netdb.h>
+#include <net/if.h>
 
 #include "server.h"
+#include "server_xdp.h"
+#include "server_stats.h"
+#include "server_binlog.h"
+#include "server_history.h"
+#include "server_msgstore.h"
+#include "server_filter.h"
+#include "server_coalesce.h"
+#include "server_mcast.h"
+#include "server_cluster.h"
+#include "server_standby.h"
+#include "server_tenant.h"
+#include "server_sched.h"
+#include "server_overload.h"
+#include "server_direct.h"
+#include "server_bulk.h"
+
+char optstr[]="t:u:f:s:r:x:b:c:l:a:m:w:g:k:j:y:T:o:";
 
-char optstr[]="t:u:f:s:r:";
+/*
+ * Busy polling: after a chat message arrives the loop keeps spinning on the
+ * UDP socket with non-blocking recvmmsg() and only goes back to sleeping in
+ * select() once no message has shown up for BUSY_POLL_IDLE_NS. The control
+ * descriptors are looked at every BUSY_POLL_SPINS rounds while spinning,
+ * or every round while the server is overloaded (see server_overload.h).
+ */
+#define BUSY_POLL_IDLE_NS   1000000LL
+#define BUSY_POLL_SPINS     64
 
 void 
 usage(char **argv) {
 	printf("usage:\n");
-	printf("%s -t <tcp port> -u <udp port> [-f <log file name> -s <sweep interval(mins) -r <room file name>]\n", argv[0]);
+	printf("%s -t <tcp port> -u <udp port> [-f <log file name> -s <sweep interval(mins) -r <room file name> -x <xdp interface>[:<queue>] -b <busy poll usecs> -c <cpu> -l <binary log prefix> -a <history arena KB> -m <message store dir>[:<retention hours>] -w <coalescing window usecs> -g <multicast group>[:<port>][@<interface address>] -k <cluster file>[:<node name>] -j <journal port> -y <primary host>:<journal port>[@<host name>] -T <tenant file> -o <shedding policy: large|rate>]\n", argv[0]);
 	exit(1);
 }
 
@@ -45,28 +74,74 @@ main(int argc, char **argv) {
 
 	int maxfd;
 	fd_set rset;
+	fd_set wset;
 	fd_set allset;
 	int num_ready_fds; 
+	int select_maxfd;
 
-	struct timeval *time_out;
 	struct timeval tv;
+	long long now_ns;
+	long long wait_ns;
+	long long held_ns;
+	long long slept_ns = 0;
+	long long next_sweep_ns;
+	long long next_report_ns;
+	long long next_expire_ns;
+
+	int busy_poll_usecs = 0;
+	int busy_poll_cpu = -1;
+	int spinning = 0;
+	unsigned long spins = 0;
+	long long last_chat_ns = 0;
+
+	char binlog_prefix[MAX_FILE_NAME_LEN];
+
+	int history_kbytes = HISTORY_ARENA_KB;
+
+	int coalesce_usecs = 0;
+
+	char mcast_spec[64];
+
+	char cluster_spec[MAX_FILE_NAME_LEN];
+
+	int journal_port = 0;
+	char primary_spec[MAX_LINE_LEN];
+
+	char store_dir[MAX_FILE_NAME_LEN];
+	int store_retention = 0;
+
+	char tenant_file[MAX_FILE_NAME_LEN];
+	struct tenant *t;
+
+	char xdp_if_name[IF_NAMESIZE + 8];
+	int xdp_queue_id = 0;
+	int xdp_fd = -1;
+
+	/* -t, -u and -r are about the default tenant */
+	tenant = tenant_default();
 
 	bzero(&log_file_name, MAX_FILE_NAME_LEN);
 	log_flag = 0;
 
-	bzero(&room_file_name, MAX_FILE_NAME_LEN);
+	bzero(&tenant->room_file_name, MAX_FILE_NAME_LEN);
+	bzero(&xdp_if_name, sizeof(xdp_if_name));
+	bzero(&binlog_prefix, MAX_FILE_NAME_LEN);
+	bzero(&store_dir, MAX_FILE_NAME_LEN);
+	bzero(&mcast_spec, sizeof(mcast_spec));
+	bzero(&cluster_spec, MAX_FILE_NAME_LEN);
+	bzero(&primary_spec, MAX_LINE_LEN);
+	bzero(&tenant_file, MAX_FILE_NAME_LEN);
 
-	time_out = (struct timeval *)NULL;
 	sweep_int = 0;
 
 	/* process arguments */
 	while((c = getopt(argc, argv, optstr)) != -1){
 		switch(c) {
 		case 't':
-			server_tcp_port = atoi(optarg);
+			tenant->server_tcp_port = atoi(optarg);
 			break;
 		case 'u':
-			server_udp_port = atoi(optarg);
+			tenant->server_udp_port = atoi(optarg);
 			break;
 		case 'f':
 			strncpy(log_file_name, optarg, MAX_FILE_NAME_LEN);
@@ -75,13 +150,59 @@ main(int argc, char **argv) {
 			sweep_int = atoi(optarg);
 
 			sweep_int *= 60;       /* convert to seconds */
-			tv.tv_sec = sweep_int;  
-			tv.tv_usec = 0;
-			if(sweep_int != 0) 
-				time_out = &tv;
 			break;
 		case 'r':
-			strncpy(room_file_name, optarg, MAX_FILE_NAME_LEN);
+			strncpy(tenant->room_file_name, optarg, MAX_FILE_NAME_LEN);
+			break;
+		case 'x':
+			strncpy(xdp_if_name, optarg, sizeof(xdp_if_name) - 1);
+			if(strchr(xdp_if_name, ':') != NULL) {
+				xdp_queue_id = atoi(strchr(xdp_if_name, ':') + 1);
+				*strchr(xdp_if_name, ':') = '\0';
+			}
+			break;
+		case 'b':
+			busy_poll_usecs = atoi(optarg);
+			break;
+		case 'c':
+			busy_poll_cpu = atoi(optarg);
+			break;
+		case 'l':
+			strncpy(binlog_prefix, optarg, MAX_FILE_NAME_LEN - 1);
+			break;
+		case 'a':
+			history_kbytes = atoi(optarg);
+			break;
+		case 'w':
+			coalesce_usecs = atoi(optarg);
+			break;
+		case 'g':
+			strncpy(mcast_spec, optarg, sizeof(mcast_spec) - 1);
+			break;
+		case 'k':
+			strncpy(cluster_spec, optarg, MAX_FILE_NAME_LEN - 1);
+			break;
+		case 'j':
+			journal_port = atoi(optarg);
+			break;
+		case 'y':
+			strncpy(primary_spec, optarg, MAX_LINE_LEN - 1);
+			break;
+		case 'T':
+			strncpy(tenant_file, optarg, MAX_FILE_NAME_LEN - 1);
+			break;
+		case 'o':
+			if(overload_init(optarg) < 0) {
+				printf("unknown shedding policy %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case 'm':
+			strncpy(store_dir, optarg, MAX_FILE_NAME_LEN - 1);
+			if(strchr(store_dir, ':') != NULL) {
+				store_retention = atoi(strchr(store_dir, ':') + 1);
+				*strchr(store_dir, ':') = '\0';
+			}
 			break;
 		default:
 			printf("invalid option\n");
@@ -89,10 +210,23 @@ main(int argc, char **argv) {
 		}
 	}
 
-	if(server_tcp_port == 0 || server_udp_port == 0) {
+	if(tenant->server_tcp_port == 0 || tenant->server_udp_port == 0) {
 		usage(argv);
 	}
 
+	if(tenant_file[0] != 0 && tenant_load(tenant_file) < 0) {
+		exit(1);
+	}
+
+	/* these work on the whole process, see server_tenant.h */
+	if(tenant_count() > 1
+	   && (cluster_spec[0] != 0 || journal_port != 0 || primary_spec[0] != 0
+	       || mcast_spec[0] != 0 || xdp_if_name[0] != 0 || store_dir[0] != 0
+	       || busy_poll_usecs != 0)) {
+		printf("-k, -j, -y, -g, -x, -m and -b need a single tenant\n");
+		exit(1);
+	}
+
 	if(log_file_name[0] != 0 ) {
 		log_flag = 1; 
 		if( (logfp = fopen(log_file_name, "a+")) == NULL) {
@@ -101,16 +235,83 @@ main(int argc, char **argv) {
 		}
 	}
 
+	if(binlog_prefix[0] != 0 && binlog_open(binlog_prefix) < 0) {
+		exit(1);
+	}
+
+	/* rooms in the room file get their history from it too */
+	if(history_init(history_kbytes) < 0) {
+		exit(1);
+	}
+
+	/* and their coalescing window */
+	coalesce_init(coalesce_usecs);
+
+	/* rooms in the room file are stored too */
+	if(store_dir[0] != 0 && msgstore_open(store_dir, store_retention) < 0) {
+		exit(1);
+	}
+
+	/* the room file only creates the rooms this node owns */
+	if(cluster_spec[0] != 0 && cluster_init(cluster_spec) < 0) {
+		exit(1);
+	}
 
 	/* initialize tcp and udp server; create rooms if config file present */
 	init_server();
 
+	/* rooms get multicast groups once the chat socket is there */
+	if(mcast_spec[0] != 0 && mcast_init(mcast_spec) < 0) {
+		exit(1);
+	}
+
+	/* a standby follows the primary until it goes away */
+	if(primary_spec[0] != 0 && standby_follow(primary_spec) < 0) {
+		exit(1);
+	}
+	if(journal_port != 0)
+		standby_serve(journal_port);
+
+	/* optional AF_XDP path; on failure we simply keep using the socket */
+	if(xdp_if_name[0] != 0)
+		xdp_fd = xdp_init(xdp_if_name, xdp_queue_id, tenant->server_udp_port);
+
 	/* usual preparation stuff for select() */
 	FD_ZERO(&allset);
-	FD_SET(tcp_socket_fd, &allset);
-	FD_SET(udp_socket_fd, &allset);
+	maxfd = -1;
+	for(t = tenant_default(); t != NULL; t = t->next_tenant) {
+		if(!standby_following()) {
+			FD_SET(t->tcp_socket_fd, &allset);
+			FD_SET(t->udp_socket_fd, &allset);
+		}
+		if(t->tcp_socket_fd > maxfd)
+			maxfd = t->tcp_socket_fd;
+		if(t->udp_socket_fd > maxfd)
+			maxfd = t->udp_socket_fd;
+	}
+
+	if(xdp_fd >= 0) {
+		FD_SET(xdp_fd, &allset);
+		if(xdp_fd > maxfd)
+			maxfd = xdp_fd;
+	}
+
+	if(busy_poll_usecs != 0)
+		set_busy_poll(tenant->udp_socket_fd, busy_poll_usecs);
 
-	maxfd = ((udp_socket_fd > tcp_socket_fd) ? udp_socket_fd : tcp_socket_fd);
+	if(busy_poll_cpu >= 0) {
+		cpu_set_t cpus;
+
+		CPU_ZERO(&cpus);
+		CPU_SET(busy_poll_cpu, &cpus);
+		if(sched_setaffinity(0, sizeof(cpus), &cpus) < 0)
+			perror("sched_setaffinity");
+	}
+
+	now_ns = mono_ns();
+	next_sweep_ns = now_ns + sweep_int * 1000000000LL;
+	next_report_ns = now_ns + STATS_REPORT_INT * 1000000000LL;
+	next_expire_ns = now_ns + MSGSTORE_EXPIRE_INT * 1000000000LL;
 
 	/*
 	 * server sits in an infinite loop waiting for events
@@ -121,119 +322,196 @@ main(int argc, char **argv) {
 	 *  2. chat client sends chat messages through udp
 	 *  3. server times out periodically to remove dormant/crashed 
 	 *     clients and rooms that do not have a member
-	 * if time_out == NULL, server will not time out, so 3. won't happen
+	 * if sweep_int == 0, server will not time out, so 3. won't happen
+	 *
+	 * in busy polling mode, 2. is mostly handled by spinning on the udp
+	 * socket while chat messages keep arriving
+	 *
+	 * with a message store, its segments are also sealed and expired
+	 * every MSGSTORE_EXPIRE_INT seconds
+	 *
+	 * chat messages are queued per room and sent on a share at a time
+	 * each round, rooms taking turns; a round with messages still
+	 * waiting does not sleep
+	 *
+	 * how long the rounds take, and how many messages wait, tell
+	 * whether the server is overloaded; if so, sweeping waits and chat
+	 * messages are shed
+	 *
+	 * chat messages held by the coalescing stage are sent when their
+	 * window is over, which may be well before any of the above
+	 *
+	 * a standby only applies the primary's journal, and does none of
+	 * the above until the primary goes away
+	 *
+	 * with several tenants, 1. and 2. happen on the ports of each, and
+	 * are handled with that tenant made the current one
 	 */
 
 	for( ; ; ) {
 
-		rset = allset;
+		overload_round(slept_ns);
+		slept_ns = 0;
 
-		if((num_ready_fds = select(maxfd+1, &rset, NULL, NULL, time_out)) < 0) {
-			perror("select");
-			exit(1);
+		if(spinning) {
+			int got = sched_ingest(tenant->udp_socket_fd);
+
+			if(xdp_fd >= 0)
+				process_xdp_chat_msgs(tenant->udp_socket_fd);
+
+			sched_run();
+			bulk_run();
+			coalesce_flush_due();
+
+			if(got > 0) {
+				last_chat_ns = mono_ns();
+			} else if(mono_ns() - last_chat_ns > BUSY_POLL_IDLE_NS) {
+				/* quiet: go back to sleeping in select() */
+				spinning = 0;
+			}
+
+			if(spinning && overload_state() == OVERLOAD_NONE
+			   && ++spins % BUSY_POLL_SPINS != 0)
+				continue;
 		}
 
-		if(num_ready_fds <=0 ) {
+		sched_run();
+		bulk_run();
+		coalesce_flush_due();
+
+		standby_tick();
+
+		now_ns = mono_ns();
+
+		/*
+		 * a standby leaves sweeping to the primary, and an overloaded
+		 * server to later: members may only seem quiet while it is
+		 * behind
+		 */
+		if(sweep_int != 0 && now_ns >= next_sweep_ns && !standby_following()) {
 			/* due to time out */
+			if(overload_state() == OVERLOAD_NONE) {
+				for(tenant = tenant_default(); tenant != NULL;
+				    tenant = tenant->next_tenant)
+					sweep_members_and_rooms();
+				tenant = tenant_default();
+			}
+			next_sweep_ns = now_ns + sweep_int * 1000000000LL;
+		}
 
-			struct member_type *mt;
-			struct room_type *rt;
+		if(now_ns >= next_report_ns) {
+			stats_report(busy_poll_usecs != 0 ? "busy-poll" : "select");
+			overload_report();
+			for(tenant = tenant_default(); tenant != NULL;
+			    tenant = tenant->next_tenant) {
+				filter_report();
+				sched_report();
+				direct_report();
+				bulk_report();
+			}
+			tenant = tenant_default();
+			tenant_report();
+			next_report_ns = now_ns + STATS_REPORT_INT * 1000000000LL;
+		}
 
-			/* go through the member list and sweep members that are there for
-			   more than 1 sweep interval without messages */
+		if(store_dir[0] != 0 && now_ns >= next_expire_ns) {
+			msgstore_expire();
+			next_expire_ns = now_ns + MSGSTORE_EXPIRE_INT * 1000000000LL;
+		}
 
-			mt = mem_list_head;
-			while(mt != NULL) {
-				struct member_type *tmp_mt;
+		/* sleep until the next timer, or just peek while spinning */
+		wait_ns = next_report_ns - now_ns;
+		if(sweep_int != 0 && next_sweep_ns - now_ns < wait_ns)
+			wait_ns = next_sweep_ns - now_ns;
+		if(store_dir[0] != 0 && next_expire_ns - now_ns < wait_ns)
+			wait_ns = next_expire_ns - now_ns;
+		held_ns = coalesce_wait_ns(now_ns);
+		if(held_ns >= 0 && held_ns < wait_ns)
+			wait_ns = held_ns;
+		if(overload_state() != OVERLOAD_NONE && OVERLOAD_TICK_NS < wait_ns)
+			wait_ns = OVERLOAD_TICK_NS;
+		if(spinning || sched_pending() || bulk_pending())
+			wait_ns = 0;
+		tv.tv_sec = wait_ns / 1000000000LL;
+		tv.tv_usec = (wait_ns % 1000000000LL) / 1000;
 
-				tmp_mt=mt->next_member;
+		rset = allset;
+		FD_ZERO(&wset);
+		select_maxfd = standby_fds(&rset, &wset, maxfd);
 
-				if(mt->quiet_flag == 0) {
-					/* active in the last time interval */
-					mt->quiet_flag ++ ; 
-				} else {
-					/* remove this member */
-					remove_member(mt);
-					if(log_flag) {
-						char *tp;
-						now = time(NULL);
-						tp = ctime(&now);
-						tp[strlen(tp)-1] = '\0';
-
-						fprintf(logfp, 
-							"%s member [%s] is removed from the session\n", 
-							tp, mt->member_name);
-						fprintf(logfp, "Total number of members:%d\n", 
-							total_num_of_members);
-						fflush(logfp);
-					}
-					free(mt);
+		now_ns = mono_ns();
+		if((num_ready_fds = select(select_maxfd+1, &rset, &wset, NULL, &tv)) < 0) {
+			perror("select");
+			exit(1);
+		}
+		slept_ns = mono_ns() - now_ns;
 
-				}
-				mt = tmp_mt; 
-			}
+		if(num_ready_fds <=0 ) {
+			/* timers are taken care of above */
+			continue;
+		}
 
-			/* go through room list */
-			rt = room_list_head;
-			while(rt != NULL) {
-				struct room_type *tmp_rt;
-				tmp_rt = rt->next_room;
-
-				if(rt->num_of_members == 0) {
-					if(rt->empty_flag == 0 ) {
-						rt->empty_flag ++;
-					} else {
-						/* remove this room */
-						remove_room(rt);
-						total_num_of_rooms --;
-
-						/* need to log this info */
-						if(log_flag) {
-							char *tp;
-							now = time(NULL);
-							tp = ctime(&now);
-							tp[strlen(tp)-1] = '\0';
-
-							fprintf(logfp, 
-								"%s room [%s] is removed from the session\n", 
-								tp, rt->room_name);
-							fprintf(logfp, "Total number of rooms:%d\n", 
-								total_num_of_rooms);
-							fflush(logfp);
-						}
-	
-						free(rt);
+		if((i = standby_ready(&rset, &wset)) > 0) {
 
-					}
-				}
+			/*
+			 * a standby or journal records for it, or if we are
+			 * the standby, records from the primary
+			 */
 
-				rt = tmp_rt;
+			if(!standby_following() && !FD_ISSET(tenant->tcp_socket_fd, &allset)) {
+				/* the primary is gone, our turn */
+				FD_SET(tenant->tcp_socket_fd, &allset);
+				FD_SET(tenant->udp_socket_fd, &allset);
 			}
 
-			/* reset the timer here */
-			if(sweep_int != 0) {
-				tv.tv_sec = sweep_int;  
-				tv.tv_usec = 0;
-				time_out = &tv;
-			}
-			continue;
+			if((num_ready_fds -= i) <= 0)
+				continue;
 		}
 
-		if(FD_ISSET(udp_socket_fd, &rset)) {
+		if(xdp_fd >= 0 && FD_ISSET(xdp_fd, &rset)) {
 
 			/*
-			 * message arrives at the udp server port 
-			 * --> chat message 
+			 * chat messages redirected to the AF_XDP socket
 			 */
 
-			process_chat_msg(udp_socket_fd);
+			process_xdp_chat_msgs(tenant->udp_socket_fd);
 
-			/* no more descriptors are ready, we go back to wait */
 			if( --num_ready_fds <= 0)
 				continue;
 		}
 
-		if(FD_ISSET(tcp_socket_fd, &rset)) {
+		for(t = tenant_default(); t != NULL && num_ready_fds > 0;
+		    t = t->next_tenant) {
+			if(!FD_ISSET(t->udp_socket_fd, &rset))
+				continue;
+
+			/*
+			 * message arrives at the udp server port of a
+			 * tenant --> chat message to it
+			 */
+
+			tenant = t;
+			if(busy_poll_usecs != 0) {
+				/* traffic again: start spinning */
+				sched_ingest(tenant->udp_socket_fd);
+				last_chat_ns = mono_ns();
+				spinning = 1;
+			} else {
+				/* all that is there, for the rooms to take turns */
+				sched_ingest(tenant->udp_socket_fd);
+			}
+
+			num_ready_fds--;
+		}
+
+		/* no more descriptors are ready, we go back to wait */
+		if(num_ready_fds <= 0)
+			continue;
+
+		for(t = tenant_default(); t != NULL && num_ready_fds > 0;
+		    t = t->next_tenant) {
+			if(!FD_ISSET(t->tcp_socket_fd, &rset))
+				continue;
 
 			/* 
 			 * a request to set up tcp connection for control messages 
@@ -243,7 +521,7 @@ main(int argc, char **argv) {
 			socklen_t client_addr_len = sizeof(struct sockaddr_in);
 			int connect_fd; 
 
-			if( (connect_fd = accept(tcp_socket_fd, 
+			if( (connect_fd = accept(t->tcp_socket_fd, 
 						 (struct sockaddr *)&client_addr, &client_addr_len)) < 0 ) {
 
 				perror("accept");
@@ -262,6 +540,7 @@ main(int argc, char **argv) {
 				for(i=0; i< MAX_CONTROL_SESSIONS; i++) {
 					if(fd_table[i] == -1){
 						fd_table[i] = connect_fd;
+						fd_tenant[i] = t;
 						break;
 					}
 				}
@@ -284,10 +563,12 @@ main(int argc, char **argv) {
 
 			}
 
-			if( --num_ready_fds <= 0)
-				continue;
+			num_ready_fds--;
 		}
 
+		if(num_ready_fds <= 0)
+			continue;
+
 		/* 
 		 * check which descriptor has data to read, and process 
 		 * the control message 
@@ -303,6 +584,7 @@ main(int argc, char **argv) {
 				continue;
 			
 			if(FD_ISSET(fd_table[i], &rset)) {
+				tenant = fd_tenant[i];
 				process_control_msg(fd_table[i]);
 				/*
 				 * close connection after processing since
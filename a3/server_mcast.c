@@ -0,0 +1,139 @@
+/*
+ *      File:      server_mcast.c
+ *
+ * IP multicast fan-out, see server_mcast.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "server.h"
+#include "server_stats.h"
+#include "server_coalesce.h"
+#include "server_mcast.h"
+
+/* group of room 0, host byte order; 0 while multicast is off */
+static u_int32_t base_group;
+static u_int16_t mcast_port;
+static struct in_addr mcast_if;
+
+int
+mcast_init(char *spec) {
+	char buf[64];
+	char *port, *ifaddr;
+	struct in_addr group;
+	unsigned char ttl = MCAST_TTL, loop = 1;
+
+	strncpy(buf, spec, sizeof(buf) - 1);
+	buf[sizeof(buf) - 1] = '\0';
+
+	if((ifaddr = strchr(buf, '@')) != NULL)
+		*ifaddr++ = '\0';
+	if((port = strchr(buf, ':')) != NULL)
+		*port++ = '\0';
+
+	if(inet_aton(buf, &group) == 0 || !IN_MULTICAST(ntohl(group.s_addr))) {
+		fprintf(stderr, "Bad multicast group %s\n", buf);
+		return -1;
+	}
+	mcast_port = port ? atoi(port) : tenant->server_udp_port + 1;
+	if(mcast_port == 0) {
+		fprintf(stderr, "Bad multicast port %s\n", port);
+		return -1;
+	}
+
+	mcast_if.s_addr = htonl(INADDR_ANY);
+	if(ifaddr != NULL && inet_aton(ifaddr, &mcast_if) == 0) {
+		fprintf(stderr, "Bad multicast interface address %s\n", ifaddr);
+		return -1;
+	}
+
+	if(setsockopt(tenant->udp_socket_fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0
+	   || setsockopt(tenant->udp_socket_fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0) {
+		perror("setsockopt multicast");
+		return -1;
+	}
+	if(ifaddr != NULL
+	   && setsockopt(tenant->udp_socket_fd, IPPROTO_IP, IP_MULTICAST_IF, &mcast_if, sizeof(mcast_if)) < 0) {
+		perror("setsockopt IP_MULTICAST_IF");
+		return -1;
+	}
+
+	base_group = ntohl(group.s_addr);
+
+	if(log_flag) {
+		fprintf(logfp, "Multicast groups from %s port %hu\n", buf, mcast_port);
+		fflush(logfp);
+	}
+	return 0;
+}
+
+int
+mcast_group_of(struct room_type *rt, struct mcast_group *mg) {
+	if(base_group == 0)
+		return 0;
+
+	mg->group = htonl(base_group + rt->room_id);
+	mg->port = htons(mcast_port);
+	mg->room_id = htons(rt->room_id);
+	mg->source = mcast_if.s_addr;
+	return 1;
+}
+
+void
+mcast_joined(struct member_type *mt) {
+	if(base_group == 0 || mt->mcast || !(mt->caps & CAP_MCAST))
+		return;
+
+	/* what is held for it by unicast comes first */
+	coalesce_flush_member(mt);
+
+	mt->mcast = 1;
+	mt->current_room->num_mcast_members++;
+
+	if(log_flag) {
+		fprintf(logfp, "Member [%s] gets room [%s] by multicast (%d members).\n",
+			mt->member_name, mt->current_room->room_name,
+			mt->current_room->num_mcast_members);
+		fflush(logfp);
+	}
+}
+
+void
+mcast_leave(struct member_type *mt) {
+	if(!mt->mcast)
+		return;
+
+	mt->mcast = 0;
+	mt->current_room->num_mcast_members--;
+}
+
+int
+mcast_send(struct room_type *rt, struct chat_out *co) {
+	struct sockaddr_in to;
+	char *msg;
+	int len;
+
+	if(rt->num_mcast_members == 0)
+		return 0;
+
+	len = chat_msg_fmt(co, CHAT_FMT_EXT, &msg);
+
+	bzero(&to, sizeof(to));
+	to.sin_family = AF_INET;
+	to.sin_addr.s_addr = htonl(base_group + rt->room_id);
+	to.sin_port = htons(mcast_port);
+
+	if(sendto(tenant->udp_socket_fd, msg, len, 0, (struct sockaddr *)&to,
+		  sizeof(struct sockaddr_in)) < 0) {
+		perror("send to group");
+		return 0;
+	}
+	stats_record_mcast(rt->num_mcast_members);
+	return 1;
+}
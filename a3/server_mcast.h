@@ -0,0 +1,98 @@
+/*
+ *      File:      server_mcast.h
+ *
+ * IP multicast fan-out. With chatserver -g <group>[:<port>][@<ifaddr>]
+ * every room gets a multicast group: the room with id n the group n
+ * addresses above <group>, all on <port> (the chat UDP port + 1 if not
+ * given), sent from the interface with address <ifaddr> (as routed if not
+ * given; give it on hosts without a multicast route, e.g. 127.0.0.1 to
+ * test over loopback).
+ *
+ * Members that negotiated CAP_MCAST are told the group of the room they
+ * join and report when they have joined it (see defs_ext.h). A message
+ * to the room then costs one datagram for all of them; the others, and
+ * members whose report does not arrive, get their copies by unicast.
+ * Retransmissions and history still go by unicast.
+ */
+
+#ifndef _SERVER_MCAST_H
+#define _SERVER_MCAST_H
+
+#include "server.h"
+
+/* datagrams sent to the groups do not leave the local network */
+#define MCAST_TTL           1
+
+/*
+ *  FUNCTION: mcast_init
+ *
+ *  SYNOPSIS: set up multicast on the chat UDP socket
+ *
+ *  PASS:     spec ==> <group>[:<port>][@<ifaddr>]
+ *
+ *  RETURN:   0 on success, -1 on failure (reported)
+ *
+ *  NOTE:     Call after init_server(). Without it multicast stays off
+ *            and every member gets its messages by unicast.
+ *
+ */
+int mcast_init(char *spec);
+
+/*
+ *  FUNCTION: mcast_group_of
+ *
+ *  SYNOPSIS: fill in the group of a room, to tell a joining member
+ *
+ *  PASS:     rt ==> the room
+ *            mg ==> filled in, in network byte order
+ *
+ *  RETURN:   1 if filled in, 0 if multicast is off
+ *
+ */
+int mcast_group_of(struct room_type *rt, struct mcast_group *mg);
+
+/*
+ *  FUNCTION: mcast_joined
+ *
+ *  SYNOPSIS: take a member's report that it joined the group of its room
+ *
+ *  PASS:     mt ==> the member
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     From now on the member gets the room's messages only through
+ *            the group.
+ *
+ */
+void mcast_joined(struct member_type *mt);
+
+/*
+ *  FUNCTION: mcast_leave
+ *
+ *  SYNOPSIS: go back to unicast for a member leaving its room
+ *
+ *  PASS:     mt ==> the member
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     Called before the member is taken out of the room.
+ *
+ */
+void mcast_leave(struct member_type *mt);
+
+/*
+ *  FUNCTION: mcast_send
+ *
+ *  SYNOPSIS: send an admitted chat message to the group of a room
+ *
+ *  PASS:     rt ==> the room
+ *            co ==> the message, as set up by admit_chat_msg()
+ *
+ *  RETURN:   1 if sent, 0 if no member of the room listens to the group
+ *
+ *  NOTE:     Members with mt->mcast set are skipped by the unicast loop.
+ *
+ */
+int mcast_send(struct room_type *rt, struct chat_out *co);
+
+#endif
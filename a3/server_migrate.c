@@ -0,0 +1,480 @@
+/*
+ *      File:      server_migrate.c
+ *
+ * Moving rooms between the nodes of a cluster, see server_migrate.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+#include "server.h"
+#include "server_stats.h"
+#include "server_binlog.h"
+#include "server_history.h"
+#include "server_coalesce.h"
+#include "server_mcast.h"
+#include "server_cluster.h"
+#include "server_standby.h"
+#include "server_migrate.h"
+#include "server_names.h"
+#include "server_sched.h"
+
+/* most members that fit into one ROOM_TRANSFER */
+#define MIGRATE_MAX_MEMBERS ((MAX_MSG_LEN - sizeof(struct control_msghdr) \
+			      - sizeof(struct room_transfer)) / sizeof(struct member_transfer))
+
+/* chat ports of the nodes rooms were moved to */
+static struct sockaddr_in node_udp[CLUSTER_MAX_NODES];
+
+/*
+ * Sends a request of len bytes, header in network byte order, to a node
+ * and reads its answer into reply, MAX_MSG_LEN bytes. Returns the type of
+ * the answer, -1 if there is none.
+ */
+static int transfer(int node, char *req, int len, char *reply, int *reply_len) {
+	struct sockaddr_in addr;
+	struct timeval tv;
+	int fd, n;
+
+	*reply_len = 0;
+	bzero(reply, MAX_MSG_LEN);
+	if(cluster_node_addr(node, SOCK_STREAM, &addr) < 0)
+		return -1;
+	if((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	/* the room is frozen while we wait */
+	tv.tv_sec = MIGRATE_TIMEOUT;
+	tv.tv_usec = 0;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+	   || send(fd, req, len, MSG_NOSIGNAL) != len) {
+		close(fd);
+		return -1;
+	}
+	while(*reply_len < MAX_MSG_LEN
+	      && (n = read(fd, reply + *reply_len, MAX_MSG_LEN - *reply_len)) > 0)
+		*reply_len += n;
+	close(fd);
+
+	if(*reply_len < sizeof(struct control_msghdr))
+		return -1;
+	return ntohs(((struct control_msghdr *)reply)->msg_type);
+}
+
+static void transfer_header(char *req, int len) {
+	struct control_msghdr *cmh = (struct control_msghdr *)req;
+
+	cmh->msg_type = htons(ROOM_TRANSFER);
+	cmh->member_id = 0;
+	cmh->msg_len = htons(len);
+	cmh->reserved = 0;
+}
+
+/* Sends the room's kept messages to a node; returns how many it took. */
+static int transfer_history(struct room_type *rt, int node) {
+	char req[MAX_MSG_LEN], reply[MAX_MSG_LEN];
+	struct room_transfer *rtr;
+	struct chat_msghdr *msg;
+	char *p;
+	int i = 0, count, len, reply_len, sent = 0;
+
+	if(rt->history == NULL)
+		return 0;
+
+	do {
+		bzero(req, MAX_MSG_LEN);
+		rtr = (struct room_transfer *)((struct control_msghdr *)req)->msgdata;
+		rtr->part = ROOM_TRANSFER_HISTORY;
+		strcpy(rtr->room_name, rt->room_name);
+
+		/* as many as fit, oldest first */
+		p = rtr->entries;
+		for(count = 0; (msg = history_msg(rt->history, i, &len)) != NULL; count++, i++) {
+			if(p + sizeof(u_int16_t) + len > req + MAX_MSG_LEN)
+				break;
+			*(u_int16_t *)p = htons(len);
+			memcpy(p + sizeof(u_int16_t), msg, len);
+			p += sizeof(u_int16_t) + len;
+		}
+		if(count == 0) {
+			/* one that never fits stays behind */
+			i++;
+			continue;
+		}
+		rtr->count = htons(count);
+		transfer_header(req, p - req);
+
+		if(transfer(node, req, p - req, reply, &reply_len) == ROOM_TRANSFER_SUCC)
+			sent += count;
+	} while(msg != NULL);
+
+	return sent;
+}
+
+/*
+ * Moves a room to a node. Returns how long it took in nanoseconds, or -1
+ * with err set if the room stays.
+ */
+static long long migrate_room(struct room_type *rt, int node, char *err) {
+	char req[MAX_MSG_LEN], reply[MAX_MSG_LEN];
+	struct control_msghdr *cmh = (struct control_msghdr *)req;
+	struct room_transfer *rtr = (struct room_transfer *)cmh->msgdata;
+	struct member_transfer *mtr;
+	struct member_type *mt, *next;
+	u_int32_t ids[MIGRATE_MAX_MEMBERS];
+	long long start = mono_ns();
+	int count, len, reply_len, members, hist_sent, i;
+
+	if(rt->num_of_members > MIGRATE_MAX_MEMBERS) {
+		strcpy(err, "Room has too many members to move!");
+		return -1;
+	}
+	if(cluster_node_addr(node, SOCK_DGRAM, &node_udp[node]) < 0) {
+		strcpy(err, "Host of the node is unknown!");
+		return -1;
+	}
+
+	/* what is queued or held for the members goes out from here */
+	sched_flush_room(rt);
+	for(mt = rt->member_list_head; mt != NULL; mt = mt->next_room_member)
+		coalesce_flush_member(mt);
+
+	bzero(req, MAX_MSG_LEN);
+	rtr->part = ROOM_TRANSFER_MEMBERS;
+	rtr->room_seq = htonl(rt->room_seq);
+	if(rt->room_opts[0] != '\0')
+		snprintf(rtr->room_name, sizeof(rtr->room_name), "%s:%s",
+			 rt->room_name, rt->room_opts);
+	else
+		strcpy(rtr->room_name, rt->room_name);
+
+	mtr = (struct member_transfer *)rtr->entries;
+	for(mt = rt->member_list_head; mt != NULL; mt = mt->next_room_member, mtr++) {
+		mtr->member_id = htonl(mt->member_id);
+		mtr->caps = htons(mt->caps);
+		mtr->addr = mt->member_udp_addr.sin_addr.s_addr;
+		mtr->port = mt->member_udp_addr.sin_port;
+		strncpy(mtr->member_name, mt->member_name, MAX_MEMBER_NAME_LEN);
+	}
+	count = rt->num_of_members;
+	rtr->count = htons(count);
+	len = (char *)mtr - req;
+	transfer_header(req, len);
+
+	switch(transfer(node, req, len, reply, &reply_len)) {
+	case ROOM_TRANSFER_SUCC:
+		break;
+	case ROOM_TRANSFER_FAIL:
+		snprintf(err, MAX_ERR_STR_LEN, "%s", (char *)((struct control_msghdr *)reply)->msgdata);
+		return -1;
+	default:
+		strcpy(err, "Node did not answer!");
+		return -1;
+	}
+	if(reply_len < sizeof(struct control_msghdr) + count * sizeof(u_int32_t)) {
+		strcpy(err, "Node answered for too few members!");
+		return -1;
+	}
+	memcpy(ids, ((struct control_msghdr *)reply)->msgdata, count * sizeof(u_int32_t));
+
+	/* the new node has the members, history is nice to have */
+	hist_sent = transfer_history(rt, node);
+
+	/* from now on the room is there, and we pass on what comes here */
+	cluster_move(rt->room_name, node);
+
+	for(mt = rt->member_list_head, i = 0; mt != NULL; mt = next, i++) {
+		next = mt->next_room_member;
+
+		mcast_leave(mt);
+		standby_log_leave(mt);
+		mt->moved_id = ntohl(ids[i]);
+		mt->moved_node = node;
+		mt->current_room = NULL;
+		mt->next_room_member = NULL;
+		mt->prev_room_member = NULL;
+	}
+	members = rt->num_of_members;
+	rt->member_list_head = NULL;
+	rt->member_list_tail = NULL;
+	rt->num_of_members = 0;
+
+	remove_room(rt);
+	tenant->total_num_of_rooms --;
+	binlog_event(EV_ROOM_REMOVE, 0, 0, rt->room_id, 0, 0);
+	standby_log_room_gone(rt);
+
+	start = mono_ns() - start;
+	stats_record_migration(start);
+
+	if(log_flag) {
+		fprintf(logfp, "Room [%s] moved to node [%s] in %lldus: %d members, "
+			"%d history messages.\n", rt->room_name, cluster_node_name(node),
+			start / 1000, members, hist_sent);
+		fprintf(logfp, "Total number of rooms:%d\n", tenant->total_num_of_rooms);
+		fflush(logfp);
+	}
+
+	free_room(rt);
+	return start;
+}
+
+void
+migrate_room_request(int fd, struct member_type *mt, char *buf) {
+	char *data = (char *)((struct control_msghdr *)buf)->msgdata;
+	char room_name[MAX_ROOM_NAME_LEN + 1];
+	char node_name[CLUSTER_NODE_NAME_LEN];
+	char reply[MAX_LINE_LEN];
+	struct room_type *rt;
+	long long ns;
+	int node;
+
+	if(sscanf(data, "%24s %31s", room_name, node_name) != 2) {
+		strcpy(err_str, "Expected a room and a node!");
+		send_control_msg_reply(fd, MOVE_ROOM_FAIL, mt->member_id, err_str);
+		return;
+	}
+
+	if(cluster_self() < 0) {
+		strcpy(err_str, "Server is not in a cluster!");
+		send_control_msg_reply(fd, MOVE_ROOM_FAIL, mt->member_id, err_str);
+		return;
+	}
+	if((node = cluster_find_node(node_name)) < 0) {
+		strcpy(err_str, "Node does not exist!");
+		send_control_msg_reply(fd, MOVE_ROOM_FAIL, mt->member_id, err_str);
+		return;
+	}
+	if(node == cluster_self()) {
+		strcpy(err_str, "Room is on this node already!");
+		send_control_msg_reply(fd, MOVE_ROOM_FAIL, mt->member_id, err_str);
+		return;
+	}
+
+	for(rt = tenant->room_list_head; rt != NULL; rt = rt->next_room) {
+		if(!strcmp(rt->room_name, room_name))
+			break;
+	}
+	if(rt == NULL) {
+		strcpy(err_str, "Room does not exist!");
+		send_control_msg_reply(fd, MOVE_ROOM_FAIL, mt->member_id, err_str);
+		return;
+	}
+
+	if((ns = migrate_room(rt, node, err_str)) < 0) {
+		send_control_msg_reply(fd, MOVE_ROOM_FAIL, mt->member_id, err_str);
+		return;
+	}
+
+	snprintf(reply, sizeof(reply), "Room %s moved to node %s in %lldus",
+		 room_name, node_name, ns / 1000);
+	send_control_msg_reply(fd, MOVE_ROOM_SUCC, mt->member_id, reply);
+}
+
+static void take_members(int fd, struct control_msghdr *cmh,
+			 struct room_transfer *rtr) {
+	struct member_transfer *mtr = (struct member_transfer *)rtr->entries;
+	u_int32_t ids[MIGRATE_MAX_MEMBERS];
+	char name[MAX_ROOM_NAME_LEN + 1];
+	char member_name[MAX_MEMBER_NAME_LEN];
+	struct sockaddr_in addr;
+	struct member_type *mt;
+	struct room_type *rt;
+	int count = ntohs(rtr->count);
+	int i, ret;
+
+	if(count > MIGRATE_MAX_MEMBERS
+	   || cmh->msg_len < (char *)(mtr + count) - (char *)cmh) {
+		strcpy(err_str, "Member list is cut short!");
+		send_control_msg_reply(fd, ROOM_TRANSFER_FAIL, 0, err_str);
+		return;
+	}
+	if(tenant->total_num_of_members + count > tenant->max_members) {
+		strcpy(err_str, "Number of members would exceed maximum!");
+		send_control_msg_reply(fd, ROOM_TRANSFER_FAIL, 0, err_str);
+		return;
+	}
+
+	/* the room lives here now, whatever its name hashes to */
+	strncpy(name, rtr->room_name, MAX_ROOM_NAME_LEN);
+	name[MAX_ROOM_NAME_LEN] = '\0';
+	if(strchr(name, ':') != NULL)
+		*strchr(name, ':') = '\0';
+	cluster_move(name, cluster_self());
+
+	if((ret = create_room(rtr->room_name)) != 0) {
+		snprintf(err_str, MAX_ERR_STR_LEN, "Room cannot be created here (%d)!", ret);
+		send_control_msg_reply(fd, ROOM_TRANSFER_FAIL, 0, err_str);
+		return;
+	}
+	rt = tenant->room_list_tail;
+	rt->room_seq = ntohl(rtr->room_seq);
+
+	bzero(&addr, sizeof(addr));
+	addr.sin_family = AF_INET;
+
+	for(i = 0; i < count; i++, mtr++) {
+		/* ids and names are only unique per node */
+		u_int32_t id = new_member_id(ntohs(mtr->caps), ntohl(mtr->member_id));
+
+		strncpy(member_name, mtr->member_name, MAX_MEMBER_NAME_LEN - 1);
+		member_name[MAX_MEMBER_NAME_LEN - 1] = '\0';
+		while(find_member_with_name(member_name) != NULL
+		      && strlen(member_name) < MAX_MEMBER_NAME_LEN - 1)
+			strcat(member_name, "_");
+
+		addr.sin_addr.s_addr = mtr->addr;
+		addr.sin_port = mtr->port;
+		mt = add_member(id, member_name, ntohs(mtr->caps), &addr);
+		standby_log_register(mt);
+		binlog_named_event(EV_MEMBER_JOIN, id, 0, member_name);
+
+		move_member(mt, rt);
+		standby_log_switch(mt);
+		names_announce(mt);
+		ids[i] = htonl(id);
+	}
+
+	send_control_reply_data(fd, ROOM_TRANSFER_SUCC, 0, 0, (char *)ids,
+				count * sizeof(u_int32_t));
+
+	if(log_flag) {
+		fprintf(logfp, "Room [%s] moved here with %d members.\n", rt->room_name, count);
+		fprintf(logfp, "Total number of members:%d\n", tenant->total_num_of_members);
+		fflush(logfp);
+	}
+}
+
+static void take_history(int fd, struct control_msghdr *cmh,
+			 struct room_transfer *rtr) {
+	struct room_type *rt;
+	char *p = rtr->entries;
+	char *end = (char *)cmh + (cmh->msg_len < MAX_MSG_LEN ? cmh->msg_len : MAX_MSG_LEN);
+	int count = ntohs(rtr->count);
+	int len;
+
+	for(rt = tenant->room_list_head; rt != NULL; rt = rt->next_room) {
+		if(!strcmp(rt->room_name, rtr->room_name))
+			break;
+	}
+	if(rt == NULL) {
+		strcpy(err_str, "Room does not exist!");
+		send_control_msg_reply(fd, ROOM_TRANSFER_FAIL, 0, err_str);
+		return;
+	}
+
+	while(count-- > 0 && p + sizeof(u_int16_t) <= end) {
+		len = ntohs(*(u_int16_t *)p);
+		p += sizeof(u_int16_t);
+		if(len < sizeof(struct chat_msghdr) + sizeof(struct chat_ext_hdr)
+		   || p + len > end)
+			break;
+
+		/* the room has another id here */
+		((struct chat_ext_hdr *)((struct chat_msghdr *)p)->msgdata)->room_id =
+			htons(rt->room_id);
+		if(rt->history != NULL)
+			history_put(rt->history, p, len);
+		p += len;
+	}
+
+	send_control_msg_reply(fd, ROOM_TRANSFER_SUCC, 0, NULL);
+}
+
+void
+migrate_transfer(int fd, char *buf) {
+	struct control_msghdr *cmh = (struct control_msghdr *)buf;
+	struct room_transfer *rtr = (struct room_transfer *)cmh->msgdata;
+	struct sockaddr_in peer_addr;
+	socklen_t peer_addr_len = sizeof(peer_addr);
+
+	/* only the nodes hand over rooms */
+	if(cluster_self() < 0
+	   || getpeername(fd, (struct sockaddr *)&peer_addr, &peer_addr_len) < 0
+	   || !cluster_is_node(&peer_addr.sin_addr)) {
+		strcpy(err_str, "Not a node of this cluster!");
+		send_control_msg_reply(fd, ROOM_TRANSFER_FAIL, 0, err_str);
+		return;
+	}
+	if(cmh->msg_len < sizeof(struct control_msghdr) + sizeof(struct room_transfer)) {
+		strcpy(err_str, "Room transfer is cut short!");
+		send_control_msg_reply(fd, ROOM_TRANSFER_FAIL, 0, err_str);
+		return;
+	}
+	rtr->room_name[sizeof(rtr->room_name) - 1] = '\0';
+
+	if(rtr->part == ROOM_TRANSFER_MEMBERS)
+		take_members(fd, cmh, rtr);
+	else if(rtr->part == ROOM_TRANSFER_HISTORY)
+		take_history(fd, cmh, rtr);
+}
+
+void
+migrate_forward(char *buf, int n, struct member_type *mt) {
+	struct chat_msghdr *cmh = (struct chat_msghdr *)buf;
+
+	cmh->sender.member_id = htons(mt->moved_id & 0xffff);
+	if(mt->caps & CAP_WIDE_ID)
+		((struct chat_sender_v2 *)&cmh->sender)->member_id_hi = htons(mt->moved_id >> 16);
+	if(sendto(tenant->udp_socket_fd, buf, n, 0, (struct sockaddr *)&node_udp[mt->moved_node],
+		  sizeof(struct sockaddr_in)) < 0) {
+		perror("send to node");
+		stats_record_handover(1);
+		return;
+	}
+	stats_record_handover(0);
+}
+
+void
+migrate_follow(int fd, struct member_type *mt, char *buf) {
+	struct control_msghdr *cmh = (struct control_msghdr *)buf;
+	char req[MAX_MSG_LEN], reply[MAX_MSG_LEN];
+	struct control_msghdr *req_hdr = (struct control_msghdr *)req;
+	int len, reply_len;
+
+	if(mt->caps & CAP_CLUSTER) {
+		char rd[sizeof(struct room_redirect) + MAX_HOST_NAME_LEN];
+
+		send_control_reply_data(fd, MEMBER_MOVED, mt->moved_id, 0, rd,
+					cluster_fill_redirect(mt->moved_node, rd));
+		if(log_flag) {
+			fprintf(logfp, "Member [%s] moved over to node [%s].\n",
+				mt->member_name, cluster_node_name(mt->moved_node));
+			fflush(logfp);
+		}
+		remove_member(mt);
+		free(mt);
+		return;
+	}
+
+	/* as if the member had sent it there */
+	len = cmh->msg_len < MAX_MSG_LEN ? cmh->msg_len : MAX_MSG_LEN;
+	memcpy(req, buf, len);
+	req_hdr->msg_type = htons(cmh->msg_type);
+	req_hdr->member_id = htons(mt->moved_id & 0xffff);
+	req_hdr->msg_len = htons(cmh->msg_len);
+	req_hdr->reserved = htons(mt->moved_id >> 16);
+
+	if(transfer(mt->moved_node, req, len, reply, &reply_len) >= 0) {
+		((struct control_msghdr *)reply)->member_id = htons(mt->member_id & 0xffff);
+		((struct control_msghdr *)reply)->reserved = htons(mt->member_id >> 16);
+		write(fd, reply, reply_len);
+	}
+
+	if(cmh->msg_type == QUIT_REQUEST) {
+		remove_member(mt);
+		free(mt);
+	}
+}
@@ -0,0 +1,92 @@
+/*
+ *      File:      server_migrate.h
+ *
+ * Moving a room to another node of a cluster (see server_cluster.h), as
+ * asked with MOVE_ROOM_REQUEST (see defs_ext.h), e.g. to take a busy room
+ * off a saturated node.
+ *
+ * The server does the whole move while handling the request, so nothing
+ * else happens to the room meanwhile: no member joins or leaves, and the
+ * chat messages sent to it wait in the socket. It sends messages held for
+ * coalescing, then the member list and the room's kept history to the
+ * new node, which creates the room under the same sequence numbers and
+ * answers with the members' ids there. Only then is the room given up
+ * here: its members stay behind as stubs pointing to the new node, and
+ * the messages that waited are passed on to it with the new ids.
+ *
+ * A stub passes on its member's chat messages until the member moves
+ * over. Members with CAP_CLUSTER do so on their next request, which is
+ * answered with MEMBER_MOVED; the requests of the others are passed on
+ * to the new node and its answers back, for as long as they stay.
+ *
+ * How long each room was frozen, and how many of the messages passed on
+ * could not be sent, go to the stats report. Retransmission rings,
+ * search indexes, filters and stored messages do not move.
+ */
+
+#ifndef _SERVER_MIGRATE_H
+#define _SERVER_MIGRATE_H
+
+#include "server.h"
+
+/* longest wait for the new node to answer, in seconds */
+#define MIGRATE_TIMEOUT     2
+
+/*
+ *  FUNCTION: migrate_room_request
+ *
+ *  SYNOPSIS: handle MOVE_ROOM_REQUEST
+ *
+ *  PASS:     fd ==> the control connection
+ *            mt ==> the member asking
+ *            buf ==> the request, header in host byte order
+ *
+ *  RETURN:   void
+ *
+ */
+void migrate_room_request(int fd, struct member_type *mt, char *buf);
+
+/*
+ *  FUNCTION: migrate_transfer
+ *
+ *  SYNOPSIS: handle ROOM_TRANSFER from another node
+ *
+ *  PASS:     fd ==> the control connection
+ *            buf ==> the request, header in host byte order
+ *
+ *  RETURN:   void
+ *
+ */
+void migrate_transfer(int fd, char *buf);
+
+/*
+ *  FUNCTION: migrate_forward
+ *
+ *  SYNOPSIS: pass a chat message of a moved member on to its new node
+ *
+ *  PASS:     buf ==> the message as received
+ *            n ==> its length
+ *            mt ==> the member's stub
+ *
+ *  RETURN:   void
+ *
+ */
+void migrate_forward(char *buf, int n, struct member_type *mt);
+
+/*
+ *  FUNCTION: migrate_follow
+ *
+ *  SYNOPSIS: answer a request of a moved member
+ *
+ *  PASS:     fd ==> the control connection
+ *            mt ==> the member's stub
+ *            buf ==> the request, header in host byte order
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     The stub is freed once the member has moved over or quit.
+ *
+ */
+void migrate_follow(int fd, struct member_type *mt, char *buf);
+
+#endif
@@ -0,0 +1,400 @@
+/*
+ *      File:      server_msgstore.c
+ *
+ * Durable message store writer, see server_msgstore.h and msgstore.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stddef.h>
+#include <endian.h>
+#include <errno.h>
+#include <glob.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "server.h"
+#include "server_stats.h"
+#include "server_msgstore.h"
+
+#define MSGSTORE_PATH_LEN  (MAX_FILE_NAME_LEN + MAX_ROOM_NAME_LEN + 16)
+
+/* the part of a segment header in front of the index */
+#define MSGSTORE_HDR_FIXED  offsetof(struct msgstore_seg_hdr, index)
+
+struct room_store {
+	char dir[MSGSTORE_PATH_LEN];
+	u_int32_t seg_no;
+
+	/* current segment, base NULL if none is open */
+	int fd;
+	char *base;
+};
+
+/* store directory, empty if the store is off */
+static char store_dir[MAX_FILE_NAME_LEN];
+static long long retention_ns;
+
+/* the direct messages, kept like a room's; dir empty if not kept */
+static struct room_store direct_store;
+static u_int32_t direct_seq;
+
+static void msgstore_disable(char *why) {
+	perror(why);
+	if(log_flag) {
+		fprintf(logfp, "Message store disabled: %s: %s\n", why, strerror(errno));
+		fflush(logfp);
+	}
+	store_dir[0] = '\0';
+}
+
+/* Number of the newest segment in a room directory, 0 if there is none. */
+static u_int32_t newest_segment(char *dir) {
+	char pattern[MSGSTORE_PATH_LEN + 8];
+	u_int32_t newest = 0;
+	glob_t g;
+	int i;
+
+	snprintf(pattern, sizeof(pattern), "%s/*.seg", dir);
+	if(glob(pattern, 0, NULL, &g) == 0) {
+		for(i = 0; i < g.gl_pathc; i++) {
+			u_int32_t n = strtoul(strrchr(g.gl_pathv[i], '/') + 1, NULL, 10);
+			if(n > newest)
+				newest = n;
+		}
+		globfree(&g);
+	}
+	return newest;
+}
+
+/*
+ * Read the header of the room's newest segment into hdr, and seal the
+ * segment if an earlier run left it open.
+ */
+static int seal_old_segment(struct room_store *rs, struct msgstore_seg_hdr *hdr) {
+	char name[MSGSTORE_PATH_LEN + 16];
+	int fd;
+
+	snprintf(name, sizeof(name), "%s/%06u.seg", rs->dir, rs->seg_no);
+	if((fd = open(name, O_RDWR)) < 0) {
+		perror(name);
+		return -1;
+	}
+	if(pread(fd, hdr, MSGSTORE_HDR_FIXED, 0) != MSGSTORE_HDR_FIXED
+	   || hdr->magic != MSGSTORE_MAGIC) {
+		close(fd);
+		return -1;
+	}
+
+	if(!(hdr->flags & MSGSTORE_SEALED)) {
+		hdr->flags |= MSGSTORE_SEALED;
+		if(ftruncate(fd, hdr->data_end) < 0
+		   || pwrite(fd, &hdr->flags, sizeof(hdr->flags),
+			     offsetof(struct msgstore_seg_hdr, flags)) < 0)
+			perror(name);
+	}
+	close(fd);
+	return 0;
+}
+
+int
+msgstore_open(char *dir, int retention_hours) {
+	struct msgstore_seg_hdr hdr;
+
+	strncpy(store_dir, dir, MAX_FILE_NAME_LEN - 1);
+	retention_ns = retention_hours * 3600LL * 1000000000LL;
+
+	if(mkdir(store_dir, 0755) < 0 && errno != EEXIST) {
+		msgstore_disable(store_dir);
+		return -1;
+	}
+
+	snprintf(direct_store.dir, sizeof(direct_store.dir), "%s/%s",
+		 store_dir, MSGSTORE_DIRECT_DIR);
+	direct_store.fd = -1;
+	if(mkdir(direct_store.dir, 0755) < 0 && errno != EEXIST) {
+		perror(direct_store.dir);
+		direct_store.dir[0] = '\0';
+	} else if((direct_store.seg_no = newest_segment(direct_store.dir)) != 0
+		  && seal_old_segment(&direct_store, &hdr) == 0) {
+		direct_seq = hdr.last_seq;
+	}
+
+	if(log_flag) {
+		fprintf(logfp, "Message store: %s, retention %d hours\n",
+			store_dir, retention_hours);
+		fflush(logfp);
+	}
+	return 0;
+}
+
+void
+msgstore_open_room(struct room_type *rt) {
+	struct room_store *rs;
+	struct msgstore_seg_hdr hdr;
+	char *p;
+
+	if(store_dir[0] == '\0')
+		return;
+
+	if((rs = (struct room_store *)malloc(sizeof(struct room_store))) == NULL) {
+		printf("Memory used up when trying to create room\n");
+		exit(1);
+	}
+	bzero(rs, sizeof(struct room_store));
+	rs->fd = -1;
+
+	/* the room name, made safe to use as a directory name */
+	snprintf(rs->dir, sizeof(rs->dir), "%s/%s", store_dir, rt->room_name);
+	p = rs->dir + strlen(store_dir) + 1;
+	if(*p == '.')
+		*p = '_';
+	for( ; *p != '\0'; p++) {
+		if(*p == '/')
+			*p = '_';
+	}
+
+	if(mkdir(rs->dir, 0755) < 0 && errno != EEXIST) {
+		perror(rs->dir);
+		free(rs);
+		return;
+	}
+	rt->store = rs;
+
+	/* stored before: pick up where the last run left off */
+	if((rs->seg_no = newest_segment(rs->dir)) != 0
+	   && seal_old_segment(rs, &hdr) == 0) {
+		rt->room_seq = hdr.last_seq;
+		if(log_flag) {
+			fprintf(logfp, "Message store of room [%s] continues after message %u.\n",
+				rt->room_name, rt->room_seq);
+			fflush(logfp);
+		}
+	}
+}
+
+/* Seal the current segment of a room: nothing is added to it any more. */
+static void seal_segment(struct room_store *rs) {
+	struct msgstore_seg_hdr *hdr = (struct msgstore_seg_hdr *)rs->base;
+	u_int32_t data_end = hdr->data_end;
+	u_int16_t flags = hdr->flags | MSGSTORE_SEALED;
+
+	msync(rs->base, MSGSTORE_SEGMENT_SIZE, MS_ASYNC);
+	munmap(rs->base, MSGSTORE_SEGMENT_SIZE);
+	rs->base = NULL;
+
+	/*
+	 * give back what the segment did not use, then mark it sealed:
+	 * chatstore takes a sealed segment to be final
+	 */
+	if(ftruncate(rs->fd, data_end) < 0
+	   || pwrite(rs->fd, &flags, sizeof(flags),
+		     offsetof(struct msgstore_seg_hdr, flags)) < 0)
+		perror("msgstore seal");
+	close(rs->fd);
+	rs->fd = -1;
+}
+
+/* Map a fresh, pre-allocated segment for a room, to start with message seq. */
+static int new_segment(struct room_store *rs, char *room_name, u_int32_t seq) {
+	char name[MSGSTORE_PATH_LEN + 16];
+	struct msgstore_seg_hdr *hdr;
+
+	if(rs->base != NULL)
+		seal_segment(rs);
+
+	rs->seg_no++;
+	snprintf(name, sizeof(name), "%s/%06u.seg", rs->dir, rs->seg_no);
+
+	if((rs->fd = open(name, O_RDWR | O_CREAT | O_EXCL, 0644)) < 0) {
+		msgstore_disable(name);
+		return -1;
+	}
+
+	/* allocate all blocks now, so appends never wait for the fs */
+	if(posix_fallocate(rs->fd, 0, MSGSTORE_SEGMENT_SIZE) != 0
+	   && ftruncate(rs->fd, MSGSTORE_SEGMENT_SIZE) < 0) {
+		close(rs->fd);
+		rs->fd = -1;
+		msgstore_disable("msgstore ftruncate");
+		return -1;
+	}
+
+	rs->base = mmap(NULL, MSGSTORE_SEGMENT_SIZE, PROT_READ | PROT_WRITE,
+			MAP_SHARED, rs->fd, 0);
+	if(rs->base == MAP_FAILED) {
+		rs->base = NULL;
+		close(rs->fd);
+		rs->fd = -1;
+		msgstore_disable("msgstore mmap");
+		return -1;
+	}
+
+	hdr = (struct msgstore_seg_hdr *)rs->base;
+	hdr->magic = MSGSTORE_MAGIC;
+	hdr->version = MSGSTORE_VERSION;
+	hdr->seg_no = rs->seg_no;
+	hdr->last_seq = seq;
+	hdr->data_end = sizeof(struct msgstore_seg_hdr);
+	strncpy(hdr->room_name, room_name, sizeof(hdr->room_name) - 1);
+
+	return 0;
+}
+
+void
+msgstore_close_room(struct room_type *rt) {
+	struct room_store *rs = rt->store;
+
+	if(rs == NULL)
+		return;
+	if(rs->base != NULL)
+		seal_segment(rs);
+	free(rs);
+	rt->store = NULL;
+}
+
+/*
+ * Append message seq to a store; head, if not NULL, is head_len bytes put
+ * in front of its text.
+ */
+static void append_rec(struct room_store *rs, char *room_name, u_int32_t seq, long long ts, struct member_type *mt, u_int16_t flags,
+		       char *head, int head_len, char *text, int text_len) {
+	struct msgstore_seg_hdr *hdr;
+	struct msgstore_rec *rec;
+	int len;
+
+	if(text_len > MAX_MSG_LEN)
+		text_len = MAX_MSG_LEN;
+	len = MSGSTORE_REC_LEN(head_len + text_len);
+
+	hdr = (struct msgstore_seg_hdr *)rs->base;
+	if(hdr == NULL || hdr->data_end + len > MSGSTORE_SEGMENT_SIZE
+	   || (hdr->count > 0 && ts - (long long)hdr->first_ns
+	       > MSGSTORE_ROLL_SECS * 1000000000LL)) {
+		if(new_segment(rs, room_name, seq) < 0)
+			return;
+		hdr = (struct msgstore_seg_hdr *)rs->base;
+	}
+
+	rec = (struct msgstore_rec *)(rs->base + hdr->data_end);
+	rec->room_seq = seq;
+	rec->ts_ns = ts;
+	rec->member_id = mt->member_id & 0xffff;
+	rec->text_len = head_len + text_len;
+	strncpy(rec->sender, mt->member_name, MAX_MEMBER_NAME_LEN);
+	rec->flags = flags;
+	if(head != NULL)
+		memcpy(rec->text, head, head_len);
+	memcpy(rec->text + head_len, text, text_len);
+	/* rec_len last: a non-zero length marks the record as complete */
+	rec->rec_len = len;
+
+	if(hdr->count % MSGSTORE_INDEX_EVERY == 0
+	   && hdr->index_count < MSGSTORE_INDEX_SLOTS) {
+		hdr->index[hdr->index_count].room_seq = rec->room_seq;
+		hdr->index[hdr->index_count].off = hdr->data_end;
+		hdr->index_count++;
+	}
+	if(hdr->count == 0) {
+		hdr->first_seq = rec->room_seq;
+		hdr->first_ns = ts;
+	}
+	hdr->last_seq = rec->room_seq;
+	hdr->last_ns = ts;
+	hdr->data_end += len;
+	hdr->count++;
+}
+
+void
+msgstore_append(struct room_type *rt, struct member_type *mt,
+		struct chat_out *co) {
+	struct room_store *rs = rt->store;
+
+	if(rs == NULL || store_dir[0] == '\0')
+		return;
+
+	append_rec(rs, rt->room_name, ntohl(co->ext.room_seq), be64toh(co->ext.server_ts),
+		   mt, 0, NULL, 0, co->text, co->text_len);
+}
+
+void
+msgstore_append_direct(struct member_type *mt, struct member_type *to,
+		       char *text, int text_len) {
+	char recipient[MAX_MEMBER_NAME_LEN];
+
+	if(direct_store.dir[0] == '\0' || store_dir[0] == '\0')
+		return;
+
+	bzero(recipient, sizeof(recipient));
+	strncpy(recipient, to->member_name, MAX_MEMBER_NAME_LEN - 1);
+	append_rec(&direct_store, MSGSTORE_DIRECT_DIR, ++direct_seq, wall_ns(), mt,
+		   MSGSTORE_REC_DIRECT, recipient, MAX_MEMBER_NAME_LEN, text, text_len);
+}
+
+void
+msgstore_expire() {
+	char pattern[MAX_FILE_NAME_LEN + 16];
+	struct msgstore_seg_hdr hdr;
+	struct room_type *rt;
+	long long now_ns;
+	glob_t g;
+	int i, fd, n, rooms;
+
+	if(store_dir[0] == '\0')
+		return;
+
+	now_ns = wall_ns();
+
+	/* seal the segments of quiet rooms too, so they can expire */
+	for(rt = tenant->room_list_head; rt != NULL; rt = rt->next_room) {
+		struct room_store *rs = rt->store;
+
+		if(rs != NULL && rs->base != NULL
+		   && now_ns - (long long)((struct msgstore_seg_hdr *)rs->base)->first_ns
+		      > MSGSTORE_ROLL_SECS * 1000000000LL)
+			seal_segment(rs);
+	}
+	if(direct_store.base != NULL
+	   && now_ns - (long long)((struct msgstore_seg_hdr *)direct_store.base)->first_ns
+	      > MSGSTORE_ROLL_SECS * 1000000000LL)
+		seal_segment(&direct_store);
+
+	if(retention_ns == 0)
+		return;
+
+	/* "*" does not match the direct messages' directory */
+	snprintf(pattern, sizeof(pattern), "%s/*/*.seg", store_dir);
+	rooms = (glob(pattern, 0, NULL, &g) == 0);
+	snprintf(pattern, sizeof(pattern), "%s/%s/*.seg", store_dir, MSGSTORE_DIRECT_DIR);
+	if(glob(pattern, rooms ? GLOB_APPEND : 0, NULL, &g) != 0 && !rooms)
+		return;
+
+	for(i = 0; i < g.gl_pathc; i++) {
+		if((fd = open(g.gl_pathv[i], O_RDONLY)) < 0)
+			continue;
+		n = pread(fd, &hdr, MSGSTORE_HDR_FIXED, 0);
+		close(fd);
+
+		if(n != MSGSTORE_HDR_FIXED || hdr.magic != MSGSTORE_MAGIC
+		   || !(hdr.flags & MSGSTORE_SEALED)
+		   || now_ns - (long long)hdr.last_ns < retention_ns)
+			continue;
+
+		if(unlink(g.gl_pathv[i]) < 0) {
+			perror(g.gl_pathv[i]);
+			continue;
+		}
+		if(log_flag) {
+			fprintf(logfp, "Message store segment %s expired.\n", g.gl_pathv[i]);
+			fflush(logfp);
+		}
+	}
+	globfree(&g);
+}
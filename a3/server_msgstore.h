@@ -0,0 +1,120 @@
+/*
+ *      File:      server_msgstore.h
+ *
+ * Durable message store. Every chat message the server forwards is
+ * appended to the segment files of its room (see msgstore.h for the
+ * format). The current segment of each room is memory mapped and
+ * pre-allocated, so appending a message is a memcpy() and never a system
+ * call; the kernel writes the pages back in large sequential runs.
+ *
+ * Segments are sealed once full or MSGSTORE_ROLL_SECS old. Sealed
+ * segments older than the retention time are removed. Use the chatstore
+ * tool to read the store, and to compact runs of small sealed segments.
+ *
+ * Direct messages are appended to a store of their own, with the names
+ * of their sender and recipient.
+ */
+
+#ifndef _SERVER_MSGSTORE_H
+#define _SERVER_MSGSTORE_H
+
+#include "server.h"
+#include "msgstore.h"
+
+/* a segment is sealed once its first message is this old */
+#define MSGSTORE_ROLL_SECS     3600
+
+/* how often msgstore_expire() should run */
+#define MSGSTORE_EXPIRE_INT    60
+
+/*
+ *  FUNCTION: msgstore_open
+ *
+ *  SYNOPSIS: start storing chat messages under a directory
+ *
+ *  PASS:     dir ==> the store directory, created if missing
+ *            retention_hours ==> how long sealed segments are kept,
+ *                                0 for forever
+ *
+ *  RETURN:   0 on success, -1 on failure
+ *
+ *  NOTE:     Must be called before any room is created.
+ *
+ */
+int msgstore_open(char *dir, int retention_hours);
+
+/*
+ *  FUNCTION: msgstore_open_room
+ *
+ *  SYNOPSIS: set up the store of a newly created room
+ *
+ *  PASS:     rt ==> the room
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     If the room was stored before, its last segment is sealed
+ *            and rt->room_seq continues from its last message. Does
+ *            nothing if the store is off.
+ *
+ */
+void msgstore_open_room(struct room_type *rt);
+
+/*
+ *  FUNCTION: msgstore_close_room
+ *
+ *  SYNOPSIS: seal the current segment of a room that is going away
+ *
+ *  PASS:     rt ==> the room
+ *
+ *  RETURN:   void
+ *
+ */
+void msgstore_close_room(struct room_type *rt);
+
+/*
+ *  FUNCTION: msgstore_append
+ *
+ *  SYNOPSIS: store an admitted chat message
+ *
+ *  PASS:     rt ==> the room it was sent to
+ *            mt ==> the sender
+ *            co ==> the message, as set up by admit_chat_msg()
+ *
+ *  RETURN:   void
+ *
+ */
+void msgstore_append(struct room_type *rt, struct member_type *mt,
+		     struct chat_out *co);
+
+/*
+ *  FUNCTION: msgstore_append_direct
+ *
+ *  SYNOPSIS: store a direct message that was sent on
+ *
+ *  PASS:     mt ==> the sender
+ *            to ==> the recipient
+ *            text ==> the text
+ *            text_len ==> its length
+ *
+ *  RETURN:   void
+ *
+ */
+void msgstore_append_direct(struct member_type *mt, struct member_type *to,
+			    char *text, int text_len);
+
+/*
+ *  FUNCTION: msgstore_expire
+ *
+ *  SYNOPSIS: seal segments that are due and remove the ones past the
+ *            retention time
+ *
+ *  PASS:     none
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     Called every MSGSTORE_EXPIRE_INT seconds from the main loop.
+ *
+ */
+void msgstore_expire();
+
+#endif
@@ -0,0 +1,107 @@
+/*
+ *      File:      server_names.c
+ *
+ * Name interning for the compact chat header, see server_names.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <netinet/in.h>
+
+#include "server.h"
+#include "server_stats.h"
+#include "server_coalesce.h"
+#include "server_names.h"
+
+int
+names_slot(struct room_type *rt) {
+	struct member_type *mt;
+	char *used;
+	int slot;
+
+	/* n members leave one of slots 0 to n free */
+	if((used = (char *)calloc(rt->num_of_members + 1, 1)) == NULL) {
+		printf("Memory used up when trying to give a slot\n");
+		exit(1);
+	}
+	for(mt = rt->member_list_head; mt != NULL; mt = mt->next_room_member) {
+		if(mt->room_slot <= rt->num_of_members)
+			used[mt->room_slot] = 1;
+	}
+	for(slot = 0; used[slot]; slot++)
+		;
+	free(used);
+	return slot;
+}
+
+int
+names_put_varint(char *p, u_int32_t v) {
+	int n = 0;
+
+	while(v >= 0x80) {
+		p[n++] = (char)(v | 0x80);
+		v >>= 7;
+	}
+	p[n++] = (char)v;
+	return n;
+}
+
+/* Appends the slot and name of mt to an announcement of len bytes. */
+static int put_name(char *buf, int len, struct member_type *mt) {
+	int n = strnlen(mt->member_name, MAX_MEMBER_NAME_LEN);
+
+	len += names_put_varint(buf + len, mt->room_slot);
+	memcpy(buf + len, mt->member_name, n);
+	buf[len + n] = '\0';
+	return len + n + 1;
+}
+
+static int start_announcement(char *buf, int flags) {
+	buf[0] = (char)CHAT_COMPACT_MARK;
+	buf[1] = (char)(CHAT_COMPACT_NAMES | flags);
+	return 2;
+}
+
+static void send_announcement(struct member_type *mt, char *buf, int len) {
+	if(sendto(tenant->udp_socket_fd, buf, len, 0,
+		  (struct sockaddr *)&mt->member_udp_addr, sizeof(struct sockaddr_in)) < 0) {
+		perror("send to");
+		return;
+	}
+	stats_record_names(len);
+}
+
+void
+names_announce(struct member_type *mt) {
+	char buf[COALESCE_MTU];
+	struct member_type *tmp_mptr;
+	int len;
+
+	/* its name to the others */
+	len = put_name(buf, start_announcement(buf, 0), mt);
+	for(tmp_mptr = mt->current_room->member_list_head; tmp_mptr != NULL;
+	    tmp_mptr = tmp_mptr->next_room_member) {
+		if(tmp_mptr == mt || !(tmp_mptr->caps & CAP_COMPACT))
+			continue;
+		coalesce_flush_member(tmp_mptr);
+		send_announcement(tmp_mptr, buf, len);
+	}
+
+	if(!(mt->caps & CAP_COMPACT))
+		return;
+
+	/* everyone's to it, in as few datagrams as they fit in */
+	len = start_announcement(buf, CHAT_COMPACT_RESET);
+	for(tmp_mptr = mt->current_room->member_list_head; tmp_mptr != NULL;
+	    tmp_mptr = tmp_mptr->next_room_member) {
+		if(len + VARINT_MAX_LEN + MAX_MEMBER_NAME_LEN + 1 > COALESCE_MTU) {
+			send_announcement(mt, buf, len);
+			len = start_announcement(buf, 0);
+		}
+		len = put_name(buf, len, tmp_mptr);
+	}
+	send_announcement(mt, buf, len);
+}
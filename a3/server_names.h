@@ -0,0 +1,63 @@
+/*
+ *      File:      server_names.h
+ *
+ * Name interning for the compact chat header (CAP_COMPACT, see
+ * defs_ext.h). Every member of a room has a slot there, a small number
+ * that compact messages carry instead of the 24 byte name; members that
+ * negotiated CAP_COMPACT are told the names behind the slots when someone
+ * joins their room. The sender's name is then only copied into a message
+ * for the members that still get the defs.h header.
+ *
+ * Slots are given by move_member() on any node, standby included, and
+ * not journalled: after a failover each member's first message carries
+ * its name again.
+ */
+
+#ifndef _SERVER_NAMES_H
+#define _SERVER_NAMES_H
+
+#include "server.h"
+
+/*
+ *  FUNCTION: names_slot
+ *
+ *  SYNOPSIS: pick a slot for a member joining a room
+ *
+ *  PASS:     rt ==> the room, without the member yet
+ *
+ *  RETURN:   the lowest slot no member of the room has
+ *
+ */
+int names_slot(struct room_type *rt);
+
+/*
+ *  FUNCTION: names_announce
+ *
+ *  SYNOPSIS: tell the members of a room that negotiated CAP_COMPACT the
+ *            name of a member that just joined, and the member all the
+ *            names of the room if it negotiated CAP_COMPACT itself
+ *
+ *  PASS:     mt ==> the member, in its new room
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     Messages held for coalescing go out first, so that none of
+ *            a member that left arrives under the new name of its slot.
+ *
+ */
+void names_announce(struct member_type *mt);
+
+/*
+ *  FUNCTION: names_put_varint
+ *
+ *  SYNOPSIS: write a number as a varint, see defs_ext.h
+ *
+ *  PASS:     p ==> where to, VARINT_MAX_LEN bytes
+ *            v ==> the number
+ *
+ *  RETURN:   the number of bytes written
+ *
+ */
+int names_put_varint(char *p, u_int32_t v);
+
+#endif
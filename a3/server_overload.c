@@ -0,0 +1,166 @@
+/*
+ *      File:      server_overload.c
+ *
+ * Overload detection and chat load shedding, see server_overload.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <netinet/in.h>
+
+#include "server.h"
+#include "server_stats.h"
+#include "server_sched.h"
+#include "server_tenant.h"
+#include "server_overload.h"
+
+static char *state_names[] = { "normal", "shedding", "critical" };
+
+static int policy = SHED_LARGE;
+static int state = OVERLOAD_NONE;
+
+/* moving average of the loop lag, over about 8 rounds */
+static long long lag_ns;
+static long long last_round_ns;
+
+/* when the load went under the bar for leaving the state, 0 if not */
+static long long calm_since;
+static long long entered_ns;
+
+/* since the state was entered, and since the last overload_report() */
+static unsigned long state_shed;
+static unsigned long shed;
+static long long max_lag_ns;
+
+int
+overload_init(char *name) {
+	if(name == NULL || name[0] == '\0' || !strcmp(name, "large"))
+		policy = SHED_LARGE;
+	else if(!strcmp(name, "rate"))
+		policy = SHED_RATE;
+	else
+		return -1;
+	return 0;
+}
+
+/* The state the load calls for; with half the bars to stay in one. */
+static int level(int queued, int half) {
+	if(lag_ns >= OVERLOAD_CRIT_LAG_NS >> half || queued >= OVERLOAD_CRIT_QUEUED >> half)
+		return OVERLOAD_CRITICAL;
+	if(lag_ns >= OVERLOAD_LAG_NS >> half || queued >= OVERLOAD_QUEUED >> half)
+		return OVERLOAD_SHED;
+	return OVERLOAD_NONE;
+}
+
+/* Everyone gets a full sweep interval to show up again. */
+static void forgive_quiet() {
+	struct tenant *current = tenant;
+	struct member_type *mt;
+
+	for(tenant = tenant_default(); tenant != NULL; tenant = tenant->next_tenant) {
+		for(mt = tenant->mem_list_head; mt != NULL; mt = mt->next_member)
+			mt->quiet_flag = 0;
+	}
+	tenant = current;
+}
+
+static void change_state(int to, long long now, int queued) {
+	FILE *fp = log_flag ? logfp : stdout;
+
+	if(to > state)
+		fprintf(fp, "Overload: %s -> %s, loop lag %.1fus, %d messages waiting\n",
+			state_names[state], state_names[to], lag_ns / 1000.0, queued);
+	else
+		fprintf(fp, "Overload: %s -> %s after %.1fs, %lu messages shed\n",
+			state_names[state], state_names[to],
+			(now - entered_ns) / 1000000000.0, state_shed);
+	fflush(fp);
+
+	if(to == OVERLOAD_NONE)
+		forgive_quiet();
+	if(state == OVERLOAD_NONE || to == OVERLOAD_NONE) {
+		entered_ns = now;
+		state_shed = 0;
+	}
+	state = to;
+	calm_since = 0;
+}
+
+void
+overload_round(long long slept_ns) {
+	long long now = mono_ns();
+	int queued = sched_queued();
+	int to;
+
+	if(last_round_ns != 0) {
+		lag_ns += (now - last_round_ns - slept_ns - lag_ns) / 8;
+		if(lag_ns > max_lag_ns)
+			max_lag_ns = lag_ns;
+	}
+	last_round_ns = now;
+
+	if((to = level(queued, 0)) > state) {
+		change_state(to, now, queued);
+		return;
+	}
+	if((to = level(queued, 1)) >= state) {
+		calm_since = 0;
+		return;
+	}
+	if(calm_since == 0)
+		calm_since = now;
+	else if(now - calm_since >= OVERLOAD_HOLD_NS)
+		change_state(to, now, queued);
+}
+
+int
+overload_state() {
+	return state;
+}
+
+int
+overload_shed(struct member_type *mt, int n) {
+	long long now, interval;
+	int rate;
+
+	if(state == OVERLOAD_NONE)
+		return 0;
+
+	if(policy == SHED_LARGE) {
+		if(n <= (state == OVERLOAD_CRITICAL ? OVERLOAD_CRIT_LARGE_LEN : OVERLOAD_LARGE_LEN))
+			return 0;
+	} else {
+		/* when it may send next without going over its rate, less the
+		 * burst it may send ahead of that */
+		rate = (state == OVERLOAD_CRITICAL) ? OVERLOAD_CRIT_RATE : OVERLOAD_RATE;
+		interval = 1000000000LL / rate;
+		now = mono_ns();
+		if(mt->shed_tat < now)
+			mt->shed_tat = now;
+		if(mt->shed_tat - now <= (OVERLOAD_BURST - 1) * interval) {
+			mt->shed_tat += interval;
+			return 0;
+		}
+	}
+
+	shed++;
+	state_shed++;
+	return 1;
+}
+
+void
+overload_report() {
+	FILE *fp = log_flag ? logfp : stdout;
+
+	if(state != OVERLOAD_NONE || shed != 0) {
+		fprintf(fp, "Overload: %s, loop lag %.1fus max %.1fus, %lu messages shed (%s first)\n",
+			state_names[state], lag_ns / 1000.0, max_lag_ns / 1000.0, shed,
+			policy == SHED_LARGE ? "large" : "rate limited");
+		fflush(fp);
+	}
+	shed = 0;
+	max_lag_ns = lag_ns;
+}
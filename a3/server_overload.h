@@ -0,0 +1,131 @@
+/*
+ *      File:      server_overload.h
+ *
+ * Overload control. The event loop tells the controller how long each
+ * round took, not counting the sleep in select(); that loop lag, kept
+ * as a moving average, and the number of chat messages waiting in the
+ * room queues (see server_sched.h) put the server in one of three
+ * states:
+ *   normal     nothing is done
+ *   shedding   lag of OVERLOAD_LAG_NS or OVERLOAD_QUEUED messages waiting
+ *   critical   lag of OVERLOAD_CRIT_LAG_NS or OVERLOAD_CRIT_QUEUED waiting
+ * A state is entered as soon as it is reached, and left once the load
+ * has stayed under half of what it takes to enter it for
+ * OVERLOAD_HOLD_NS, the loop waking up every OVERLOAD_TICK_NS at least
+ * to see it. Each change is logged.
+ *
+ * While overloaded, liveness and control come first:
+ *   - members are not swept, and when it is over everyone gets a full
+ *     sweep interval again: a keep alive that waited behind the chat
+ *     does not cost a member its session, nor us its re-registration
+ *   - the busy polling loop looks at the control descriptors on every
+ *     round instead of every BUSY_POLL_SPINS
+ *   - chat messages are shed as they come in, before they are queued,
+ *     by the policy given with chatserver -o:
+ *       large  messages over OVERLOAD_LARGE_LEN bytes, over
+ *              OVERLOAD_CRIT_LARGE_LEN when critical (the default)
+ *       rate   messages of members sending more than OVERLOAD_RATE a
+ *              second, OVERLOAD_CRIT_RATE when critical, in bursts of
+ *              up to OVERLOAD_BURST
+ *     a shed message still counts as a sign of life of its sender
+ */
+
+#ifndef _SERVER_OVERLOAD_H
+#define _SERVER_OVERLOAD_H
+
+#include "server.h"
+
+#define OVERLOAD_NONE           0
+#define OVERLOAD_SHED           1
+#define OVERLOAD_CRITICAL       2
+
+#define OVERLOAD_LAG_NS         5000000LL
+#define OVERLOAD_CRIT_LAG_NS    20000000LL
+#define OVERLOAD_QUEUED         512
+#define OVERLOAD_CRIT_QUEUED    2048
+#define OVERLOAD_HOLD_NS        1000000000LL
+
+/* longest sleep in select() while overloaded, to notice that it is over */
+#define OVERLOAD_TICK_NS        100000000LL
+
+/* shedding policies */
+#define SHED_LARGE              0
+#define SHED_RATE               1
+
+#define OVERLOAD_LARGE_LEN      512
+#define OVERLOAD_CRIT_LARGE_LEN 128
+
+/* messages a second */
+#define OVERLOAD_RATE           20
+#define OVERLOAD_CRIT_RATE      5
+#define OVERLOAD_BURST          10
+
+/*
+ *  FUNCTION: overload_init
+ *
+ *  SYNOPSIS: choose how chat messages are shed
+ *
+ *  PASS:     policy ==> "large" or "rate", NULL for the default
+ *
+ *  RETURN:   0 if success, -1 if the policy is unknown
+ *
+ */
+int overload_init(char *policy);
+
+/*
+ *  FUNCTION: overload_round
+ *
+ *  SYNOPSIS: account for a round of the event loop and work out the state
+ *
+ *  PASS:     slept_ns ==> time the round spent waiting in select()
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     Called at the start of every round.
+ *
+ */
+void overload_round(long long slept_ns);
+
+/*
+ *  FUNCTION: overload_state
+ *
+ *  SYNOPSIS: the current state
+ *
+ *  PASS:     none
+ *
+ *  RETURN:   OVERLOAD_NONE, OVERLOAD_SHED or OVERLOAD_CRITICAL
+ *
+ */
+int overload_state();
+
+/*
+ *  FUNCTION: overload_shed
+ *
+ *  SYNOPSIS: decide whether a chat message is to be shed
+ *
+ *  PASS:     mt ==> its sender
+ *            n ==> its length
+ *
+ *  RETURN:   1 if it is to be dropped, 0 if not
+ *
+ *  NOTE:     Always 0 when the server is not overloaded.
+ *
+ */
+int overload_shed(struct member_type *mt, int n);
+
+/*
+ *  FUNCTION: overload_report
+ *
+ *  SYNOPSIS: log the state, loop lag and messages shed since the last
+ *            report, then start a new window
+ *
+ *  PASS:     none
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     Called every STATS_REPORT_INT seconds, next to stats_report().
+ *
+ */
+void overload_report();
+
+#endif
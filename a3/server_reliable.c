@@ -0,0 +1,182 @@
+/*
+ *      File:      server_reliable.c
+ *
+ * Retransmission ring and NACK handling for reliable rooms, see
+ * server_reliable.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <arpa/inet.h>
+
+#include "server.h"
+#include "server_binlog.h"
+#include "server_stats.h"
+#include "server_overload.h"
+#include "server_reliable.h"
+#include "server_mcast.h"
+
+#define RELIABLE_SLOT_SIZE   (MAX_MSG_LEN + sizeof(struct chat_ext_hdr))
+
+struct chat_ring {
+	u_int32_t seq[RELIABLE_RING_SIZE];
+	int len[RELIABLE_RING_SIZE];
+	char data[RELIABLE_RING_SIZE][RELIABLE_SLOT_SIZE];
+};
+
+struct chat_ring *
+chat_ring_create() {
+	struct chat_ring *ring;
+
+	/* zeroed: len 0 marks a slot that holds nothing yet */
+	if((ring = (struct chat_ring *)calloc(1, sizeof(struct chat_ring))) == NULL) {
+		printf("Memory used up when trying to create room\n");
+		exit(1);
+	}
+	return ring;
+}
+
+void
+chat_ring_free(struct chat_ring *ring) {
+	free(ring);
+}
+
+void
+chat_ring_store(struct chat_ring *ring, struct chat_out *co) {
+	struct chat_ext_hdr *ext;
+	u_int32_t seq = ntohl(co->ext.room_seq);
+	int slot = seq & (RELIABLE_RING_SIZE - 1);
+	char *msg;
+	int len;
+
+	/* the copy with the extended header, the only one a NACK can ask for */
+	len = chat_msg_fmt(co, CHAT_FMT_EXT, &msg);
+	if(len > RELIABLE_SLOT_SIZE)
+		len = RELIABLE_SLOT_SIZE;
+
+	memcpy(ring->data[slot], msg, len);
+	ring->seq[slot] = seq;
+	ring->len[slot] = len;
+
+	ext = (struct chat_ext_hdr *)((struct chat_msghdr *)ring->data[slot])->msgdata;
+	ext->flags |= htons(CHAT_FLAG_RETRANS);
+}
+
+int
+is_chat_nack(char *buf, int n) {
+	struct chat_msghdr *cmh = (struct chat_msghdr *)buf;
+
+	return n >= sizeof(struct chat_msghdr)
+		&& (ntohs(cmh->msg_len) & CHAT_NACK_FLAG) != 0;
+}
+
+/* Whether one more message may go to a member under its retransmission
+ * rate; it is counted against the rate if so. */
+static int retrans_allowed(struct member_type *mt, long long now) {
+	long long interval = 1000000000LL / RELIABLE_RETRANS_RATE;
+
+	if(mt->retrans_tat < now)
+		mt->retrans_tat = now;
+	if(mt->retrans_tat - now > (RELIABLE_RETRANS_BURST - 1) * interval)
+		return 0;
+	mt->retrans_tat += interval;
+	return 1;
+}
+
+void
+process_chat_nack(int udp_socket_fd, char *buf, int n,
+		  struct sockaddr_in *from) {
+	struct chat_msghdr *cmh = (struct chat_msghdr *)buf;
+	struct chat_nack *nack = (struct chat_nack *)cmh->msgdata;
+	struct room_type *rt;
+	struct member_type *mt;
+	u_int8_t done[RELIABLE_RING_SIZE];
+	long long now = mono_ns();
+	int nranges, i;
+	int sent = 0, missed = 0, limited = 0, looked = 0;
+
+	nranges = ntohs(cmh->msg_len) & CHAT_LEN_MASK;
+	if(nranges > CHAT_MAX_NACK_RANGES)
+		nranges = CHAT_MAX_NACK_RANGES;
+	if(n < sizeof(struct chat_msghdr) + sizeof(struct chat_nack)
+	   + nranges * sizeof(struct chat_nack_range))
+		return;
+
+	for(rt = tenant->room_list_head; rt != NULL; rt = rt->next_room) {
+		if(rt->room_id == ntohs(nack->room_id))
+			break;
+	}
+	if(rt == NULL)
+		return;
+
+	/* only members of the room get its messages */
+	for(mt = rt->member_list_head; mt != NULL; mt = mt->next_room_member) {
+		if(mt->member_udp_addr.sin_addr.s_addr == from->sin_addr.s_addr
+		   && mt->member_udp_addr.sin_port == from->sin_port)
+			break;
+	}
+	if(mt == NULL)
+		return;
+
+	mt->quiet_flag = 0;
+
+	if(ntohs(nack->flags) & NACK_MCAST_JOINED)
+		mcast_joined(mt);
+
+	if(rt->ring == NULL)
+		return;
+
+	if(overload_shed(mt, n)) {
+		binlog_event(EV_CHAT_DROP, DROP_SHED, mt->member_id, rt->room_id, n, 0);
+		return;
+	}
+	if(!retrans_allowed(mt, now)) {
+		binlog_event(EV_CHAT_DROP, DROP_NACK_LIMIT, mt->member_id, rt->room_id, n, 0);
+		return;
+	}
+
+	/* anything beyond a ring's worth is gone anyway, and each message
+	 * goes once however many ranges ask for it */
+	bzero(done, sizeof(done));
+	for(i = 0; i < nranges && looked < RELIABLE_RING_SIZE && !limited; i++) {
+		u_int32_t seq = ntohl(nack->ranges[i].first_seq);
+		u_int32_t count = ntohl(nack->ranges[i].count);
+
+		for( ; count > 0 && looked < RELIABLE_RING_SIZE; count--, seq++) {
+			int slot = seq & (RELIABLE_RING_SIZE - 1);
+
+			looked++;
+			if(rt->ring->len[slot] == 0 || rt->ring->seq[slot] != seq) {
+				missed++;
+				continue;
+			}
+			if(done[slot])
+				continue;
+			if(!retrans_allowed(mt, now)) {
+				limited = 1;
+				break;
+			}
+			done[slot] = 1;
+			if(sendto(udp_socket_fd, rt->ring->data[slot],
+				  rt->ring->len[slot], 0,
+				  (struct sockaddr *)&mt->member_udp_addr,
+				  sizeof(struct sockaddr_in)) < 0) {
+				perror("send to");
+				return;
+			}
+			sent++;
+		}
+	}
+
+	binlog_event(EV_CHAT_NACK, sent, mt->member_id, rt->room_id, missed, 0);
+
+	if(log_flag) {
+		fprintf(logfp, "NACK from [%s] in room [%s]: %d retransmitted, %d too old%s.\n",
+			mt->member_name, rt->room_name, sent, missed,
+			limited ? ", the rest over its rate" : "");
+		fflush(logfp);
+	}
+}
@@ -0,0 +1,110 @@
+/*
+ *      File:      server_reliable.h
+ *
+ * Reliable rooms. A room created with the "reliable" option keeps its
+ * last RELIABLE_RING_SIZE chat messages in a ring indexed by room
+ * sequence number. Members that use the extended header (defs_ext.h)
+ * find gaps in the room sequence and send a NACK listing the missing
+ * ranges; the server answers with the messages still in the ring.
+ * Rooms without the option have no ring and pay nothing for this.
+ *
+ * A NACK comes from nothing but a UDP source address, so what it can make
+ * the server send is bounded: each message at most once per NACK, at
+ * most RELIABLE_RING_SIZE of them, and at most RELIABLE_RETRANS_RATE a
+ * second to a member, with a burst of RELIABLE_RETRANS_BURST; the NACK
+ * itself counts as one. NACKs are also shed with chat while the server
+ * is overloaded (see server_overload.h).
+ */
+
+#ifndef _SERVER_RELIABLE_H
+#define _SERVER_RELIABLE_H
+
+#include <netinet/in.h>
+
+#include "server.h"
+
+/* messages kept per reliable room, must be a power of two */
+#define RELIABLE_RING_SIZE   256
+
+/* messages retransmitted to a member a second, and ahead of that rate */
+#define RELIABLE_RETRANS_RATE   2048
+#define RELIABLE_RETRANS_BURST  (2 * RELIABLE_RING_SIZE)
+
+/*
+ *  FUNCTION: chat_ring_create
+ *
+ *  SYNOPSIS: allocate an empty retransmission ring
+ *
+ *  PASS:     none
+ *
+ *  RETURN:   the ring
+ *
+ *  NOTE:     Exits if out of memory, like create_room().
+ *
+ */
+struct chat_ring *chat_ring_create();
+
+/*
+ *  FUNCTION: chat_ring_free
+ *
+ *  SYNOPSIS: free a ring from chat_ring_create(), NULL is ignored
+ *
+ *  PASS:     ring ==> the ring
+ *
+ *  RETURN:   void
+ *
+ */
+void chat_ring_free(struct chat_ring *ring);
+
+/*
+ *  FUNCTION: chat_ring_store
+ *
+ *  SYNOPSIS: keep an admitted chat message for retransmission
+ *
+ *  PASS:     ring ==> the room's ring
+ *            co ==> the message, as set up by admit_chat_msg()
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     Overwrites the message RELIABLE_RING_SIZE sequence numbers
+ *            older. The stored copy is marked CHAT_FLAG_RETRANS.
+ *
+ */
+void chat_ring_store(struct chat_ring *ring, struct chat_out *co);
+
+/*
+ *  FUNCTION: is_chat_nack
+ *
+ *  SYNOPSIS: tell a NACK apart from a chat message
+ *
+ *  PASS:     buf ==> a datagram received on the chat port
+ *            n ==> its length
+ *
+ *  RETURN:   non-zero if the datagram is a NACK
+ *
+ */
+int is_chat_nack(char *buf, int n);
+
+/*
+ *  FUNCTION: process_chat_nack
+ *
+ *  SYNOPSIS: retransmit the messages a member asks for
+ *
+ *  PASS:     udp_socket_fd ==> the socket to send from
+ *            buf, n ==> the NACK datagram
+ *            from ==> its source address
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     NACKs from addresses that are not a member of the room are
+ *            ignored. Messages no longer in the ring are counted and
+ *            logged but cannot be recovered, nor can those over the
+ *            member's retransmission rate. A NACK with NACK_MCAST_JOINED
+ *            is also the member's report that it joined the room's
+ *            multicast group, in any room.
+ *
+ */
+void process_chat_nack(int udp_socket_fd, char *buf, int n,
+		       struct sockaddr_in *from);
+
+#endif
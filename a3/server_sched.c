@@ -0,0 +1,343 @@
+/*
+ *      File:      server_sched.c
+ *
+ * Deficit round robin between the rooms on the send path, see
+ * server_sched.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "server.h"
+#include "server_stats.h"
+#include "server_binlog.h"
+#include "server_reliable.h"
+#include "server_sched.h"
+#include "server_overload.h"
+#include "server_direct.h"
+#include "server_bulk.h"
+#include "server_subs.h"
+
+struct sched_msg {
+	struct sched_msg *next;
+	long long queued_ns;
+	struct timespec rx_ts;
+	int has_ts;
+	struct sockaddr_in from;
+	int udp_socket_fd;
+	int n;
+	char buf[MAX_MSG_LEN + 1];
+};
+
+struct sched_queue {
+	struct room_type *rt;
+	struct tenant *tenant;
+
+	struct sched_msg *head;
+	struct sched_msg *tail;
+	int queued;
+
+	/* copies it may still send, and whether this turn's quantum is in */
+	int deficit;
+	int granted;
+	int active;
+	struct sched_queue *next_active;
+
+	/* since the last sched_report() */
+	unsigned long msgs;
+	long long delay_ns;
+	long long max_delay_ns;
+	unsigned long dropped;
+};
+
+/* rooms with messages waiting, the one whose turn it is first */
+static struct sched_queue *active_head;
+static struct sched_queue *active_tail;
+
+/* messages sent on, kept for reuse */
+static struct sched_msg *free_msgs;
+
+/* messages waiting, in all rooms */
+static int total_queued;
+
+/* What sending a message to the room costs, in copies. */
+static int room_cost(struct room_type *rt) {
+	int cost = rt->num_of_members - rt->num_mcast_members + rt->num_subs;
+
+	if(rt->num_mcast_members != 0)
+		cost++;
+	return (cost > 0) ? cost : 1;
+}
+
+static struct sched_queue *room_queue(struct room_type *rt) {
+	struct sched_queue *q = rt->sched;
+
+	if(q == NULL) {
+		if((q = (struct sched_queue *)calloc(1, sizeof(struct sched_queue))) == NULL) {
+			printf("Memory used up when trying to queue a chat message\n");
+			exit(1);
+		}
+		q->rt = rt;
+		q->tenant = tenant;
+		rt->sched = q;
+	}
+	return q;
+}
+
+static void activate(struct sched_queue *q) {
+	q->active = 1;
+	q->next_active = NULL;
+	if(active_head == NULL)
+		active_head = q;
+	else
+		active_tail->next_active = q;
+	active_tail = q;
+}
+
+/* Take the room whose turn it is off the active list. */
+static struct sched_queue *pop_active() {
+	struct sched_queue *q = active_head;
+
+	active_head = q->next_active;
+	if(active_head == NULL)
+		active_tail = NULL;
+	q->active = 0;
+	q->granted = 0;
+	return q;
+}
+
+static void unlink_active(struct sched_queue *q) {
+	struct sched_queue **pp;
+
+	if(!q->active)
+		return;
+	if(q == active_head) {
+		pop_active();
+		return;
+	}
+	for(pp = &active_head; *pp != NULL; pp = &(*pp)->next_active) {
+		if((*pp)->next_active == q) {
+			(*pp)->next_active = q->next_active;
+			if(active_tail == q)
+				active_tail = *pp;
+			break;
+		}
+	}
+	q->active = 0;
+	q->granted = 0;
+}
+
+/* Send on the first message of a room, as its tenant. */
+static void send_head(struct sched_queue *q) {
+	struct sched_msg *m = q->head;
+	long long delay = mono_ns() - m->queued_ns;
+
+	q->head = m->next;
+	if(q->head == NULL)
+		q->tail = NULL;
+	q->queued--;
+	total_queued--;
+
+	q->msgs++;
+	q->delay_ns += delay;
+	if(delay > q->max_delay_ns)
+		q->max_delay_ns = delay;
+
+	tenant = q->tenant;
+	forward_chat_msg(m->udp_socket_fd, m->buf, m->n,
+			 m->has_ts ? &m->rx_ts : NULL, &m->from);
+
+	m->next = free_msgs;
+	free_msgs = m;
+}
+
+void
+sched_chat_msg(int udp_socket_fd, char *buf, int n,
+	       struct timespec *rx_ts, struct sockaddr_in *from) {
+	struct chat_msghdr *cmh = (struct chat_msghdr *)buf;
+	struct member_type *mt;
+	struct room_type *rt;
+	struct sched_queue *q;
+	struct sched_msg *m;
+
+	if(n < sizeof(struct chat_msghdr) || is_chat_nack(buf, n) || is_chat_direct(buf, n)
+	   || is_chat_bulk(buf, n)
+	   || (mt = find_sender(ntohs(cmh->sender.member_id),
+				ntohs(((struct chat_sender_v2 *)&cmh->sender)->member_id_hi))) == NULL
+	   || mt->moved_id != 0 || (rt = subs_target_room(mt, buf, n)) == NULL) {
+		forward_chat_msg(udp_socket_fd, buf, n, rx_ts, from);
+		return;
+	}
+
+	/* on the queue of the room it goes to, which it may only follow */
+	q = room_queue(rt);
+	if(overload_shed(mt, n)) {
+		/* it is alive all the same */
+		mt->quiet_flag = 0;
+		binlog_event(EV_CHAT_DROP, DROP_SHED, mt->member_id,
+			     rt->room_id, n, 0);
+		return;
+	}
+	if(q->queued >= SCHED_MAX_QUEUED) {
+		q->dropped++;
+		binlog_event(EV_CHAT_DROP, DROP_QUEUE_FULL, mt->member_id,
+			     rt->room_id, n, 0);
+		if(log_flag) {
+			fprintf(logfp,
+				"Chat message is discarded because the queue of room [%s] is full!\n",
+				rt->room_name);
+			fflush(logfp);
+		}
+		return;
+	}
+
+	if((m = free_msgs) != NULL) {
+		free_msgs = m->next;
+	} else if((m = (struct sched_msg *)malloc(sizeof(struct sched_msg))) == NULL) {
+		printf("Memory used up when trying to queue a chat message\n");
+		exit(1);
+	}
+	m->next = NULL;
+	m->queued_ns = mono_ns();
+	m->has_ts = (rx_ts != NULL);
+	if(rx_ts != NULL)
+		m->rx_ts = *rx_ts;
+	m->from = *from;
+	m->udp_socket_fd = udp_socket_fd;
+	m->n = n;
+	memcpy(m->buf, buf, n);
+	m->buf[n] = '\0';
+
+	if(q->tail == NULL)
+		q->head = m;
+	else
+		q->tail->next = m;
+	q->tail = m;
+	q->queued++;
+	total_queued++;
+
+	if(!q->active)
+		activate(q);
+}
+
+int
+sched_ingest(int udp_socket_fd) {
+	int got, total = 0;
+	int batches = 0;
+
+	do {
+		got = process_chat_batch(udp_socket_fd);
+		total += got;
+	} while(got == CHAT_BATCH && ++batches < SCHED_INGEST_BATCHES);
+	return total;
+}
+
+void
+sched_run() {
+	struct tenant *current = tenant;
+	struct sched_queue *q;
+	int budget = SCHED_ROUND_COPIES;
+	int cost;
+
+	while((q = active_head) != NULL && budget > 0) {
+		if(!q->granted) {
+			q->deficit += SCHED_QUANTUM * q->rt->sched_weight;
+			q->granted = 1;
+		}
+
+		while(q->head != NULL && budget > 0) {
+			cost = room_cost(q->rt);
+			if(cost > q->deficit)
+				break;
+			q->deficit -= cost;
+			budget -= cost;
+			send_head(q);
+		}
+
+		if(q->head == NULL) {
+			/* nothing saved up for later */
+			q->deficit = 0;
+			pop_active();
+		} else if(budget > 0) {
+			/* used up its turn: to the back */
+			pop_active();
+			activate(q);
+		}
+		/* else out of budget, its turn goes on next round */
+	}
+
+	tenant = current;
+}
+
+int
+sched_pending() {
+	return active_head != NULL;
+}
+
+int
+sched_queued() {
+	return total_queued;
+}
+
+void
+sched_flush_room(struct room_type *rt) {
+	struct sched_queue *q = rt->sched;
+	struct tenant *current = tenant;
+
+	if(q == NULL || q->head == NULL)
+		return;
+	while(q->head != NULL)
+		send_head(q);
+	q->deficit = 0;
+	unlink_active(q);
+	tenant = current;
+}
+
+void
+sched_free(struct room_type *rt) {
+	struct sched_queue *q = rt->sched;
+	struct sched_msg *m;
+
+	if(q == NULL)
+		return;
+	unlink_active(q);
+	while((m = q->head) != NULL) {
+		q->head = m->next;
+		total_queued--;
+		m->next = free_msgs;
+		free_msgs = m;
+	}
+	free(q);
+	rt->sched = NULL;
+}
+
+void
+sched_report() {
+	FILE *fp = log_flag ? logfp : stdout;
+	struct room_type *rt;
+	struct sched_queue *q;
+
+	for(rt = tenant->room_list_head; rt != NULL; rt = rt->next_room) {
+		if((q = rt->sched) == NULL)
+			continue;
+
+		if(q->max_delay_ns >= SCHED_SLOW_NS || q->dropped != 0) {
+			fprintf(fp, "Queue of room [%s] (weight %d): %lu msgs, delay mean %.1fus "
+				"max %.1fus, %d waiting, %lu dropped\n",
+				rt->room_name, rt->sched_weight, q->msgs,
+				q->msgs != 0 ? q->delay_ns / 1000.0 / q->msgs : 0.0,
+				q->max_delay_ns / 1000.0, q->queued, q->dropped);
+			fflush(fp);
+		}
+
+		q->msgs = 0;
+		q->delay_ns = 0;
+		q->max_delay_ns = 0;
+		q->dropped = 0;
+	}
+}
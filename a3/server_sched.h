@@ -0,0 +1,168 @@
+/*
+ *      File:      server_sched.h
+ *
+ * Fair sharing of the send path between rooms. Chat messages are not
+ * sent on in the order they arrive: each is queued on the room of its
+ * sender, and the queues are drained by deficit round robin. A room's
+ * turn lets it spend up to weight * SCHED_QUANTUM copies, a message
+ * costing one per member it is sent to (one for all those listening to
+ * the multicast group), and the event loop drains at most
+ * SCHED_ROUND_COPIES copies between two looks at the sockets. Each look
+ * takes in all that is there, up to SCHED_INGEST_BATCHES recvmmsg()
+ * calls, so a flood waits in its room's queue, and overflows it, rather
+ * than in front of everyone in the socket buffer. A busy room then waits
+ * behind its own backlog, not the others behind it.
+ *
+ * The weight is set per room with the room options (see create_room):
+ *   weight=<n>        n shares of the send path, 1 to SCHED_MAX_WEIGHT
+ * Rooms that do not say get 1.
+ *
+ * Rooms whose messages waited SCHED_SLOW_NS or more, or were dropped for
+ * a full queue, are named in the report every STATS_REPORT_INT seconds.
+ *
+ * While the server is overloaded, messages may be shed before they are
+ * queued, see server_overload.h.
+ *
+ * Messages that come in through AF_XDP (see server_xdp.h) are sent on
+ * at once, as are NACKs, direct messages (see server_direct.h) and
+ * anything not for a room of ours. Bulk chunks wait on queues of their
+ * own, behind all of these, see server_bulk.h.
+ */
+
+#ifndef _SERVER_SCHED_H
+#define _SERVER_SCHED_H
+
+#include "server.h"
+
+/* copies a room of weight 1 may send per turn */
+#define SCHED_QUANTUM           64
+
+/* copies sent per round of the event loop, at most */
+#define SCHED_ROUND_COPIES      256
+
+#define SCHED_MAX_WEIGHT        64
+
+/* recvmmsg() calls of CHAT_BATCH messages per round, at most */
+#define SCHED_INGEST_BATCHES    16
+
+/* messages a room may have waiting; more are dropped */
+#define SCHED_MAX_QUEUED        256
+
+/* queue delay from which a room is reported */
+#define SCHED_SLOW_NS           1000000LL
+
+/*
+ *  FUNCTION: sched_chat_msg
+ *
+ *  SYNOPSIS: queue a received chat message on the room of its sender
+ *
+ *  PASS:     udp_socket_fd ==> the socket it came in on
+ *            buf ==> the message
+ *            n ==> its length
+ *            rx_ts ==> kernel receive timestamp, NULL if none
+ *            from ==> where it came from
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     What is not for a room is handed to forward_chat_msg() at
+ *            once, so it is dropped, forwarded or answered as before.
+ *
+ */
+void sched_chat_msg(int udp_socket_fd, char *buf, int n,
+		    struct timespec *rx_ts, struct sockaddr_in *from);
+
+/*
+ *  FUNCTION: sched_ingest
+ *
+ *  SYNOPSIS: receive and queue the chat messages waiting on a socket
+ *
+ *  PASS:     udp_socket_fd ==> the socket
+ *
+ *  RETURN:   number of messages received, 0 if none were pending
+ *
+ */
+int sched_ingest(int udp_socket_fd);
+
+/*
+ *  FUNCTION: sched_run
+ *
+ *  SYNOPSIS: send on queued messages, room by room, up to
+ *            SCHED_ROUND_COPIES copies
+ *
+ *  PASS:     none
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     The event loop calls it on every round, for all tenants.
+ *
+ */
+void sched_run();
+
+/*
+ *  FUNCTION: sched_pending
+ *
+ *  SYNOPSIS: whether messages are waiting to be sent on
+ *
+ *  PASS:     none
+ *
+ *  RETURN:   1 if there are, 0 if not
+ *
+ */
+int sched_pending();
+
+/*
+ *  FUNCTION: sched_queued
+ *
+ *  SYNOPSIS: how many messages are waiting to be sent on, in all rooms
+ *
+ *  PASS:     none
+ *
+ *  RETURN:   the number of messages
+ *
+ */
+int sched_queued();
+
+/*
+ *  FUNCTION: sched_flush_room
+ *
+ *  SYNOPSIS: send on everything queued for a room now
+ *
+ *  PASS:     rt ==> the room
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     Called before a member leaves the room or the room moves,
+ *            so the messages sent before go where they were meant to.
+ *
+ */
+void sched_flush_room(struct room_type *rt);
+
+/*
+ *  FUNCTION: sched_free
+ *
+ *  SYNOPSIS: drop the queue of a room that goes away
+ *
+ *  PASS:     rt ==> the room
+ *
+ *  RETURN:   void
+ *
+ */
+void sched_free(struct room_type *rt);
+
+/*
+ *  FUNCTION: sched_report
+ *
+ *  SYNOPSIS: log the queue delay of the rooms of the current tenant that
+ *            waited long or dropped messages since the last report, then
+ *            start a new window
+ *
+ *  PASS:     none
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     Called every STATS_REPORT_INT seconds, next to stats_report().
+ *
+ */
+void sched_report();
+
+#endif
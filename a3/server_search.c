@@ -0,0 +1,307 @@
+/*
+ *      File:      server_search.c
+ *
+ * Inverted index over room history, see server_search.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include <arpa/inet.h>
+
+#include "server.h"
+#include "server_history.h"
+#include "server_search.h"
+
+struct search_word {
+	char word[SEARCH_MAX_WORD_LEN];    /* '\0' padded, word[0] 0 if free */
+	u_int32_t base;                    /* the first delta is from here */
+	u_int32_t last_seq;
+	u_int16_t len;                     /* bytes of postings used */
+	u_int16_t count;
+	u_int8_t postings[SEARCH_POSTING_BYTES];
+};
+
+struct room_index {
+	struct search_word slots[SEARCH_SLOTS];
+};
+
+/* two decoded posting lists, of at most one sequence number per byte */
+static u_int32_t seq_buf[2][SEARCH_POSTING_BYTES];
+
+struct room_index *
+search_index_create() {
+	struct room_index *ri;
+
+	if((ri = (struct room_index *)calloc(1, sizeof(struct room_index))) == NULL) {
+		printf("Memory used up when trying to create room\n");
+		exit(1);
+	}
+	return ri;
+}
+
+void
+search_index_free(struct room_index *ri) {
+	free(ri);
+}
+
+/* true if sequence number a comes before b */
+static int seq_before(u_int32_t a, u_int32_t b) {
+	return (int32_t)(a - b) < 0;
+}
+
+/*
+ * Cut the next word out of *text (of *len bytes), case folded and '\0'
+ * padded. Returns 0 when there are no more words.
+ */
+static int next_word(char **text, int *len, char *word) {
+	char *p = *text, *end = *text + *len;
+	int n;
+
+	for( ; ; ) {
+		while(p < end && *p != '\0' && !isalnum((unsigned char)*p))
+			p++;
+		if(p == end || *p == '\0')
+			return 0;
+
+		bzero(word, SEARCH_MAX_WORD_LEN);
+		for(n = 0; p < end && isalnum((unsigned char)*p); p++) {
+			if(n < SEARCH_MAX_WORD_LEN)
+				word[n++] = tolower((unsigned char)*p);
+		}
+		if(n >= SEARCH_MIN_WORD_LEN)
+			break;
+	}
+
+	*len -= p - *text;
+	*text = p;
+	return 1;
+}
+
+static u_int32_t word_hash(char *word) {
+	u_int32_t h = 2166136261u;
+	int i;
+
+	for(i = 0; i < SEARCH_MAX_WORD_LEN && word[i] != '\0'; i++)
+		h = (h ^ (unsigned char)word[i]) * 16777619u;
+	return h;
+}
+
+/*
+ * Find the slot of a word. With insert set, a missing word gets a free
+ * slot, or one whose postings are all older than oldest; NULL if none.
+ */
+static struct search_word *find_word(struct room_index *ri, char *word,
+				     int insert, u_int32_t oldest) {
+	struct search_word *w, *reuse = NULL;
+	u_int32_t h = word_hash(word);
+	int i;
+
+	for(i = 0; i < SEARCH_SLOTS; i++) {
+		w = &ri->slots[(h + i) & (SEARCH_SLOTS - 1)];
+		if(w->word[0] == '\0') {
+			if(reuse == NULL)
+				reuse = w;
+			break;
+		}
+		if(!memcmp(w->word, word, SEARCH_MAX_WORD_LEN))
+			return w;
+		/* still part of the probe chains of other words, so not freed */
+		if(reuse == NULL && seq_before(w->last_seq, oldest))
+			reuse = w;
+	}
+
+	if(!insert || reuse == NULL)
+		return NULL;
+
+	bzero(reuse, sizeof(struct search_word));
+	memcpy(reuse->word, word, SEARCH_MAX_WORD_LEN);
+	return reuse;
+}
+
+static int put_varint(u_int8_t *p, u_int32_t v) {
+	int n = 0;
+
+	while(v >= 0x80) {
+		p[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	p[n++] = v;
+	return n;
+}
+
+/* Decode the postings of a word into seqs; returns how many there are. */
+static int get_postings(struct search_word *w, u_int32_t *seqs) {
+	u_int32_t seq = w->base, d;
+	int i = 0, n = 0, shift;
+
+	while(i < w->len) {
+		d = 0;
+		shift = 0;
+		while(i < w->len && (w->postings[i] & 0x80)) {
+			d |= (w->postings[i++] & 0x7f) << shift;
+			shift += 7;
+		}
+		if(i < w->len)
+			d |= w->postings[i++] << shift;
+		seq += d;
+		seqs[n++] = seq;
+	}
+	return n;
+}
+
+/* Replace the postings of a word with seqs[0..n-1]. */
+static void set_postings(struct search_word *w, u_int32_t *seqs, int n) {
+	int i;
+
+	w->len = 0;
+	w->count = n;
+	if(n == 0)
+		return;
+	w->base = seqs[0] - 1;
+	for(i = 0; i < n; i++)
+		w->len += put_varint(w->postings + w->len,
+				     seqs[i] - (i == 0 ? w->base : seqs[i - 1]));
+}
+
+/* Add seq to the postings of a word, making room for it if needed. */
+static void add_posting(struct search_word *w, u_int32_t seq, u_int32_t oldest) {
+	u_int8_t buf[5];
+	u_int32_t *seqs = seq_buf[0];
+	int n, i, need;
+
+	if(w->count == 0)
+		w->base = seq - 1;
+	need = put_varint(buf, seq - (w->count == 0 ? w->base : w->last_seq));
+
+	if(w->len + need > SEARCH_POSTING_BYTES) {
+		/* drop what left the history, then the oldest quarter at a time */
+		n = get_postings(w, seqs);
+		for(i = 0; i < n && seq_before(seqs[i], oldest); i++)
+			;
+		set_postings(w, seqs + i, n - i);
+		while(w->count > 0 && w->len + need > SEARCH_POSTING_BYTES) {
+			i += (w->count + 3) / 4;
+			set_postings(w, seqs + i, n - i);
+		}
+		if(w->count == 0) {
+			w->base = seq - 1;
+			need = put_varint(buf, 1);
+		}
+	}
+
+	memcpy(w->postings + w->len, buf, need);
+	w->len += need;
+	w->count++;
+	w->last_seq = seq;
+}
+
+void
+search_index_add(struct room_type *rt, struct chat_out *co) {
+	struct room_index *ri = rt->index;
+	struct search_word *w;
+	u_int32_t seq = ntohl(co->ext.room_seq);
+	u_int32_t oldest = history_oldest_seq(rt->history, rt);
+	char word[SEARCH_MAX_WORD_LEN];
+	char *text = co->text;
+	int len = co->text_len;
+
+	while(next_word(&text, &len, word)) {
+		if((w = find_word(ri, word, 1, oldest)) == NULL)
+			continue;           /* index full of live words */
+		if(w->count > 0 && w->last_seq == seq)
+			continue;           /* word seen before in this message */
+		add_posting(w, seq, oldest);
+	}
+}
+
+/* Intersect sorted a[0..na-1] with b[0..nb-1] into a; returns the size. */
+static int intersect(u_int32_t *a, int na, u_int32_t *b, int nb) {
+	int i = 0, j = 0, n = 0;
+
+	while(i < na && j < nb) {
+		if(a[i] == b[j]) {
+			a[n++] = a[i];
+			i++;
+			j++;
+		} else if(seq_before(a[i], b[j])) {
+			i++;
+		} else {
+			j++;
+		}
+	}
+	return n;
+}
+
+/* Render a kept message as "[seq] sender: text" into line. */
+static void render_match(struct chat_msghdr *cmh, u_int32_t seq, char *line) {
+	struct chat_ext_hdr *ext = (struct chat_ext_hdr *)cmh->msgdata;
+	char *text = (char *)ext->msgdata;
+	int text_len = ntohs(cmh->msg_len) & CHAT_LEN_MASK;
+	int n, i;
+
+	n = snprintf(line, SEARCH_LINE_LEN, "[%u] %.*s: ", seq,
+		     MAX_MEMBER_NAME_LEN, cmh->sender.member_name);
+	for(i = 0; i < text_len && text[i] != '\0' && n < SEARCH_LINE_LEN - 1; i++)
+		line[n++] = (text[i] == '\n') ? ' ' : text[i];
+	while(n > 0 && line[n - 1] == ' ')
+		n--;
+	line[n] = '\0';
+}
+
+int
+search_room(struct room_type *rt, char *query, char *reply, int size) {
+	struct search_word *w;
+	u_int32_t oldest = history_oldest_seq(rt->history, rt);
+	char words[SEARCH_MAX_TERMS][SEARCH_MAX_WORD_LEN];
+	char word[SEARCH_MAX_WORD_LEN];
+	int len = strlen(query);
+	int nwords = 0, n = 0, nb, i, j, out;
+	u_int32_t *seqs = seq_buf[0];
+
+	reply[0] = '\0';
+
+	while(nwords < SEARCH_MAX_TERMS && next_word(&query, &len, word)) {
+		for(i = 0; i < nwords && memcmp(words[i], word, SEARCH_MAX_WORD_LEN); i++)
+			;
+		if(i == nwords)
+			memcpy(words[nwords++], word, SEARCH_MAX_WORD_LEN);
+	}
+	if(nwords == 0)
+		return -1;
+
+	for(i = 0; i < nwords; i++) {
+		if((w = find_word(rt->index, words[i], 0, oldest)) == NULL)
+			return 0;
+		if(i == 0) {
+			n = get_postings(w, seqs);
+		} else {
+			nb = get_postings(w, seq_buf[1]);
+			n = intersect(seqs, n, seq_buf[1], nb);
+		}
+		if(n == 0)
+			return 0;
+	}
+
+	/* newest first, only what is still kept, as many as fit */
+	out = 0;
+	for(i = n - 1, j = 0; i >= 0 && j < SEARCH_MAX_RESULTS; i--) {
+		struct chat_msghdr *cmh;
+		char line[SEARCH_LINE_LEN];
+
+		if(seq_before(seqs[i], oldest))
+			break;
+		if((cmh = history_find(rt->history, seqs[i])) == NULL)
+			continue;
+		render_match(cmh, seqs[i], line);
+		if(out + strlen(line) + 2 > size)
+			break;
+		out += sprintf(reply + out, "%s%s", out > 0 ? "\n" : "", line);
+		j++;
+	}
+
+	return j;
+}
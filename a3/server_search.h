@@ -0,0 +1,94 @@
+/*
+ *      File:      server_search.h
+ *
+ * Full-text search over the recent history of a room (SEARCH_REQUEST,
+ * see defs_ext.h). Every room that keeps a history (server_history.h)
+ * has an inverted index from word to the room sequence numbers of the
+ * messages that contain it, updated as messages come in. A query looks
+ * up its words and intersects their posting lists; only the matching
+ * messages themselves are read from the history.
+ *
+ * Memory is fixed per room: SEARCH_SLOTS words, each with a posting list
+ * of SEARCH_POSTING_BYTES bytes of varint coded sequence number deltas.
+ * Postings of messages that left the history are dropped as room is
+ * needed, then the oldest postings of the word.
+ */
+
+#ifndef _SERVER_SEARCH_H
+#define _SERVER_SEARCH_H
+
+#include "server.h"
+
+/* words indexed per room, must be a power of two */
+#define SEARCH_SLOTS            512
+
+/* words are letters and digits, case folded; longer ones are cut down */
+#define SEARCH_MIN_WORD_LEN     2
+#define SEARCH_MAX_WORD_LEN     16
+
+#define SEARCH_POSTING_BYTES    116
+
+/* words of a query that are used, all of them must match */
+#define SEARCH_MAX_TERMS        4
+
+/* matches returned, newest first, each cut to SEARCH_LINE_LEN */
+#define SEARCH_MAX_RESULTS      10
+#define SEARCH_LINE_LEN         120
+
+/*
+ *  FUNCTION: search_index_create
+ *
+ *  SYNOPSIS: allocate an empty index
+ *
+ *  PASS:     none
+ *
+ *  RETURN:   the index
+ *
+ *  NOTE:     Exits if memory is used up, like the rest of room creation.
+ *
+ */
+struct room_index *search_index_create();
+
+/*
+ *  FUNCTION: search_index_free
+ *
+ *  SYNOPSIS: free an index, NULL is ignored
+ *
+ *  PASS:     ri ==> the index
+ *
+ *  RETURN:   void
+ *
+ */
+void search_index_free(struct room_index *ri);
+
+/*
+ *  FUNCTION: search_index_add
+ *
+ *  SYNOPSIS: index the words of an admitted chat message
+ *
+ *  PASS:     rt ==> the room, which keeps a history
+ *            co ==> the message, as set up by admit_chat_msg() and
+ *                   already added to the history
+ *
+ *  RETURN:   void
+ *
+ */
+void search_index_add(struct room_type *rt, struct chat_out *co);
+
+/*
+ *  FUNCTION: search_room
+ *
+ *  SYNOPSIS: find the recent messages of a room containing all words
+ *            of a query
+ *
+ *  PASS:     rt ==> the room
+ *            query ==> the search words
+ *            reply ==> filled in with one line per match, newest first
+ *            size ==> size of reply
+ *
+ *  RETURN:   number of matches, -1 if the query has no usable word
+ *
+ */
+int search_room(struct room_type *rt, char *query, char *reply, int size);
+
+#endif
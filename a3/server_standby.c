@@ -0,0 +1,571 @@
+/*
+ *      File:      server_standby.c
+ *
+ * Hot standby, see server_standby.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+
+#include "server.h"
+#include "server_stats.h"
+#include "server_standby.h"
+
+/* the longest record, name included */
+#define STANDBY_REC_LEN     (sizeof(struct standby_rec) + MAX_LINE_LEN)
+
+/* on the primary: the journal port and the standby following it */
+static int listen_fd = -1;
+static int peer_fd = -1;
+static char peer_host[MAX_HOST_NAME_LEN];
+static u_int16_t peer_tcp_port;
+static u_int16_t peer_udp_port;
+static long long next_seq_ns;
+
+/* journal the standby's socket did not take yet, out_len bytes from out_start */
+static char *out_buf;
+static int out_start;
+static int out_len;
+
+/* a connection to the journal port that has not said HELLO in full yet */
+static int hello_fd = -1;
+static char hello_buf[STANDBY_REC_LEN + 1];
+static int hello_len;
+
+/* on the standby: the journal from the primary */
+static int follow_fd = -1;
+
+/* Puts a record into buf, STANDBY_REC_LEN bytes; returns its length. */
+static int make_rec(char *buf, int type, u_int32_t member_id, u_int16_t room_id,
+		    u_int32_t arg, u_int32_t addr, u_int16_t port, char *name) {
+	struct standby_rec *rec = (struct standby_rec *)buf;
+	int len = sizeof(struct standby_rec);
+
+	bzero(rec, sizeof(struct standby_rec));
+	if(name != NULL) {
+		strncpy(rec->name, name, MAX_LINE_LEN - 1);
+		rec->name[MAX_LINE_LEN - 1] = '\0';
+		len += strlen(rec->name) + 1;
+	}
+	rec->type = type;
+	rec->len = htons(len);
+	rec->member_id = htons(member_id & 0xffff);
+	rec->member_id_hi = htons(member_id >> 16);
+	rec->room_id = htons(room_id);
+	rec->arg = htonl(arg);
+	rec->addr = addr;
+	rec->port = port;
+	return len;
+}
+
+/* Sends a record on a blocking socket. */
+static int write_rec(int fd, int type, u_int32_t member_id, u_int16_t room_id,
+		     u_int32_t arg, u_int32_t addr, u_int16_t port, char *name) {
+	char buf[STANDBY_REC_LEN];
+	int len;
+
+	len = make_rec(buf, type, member_id, room_id, arg, addr, port, name);
+	if(send(fd, buf, len, MSG_NOSIGNAL) != len)
+		return -1;
+	return 0;
+}
+
+/* Reads one record into buf, STANDBY_REC_LEN + 1 bytes, name terminated. */
+static int read_rec(int fd, char *buf) {
+	struct standby_rec *rec = (struct standby_rec *)buf;
+	int len;
+
+	if(recv(fd, buf, sizeof(struct standby_rec), MSG_WAITALL)
+	   != sizeof(struct standby_rec))
+		return -1;
+
+	len = ntohs(rec->len);
+	if(len < sizeof(struct standby_rec) || len > STANDBY_REC_LEN)
+		return -1;
+	len -= sizeof(struct standby_rec);
+	if(len > 0 && recv(fd, rec->name, len, MSG_WAITALL) != len)
+		return -1;
+	rec->name[len] = '\0';
+	return 0;
+}
+
+static void drop_standby() {
+	if(log_flag) {
+		fprintf(logfp, "Standby %s:%hu is gone.\n", peer_host, peer_tcp_port);
+		fflush(logfp);
+	}
+	close(peer_fd);
+	peer_fd = -1;
+	out_start = 0;
+	out_len = 0;
+}
+
+/* Sends the standby what its socket takes of the journal held back. */
+static int flush_journal() {
+	int n;
+
+	if(out_len == 0)
+		return 0;
+	/* a standby that went away must not take the primary with it */
+	if((n = send(peer_fd, out_buf + out_start, out_len, MSG_NOSIGNAL)) < 0)
+		return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+	out_start += n;
+	out_len -= n;
+	if(out_len == 0)
+		out_start = 0;
+	return 0;
+}
+
+/*
+ * Sends a record to the standby, if there is one. The loop never waits
+ * for the standby: what its socket does not take is held back, and a
+ * standby that lets STANDBY_BUF_LEN bytes pile up is dropped.
+ */
+static void journal(int type, u_int32_t member_id, u_int16_t room_id,
+		    u_int32_t arg, u_int32_t addr, u_int16_t port, char *name) {
+	char buf[STANDBY_REC_LEN];
+	int len;
+
+	if(peer_fd < 0)
+		return;
+
+	len = make_rec(buf, type, member_id, room_id, arg, addr, port, name);
+	if(out_len + len > STANDBY_BUF_LEN) {
+		if(log_flag) {
+			fprintf(logfp, "Standby %s:%hu is %d bytes behind, dropping it.\n",
+				peer_host, peer_tcp_port, out_len);
+			fflush(logfp);
+		}
+		drop_standby();
+		return;
+	}
+	if(out_start + out_len + len > STANDBY_BUF_LEN) {
+		memmove(out_buf, out_buf + out_start, out_len);
+		out_start = 0;
+	}
+	memcpy(out_buf + out_start + out_len, buf, len);
+	out_len += len;
+
+	if(flush_journal() < 0)
+		drop_standby();
+}
+
+void
+standby_serve(u_int16_t port) {
+	listen_fd = create_server(SOCK_STREAM, port);
+}
+
+/* Start sending a journal to the standby that said HELLO on fd. */
+static void take_standby(int fd, struct standby_rec *rec) {
+	struct member_type *mt;
+	struct room_type *rt;
+
+	if(out_buf == NULL && (out_buf = (char *)malloc(STANDBY_BUF_LEN)) == NULL) {
+		printf("Memory used up when trying to take a standby\n");
+		exit(1);
+	}
+	strncpy(peer_host, rec->name, MAX_HOST_NAME_LEN - 1);
+	peer_tcp_port = ntohs(rec->port);
+	peer_udp_port = ntohl(rec->arg);
+	peer_fd = fd;
+
+	/* a snapshot first, rooms before the members in them */
+	for(rt = tenant->room_list_head; rt != NULL; rt = rt->next_room)
+		standby_log_room(rt);
+	for(mt = tenant->mem_list_head; mt != NULL; mt = mt->next_member) {
+		standby_log_register(mt);
+		if(mt->current_room != NULL)
+			standby_log_switch(mt);
+	}
+	next_seq_ns = 0;
+	standby_tick();
+
+	if(log_flag && peer_fd >= 0) {
+		fprintf(logfp, "Standby %s:%hu follows, %d members and %d rooms sent.\n",
+			peer_host, peer_tcp_port, tenant->total_num_of_members, tenant->total_num_of_rooms);
+		fflush(logfp);
+	}
+}
+
+/*
+ * Take a connection to the journal port. Nothing is read from it here:
+ * its HELLO is read as select() finds it readable, so that a connection
+ * that says nothing cannot hold up the loop. A newer one replaces it.
+ */
+static void accept_standby() {
+	int fd;
+
+	if((fd = accept(listen_fd, NULL, NULL)) < 0) {
+		perror("accept standby");
+		return;
+	}
+
+	/* one standby at a time */
+	if(peer_fd >= 0) {
+		close(fd);
+		return;
+	}
+	if(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
+		perror("standby fcntl");
+		close(fd);
+		return;
+	}
+	if(hello_fd >= 0)
+		close(hello_fd);
+	hello_fd = fd;
+	hello_len = 0;
+}
+
+/* Read what came of the HELLO, and take the standby once it is whole. */
+static void read_hello() {
+	struct standby_rec *rec = (struct standby_rec *)hello_buf;
+	int want = sizeof(struct standby_rec);
+	int n;
+
+	if(hello_len >= sizeof(struct standby_rec))
+		want = ntohs(rec->len);
+	if((n = recv(hello_fd, hello_buf + hello_len, want - hello_len, 0)) < 0
+	   && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return;
+	if(n <= 0)
+		goto bad;
+	hello_len += n;
+
+	if(hello_len == sizeof(struct standby_rec)) {
+		want = ntohs(rec->len);
+		if(rec->type != STANDBY_HELLO || want < sizeof(struct standby_rec)
+		   || want > STANDBY_REC_LEN)
+			goto bad;
+	}
+	if(hello_len < want)
+		return;
+	hello_buf[hello_len] = '\0';
+
+	take_standby(hello_fd, rec);
+	hello_fd = -1;
+	return;
+
+bad:
+	close(hello_fd);
+	hello_fd = -1;
+}
+
+int
+standby_follow(char *spec) {
+	char buf[MAX_LINE_LEN];
+	char host_name[MAX_HOST_NAME_LEN];
+	char *port, *client_host;
+	struct sockaddr_in addr;
+	struct hostent *hp;
+	int fd;
+
+	strncpy(buf, spec, MAX_LINE_LEN - 1);
+	buf[MAX_LINE_LEN - 1] = '\0';
+	if((client_host = strchr(buf, '@')) != NULL)
+		*client_host++ = '\0';
+	if((port = strchr(buf, ':')) == NULL || atoi(port + 1) == 0) {
+		fprintf(stderr, "Expected <primary host>:<journal port>, got %s\n", spec);
+		return -1;
+	}
+	*port++ = '\0';
+
+	if((hp = gethostbyname(buf)) == NULL) {
+		fprintf(stderr, "Unknown primary host %s\n", buf);
+		return -1;
+	}
+	bzero(&addr, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(atoi(port));
+	memcpy(&addr.sin_addr, hp->h_addr_list[0], sizeof(addr.sin_addr));
+
+	if((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+		perror("socket");
+		return -1;
+	}
+	if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("connect to primary");
+		close(fd);
+		return -1;
+	}
+
+	/* tell the primary where its members are to find us */
+	if(client_host == NULL) {
+		if(gethostname(host_name, MAX_HOST_NAME_LEN) < 0) {
+			perror("gethostname");
+			close(fd);
+			return -1;
+		}
+		client_host = host_name;
+	}
+	if(write_rec(fd, STANDBY_HELLO, 0, 0, tenant->server_udp_port, 0,
+		     htons(tenant->server_tcp_port), client_host) < 0) {
+		perror("write to primary");
+		close(fd);
+		return -1;
+	}
+	follow_fd = fd;
+
+	if(log_flag) {
+		fprintf(logfp, "Standby of %s:%s\n", buf, port);
+		fflush(logfp);
+	}
+	return 0;
+}
+
+int
+standby_following() {
+	return follow_fd >= 0;
+}
+
+int
+standby_fds(fd_set *set, fd_set *wset, int maxfd) {
+	int fds[4], i;
+
+	/* once its socket takes more */
+	if(peer_fd >= 0 && out_len > 0)
+		FD_SET(peer_fd, wset);
+
+	fds[0] = listen_fd;
+	fds[1] = peer_fd;
+	fds[2] = follow_fd;
+	fds[3] = hello_fd;
+	for(i = 0; i < 4; i++) {
+		if(fds[i] < 0)
+			continue;
+		FD_SET(fds[i], set);
+		if(fds[i] > maxfd)
+			maxfd = fds[i];
+	}
+	return maxfd;
+}
+
+static struct room_type *find_room_with_id(u_int16_t room_id) {
+	struct room_type *rt;
+
+	for(rt = tenant->room_list_head; rt != NULL; rt = rt->next_room) {
+		if(rt->room_id == room_id)
+			break;
+	}
+	return rt;
+}
+
+static u_int32_t rec_member_id(struct standby_rec *rec) {
+	return (u_int32_t)ntohs(rec->member_id_hi) << 16 | ntohs(rec->member_id);
+}
+
+static void apply_member(struct standby_rec *rec) {
+	struct sockaddr_in addr;
+
+	bzero(&addr, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = rec->addr;
+	addr.sin_port = rec->port;
+
+	/* passed on, should this standby have one of its own */
+	standby_log_register(add_member(rec_member_id(rec), rec->name,
+					ntohl(rec->arg), &addr));
+}
+
+static void apply_room(struct standby_rec *rec) {
+	u_int16_t room_id = ntohs(rec->room_id);
+	u_int16_t saved_id = tenant->last_room_id;
+	struct room_type *rt;
+	int ret;
+
+	/* create_room() hands out the id after the last one */
+	tenant->last_room_id = room_id - 1;
+	ret = create_room(rec->name);
+	if(saved_id > room_id)
+		tenant->last_room_id = saved_id;
+
+	/* one of our room file's, with the primary's id for it */
+	if(ret == 3) {
+		for(rt = tenant->room_list_head; rt != NULL; rt = rt->next_room) {
+			if(!strcmp(rt->room_name, rec->name))
+				rt->room_id = room_id;
+		}
+	} else if(ret != 0 && log_flag) {
+		fprintf(logfp, "Standby could not create room [%s]: %d\n", rec->name, ret);
+		fflush(logfp);
+	}
+}
+
+static void apply_rec(struct standby_rec *rec) {
+	struct member_type *mt = NULL;
+	struct room_type *rt = NULL;
+
+	if(rec_member_id(rec) != 0)
+		mt = find_member_with_id(rec_member_id(rec));
+	if(rec->room_id != 0)
+		rt = find_room_with_id(ntohs(rec->room_id));
+
+	switch(rec->type) {
+	case STANDBY_MEMBER:
+		if(mt == NULL)
+			apply_member(rec);
+		break;
+	case STANDBY_ROOM:
+		apply_room(rec);
+		break;
+	case STANDBY_SWITCH:
+		if(mt != NULL && rt != NULL) {
+			move_member(mt, rt);
+			standby_log_switch(mt);
+		}
+		break;
+	case STANDBY_LEAVE:
+		if(mt != NULL) {
+			remove_member(mt);
+			free(mt);
+		}
+		break;
+	case STANDBY_ROOM_GONE:
+		if(rt != NULL && rt->num_of_members == 0) {
+			remove_room(rt);
+			tenant->total_num_of_rooms--;
+			standby_log_room_gone(rt);
+			free_room(rt);
+		}
+		break;
+	case STANDBY_SEQ:
+		if(rt != NULL)
+			rt->room_seq = ntohl(rec->arg);
+		break;
+	}
+}
+
+static void take_over() {
+	struct member_type *mt;
+	struct room_type *rt;
+
+	close(follow_fd);
+	follow_fd = -1;
+
+	/* give everyone a full sweep interval to show up here */
+	for(mt = tenant->mem_list_head; mt != NULL; mt = mt->next_member)
+		mt->quiet_flag = 0;
+	for(rt = tenant->room_list_head; rt != NULL; rt = rt->next_room) {
+		rt->empty_flag = 0;
+		rt->room_seq += STANDBY_SEQ_SKIP;
+	}
+
+	if(log_flag) {
+		now = time(NULL);
+		fprintf(logfp, "%sPrimary is gone, taking over with %d members and %d rooms.\n",
+			ctime(&now), tenant->total_num_of_members, tenant->total_num_of_rooms);
+		fflush(logfp);
+	}
+}
+
+int
+standby_ready(fd_set *set, fd_set *wset) {
+	char buf[STANDBY_REC_LEN + 1];
+	int n = 0;
+
+	if(peer_fd >= 0 && FD_ISSET(peer_fd, wset)) {
+		if(flush_journal() < 0)
+			drop_standby();
+		n++;
+	}
+
+	if(follow_fd >= 0 && FD_ISSET(follow_fd, set)) {
+		if(read_rec(follow_fd, buf) < 0)
+			take_over();
+		else
+			apply_rec((struct standby_rec *)buf);
+		n++;
+	}
+
+	/* the standby has nothing to say, this is it going away */
+	if(peer_fd >= 0 && FD_ISSET(peer_fd, set)) {
+		drop_standby();
+		n++;
+	}
+
+	if(hello_fd >= 0 && FD_ISSET(hello_fd, set)) {
+		read_hello();
+		n++;
+	}
+
+	if(listen_fd >= 0 && FD_ISSET(listen_fd, set)) {
+		accept_standby();
+		n++;
+	}
+	return n;
+}
+
+void
+standby_tick() {
+	struct room_type *rt;
+	long long now_ns;
+
+	if(peer_fd < 0 || (now_ns = mono_ns()) < next_seq_ns)
+		return;
+	next_seq_ns = now_ns + STANDBY_SEQ_MS * 1000000LL;
+
+	for(rt = tenant->room_list_head; rt != NULL; rt = rt->next_room) {
+		if(rt->room_seq != rt->standby_seq) {
+			journal(STANDBY_SEQ, 0, rt->room_id, rt->room_seq, 0, 0, NULL);
+			rt->standby_seq = rt->room_seq;
+		}
+	}
+}
+
+void
+standby_announce(int fd, struct member_type *mt) {
+	char buf[sizeof(struct room_redirect) + MAX_HOST_NAME_LEN];
+	struct room_redirect *rd = (struct room_redirect *)buf;
+
+	if(peer_fd < 0 || !(mt->caps & CAP_STANDBY))
+		return;
+
+	rd->tcp_port = htons(peer_tcp_port);
+	rd->udp_port = htons(peer_udp_port);
+	strcpy(rd->host_name, peer_host);
+	send_control_reply_data(fd, STANDBY_INFO, mt->member_id, 0, buf,
+				sizeof(struct room_redirect) + strlen(peer_host) + 1);
+}
+
+void
+standby_log_register(struct member_type *mt) {
+	journal(STANDBY_MEMBER, mt->member_id, 0, mt->caps,
+		mt->member_udp_addr.sin_addr.s_addr, mt->member_udp_addr.sin_port,
+		mt->member_name);
+}
+
+void
+standby_log_room(struct room_type *rt) {
+	char spec[MAX_ROOM_NAME_LEN + ROOM_OPTS_LEN + 2];
+
+	if(peer_fd < 0)
+		return;
+	if(rt->room_opts[0] != '\0')
+		snprintf(spec, sizeof(spec), "%s:%s", rt->room_name, rt->room_opts);
+	else
+		strcpy(spec, rt->room_name);
+	journal(STANDBY_ROOM, 0, rt->room_id, 0, 0, 0, spec);
+}
+
+void
+standby_log_switch(struct member_type *mt) {
+	journal(STANDBY_SWITCH, mt->member_id, mt->current_room->room_id, 0, 0, 0, NULL);
+}
+
+void
+standby_log_leave(struct member_type *mt) {
+	journal(STANDBY_LEAVE, mt->member_id, 0, 0, 0, 0, NULL);
+}
+
+void
+standby_log_room_gone(struct room_type *rt) {
+	journal(STANDBY_ROOM_GONE, 0, rt->room_id, 0, 0, 0, NULL);
+}
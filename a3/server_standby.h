@@ -0,0 +1,187 @@
+/*
+ *      File:      server_standby.h
+ *
+ * Hot standby. A primary started with chatserver -j <journal port> takes
+ * one standby, a chatserver started with
+ *
+ *   -y <primary host>:<journal port>[@<host name for clients>]
+ *
+ * The standby connects to the journal port and gets a snapshot of the
+ * primary's members and rooms, then a record of every member that
+ * registers, room that is created, switch, quit and swept member or room,
+ * each queued before the client gets its reply. The standby applies the
+ * records as they come, keeping the same member and room ids, and does
+ * not serve its own ports meanwhile. When the journal connection closes
+ * the standby takes over: it starts serving with all members and rooms
+ * in place.
+ *
+ * Members that negotiated CAP_STANDBY learn where the standby is from the
+ * answers to their keep-alives (STANDBY_INFO, see defs_ext.h) and move
+ * over without registering again.
+ *
+ * Only the membership is replicated. Room messages kept for history,
+ * retransmission or search, content filters and multicast joins are not;
+ * room sequence numbers are, about every STANDBY_SEQ_MS, and jump ahead
+ * by STANDBY_SEQ_SKIP at takeover so that receivers never see them go
+ * back.
+ */
+
+#ifndef _SERVER_STANDBY_H
+#define _SERVER_STANDBY_H
+
+#include <sys/select.h>
+
+#include "server.h"
+
+#define STANDBY_SEQ_MS      100
+#define STANDBY_SEQ_SKIP    1000
+
+/* journal held for a standby that does not keep up; more and it is dropped */
+#define STANDBY_BUF_LEN     (4 << 20)
+
+/* journal record types */
+#define STANDBY_HELLO       1   /* standby to primary: where clients find it */
+#define STANDBY_MEMBER      2   /* a member registered */
+#define STANDBY_ROOM        3   /* a room was created, name[:options] */
+#define STANDBY_SWITCH      4   /* a member moved to a room */
+#define STANDBY_LEAVE       5   /* a member quit or was swept */
+#define STANDBY_ROOM_GONE   6   /* an empty room was swept */
+#define STANDBY_SEQ         7   /* sequence number of a room */
+
+/*
+ * A journal record, all fields in network byte order, followed by a '\0'
+ * terminated name where the type has one. len counts the whole record.
+ * HELLO puts the standby's tcp port in port and its udp port in arg, a
+ * MEMBER its caps in arg and its chat address in addr and port, a SEQ
+ * the sequence number in arg. member_id_hi is the high half of a wide
+ * member id, see defs_ext.h.
+ */
+struct standby_rec {
+	u_int8_t type;
+	u_int8_t pad;
+	u_int16_t len;
+	u_int16_t member_id;
+	u_int16_t room_id;
+	u_int32_t arg;
+	u_int32_t addr;
+	u_int16_t port;
+	u_int16_t member_id_hi;
+	char name[0];
+} __attribute__ ((packed));
+
+/*
+ *  FUNCTION: standby_serve
+ *
+ *  SYNOPSIS: take a standby on the journal port
+ *
+ *  PASS:     port ==> the journal port
+ *
+ *  RETURN:   void
+ *
+ */
+void standby_serve(u_int16_t port);
+
+/*
+ *  FUNCTION: standby_follow
+ *
+ *  SYNOPSIS: become the standby of a primary
+ *
+ *  PASS:     spec ==> <primary host>:<journal port>[@<host name for clients>]
+ *
+ *  RETURN:   0 on success, -1 on failure (reported)
+ *
+ *  NOTE:     Call after init_server(). The chat ports are not to be
+ *            served while standby_following() says so.
+ *
+ */
+int standby_follow(char *spec);
+
+/*
+ *  FUNCTION: standby_following
+ *
+ *  SYNOPSIS: tell whether this server is still a standby
+ *
+ *  RETURN:   non-zero until it takes over
+ *
+ */
+int standby_following();
+
+/*
+ *  FUNCTION: standby_fds
+ *
+ *  SYNOPSIS: add the journal descriptors to the sets for select()
+ *
+ *  PASS:     set ==> the read set
+ *            wset ==> the write set, for a standby with journal held back
+ *            maxfd ==> the highest descriptor in them
+ *
+ *  RETURN:   the highest descriptor in them now
+ *
+ */
+int standby_fds(fd_set *set, fd_set *wset, int maxfd);
+
+/*
+ *  FUNCTION: standby_ready
+ *
+ *  SYNOPSIS: take a standby, send it journal held back, or apply journal
+ *            records, as select() says
+ *
+ *  PASS:     set ==> what select() found ready to read
+ *            wset ==> what it found ready to write
+ *
+ *  RETURN:   the number of journal descriptors that were ready, counted
+ *            once per set
+ *
+ */
+int standby_ready(fd_set *set, fd_set *wset);
+
+/*
+ *  FUNCTION: standby_tick
+ *
+ *  SYNOPSIS: send the standby the room sequence numbers that moved on
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     Called every round of the server loop; does the work at
+ *            most every STANDBY_SEQ_MS.
+ *
+ */
+void standby_tick();
+
+/*
+ *  FUNCTION: standby_announce
+ *
+ *  SYNOPSIS: answer a keep-alive with where the standby is
+ *
+ *  PASS:     fd ==> the control connection
+ *            mt ==> the member
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     Nothing is sent without a standby or CAP_STANDBY.
+ *
+ */
+void standby_announce(int fd, struct member_type *mt);
+
+/*
+ *  FUNCTION: standby_log_register, standby_log_room, standby_log_switch,
+ *            standby_log_leave, standby_log_room_gone
+ *
+ *  SYNOPSIS: journal a change of membership
+ *
+ *  PASS:     mt ==> the member that registered, moved to its current
+ *                   room or is about to be removed
+ *            rt ==> the room that was created or is being removed
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     Nothing happens without a standby.
+ *
+ */
+void standby_log_register(struct member_type *mt);
+void standby_log_room(struct room_type *rt);
+void standby_log_switch(struct member_type *mt);
+void standby_log_leave(struct member_type *mt);
+void standby_log_room_gone(struct room_type *rt);
+
+#endif
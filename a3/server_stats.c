@@ -0,0 +1,234 @@
+/*
+ *      File:      server_stats.c
+ *
+ * Forwarding latency histogram, see server_stats.h.
+ */
+
+#include <stdio.h>
+#include <strings.h>
+
+#include <netinet/in.h>
+
+#include "server.h"
+#include "server_stats.h"
+
+#define HIST_SUB_BITS   3
+#define HIST_SUB        (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS    (64 * HIST_SUB)
+
+static unsigned long hist[HIST_BUCKETS];
+static unsigned long hist_count;
+static long long hist_max;
+
+/* compressed chat messages */
+static unsigned long zip_msgs;
+static unsigned long long zip_bytes;
+static unsigned long long zip_raw_bytes;
+static long long zip_ns;
+static unsigned long zip_copies;
+static unsigned long long zip_saved;
+
+/* copies sent with the compact header, and announcements of names */
+static unsigned long compact_copies;
+static unsigned long long compact_saved;
+static unsigned long name_sends;
+static unsigned long long name_bytes;
+
+/* datagrams sent by the coalescing stage */
+static unsigned long bundles;
+static unsigned long bundled_msgs;
+
+/* datagrams sent to multicast groups */
+static unsigned long mcast_sends;
+static unsigned long mcast_members;
+
+/* rooms moved to other nodes, and chat messages of their members since */
+static unsigned long migrations;
+static long long migration_ns_max;
+static unsigned long handover_msgs;
+static unsigned long handover_lost;
+
+long long mono_ns() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+long long wall_ns() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int hist_index(unsigned long long v) {
+	int e;
+
+	if(v < HIST_SUB)
+		return v;
+	e = 63 - __builtin_clzll(v);
+	return (e - HIST_SUB_BITS + 1) * HIST_SUB
+		+ ((v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/* upper bound of the values that land in bucket idx */
+static unsigned long long hist_value(int idx) {
+	int e;
+
+	if(idx < HIST_SUB)
+		return idx;
+	e = idx / HIST_SUB + HIST_SUB_BITS - 1;
+	return ((unsigned long long)(HIST_SUB + idx % HIST_SUB + 1)
+		<< (e - HIST_SUB_BITS)) - 1;
+}
+
+static unsigned long long hist_percentile(double p) {
+	unsigned long target = (unsigned long)(p * hist_count);
+	unsigned long seen = 0;
+	int i;
+
+	if(target >= hist_count)
+		target = hist_count - 1;
+	for(i = 0; i < HIST_BUCKETS; i++) {
+		seen += hist[i];
+		if(seen > target)
+			return hist_value(i);
+	}
+	return hist_max;
+}
+
+void stats_record_forward(struct timespec *rx_ts) {
+	long long lat;
+
+	if(rx_ts == NULL || rx_ts->tv_sec == 0)
+		return;
+
+	lat = wall_ns() - ((long long)rx_ts->tv_sec * 1000000000LL + rx_ts->tv_nsec);
+	if(lat < 0)
+		lat = 0;
+
+	hist[hist_index(lat)]++;
+	hist_count++;
+	if(lat > hist_max)
+		hist_max = lat;
+}
+
+void stats_record_unzip(int zlen, int len, long long ns) {
+	zip_msgs++;
+	zip_bytes += zlen;
+	zip_raw_bytes += len;
+	zip_ns += ns;
+}
+
+void stats_record_zip_copy(int saved) {
+	zip_copies++;
+	zip_saved += saved;
+}
+
+void stats_record_compact_copy(int saved) {
+	compact_copies++;
+	compact_saved += saved;
+}
+
+void stats_record_names(int len) {
+	name_sends++;
+	name_bytes += len;
+}
+
+void stats_record_bundle(int count) {
+	bundles++;
+	bundled_msgs += count;
+}
+
+void stats_record_mcast(int members) {
+	mcast_sends++;
+	mcast_members += members;
+}
+
+void stats_record_migration(long long ns) {
+	migrations++;
+	if(ns > migration_ns_max)
+		migration_ns_max = ns;
+}
+
+void stats_record_handover(int lost) {
+	handover_msgs++;
+	handover_lost += lost;
+}
+
+void stats_report(char *mode) {
+	FILE *fp = log_flag ? logfp : stdout;
+
+	if(migrations != 0 || handover_msgs != 0) {
+		fprintf(fp, "Migration: %lu rooms moved, longest %lldus; "
+			"%lu msgs passed on, %lu lost\n",
+			migrations, migration_ns_max / 1000, handover_msgs, handover_lost);
+		fflush(fp);
+
+		migrations = 0;
+		migration_ns_max = 0;
+		handover_msgs = 0;
+		handover_lost = 0;
+	}
+
+	if(mcast_sends != 0) {
+		fprintf(fp, "Multicast: %lu datagrams for %lu member copies\n",
+			mcast_sends, mcast_members);
+		fflush(fp);
+
+		mcast_sends = 0;
+		mcast_members = 0;
+	}
+
+	if(compact_copies != 0 || name_sends != 0) {
+		fprintf(fp, "Compact header: %lu copies saved %llu bytes; "
+			"%lu name announcements, %llu bytes\n",
+			compact_copies, compact_saved, name_sends, name_bytes);
+		fflush(fp);
+
+		compact_copies = 0;
+		compact_saved = 0;
+		name_sends = 0;
+		name_bytes = 0;
+	}
+
+	if(bundles != 0) {
+		fprintf(fp, "Coalescing: %lu msgs in %lu datagrams (%.1f per datagram)\n",
+			bundled_msgs, bundles, (double)bundled_msgs / bundles);
+		fflush(fp);
+
+		bundles = 0;
+		bundled_msgs = 0;
+	}
+
+	if(zip_msgs != 0) {
+		fprintf(fp, "Compression: %lu msgs %llu -> %llu bytes (%.0f%%) unzip %.0fns/msg, "
+			"%lu copies saved %llu bytes\n",
+			zip_msgs, zip_raw_bytes, zip_bytes,
+			zip_raw_bytes ? zip_bytes * 100.0 / zip_raw_bytes : 0.0,
+			(double)zip_ns / zip_msgs, zip_copies, zip_saved);
+		fflush(fp);
+
+		zip_msgs = 0;
+		zip_bytes = 0;
+		zip_raw_bytes = 0;
+		zip_ns = 0;
+		zip_copies = 0;
+		zip_saved = 0;
+	}
+
+	if(hist_count == 0)
+		return;
+
+	fprintf(fp, "Forwarding latency [%s]: %lu msgs p50 %.1fus p99 %.1fus max %.1fus\n",
+		mode, hist_count,
+		hist_percentile(0.50) / 1000.0,
+		hist_percentile(0.99) / 1000.0,
+		hist_max / 1000.0);
+	fflush(fp);
+
+	bzero(hist, sizeof(hist));
+	hist_count = 0;
+	hist_max = 0;
+}
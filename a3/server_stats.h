@@ -0,0 +1,154 @@
+/*
+ *      File:      server_stats.h
+ *
+ * Forwarding latency instrumentation for the chatserver. The latency of a
+ * chat message is measured from the kernel receive timestamp of the
+ * datagram (SO_TIMESTAMPNS) to the moment the last copy has been handed
+ * to the kernel for sending. Samples go into a log-linear histogram
+ * (8 sub-buckets per power of two, so percentiles are within 12.5%)
+ * which is reported and reset periodically.
+ */
+
+#ifndef _SERVER_STATS_H
+#define _SERVER_STATS_H
+
+#include <time.h>
+
+/* seconds between two latency reports */
+#define STATS_REPORT_INT   10
+
+/*
+ *  FUNCTION: stats_record_forward
+ *
+ *  SYNOPSIS: record the forwarding latency of one chat message
+ *
+ *  PASS:     rx_ts ==> kernel receive timestamp (CLOCK_REALTIME) of the
+ *                      datagram, NULL if none was available
+ *
+ *  RETURN:   void
+ *
+ */
+void stats_record_forward(struct timespec *rx_ts);
+
+/*
+ *  FUNCTION: stats_report
+ *
+ *  SYNOPSIS: log count, p50, p99 and max forwarding latency since the last
+ *            report, then start a new window
+ *
+ *  PASS:     mode ==> name of the event loop mode, included in the report
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     Nothing is logged for a window without samples. Reports go to
+ *            the log file if there is one, else to stdout.
+ *
+ */
+void stats_report(char *mode);
+
+/*
+ *  FUNCTION: stats_record_unzip
+ *
+ *  SYNOPSIS: record the decompression of one compressed chat message
+ *
+ *  PASS:     zlen ==> length of the compressed text
+ *            len ==> length of the text
+ *            ns ==> time taken to decompress it
+ *
+ *  RETURN:   void
+ *
+ */
+void stats_record_unzip(int zlen, int len, long long ns);
+
+/*
+ *  FUNCTION: stats_record_zip_copy
+ *
+ *  SYNOPSIS: record a copy of a chat message sent compressed
+ *
+ *  PASS:     saved ==> bytes saved against sending the text
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     Compression is reported with the latency, by stats_report().
+ *
+ */
+void stats_record_zip_copy(int saved);
+
+/*
+ *  FUNCTION: stats_record_compact_copy
+ *
+ *  SYNOPSIS: record a copy of a chat message sent with the compact header
+ *
+ *  PASS:     saved ==> bytes saved against the defs.h header
+ *
+ *  RETURN:   void
+ *
+ */
+void stats_record_compact_copy(int saved);
+
+/*
+ *  FUNCTION: stats_record_names
+ *
+ *  SYNOPSIS: record a datagram announcing names, see server_names.h
+ *
+ *  PASS:     len ==> its length
+ *
+ *  RETURN:   void
+ *
+ */
+void stats_record_names(int len);
+
+/*
+ *  FUNCTION: stats_record_bundle
+ *
+ *  SYNOPSIS: record a datagram sent by the coalescing stage
+ *
+ *  PASS:     count ==> number of chat messages in it
+ *
+ *  RETURN:   void
+ *
+ */
+void stats_record_bundle(int count);
+
+/*
+ *  FUNCTION: stats_record_mcast
+ *
+ *  SYNOPSIS: record a datagram sent to the multicast group of a room
+ *
+ *  PASS:     members ==> number of members it stands in for
+ *
+ *  RETURN:   void
+ *
+ */
+void stats_record_mcast(int members);
+
+/*
+ *  FUNCTION: stats_record_migration
+ *
+ *  SYNOPSIS: record a room moved to another node
+ *
+ *  PASS:     ns ==> how long the room was frozen
+ *
+ *  RETURN:   void
+ *
+ */
+void stats_record_migration(long long ns);
+
+/*
+ *  FUNCTION: stats_record_handover
+ *
+ *  SYNOPSIS: record a chat message passed on to the node a member's
+ *            room moved to
+ *
+ *  PASS:     lost ==> 1 if it could not be sent on, 0 if it was
+ *
+ *  RETURN:   void
+ *
+ */
+void stats_record_handover(int lost);
+
+/* monotonic and wall clock in nanoseconds */
+long long mono_ns();
+long long wall_ns();
+
+#endif
@@ -0,0 +1,253 @@
+/*
+ *      File:      server_subs.c
+ *
+ * Room subscriptions, see server_subs.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "server.h"
+#include "server_stats.h"
+#include "server_sched.h"
+#include "server_subs.h"
+
+struct room_sub {
+	struct member_type *mt;
+	struct room_type *rt;
+
+	/* the room's followers */
+	struct room_sub *next_in_room;
+	struct room_sub *prev_in_room;
+
+	/* the member's rooms */
+	struct room_sub *next_of_member;
+	struct room_sub *prev_of_member;
+
+	/* in the tenant's sub_hash */
+	struct room_sub *next_hash;
+};
+
+static unsigned int sub_bucket(struct member_type *mt, u_int16_t room_id) {
+	return ((mt->member_id * 2654435761U) >> 16 ^ room_id * 40503U) & (SUB_HASH_SIZE - 1);
+}
+
+static struct room_sub *sub_lookup(struct member_type *mt, u_int16_t room_id) {
+	struct room_sub *s;
+
+	for(s = tenant->sub_hash[sub_bucket(mt, room_id)]; s != NULL; s = s->next_hash) {
+		if(s->mt == mt && s->rt->room_id == room_id)
+			break;
+	}
+	return s;
+}
+
+static void sub_add(struct member_type *mt, struct room_type *rt) {
+	struct room_sub *s;
+	unsigned int b = sub_bucket(mt, rt->room_id);
+
+	if((s = (struct room_sub *)calloc(1, sizeof(struct room_sub))) == NULL) {
+		printf("Memory used up when trying to subscribe to a room\n");
+		exit(1);
+	}
+	s->mt = mt;
+	s->rt = rt;
+
+	s->next_in_room = rt->subs;
+	if(rt->subs != NULL)
+		rt->subs->prev_in_room = s;
+	rt->subs = s;
+	rt->num_subs++;
+
+	s->next_of_member = mt->subs;
+	if(mt->subs != NULL)
+		mt->subs->prev_of_member = s;
+	mt->subs = s;
+	mt->num_subs++;
+
+	s->next_hash = tenant->sub_hash[b];
+	tenant->sub_hash[b] = s;
+}
+
+static void sub_free(struct room_sub *s) {
+	struct room_sub **pp;
+
+	if(s->prev_in_room != NULL)
+		s->prev_in_room->next_in_room = s->next_in_room;
+	else
+		s->rt->subs = s->next_in_room;
+	if(s->next_in_room != NULL)
+		s->next_in_room->prev_in_room = s->prev_in_room;
+	s->rt->num_subs--;
+
+	if(s->prev_of_member != NULL)
+		s->prev_of_member->next_of_member = s->next_of_member;
+	else
+		s->mt->subs = s->next_of_member;
+	if(s->next_of_member != NULL)
+		s->next_of_member->prev_of_member = s->prev_of_member;
+	s->mt->num_subs--;
+
+	for(pp = &tenant->sub_hash[sub_bucket(s->mt, s->rt->room_id)]; *pp != NULL;
+	    pp = &(*pp)->next_hash) {
+		if(*pp == s) {
+			*pp = s->next_hash;
+			break;
+		}
+	}
+	free(s);
+}
+
+static struct room_type *room_named(char *room_name) {
+	struct room_type *rt;
+
+	for(rt = tenant->room_list_head; rt != NULL; rt = rt->next_room) {
+		if(!strcmp(room_name, rt->room_name))
+			break;
+	}
+	return rt;
+}
+
+void
+process_subscribe_request(int fd, struct member_type *mt, char *msg) {
+	struct control_msghdr *cmh = (struct control_msghdr *)msg;
+	struct room_type *rt;
+	u_int16_t room_id;
+
+	if(!(mt->caps & CAP_SUBSCRIBE) || !(mt->caps & CAP_EXT_HDR)) {
+		strcpy(err_str, "Subscriptions not negotiated!");
+		send_control_msg_reply(fd, SUBSCRIBE_FAIL, mt->member_id, err_str);
+		return;
+	}
+	if((rt = room_named((char *)cmh->msgdata)) == NULL) {
+		strcpy(err_str, "Room not found!");
+		send_control_msg_reply(fd, SUBSCRIBE_FAIL, mt->member_id, err_str);
+		return;
+	}
+	if(rt == mt->current_room || sub_lookup(mt, rt->room_id) != NULL) {
+		strcpy(err_str, "Already following this room!");
+		send_control_msg_reply(fd, SUBSCRIBE_FAIL, mt->member_id, err_str);
+		return;
+	}
+	if(mt->num_subs >= SUBS_MAX_PER_MEMBER) {
+		strcpy(err_str, "Following too many rooms!");
+		send_control_msg_reply(fd, SUBSCRIBE_FAIL, mt->member_id, err_str);
+		return;
+	}
+	if(rt->num_subs >= SUBS_MAX_PER_ROOM) {
+		strcpy(err_str, "Room has too many followers!");
+		send_control_msg_reply(fd, SUBSCRIBE_FAIL, mt->member_id, err_str);
+		return;
+	}
+
+	sub_add(mt, rt);
+	rt->empty_flag = 0;
+
+	room_id = htons(rt->room_id);
+	send_control_reply_data(fd, SUBSCRIBE_SUCC, mt->member_id, 0,
+				(char *)&room_id, sizeof(room_id));
+	if(log_flag) {
+		fprintf(logfp, "Member [%s] follows room [%s], %d rooms, %d followers.\n",
+			mt->member_name, rt->room_name, mt->num_subs, rt->num_subs);
+		fflush(logfp);
+	}
+}
+
+void
+process_unsubscribe_request(int fd, struct member_type *mt, char *msg) {
+	struct control_msghdr *cmh = (struct control_msghdr *)msg;
+	struct room_type *rt;
+	char reply[MAX_ROOM_NAME_LEN + 32];
+
+	if((rt = room_named((char *)cmh->msgdata)) == NULL
+	   || sub_lookup(mt, rt->room_id) == NULL) {
+		strcpy(err_str, "Not following this room!");
+		send_control_msg_reply(fd, UNSUBSCRIBE_FAIL, mt->member_id, err_str);
+		return;
+	}
+
+	subs_leave(mt, rt);
+	snprintf(reply, sizeof(reply), "No longer following room %s", rt->room_name);
+	send_control_msg_reply(fd, UNSUBSCRIBE_SUCC, mt->member_id, reply);
+	if(log_flag) {
+		fprintf(logfp, "Member [%s] no longer follows room [%s].\n",
+			mt->member_name, rt->room_name);
+		fflush(logfp);
+	}
+}
+
+struct room_type *
+subs_target_room(struct member_type *mt, char *buf, int n) {
+	struct chat_msghdr *cmh = (struct chat_msghdr *)buf;
+	struct chat_ext_hdr *ext = (struct chat_ext_hdr *)cmh->msgdata;
+	struct room_sub *s;
+	u_int16_t room_id;
+
+	/* room_id means nothing from those that did not negotiate it */
+	if(!(mt->caps & CAP_SUBSCRIBE) || !(ntohs(cmh->msg_len) & CHAT_EXT_FLAG)
+	   || n < sizeof(struct chat_msghdr) + sizeof(struct chat_ext_hdr)
+	   || (room_id = ntohs(ext->room_id)) == 0
+	   || (mt->current_room != NULL && room_id == mt->current_room->room_id))
+		return mt->current_room;
+
+	return (s = sub_lookup(mt, room_id)) != NULL ? s->rt : NULL;
+}
+
+int
+subs_send(int udp_socket_fd, struct chat_out *co) {
+	struct room_sub *s;
+	char *msg;
+	int fmt, len;
+	int copies = 0;
+
+	for(s = co->rt->subs; s != NULL; s = s->next_in_room) {
+		if(s->mt->moved_id != 0)
+			continue;
+
+		fmt = CHAT_FMT_EXT;
+		if((s->mt->caps & CAP_COMPRESS) && co->ztext != NULL) {
+			stats_record_zip_copy(co->text_len - co->ztext_len);
+			fmt |= CHAT_FMT_ZIP;
+		}
+		len = chat_msg_fmt(co, fmt, &msg);
+		if(sendto(udp_socket_fd, msg, len, 0,
+			  (struct sockaddr *)&s->mt->member_udp_addr,
+			  sizeof(struct sockaddr_in)) < 0) {
+			perror("send to");
+			break;
+		}
+		copies++;
+	}
+	return copies;
+}
+
+void
+subs_leave(struct member_type *mt, struct room_type *rt) {
+	struct room_sub *s;
+
+	if(mt->subs == NULL || (s = sub_lookup(mt, rt->room_id)) == NULL)
+		return;
+
+	/* what it sent goes to the room it sent it to */
+	sched_flush_room(rt);
+	sub_free(s);
+}
+
+void
+subs_drop_member(struct member_type *mt) {
+	while(mt->subs != NULL) {
+		sched_flush_room(mt->subs->rt);
+		sub_free(mt->subs);
+	}
+}
+
+void
+subs_drop_room(struct room_type *rt) {
+	while(rt->subs != NULL)
+		sub_free(rt->subs);
+}
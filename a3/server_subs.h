@@ -0,0 +1,126 @@
+/*
+ *      File:      server_subs.h
+ *
+ * Room subscriptions (see defs_ext.h): a member follows rooms besides the
+ * one it is in, with one registration and one keep alive for all of them.
+ *
+ * A subscription is a room_sub on two lists: the room's list of members
+ * following it, which its messages are sent to after its own members,
+ * and the member's list of the rooms it follows, the inverted index that
+ * lets the member go (remove_member) or leave a room without looking at
+ * anyone else's. A hash of the subscriptions of the tenant by member and
+ * room id finds the room a chat message names. Nothing here walks the
+ * rooms or the members of the server.
+ *
+ * A member follows at most SUBS_MAX_PER_MEMBER rooms, and a room has at
+ * most SUBS_MAX_PER_ROOM followers. A room that is followed is not swept
+ * away for being empty.
+ */
+
+#ifndef _SERVER_SUBS_H
+#define _SERVER_SUBS_H
+
+#include "server.h"
+
+#define SUBS_MAX_PER_MEMBER     64
+#define SUBS_MAX_PER_ROOM       4096
+
+/*
+ *  FUNCTION: process_subscribe_request
+ *
+ *  SYNOPSIS: have a member follow the room named in a SUBSCRIBE_REQUEST
+ *
+ *  PASS:     fd ==> the control connection, to answer on
+ *            mt ==> the member
+ *            msg ==> the request, header in host byte order
+ *
+ *  RETURN:   void
+ *
+ */
+void process_subscribe_request(int fd, struct member_type *mt, char *msg);
+
+/*
+ *  FUNCTION: process_unsubscribe_request
+ *
+ *  SYNOPSIS: end the subscription named in an UNSUBSCRIBE_REQUEST
+ *
+ *  PASS:     fd ==> the control connection, to answer on
+ *            mt ==> the member
+ *            msg ==> the request, header in host byte order
+ *
+ *  RETURN:   void
+ *
+ */
+void process_unsubscribe_request(int fd, struct member_type *mt, char *msg);
+
+/*
+ *  FUNCTION: subs_target_room
+ *
+ *  SYNOPSIS: find the room a chat message from a member goes to
+ *
+ *  PASS:     mt ==> the sender
+ *            buf ==> the message as received
+ *            n ==> its length
+ *
+ *  RETURN:   the room it follows whose id the extended header names,
+ *            else its current room; NULL if it names a room it does not
+ *            follow, or it is in no room
+ *
+ */
+struct room_type *subs_target_room(struct member_type *mt, char *buf, int n);
+
+/*
+ *  FUNCTION: subs_send
+ *
+ *  SYNOPSIS: send a chat message to the members that follow its room
+ *
+ *  PASS:     udp_socket_fd ==> the socket to send with
+ *            co ==> the message, as admit_chat_msg() left it
+ *
+ *  RETURN:   the number of copies sent
+ *
+ */
+int subs_send(int udp_socket_fd, struct chat_out *co);
+
+/*
+ *  FUNCTION: subs_leave
+ *
+ *  SYNOPSIS: end a member's subscription to a room, if it has one
+ *
+ *  PASS:     mt ==> the member
+ *            rt ==> the room
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     Called when the member switches into the room.
+ *
+ */
+void subs_leave(struct member_type *mt, struct room_type *rt);
+
+/*
+ *  FUNCTION: subs_drop_member
+ *
+ *  SYNOPSIS: end all the subscriptions of a member that goes away
+ *
+ *  PASS:     mt ==> the member
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     What it sent to the rooms it follows goes out first.
+ *
+ */
+void subs_drop_member(struct member_type *mt);
+
+/*
+ *  FUNCTION: subs_drop_room
+ *
+ *  SYNOPSIS: end all the subscriptions to a room that goes away
+ *
+ *  PASS:     rt ==> the room
+ *
+ *  RETURN:   void
+ *
+ */
+void subs_drop_room(struct room_type *rt);
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ *      File:      server_tenant.c
+ *
+ * Virtual chatservers sharing one process, see server_tenant.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <netinet/in.h>
+
+#include "server.h"
+#include "server_tenant.h"
+
+static struct tenant default_tenant;
+static int num_tenants;
+
+static void tenant_setup(struct tenant *t, char *name) {
+	bzero(t, sizeof(struct tenant));
+	strncpy(t->name, name, TENANT_NAME_LEN - 1);
+	t->tcp_socket_fd = -1;
+	t->udp_socket_fd = -1;
+	t->max_members = MAX_NUM_OF_MEMBERS;
+	t->max_rooms = MAX_NUM_OF_ROOMS;
+}
+
+struct tenant *
+tenant_default() {
+	if(num_tenants == 0) {
+		tenant_setup(&default_tenant, "default");
+		num_tenants = 1;
+	}
+	return &default_tenant;
+}
+
+int
+tenant_load(char *file_name) {
+	FILE *fp;
+	char line[MAX_LINE_LEN];
+	struct tenant *t, *last;
+	int lineno = 0;
+
+	if((fp = fopen(file_name, "r")) == NULL) {
+		perror("fopen tenant file");
+		return -1;
+	}
+
+	for(last = tenant_default(); last->next_tenant != NULL; )
+		last = last->next_tenant;
+
+	while(fgets(line, MAX_LINE_LEN, fp) != NULL) {
+		char name[TENANT_NAME_LEN], room_file[MAX_FILE_NAME_LEN];
+		unsigned int tcp_port, udp_port;
+		int max_members = MAX_NUM_OF_MEMBERS, max_rooms = MAX_NUM_OF_ROOMS;
+		char *p = line;
+		int n;
+
+		lineno++;
+		while(*p == ' ' || *p == '\t')
+			p++;
+		if(*p == '#' || *p == '\n' || *p == '\0')
+			continue;
+
+		room_file[0] = '\0';
+		n = sscanf(p, "%31s %u %u %d %d %79s", name, &tcp_port, &udp_port,
+			   &max_members, &max_rooms, room_file);
+		if(n < 3 || tcp_port == 0 || tcp_port > 65535
+		   || udp_port == 0 || udp_port > 65535
+		   || max_members <= 0 || max_members > MAX_NUM_OF_MEMBERS
+		   || max_rooms <= 0 || max_rooms > MAX_NUM_OF_ROOMS) {
+			fprintf(stderr, "%s:%d: expected <name> <tcp port> <udp port> [<max members> (1-%d) [<max rooms> (1-%d) [<room file>]]]\n",
+				file_name, lineno, MAX_NUM_OF_MEMBERS, MAX_NUM_OF_ROOMS);
+			fclose(fp);
+			return -1;
+		}
+		if(num_tenants == TENANT_MAX) {
+			fprintf(stderr, "%s: more than %d tenants\n", file_name, TENANT_MAX);
+			fclose(fp);
+			return -1;
+		}
+
+		if((t = (struct tenant *)malloc(sizeof(struct tenant))) == NULL) {
+			printf("Memory used up when trying to add a tenant\n");
+			exit(1);
+		}
+		tenant_setup(t, name);
+		t->server_tcp_port = tcp_port;
+		t->server_udp_port = udp_port;
+		t->max_members = max_members;
+		t->max_rooms = max_rooms;
+		strcpy(t->room_file_name, room_file);
+
+		last->next_tenant = t;
+		last = t;
+		num_tenants++;
+	}
+	fclose(fp);
+	return 0;
+}
+
+int
+tenant_count() {
+	return num_tenants;
+}
+
+void
+tenant_report() {
+	FILE *fp = log_flag ? logfp : stdout;
+	struct tenant *t;
+
+	if(num_tenants < 2)
+		return;
+
+	for(t = tenant_default(); t != NULL; t = t->next_tenant) {
+		fprintf(fp, "Tenant %s (%hu/%hu): %d/%d members, %d/%d rooms; %lu chat msgs (%lu bytes), %lu requests, %lu refused\n",
+			t->name, t->server_tcp_port, t->server_udp_port,
+			t->total_num_of_members, t->max_members,
+			t->total_num_of_rooms, t->max_rooms,
+			t->chat_msgs, t->chat_bytes, t->control_msgs, t->refused);
+		fflush(fp);
+
+		t->chat_msgs = 0;
+		t->chat_bytes = 0;
+		t->control_msgs = 0;
+		t->refused = 0;
+	}
+}
@@ -0,0 +1,74 @@
+/*
+ *      File:      server_tenant.h
+ *
+ * Several virtual chatservers in one process. Besides the tenant on the
+ * -t/-u ports, named "default", chatserver -T <tenant file> serves the
+ * tenants listed in the file, one per line:
+ *
+ *   <name> <tcp port> <udp port> [<max members> [<max rooms> [<room file>]]]
+ *
+ * (blank lines and lines starting with '#' are skipped). Each tenant has
+ * its own members, rooms, ids, limits and counts (struct tenant, see
+ * server.h). A client reaches a tenant by its ports, so requests and chat
+ * messages are handed to the tenant whose port they came in on.
+ *
+ * The tenants share the server loop, the history arena, coalescing, the
+ * logs and the latency stats; each gets a line of its own in the stats
+ * report. Cluster, standby, multicast, AF_XDP, busy polling and the
+ * message store work on the process as a whole and are only available
+ * with a single tenant. Only the default tenant is announced to the
+ * location server.
+ */
+
+#ifndef _SERVER_TENANT_H
+#define _SERVER_TENANT_H
+
+#include "server.h"
+
+#define TENANT_MAX      64
+
+/*
+ *  FUNCTION: tenant_default
+ *
+ *  SYNOPSIS: get the default tenant, with no ports and the full limits
+ *
+ *  RETURN:   the tenant, always the first of the list
+ *
+ */
+struct tenant *tenant_default();
+
+/*
+ *  FUNCTION: tenant_load
+ *
+ *  SYNOPSIS: add the tenants of a tenant file
+ *
+ *  PASS:     file_name ==> the tenant file
+ *
+ *  RETURN:   0 on success, -1 on failure (reported)
+ *
+ */
+int tenant_load(char *file_name);
+
+/*
+ *  FUNCTION: tenant_count
+ *
+ *  SYNOPSIS: tell how many tenants there are
+ *
+ *  RETURN:   the number of tenants, at least 1
+ *
+ */
+int tenant_count();
+
+/*
+ *  FUNCTION: tenant_report
+ *
+ *  SYNOPSIS: print the counts of every tenant, and reset them
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     Prints nothing with a single tenant.
+ *
+ */
+void tenant_report();
+
+#endif
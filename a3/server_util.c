@@ -16,6 +16,7 @@
  *   Please report bugs/comments to bogdan@cs.toronto.edu
  */
 
+#define _GNU_SOURCE
 
 #include <sys/un.h>
 
@@ -26,12 +27,35 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
+#include <endian.h>
 
 #include <sys/stat.h>
+#include <sys/random.h>
 #include <fcntl.h>
 
 #include "server.h"
+#include "server_stats.h"
+#include "server_binlog.h"
+#include "server_reliable.h"
+#include "server_history.h"
+#include "server_msgstore.h"
+#include "server_search.h"
+#include "server_filter.h"
+#include "server_coalesce.h"
+#include "server_mcast.h"
+#include "server_cluster.h"
+#include "server_standby.h"
+#include "server_migrate.h"
+#include "server_tenant.h"
+#include "server_names.h"
+#include "server_sched.h"
+#include "server_direct.h"
+#include "server_subs.h"
+#include "server_dir.h"
+#include "server_bulk.h"
+#include "msgzip.h"
 
 
 /* for message logging purpose */
@@ -61,7 +85,38 @@ char *msg_arr[] = {
 
 "MEMBER_KEEP_ALIVE",
 
-"QUIT_REQUEST"
+"QUIT_REQUEST",
+
+/* 18 and 19 are not used, see defs_ext.h */
+"18",
+"19",
+
+"SEARCH_REQUEST",
+"SEARCH_SUCC",
+"SEARCH_FAIL",
+
+"FILTER_REQUEST",
+"FILTER_SUCC",
+"FILTER_FAIL",
+
+"ROOM_REDIRECT",
+"STANDBY_INFO",
+"MOVE_ROOM_REQUEST",
+"MOVE_ROOM_SUCC",
+"MOVE_ROOM_FAIL",
+"ROOM_TRANSFER",
+"ROOM_TRANSFER_SUCC",
+"ROOM_TRANSFER_FAIL",
+"MEMBER_MOVED",
+"SUBSCRIBE_REQUEST",
+"SUBSCRIBE_SUCC",
+"SUBSCRIBE_FAIL",
+"UNSUBSCRIBE_REQUEST",
+"UNSUBSCRIBE_SUCC",
+"UNSUBSCRIBE_FAIL",
+"DIRECTORY_REQUEST",
+"DIRECTORY_SUCC",
+"DIRECTORY_FAIL"
 
 };
 
@@ -79,7 +134,7 @@ static void announce_server_ready(char *local_host_name) {
 	char output[MAX_HOST_NAME_LEN + 15]; 
 
 	snprintf(output, maxlen, "%s %hu %hu", local_host_name,
-		 server_tcp_port,server_udp_port); 
+		 tenant->server_tcp_port,tenant->server_udp_port); 
 
 	write(fd, output, strlen(output));
 	close(fd);
@@ -103,6 +158,7 @@ static void ntoh_control_header(struct control_msghdr *cmh) {
 	cmh->msg_type = ntohs(cmh->msg_type);
 	cmh->member_id = ntohs(cmh->member_id);
 	cmh->msg_len = ntohs(cmh->msg_len);
+	cmh->reserved = ntohs(cmh->reserved);
 }
 
 int
@@ -152,10 +208,10 @@ create_server(int type, u_int16_t server_port) {
 			exit(1);
 		}
 		snprintf(type_str, 4, "TCP");		
-		server_tcp_port = server_port;
+		tenant->server_tcp_port = server_port;
 	} else {
 		snprintf(type_str, 4, "UDP");
-		server_udp_port = server_port;
+		tenant->server_udp_port = server_port;
 	}
 
 	printf("Chat server listening on %s port: %hu\n", type_str, server_port);
@@ -168,15 +224,89 @@ create_server(int type, u_int16_t server_port) {
 	return socket_fd;
 };
 
+/* Parse the comma separated room options that follow "name:". */
+static int parse_room_opts(char *str, struct room_opts *opts) {
+	char *opt, *save, *end;
+	long val;
+
+	for(opt = strtok_r(str, ",", &save); opt != NULL;
+	    opt = strtok_r(NULL, ",", &save)) {
+		if(!strcmp(opt, "reliable")) {
+			opts->flags |= ROOM_RELIABLE;
+		} else if(!strncmp(opt, "history=", 8)) {
+			val = strtol(opt + 8, &end, 10);
+			if(end == opt + 8 || *end != '\0'
+			   || val < 0 || val > HISTORY_MAX_MSGS)
+				return -1;
+			opts->history_msgs = val;
+		} else if(!strncmp(opt, "histbytes=", 10)) {
+			val = strtol(opt + 10, &end, 10);
+			if(*end == 'k' || *end == 'K') {
+				val *= 1024;
+				end++;
+			}
+			if(end == opt + 10 || *end != '\0'
+			   || val <= 0 || val > HISTORY_ARENA_KB * 1024)
+				return -1;
+			opts->history_bytes = val;
+		} else if(!strncmp(opt, "coalesce=", 9)) {
+			val = strtol(opt + 9, &end, 10);
+			if(end == opt + 9 || *end != '\0'
+			   || val < 0 || val > COALESCE_MAX_USECS)
+				return -1;
+			opts->coalesce_usecs = val;
+		} else if(!strcmp(opt, "lowlat")) {
+			opts->flags |= ROOM_LOW_LATENCY;
+		} else if(!strncmp(opt, "weight=", 7)) {
+			val = strtol(opt + 7, &end, 10);
+			if(end == opt + 7 || *end != '\0'
+			   || val < 1 || val > SCHED_MAX_WEIGHT)
+				return -1;
+			opts->weight = val;
+		} else if(!strncmp(opt, "bulk=", 5)) {
+			val = strtol(opt + 5, &end, 10);
+			if(*end == 'k' || *end == 'K') {
+				val *= 1024;
+				end++;
+			}
+			if(end == opt + 5 || *end != '\0'
+			   || val < 0 || val > BULK_ROOM_MAX_BYTES)
+				return -1;
+			opts->bulk_bytes = val;
+		} else {
+			return -1;
+		}
+	}
+	return 0;
+}
+
 int create_room(char *room_name) {
 	struct room_type *rt;
 	struct room_type *tmp_rptr;
+	struct room_opts opts;
+	char *opt_str;
+
+	/* split off the room options, if any */
+	bzero(&opts, sizeof(opts));
+	opts.history_msgs = -1;
+	opts.coalesce_usecs = -1;
+	opts.bulk_bytes = -1;
+	if((opt_str = strchr(room_name, ':')) != NULL) {
+		*opt_str++ = '\0';
+		if(parse_room_opts(opt_str, &opts) < 0)
+			return 4;
+	}
 
 	/* first check the length of room_name, discard if too long */
 	if(strlen(room_name) > MAX_ROOM_NAME_LEN) {
 		return 1;
 	}
 
+	/* in a cluster, only the node the room hashes to has it */
+	if(!cluster_owns(room_name)) {
+		return 6;
+	}
+
 	rt = (struct room_type *)malloc(sizeof(struct room_type));
 	if(rt == NULL) {
 		printf("Memory used up when trying to create room\n");
@@ -186,45 +316,144 @@ int create_room(char *room_name) {
 	bzero(rt, sizeof(struct room_type));
 
 	strcpy(rt->room_name, room_name);
+	if(opt_str != NULL)
+		strncpy(rt->room_opts, opt_str, ROOM_OPTS_LEN - 1);
+	rt->flags = opts.flags;
+	rt->coalesce_ns = coalesce_room_window(&opts);
+	rt->sched_weight = (opts.weight != 0) ? opts.weight : 1;
+	rt->bulk_max_bytes = (opts.bulk_bytes >= 0) ? opts.bulk_bytes : BULK_ROOM_BYTES;
 
 	/* make sure we are not exceeding maximum allowable number of rooms */
 
-	if(total_num_of_rooms == MAX_NUM_OF_ROOMS) {
+	if(tenant->total_num_of_rooms >= tenant->max_rooms) {
+		tenant->refused++;
 		return 2;
 	}
 
+	/*
+	 * history asked for must fit into the arena, the default one is
+	 * left out if it doesn't; a byte limit alone lets the room keep as
+	 * many messages as fit
+	 */
+	if(opts.history_msgs < 0 && opts.history_bytes == 0) {
+		rt->history = history_create(HISTORY_DEFAULT_MSGS, 0);
+	} else if(opts.history_msgs != 0) {
+		if(opts.history_msgs < 0)
+			opts.history_msgs = HISTORY_MAX_MSGS;
+		rt->history = history_create(opts.history_msgs, opts.history_bytes);
+		if(rt->history == NULL) {
+			free(rt);
+			return 5;
+		}
+	}
+
 	/* 
 	 * go through room list and see whether a room with same name exists 
 	 */
     
-	if(room_list_head == NULL) {
+	if(tenant->room_list_head == NULL) {
 
 		/* no rooms yet, create it */
-		room_list_head = rt;
-		room_list_tail = room_list_head;
+		tenant->room_list_head = rt;
+		tenant->room_list_tail = tenant->room_list_head;
 	} else {
-		for(tmp_rptr=room_list_head; tmp_rptr != NULL; tmp_rptr=tmp_rptr->next_room){
+		for(tmp_rptr=tenant->room_list_head; tmp_rptr != NULL; tmp_rptr=tmp_rptr->next_room){
 			if(!strcmp(rt->room_name, tmp_rptr->room_name)) {
 				/* room exists */
+				history_free(rt->history);
+				free(rt);
 				return 3;
 			}
 		}
 
 		/* add the new room to the tail */
-		room_list_tail->next_room = rt;
-		room_list_tail = rt;
+		tenant->room_list_tail->next_room = rt;
+		tenant->room_list_tail = rt;
 	}
 
-	total_num_of_rooms ++;
+	tenant->total_num_of_rooms ++;
+
+	/* 0 means "no room" in the binary log */
+	if(++tenant->last_room_id == 0)
+		tenant->last_room_id = 1;
+	rt->room_id = tenant->last_room_id;
+	dir_add_room(rt);
+	binlog_named_event(EV_ROOM_CREATE, 0, rt->room_id, rt->room_name);
+	standby_log_room(rt);
+
+	if(rt->flags & ROOM_RELIABLE)
+		rt->ring = chat_ring_create();
+	if(rt->history != NULL)
+		rt->index = search_index_create();
+
+	msgstore_open_room(rt);
 
 	if(log_flag){
-		fprintf(logfp, "Room [%s] is created.\n", room_name);
-		fprintf(logfp, "Total number of rooms:%d\n", total_num_of_rooms);
+		fprintf(logfp, "Room [%s]%s is created.\n", room_name,
+			(rt->flags & ROOM_RELIABLE) ? " (reliable)" : "");
+		fprintf(logfp, "Total number of rooms:%d\n", tenant->total_num_of_rooms);
 		fflush(logfp);
 	}
 	return 0;
 };
 
+/* Create the current tenant's servers, and the rooms of its room file */
+static void start_tenant() {
+	int i;
+
+	/* create master tcp and udp servers */
+	tenant->tcp_socket_fd = create_server(SOCK_STREAM, tenant->server_tcp_port);
+	tenant->udp_socket_fd = create_server(SOCK_DGRAM, tenant->server_udp_port);
+
+	/* kernel receive timestamps, for the forwarding latency stats */
+	i = 1;
+	if(setsockopt(tenant->udp_socket_fd, SOL_SOCKET, SO_TIMESTAMPNS, &i, sizeof(i)) < 0)
+		perror("setsockopt(SO_TIMESTAMPNS)");
+
+	/* member, room initialization */
+
+	tenant->mem_list_head = NULL;
+	tenant->mem_list_tail = tenant->mem_list_head;
+	tenant->total_num_of_members = 0;
+
+	tenant->room_list_head = NULL;
+	tenant->room_list_tail = tenant->room_list_head;
+	tenant->total_num_of_rooms = 0;
+
+	if(tenant->room_file_name[0] != 0) {
+		/* open room file and create some rooms */
+		if( (rfp=fopen(tenant->room_file_name, "r")) == NULL) {
+			perror("fopen");
+		} else {
+			char line[MAX_LINE_LEN];
+			while(!feof(rfp)) {
+				fgets(line, MAX_LINE_LEN, rfp);
+				if(!feof(rfp)) {
+					char *str[MAX_NUM_OF_ROOMS];
+					int i;
+		
+					if(line[strlen(line)-1] == '\n')
+						line[strlen(line)-1] = '\0';
+					/* parse line to get names */
+					str[0] = NULL;
+					str[0] = strtok(line, " ");
+					if(str[0] != NULL)
+						create_room(str[0]);
+					for(i=1; i < MAX_NUM_OF_ROOMS; i++) {
+						str[i] = NULL;
+						if((str[i] = strtok(NULL, " ")) != NULL){
+							if(str[i] != NULL)
+								create_room(str[i]);
+						}
+						else 
+							break;		
+					}
+				}
+			}
+		}
+	}
+}
+
 void 
 init_server(){
 	int i;
@@ -277,10 +506,6 @@ init_server(){
 		fflush(logfp);
 	}
 
-	/* create master tcp and udp servers */
-	tcp_socket_fd = create_server(SOCK_STREAM, server_tcp_port);
-	udp_socket_fd = create_server(SOCK_DGRAM, server_udp_port);
-
 	/* initialize the fd_table: -1 means not used */
     
 	for( i = 0; i < MAX_CONTROL_SESSIONS; i++) {
@@ -289,49 +514,19 @@ init_server(){
 
 	max_fd_idx = -1;
 
-	/* member, room initialization */
-
-	mem_list_head = NULL;
-	mem_list_tail = mem_list_head;
-	total_num_of_members = 0;
-
-	room_list_head = NULL;
-	room_list_tail = room_list_head;
-	total_num_of_rooms = 0;
-
-	if(room_file_name[0] != 0) {
-		/* open room file and create some rooms */
-		if( (rfp=fopen(room_file_name, "r")) == NULL) {
-			perror("fopen");
-		} else {
-			char line[MAX_LINE_LEN];
-			while(!feof(rfp)) {
-				fgets(line, MAX_LINE_LEN, rfp);
-				if(!feof(rfp)) {
-					char *str[MAX_NUM_OF_ROOMS];
-					int i;
-		
-					if(line[strlen(line)-1] == '\n')
-						line[strlen(line)-1] = '\0';
-					/* parse line to get names */
-					str[0] = NULL;
-					str[0] = strtok(line, " ");
-					if(str[0] != NULL)
-						create_room(str[0]);
-					for(i=1; i < MAX_NUM_OF_ROOMS; i++) {
-						str[i] = NULL;
-						if((str[i] = strtok(NULL, " ")) != NULL){
-							if(str[i] != NULL)
-								create_room(str[i]);
-						}
-						else 
-							break;		
-					}
-				}
-			}
+	/* each tenant gets its own ports, members and rooms */
+	for(tenant = tenant_default(); tenant != NULL; tenant = tenant->next_tenant) {
+		if(log_flag && tenant_count() > 1) {
+			fprintf(logfp, "Tenant [%s] on ports %hu/%hu\n", tenant->name,
+				tenant->server_tcp_port, tenant->server_udp_port);
+			fflush(logfp);
 		}
+		start_tenant();
 	}
 
+	/* only the default one is announced */
+	tenant = tenant_default();
+
 #ifdef USE_LOCN_SERVER
 	announce_server_ready(hp->h_name);
 #endif
@@ -365,15 +560,67 @@ void get_peer_info(int fd, char *str) {
 	tp = ctime(&now);
 	tp[strlen(tp)-1] = '\0'; /* Chop off newline in string from ctime */
 
-	sprintf(str, "%s %s:%hu", tp, host_entry->h_name, ntohs(peer_addr.sin_port));
+	sprintf(str, "%s %s:%hu", tp, 
+		host_entry != NULL ? host_entry->h_name : inet_ntoa(peer_addr.sin_addr),
+		ntohs(peer_addr.sin_port));
 	return;
 }
 
+static unsigned int id_bucket(u_int32_t member_id) {
+	return (member_id * 2654435761U) >> 16 & (MEMBER_HASH_SIZE - 1);
+}
+
+static unsigned int name_bucket(char *name) {
+	u_int32_t h = 2166136261U;
+	int i;
+
+	for(i = 0; i < MAX_MEMBER_NAME_LEN && name[i] != '\0'; i++)
+		h = (h ^ (u_int8_t)name[i]) * 16777619U;
+	return h & (MEMBER_HASH_SIZE - 1);
+}
+
+void index_member(struct member_type *mt) {
+	unsigned int b;
+
+	b = id_bucket(mt->member_id);
+	mt->next_id_hash = tenant->id_hash[b];
+	tenant->id_hash[b] = mt;
+
+	b = name_bucket(mt->member_name);
+	mt->next_name_hash = tenant->name_hash[b];
+	tenant->name_hash[b] = mt;
+
+	dir_add_member(mt);
+}
+
+void unindex_member(struct member_type *mt) {
+	struct member_type **pp;
+
+	for(pp = &tenant->id_hash[id_bucket(mt->member_id)]; *pp != NULL;
+	    pp = &(*pp)->next_id_hash) {
+		if(*pp == mt) {
+			*pp = mt->next_id_hash;
+			break;
+		}
+	}
+	for(pp = &tenant->name_hash[name_bucket(mt->member_name)]; *pp != NULL;
+	    pp = &(*pp)->next_name_hash) {
+		if(*pp == mt) {
+			*pp = mt->next_name_hash;
+			break;
+		}
+	}
+	mt->next_id_hash = NULL;
+	mt->next_name_hash = NULL;
+
+	dir_remove_member(mt);
+}
+
 /* Assumes member_id is in host byte order. */
-struct member_type *find_member_with_id(u_int16_t member_id) {
+struct member_type *find_member_with_id(u_int32_t member_id) {
 	struct member_type *mt;
 
-	for(mt = mem_list_head; mt != NULL; mt=mt->next_member) {
+	for(mt = tenant->id_hash[id_bucket(member_id)]; mt != NULL; mt = mt->next_id_hash) {
 		if(mt->member_id == member_id)
 			break;
 	}
@@ -381,7 +628,105 @@ struct member_type *find_member_with_id(u_int16_t member_id) {
 
 }
 
+struct member_type *find_member_with_name(char *name) {
+	struct member_type *mt;
+
+	for(mt = tenant->name_hash[name_bucket(name)]; mt != NULL; mt = mt->next_name_hash) {
+		if(!strncmp(mt->member_name, name, MAX_MEMBER_NAME_LEN))
+			break;
+	}
+	return mt;
+}
+
+/* Assumes id and id_hi are in host byte order. */
+struct member_type *find_sender(u_int16_t id, u_int16_t id_hi) {
+	struct member_type *mt = NULL;
+
+	/* no 16 bit id in use shares its low half with a wide one */
+	if(id_hi != 0)
+		mt = find_member_with_id((u_int32_t)id_hi << 16 | id);
+	if(mt == NULL)
+		mt = find_member_with_id(id);
+	return mt;
+}
+
+/* Whether id is in use, or would be mistaken for one in use. */
+static int member_id_taken(u_int32_t id) {
+	struct member_type *mt;
+
+	for(mt = tenant->mem_list_head; mt != NULL; mt = mt->next_member) {
+		if(mt->member_id == id)
+			return 1;
+		if(id < V2_MIN_MEMBER_ID && (mt->member_id & 0xffff) == id)
+			return 1;
+		if(mt->member_id < V2_MIN_MEMBER_ID && (id & 0xffff) == mt->member_id)
+			return 1;
+	}
+	return 0;
+}
+
+u_int32_t new_member_id(u_int16_t caps, u_int32_t wanted) {
+	u_int32_t id = wanted;
+
+	if(id != 0 && (id >= V2_MIN_MEMBER_ID) == !!(caps & CAP_WIDE_ID)
+	   && !member_id_taken(id))
+		return id;
+	do {
+		id = 1 + (u_int16_t) (65535.0 * rand()/(RAND_MAX+1.0));
+		if(caps & CAP_WIDE_ID)
+			id |= (u_int32_t)(1 + (u_int16_t) (65535.0 * rand()/(RAND_MAX+1.0))) << 16;
+	} while(member_id_taken(id));
+	return id;
+}
+
+struct member_type *add_member(u_int32_t member_id, char *member_name,
+			       u_int16_t caps, struct sockaddr_in *udp_addr) {
+	struct member_type *mt;
+
+	if((mt = (struct member_type *)malloc(sizeof(struct member_type))) == NULL) {
+		printf("Memory used up when trying to add a member\n");
+		exit(1);
+	}
+	bzero(mt, sizeof(struct member_type));
+
+	mt->member_id = member_id;
+	strncpy(mt->member_name, member_name, MAX_MEMBER_NAME_LEN - 1);
+	mt->caps = caps;
+	mt->member_udp_addr = *udp_addr;
+
+	/* add to the tail */
+	if(tenant->mem_list_head == NULL) {
+		tenant->mem_list_head = mt;
+	} else {
+		tenant->mem_list_tail->next_member = mt;
+		mt->prev_member = tenant->mem_list_tail;
+	}
+	tenant->mem_list_tail = mt;
+	tenant->total_num_of_members ++;
+	index_member(mt);
+
+	return mt;
+}
+
 void remove_member(struct member_type *mt){
+	struct room_type *rt;
+
+	/* whoever gets its id next does not get its rooms */
+	if(mt->rooms_created != 0) {
+		for(rt = tenant->room_list_head; rt != NULL; rt = rt->next_room) {
+			if(rt->owner_id == mt->member_id)
+				rt->owner_id = 0;
+		}
+	}
+
+	/* what it sent goes out while it is still there */
+	if(mt->current_room != NULL)
+		sched_flush_room(mt->current_room);
+	subs_drop_member(mt);
+
+	standby_log_leave(mt);
+	coalesce_drop(mt);
+	mcast_leave(mt);
 
 	if(mt->current_room != NULL) {
 
@@ -406,46 +751,105 @@ void remove_member(struct member_type *mt){
 		}
 		     
 		mt->current_room->num_of_members --;
+		dir_room_resized(mt->current_room);
 	}
 	/* remove the member from the member list */
 
+	unindex_member(mt);
 	if(mt->prev_member == NULL) {
-		mem_list_head = mt->next_member;
-		if(mem_list_head == NULL)
-			mem_list_tail = mem_list_head;
+		tenant->mem_list_head = mt->next_member;
+		if(tenant->mem_list_head == NULL)
+			tenant->mem_list_tail = tenant->mem_list_head;
 		else
-			mem_list_head->prev_member = NULL;
+			tenant->mem_list_head->prev_member = NULL;
 	} else {
 		mt->prev_member->next_member = mt->next_member;
 		if(mt->next_member != NULL ) 
 			mt->next_member->prev_member = mt->prev_member;
 		else 
-			mem_list_tail = mt->prev_member;
+			tenant->mem_list_tail = mt->prev_member;
 	}
 
-	total_num_of_members --;
+	tenant->total_num_of_members --;
 
 	/* NOTE: we let the caller free the memory */
 
 	return;
 }
 
+void move_member(struct member_type *mt, struct room_type *rt) {
+
+	if(mt->current_room != NULL) {
+
+		/* what it sent goes to the room it sent it to */
+		sched_flush_room(mt->current_room);
+
+		/* remove the member from its current room */
+		if(mt->prev_room_member == NULL) {
+			/* this member is the first member in the room */
+			mt->current_room->member_list_head = mt->next_room_member;
+			if(mt->current_room->member_list_head == NULL)
+				mt->current_room->member_list_tail = 
+					mt->current_room->member_list_head;
+			else 
+				mt->current_room->member_list_head->prev_room_member = NULL;
+		} else {
+
+			/* not the first member */
+			mt->prev_room_member->next_room_member = mt->next_room_member;
+			if( mt->next_room_member != NULL ) 
+				mt->next_room_member->prev_room_member = mt->prev_room_member;
+			else 
+				mt->current_room->member_list_tail = mt->prev_room_member;
+		}
+
+		mt->current_room->num_of_members --;
+		dir_room_resized(mt->current_room);
+	}
+
+	/* what the old room sent comes first */
+	coalesce_flush_member(mt);
+	mcast_leave(mt);
+	subs_leave(mt, rt);
+
+	mt->next_room_member = NULL;
+	mt->prev_room_member = NULL;
+	mt->current_room = rt;
+	mt->room_slot = names_slot(rt);
+	rt->names_gen++;
+
+	/* put the member in the new room */
+	if(rt->member_list_head == NULL) {
+		rt->member_list_head = mt;
+		rt->member_list_tail = rt->member_list_head;
+	} else {
+		rt->member_list_tail->next_room_member = mt;
+		mt->prev_room_member = rt->member_list_tail;
+		rt->member_list_tail = rt->member_list_tail->next_room_member;
+	}
+
+	rt->num_of_members ++;
+	rt->empty_flag = 0;
+	dir_room_resized(rt);
+}
+
 void remove_room(struct room_type *rt){
 	struct room_type *trt;
 
 	/* this room has no members */
+	dir_remove_room(rt);
 
-	for(trt = room_list_head; trt != NULL; trt = trt->next_room) {
+	for(trt = tenant->room_list_head; trt != NULL; trt = trt->next_room) {
 		if(trt == rt) {
 			/* head */
-			room_list_head = trt->next_room;
-			if(room_list_head == NULL)
-				room_list_tail = NULL;
+			tenant->room_list_head = trt->next_room;
+			if(tenant->room_list_head == NULL)
+				tenant->room_list_tail = NULL;
 			break;
 		} else if(trt->next_room == rt){
 			trt->next_room = rt->next_room;
 			if(trt->next_room == NULL)
-				room_list_tail = NULL;
+				tenant->room_list_tail = trt;
 			break;
 		}
 	}
@@ -454,14 +858,35 @@ void remove_room(struct room_type *rt){
 	return;
 }
 
+void free_room(struct room_type *rt) {
+	chat_ring_free(rt->ring);
+	history_free(rt->history);
+	search_index_free(rt->index);
+	filter_free(rt->filter);
+	sched_free(rt);
+	bulk_free(rt);
+	subs_drop_room(rt);
+	msgstore_close_room(rt);
+	free(rt);
+}
+
 
 /* Assumes input msg is in network host byte order.
  */
 void dump_control_msg(int fd, char *msg, int type){
 	struct control_msghdr *cmh;
-	
-	get_peer_info(fd, info_str);
+	struct sockaddr_in peer_addr;
+	socklen_t peer_addr_len = sizeof(peer_addr);
+
+	cmh = (struct control_msghdr *)msg;
+
+	bzero(&peer_addr, sizeof(peer_addr));
+	getpeername(fd, (struct sockaddr *)&peer_addr, &peer_addr_len);
+	binlog_event(type == 1 ? EV_CTRL_RECV : EV_CTRL_SEND, cmh->msg_type,
+		     cmh->member_id, 0, cmh->msg_len, peer_addr.sin_addr.s_addr);
+
 	if(log_flag) {
+		get_peer_info(fd, info_str);
 		if(type == 1)
 			fprintf(logfp, "RECEIVE %s control message\n", info_str);
 		else
@@ -470,8 +895,6 @@ void dump_control_msg(int fd, char *msg, int type){
 		fflush(logfp);	
 	}
 
-	cmh = (struct control_msghdr *)msg;
-
 	if(cmh->msg_type == REGISTER_REQUEST) {
 		if(log_flag){
 			struct register_msgdata *rdata;
@@ -483,13 +906,39 @@ void dump_control_msg(int fd, char *msg, int type){
 			fprintf(logfp, "member_name:%s\n", (char *)rdata->member_name);
 			fflush(logfp);
 		}
-	} else if( cmh->msg_type >=REGISTER_SUCC && cmh->msg_type <= QUIT_REQUEST) {
+	} else if((cmh->msg_type >= REGISTER_SUCC && cmh->msg_type <= QUIT_REQUEST)
+		  || (cmh->msg_type >= SEARCH_REQUEST && cmh->msg_type <= DIRECTORY_FAIL)) {
 		if(log_flag){
 			fprintf(logfp, 
 				"msg_type:%s\tmsg_len:%d\tmember_id:%d\n",
 				msg_arr[cmh->msg_type],
 				cmh->msg_len, cmh->member_id);
-			if(cmh->msg_len > sizeof(struct control_msghdr)) {
+			if(cmh->msg_type == SWITCH_ROOM_SUCC
+			   && cmh->msg_len == sizeof(struct control_msghdr)
+			   + sizeof(struct mcast_group)) {
+				struct mcast_group *mg = (struct mcast_group *)cmh->msgdata;
+				struct in_addr group;
+
+				group.s_addr = mg->group;
+				fprintf(logfp, "msg_data:group %s:%hu\n",
+					inet_ntoa(group), ntohs(mg->port));
+			} else if(cmh->msg_type == ROOM_TRANSFER) {
+				struct room_transfer *rtr = (struct room_transfer *)cmh->msgdata;
+
+				fprintf(logfp, "msg_data:room %.*s, %d %s\n",
+					(int)sizeof(rtr->room_name), rtr->room_name,
+					ntohs(rtr->count), rtr->part == ROOM_TRANSFER_MEMBERS
+					? "members" : "messages");
+			} else if(cmh->msg_type == ROOM_TRANSFER_SUCC) {
+				/* member ids */
+			} else if(cmh->msg_type == ROOM_REDIRECT
+				  || cmh->msg_type == STANDBY_INFO
+				  || cmh->msg_type == MEMBER_MOVED) {
+				struct room_redirect *rd = (struct room_redirect *)cmh->msgdata;
+
+				fprintf(logfp, "msg_data:%s:%hu\n", rd->host_name,
+					ntohs(rd->tcp_port));
+			} else if(cmh->msg_len > sizeof(struct control_msghdr)) {
 				fprintf(logfp, "msg_data:");
 				fprintf(logfp, "%s\n", (char *)cmh->msgdata);
 			}
@@ -504,43 +953,109 @@ void dump_control_msg(int fd, char *msg, int type){
 
 }
 
-void
-process_chat_msg(int udp_socket_fd) {
-	int n;
-	char buf[MAX_MSG_LEN];
-	struct chat_msghdr *cmh;
-	struct member_type *mt;
-	struct member_type *tmp_mptr;
+/*
+ * Put the name a relay gave behind the sender id (see defs_ext.h) where the
+ * sender's name goes. Returns -1 if it gave none, or the name of a member
+ * of ours.
+ */
+static int relay_sender_name(struct chat_msghdr *cmh) {
+	char *given = cmh->sender.member_name + RELAY_NAME_OFFSET;
+	char name[RELAY_NAME_LEN];
 
-	bzero(buf, MAX_MSG_LEN);
+	if(given[0] == '\0' || (u_int8_t)given[0] == CHAT_COMPACT_MARK
+	   || memchr(given, '\0', RELAY_NAME_LEN) == NULL
+	   || find_member_with_name(given) != NULL)
+		return -1;
 
-	n = recvfrom(udp_socket_fd, buf, MAX_MSG_LEN, 0, NULL, 0);
-	if(n<0) {
-		perror("recvfrom");
-		return;
-	} 
+	strcpy(name, given);
+	strcpy(cmh->sender.member_name, name);
+	return 0;
+}
 
-	cmh = (struct chat_msghdr *)buf;
+/* Assumes buf holds a chat message of n bytes as received from a member. */
+struct member_type *
+admit_chat_msg(char *buf, int n, struct timespec *rx_ts, struct chat_out *co) {
+	struct chat_msghdr *cmh;
+	struct chat_ext_hdr *ext = NULL;
+	struct member_type *mt;
+	struct room_type *rt;
+	static char plain_text[MAX_MSG_LEN];
+	long long ts;
+	int fmt, filtered;
 
-	/* now distribute to all the members in the group */
+	cmh = (struct chat_msghdr *)buf;
 
 	/* find the member first */
-	if( (mt =find_member_with_id(ntohs(cmh->sender.member_id))) == NULL) {
+	if( (mt = find_sender(ntohs(cmh->sender.member_id),
+			      ntohs(((struct chat_sender_v2 *)&cmh->sender)->member_id_hi))) == NULL) {
 		/* no match, ignore: invalid id*/
+		binlog_event(EV_CHAT_DROP, DROP_BAD_ID, ntohs(cmh->sender.member_id),
+			     0, n, 0);
 		if(log_flag) {
 			fprintf(logfp, 
 				"Chat message is discarded because the sender's member id is invalid!\n");
 			fflush(logfp);
 		}
-		return;
+		return NULL;
 
 	}
 
 	mt->quiet_flag = 0; 
 
-	strcpy(cmh->sender.member_name, mt->member_name);
+	/* its room went to another node while this was on the way */
+	if(mt->moved_id != 0) {
+		migrate_forward(buf, n, mt);
+		return NULL;
+	}
+
+	/* a relay says which of its members wrote it; otherwise the name goes
+	 * in only for copies that have room for it, see chat_msg_fmt() */
+	if((mt->caps & CAP_RELAY) && relay_sender_name(cmh) == 0) {
+		co->name = cmh->sender.member_name;
+		co->named = 1;
+		co->slot = -1;
+	} else {
+		co->name = mt->member_name;
+		co->named = 0;
+		co->slot = mt->room_slot;
+	}
+
+	/* locate the text, behind the extended header if the sender used one */
+	co->text = (char *)cmh->msgdata;
+	if((ntohs(cmh->msg_len) & CHAT_EXT_FLAG)
+	   && n >= sizeof(struct chat_msghdr) + sizeof(struct chat_ext_hdr)) {
+		ext = (struct chat_ext_hdr *)cmh->msgdata;
+		co->text = (char *)ext->msgdata;
+	}
+	co->text_len = n - (co->text - buf);
+	if(co->text_len < 0)
+		co->text_len = 0;
+
+	/* keep the compressed text to send on, the rest of us read it plain */
+	co->ztext = NULL;
+	if(ntohs(cmh->msg_len) & CHAT_ZIP_FLAG) {
+		long long start = mono_ns();
+
+		co->ztext = co->text;
+		co->ztext_len = co->text_len;
+		co->text = plain_text;
+		co->text_len = msgzip_decompress(co->ztext, co->ztext_len,
+						 plain_text, sizeof(plain_text));
+		if(co->text_len < 0) {
+			binlog_event(EV_CHAT_DROP, DROP_CORRUPT, mt->member_id, 0, n, 0);
+			if(log_flag) {
+				fprintf(logfp, 
+					"Chat message is discarded because its text does not decompress!\n");
+				fflush(logfp);
+			}
+			return NULL;
+		}
+		stats_record_unzip(co->ztext_len, co->text_len, mono_ns() - start);
+	}
 
 	/* update certain things of the member */
+	tenant->chat_msgs++;
+	tenant->chat_bytes += n;
 	mt->num_chat_msgs ++;
 	mt->num_bytes_rcved += n;
 
@@ -553,44 +1068,445 @@ process_chat_msg(int udp_socket_fd) {
 
 		fprintf(logfp, "Chat message from [%s %d](%s)::\n", 
 			mt->member_name, mt->member_id, tp);
-		fprintf(logfp, "\"%s\"\n", (char *)cmh->msgdata); 
+		fprintf(logfp, "\"%s\"\n", co->text); 
 		fprintf(logfp, "Received %d chat messages(%d bytes) from this member.\n",
 			mt->num_chat_msgs, mt->num_bytes_rcved);
 		fflush(logfp);
 	}
     
 
-	/* find which room this member is in */
-	if(mt->current_room == NULL) {
+	/* find which room this member is in, or names of those it follows */
+	if((rt = subs_target_room(mt, buf, n)) == NULL) {
+		binlog_event(EV_CHAT_DROP, DROP_NO_ROOM, mt->member_id, 0, n, 0);
+		if(log_flag) {
+			fprintf(logfp, 
+				"Chat message is discarded because the sender is not in the room!\n");
+			fflush(logfp);
+		}
+		return NULL;
+	}
+	co->rt = rt;
+
+	/* it has no slot in a room it only follows */
+	if(rt != mt->current_room)
+		co->slot = -1;
+	filtered = (rt->filter != NULL) ? filter_chat_msg(rt, co) : FILTER_PASS;
+	if(filtered == FILTER_BLOCK) {
+		binlog_event(EV_CHAT_DROP, DROP_FILTERED, mt->member_id, rt->room_id, n, 0);
 		if(log_flag) {
 			fprintf(logfp, 
-				"Chat message is discarded because the sender is not in any room!\n");
+				"Chat message is discarded by the filter of room [%s]!\n",
+				rt->room_name);
 			fflush(logfp);
 		}
+		return NULL;
+	}
+	/* the compressed text still has what was redacted */
+	if(filtered == FILTER_REDACTED)
+		co->ztext = NULL;
+
+	/* stamp the extended header fields, whether or not anyone reads them */
+	if(rx_ts != NULL && rx_ts->tv_sec != 0)
+		ts = (long long)rx_ts->tv_sec * 1000000000LL + rx_ts->tv_nsec;
+	else
+		ts = wall_ns();
+
+	co->ext.sender_seq = (ext != NULL) ? ext->sender_seq : 0;
+	co->ext.room_seq = htonl(++rt->room_seq);
+	co->ext.room_id = htons(rt->room_id);
+	co->ext.flags = htons((rt->flags & ROOM_RELIABLE) ? CHAT_FLAG_RELIABLE : 0);
+	co->ext.server_ts = htobe64(ts);
+
+	if(ext != NULL)
+		memcpy(ext, &co->ext, sizeof(struct chat_ext_hdr));
+	co->hdr = cmh;
+
+	/* compact copies name the sender again once someone joined */
+	co->name_inline = (mt->name_gen != rt->names_gen);
+	if(rt == mt->current_room)
+		mt->name_gen = rt->names_gen;
+	bzero(co->msg, sizeof(co->msg));
+	fmt = (ext != NULL ? CHAT_FMT_EXT : 0);
+	if(!(ntohs(cmh->msg_len) & CHAT_ZIP_FLAG)) {
+		co->msg[fmt] = buf;
+		co->len[fmt] = n;
+	} else if(co->ztext != NULL) {
+		co->msg[fmt | CHAT_FMT_ZIP] = buf;
+		co->len[fmt | CHAT_FMT_ZIP] = n;
+	}
+
+	if(rt->ring != NULL)
+		chat_ring_store(rt->ring, co);
+	if(rt->history != NULL)
+		history_store(rt->history, co);
+	if(rt->index != NULL)
+		search_index_add(rt, co);
+	if(rt->store != NULL)
+		msgstore_append(rt, mt, co);
+
+	return mt;
+}
+
+int
+chat_msg_for(struct chat_out *co, struct member_type *mt, char **msg) {
+	int fmt = (mt->caps & CAP_EXT_HDR) ? CHAT_FMT_EXT : 0;
+	int len;
+
+	if((mt->caps & CAP_COMPRESS) && co->ztext != NULL) {
+		stats_record_zip_copy(co->text_len - co->ztext_len);
+		fmt |= CHAT_FMT_ZIP;
+	}
+	if((mt->caps & CAP_COMPACT) && co->slot >= 0)
+		fmt |= CHAT_FMT_COMPACT;
+
+	len = chat_msg_fmt(co, fmt, msg);
+	if(fmt & CHAT_FMT_COMPACT)
+		stats_record_compact_copy(sizeof(struct chat_msghdr) - co->compact_hdr_len);
+	return len;
+}
+
+/* Builds the compact copy of co in buf, see defs_ext.h. Returns where the
+ * text goes. */
+static char *compact_header(struct chat_out *co, int fmt, char *buf) {
+	char *p = buf;
+	int n;
+
+	*p++ = (char)CHAT_COMPACT_MARK;
+	*p++ = (char)(((fmt & CHAT_FMT_EXT) ? CHAT_COMPACT_EXT : 0)
+		      | ((fmt & CHAT_FMT_ZIP) ? CHAT_COMPACT_ZIP : 0)
+		      | (co->name_inline ? CHAT_COMPACT_NAME : 0));
+	p += names_put_varint(p, co->slot);
+	if(co->name_inline) {
+		n = strnlen(co->name, MAX_MEMBER_NAME_LEN);
+		memcpy(p, co->name, n);
+		p[n] = '\0';
+		p += n + 1;
+	}
+	co->compact_hdr_len = p - buf;
+	return p;
+}
+
+/*
+ * The largest copy chat_msg_fmt() builds: the compact header with a five
+ * byte slot and the name inline, which is longer than a chat_msghdr, the
+ * extended header, and the longest text a compressed one comes out to.
+ * The last is longer than any text that fits MAX_MSG_LEN as it came.
+ */
+#define CHAT_COPY_MAX_LEN   (2 + 5 + MAX_MEMBER_NAME_LEN + 1 \
+			     + sizeof(struct chat_ext_hdr) + MSGZIP_MAX_TEXT)
+
+int
+chat_msg_fmt(struct chat_out *co, int fmt, char **msg) {
+	static char alt_buf[CHAT_FMTS][CHAT_COPY_MAX_LEN];
+	struct chat_msghdr *cmh;
+	char *p, *text;
+	int text_len;
+
+	if(co->ztext == NULL)
+		fmt &= ~CHAT_FMT_ZIP;
+	if(co->slot < 0)
+		fmt &= ~CHAT_FMT_COMPACT;
+
+	/* the sender's name, the first time a copy has room for it */
+	if(!(fmt & CHAT_FMT_COMPACT) && !co->named) {
+		strncpy(co->hdr->sender.member_name, co->name, MAX_MEMBER_NAME_LEN);
+		co->named = 1;
+	}
+
+	if(co->msg[fmt] == NULL) {
+		/* rebuild the message around another header format or text */
+		text = (fmt & CHAT_FMT_ZIP) ? co->ztext : co->text;
+		text_len = (fmt & CHAT_FMT_ZIP) ? co->ztext_len : co->text_len;
+
+		if(fmt & CHAT_FMT_COMPACT) {
+			p = compact_header(co, fmt, alt_buf[fmt]);
+		} else {
+			cmh = (struct chat_msghdr *)alt_buf[fmt];
+			memcpy(cmh, co->hdr, sizeof(struct chat_msghdr));
+			cmh->msg_len = htons(text_len
+					     | ((fmt & CHAT_FMT_EXT) ? CHAT_EXT_FLAG : 0)
+					     | ((fmt & CHAT_FMT_ZIP) ? CHAT_ZIP_FLAG : 0));
+			p = (char *)cmh->msgdata;
+		}
+		if(fmt & CHAT_FMT_EXT) {
+			memcpy(p, &co->ext, sizeof(struct chat_ext_hdr));
+			p += sizeof(struct chat_ext_hdr);
+		}
+
+		/*
+		 * cannot happen with the row sized as above, but a copy that
+		 * did not fit would lose its end: compressed text is of no
+		 * use cut short, so those go plain, where the text is cut
+		 */
+		if(p + text_len > alt_buf[fmt] + CHAT_COPY_MAX_LEN) {
+			if(fmt & CHAT_FMT_ZIP)
+				return chat_msg_fmt(co, fmt & ~CHAT_FMT_ZIP, msg);
+			text_len = alt_buf[fmt] + CHAT_COPY_MAX_LEN - p;
+			if(!(fmt & CHAT_FMT_COMPACT))
+				cmh->msg_len = htons((ntohs(cmh->msg_len) & ~CHAT_LEN_MASK)
+						     | text_len);
+		}
+		memcpy(p, text, text_len);
+
+		co->msg[fmt] = alt_buf[fmt];
+		co->len[fmt] = p + text_len - alt_buf[fmt];
+	}
+
+	*msg = co->msg[fmt];
+	return co->len[fmt];
+}
+
+/* Find the kernel receive timestamp among the control messages, if any. */
+static struct timespec *rx_timestamp(struct msghdr *msg) {
+	struct cmsghdr *cm;
+
+	for(cm = CMSG_FIRSTHDR(msg); cm != NULL; cm = CMSG_NXTHDR(msg, cm)) {
+		if(cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPNS)
+			return (struct timespec *)CMSG_DATA(cm);
+	}
+	return NULL;
+}
+
+void
+forward_chat_msg(int udp_socket_fd, char *buf, int n,
+		 struct timespec *rx_ts, struct sockaddr_in *from) {
+	struct member_type *mt;
+	struct member_type *tmp_mptr;
+	struct chat_out co;
+	char *msg;
+	int len;
+	int copies = 0;
+	int mcast;
+
+	if(is_chat_nack(buf, n)) {
+		process_chat_nack(udp_socket_fd, buf, n, from);
+		return;
+	}
+	if(is_chat_direct(buf, n)) {
+		process_direct_msg(udp_socket_fd, buf, n, from);
 		return;
 	}
+	if(is_chat_bulk(buf, n)) {
+		process_bulk_chunk(buf, n);
+		return;
+	}
+
+	/* now distribute to all the members in the group */
+	if((mt = admit_chat_msg(buf, n, rx_ts, &co)) == NULL)
+		return;
+
+	/* one datagram for the members listening to the group */
+	mcast = mcast_send(co.rt, &co);
+	copies += mcast;
 
-	for(tmp_mptr = mt->current_room->member_list_head; tmp_mptr != NULL;
+	for(tmp_mptr = co.rt->member_list_head; tmp_mptr != NULL;
 	    tmp_mptr = tmp_mptr->next_room_member) {
+		if(tmp_mptr->mcast && mcast)
+			continue;
+
 		/* send messages one by one, iteratively */
-		n = sendto(udp_socket_fd, cmh, n, 0,
-			   (struct sockaddr *)&tmp_mptr->member_udp_addr, 
-			   sizeof(struct sockaddr_in));
-		if(n<0) {
+		len = chat_msg_for(&co, tmp_mptr, &msg);
+		if(coalesce_add(tmp_mptr, msg, len)) {
+			copies++;
+			continue;
+		}
+		if(sendto(udp_socket_fd, msg, len, 0,
+			  (struct sockaddr *)&tmp_mptr->member_udp_addr, 
+			  sizeof(struct sockaddr_in)) < 0) {
 			perror("send to");
 			return;
 		}
-
+		copies++;
 	}
+	copies += subs_send(udp_socket_fd, &co);
+
+	stats_record_forward(rx_ts);
+	binlog_event(EV_CHAT, copies, mt->member_id, co.rt->room_id, n, 0);
+
 	if(log_flag) {
 		fprintf(logfp, "Chat message is broadcast to room [%s(%d)].\n",
-			mt->current_room->room_name, mt->current_room->num_of_members);             
+			co.rt->room_name, co.rt->num_of_members);             
 		fflush(logfp);
 	}
+}
+
+void
+process_chat_msg(int udp_socket_fd) {
+	int n;
+	char buf[MAX_MSG_LEN];
+	char cbuf[CMSG_SPACE(sizeof(struct timespec))];
+	struct sockaddr_in from;
+	struct iovec iov;
+	struct msghdr msg;
+
+	bzero(buf, MAX_MSG_LEN);
+
+	iov.iov_base = buf;
+	iov.iov_len = MAX_MSG_LEN;
+	bzero(&msg, sizeof(msg));
+	msg.msg_name = &from;
+	msg.msg_namelen = sizeof(from);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+
+	n = recvmsg(udp_socket_fd, &msg, 0);
+	if(n<0) {
+		perror("recvfrom");
+		return;
+	} 
+
+	sched_chat_msg(udp_socket_fd, buf, n, rx_timestamp(&msg), &from);
      
 	return;
 }
 
+int
+process_chat_batch(int udp_socket_fd) {
+	static char bufs[CHAT_BATCH][MAX_MSG_LEN + 1];
+	static char cbufs[CHAT_BATCH][CMSG_SPACE(sizeof(struct timespec))];
+	struct sockaddr_in froms[CHAT_BATCH];
+	struct iovec iovs[CHAT_BATCH];
+	struct mmsghdr msgs[CHAT_BATCH];
+	int i, cnt;
+
+	bzero(msgs, sizeof(msgs));
+	for(i = 0; i < CHAT_BATCH; i++) {
+		iovs[i].iov_base = bufs[i];
+		iovs[i].iov_len = MAX_MSG_LEN;
+		msgs[i].msg_hdr.msg_name = &froms[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(froms[i]);
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_control = cbufs[i];
+		msgs[i].msg_hdr.msg_controllen = sizeof(cbufs[i]);
+	}
+
+	cnt = recvmmsg(udp_socket_fd, msgs, CHAT_BATCH, MSG_DONTWAIT, NULL);
+	if(cnt < 0) {
+		if(errno != EAGAIN && errno != EWOULDBLOCK)
+			perror("recvmmsg");
+		return 0;
+	}
+
+	for(i = 0; i < cnt; i++) {
+		int n = msgs[i].msg_len;
+
+		/*
+		 * no bzero() of the whole buffer per message; just make sure
+		 * the text is terminated for logging
+		 */
+		if(n < sizeof(struct chat_msghdr))
+			bzero(bufs[i] + n, sizeof(struct chat_msghdr) + 1 - n);
+		else
+			bufs[i][n] = '\0';
+		sched_chat_msg(udp_socket_fd, bufs[i], n,
+			       rx_timestamp(&msgs[i].msg_hdr), &froms[i]);
+	}
+
+	return cnt;
+}
+
+void
+set_busy_poll(int fd, int usecs) {
+	int one = 1;
+	int budget = CHAT_BATCH;
+
+	if(setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs)) < 0)
+		perror("setsockopt(SO_BUSY_POLL)");
+	/* the next two need a 5.11 kernel; without them we still spin */
+	if(setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &one, sizeof(one)) < 0)
+		perror("setsockopt(SO_PREFER_BUSY_POLL)");
+	if(setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL_BUDGET, &budget, sizeof(budget)) < 0)
+		perror("setsockopt(SO_BUSY_POLL_BUDGET)");
+
+	if(log_flag) {
+		fprintf(logfp, "Busy polling the UDP socket for %d us\n", usecs);
+		fflush(logfp);
+	}
+}
+
+void
+sweep_members_and_rooms() {
+	struct member_type *mt;
+	struct room_type *rt;
+
+	/* go through the member list and sweep members that are there for
+	   more than 1 sweep interval without messages */
+
+	mt = tenant->mem_list_head;
+	while(mt != NULL) {
+		struct member_type *tmp_mt;
+
+		tmp_mt=mt->next_member;
+
+		if(mt->quiet_flag == 0) {
+			/* active in the last time interval */
+			mt->quiet_flag ++ ; 
+		} else {
+			/* remove this member */
+			remove_member(mt);
+			binlog_event(EV_MEMBER_LEAVE, LEAVE_SWEPT, mt->member_id, 0, 0, 0);
+			if(log_flag) {
+				char *tp;
+				now = time(NULL);
+				tp = ctime(&now);
+				tp[strlen(tp)-1] = '\0';
+
+				fprintf(logfp, 
+					"%s member [%s] is removed from the session\n", 
+					tp, mt->member_name);
+				fprintf(logfp, "Total number of members:%d\n", 
+					tenant->total_num_of_members);
+				fflush(logfp);
+			}
+			free(mt);
+
+		}
+		mt = tmp_mt; 
+	}
+
+	/* go through room list */
+	rt = tenant->room_list_head;
+	while(rt != NULL) {
+		struct room_type *tmp_rt;
+		tmp_rt = rt->next_room;
+
+		if(rt->num_of_members == 0 && rt->num_subs == 0) {
+			if(rt->empty_flag == 0 ) {
+				rt->empty_flag ++;
+			} else {
+				/* remove this room */
+				remove_room(rt);
+				tenant->total_num_of_rooms --;
+				binlog_event(EV_ROOM_REMOVE, 0, 0, rt->room_id, 0, 0);
+
+				/* need to log this info */
+				if(log_flag) {
+					char *tp;
+					now = time(NULL);
+					tp = ctime(&now);
+					tp[strlen(tp)-1] = '\0';
+
+					fprintf(logfp, 
+						"%s room [%s] is removed from the session\n", 
+						tp, rt->room_name);
+					fprintf(logfp, "Total number of rooms:%d\n", 
+						tenant->total_num_of_rooms);
+					fflush(logfp);
+				}
+
+				standby_log_room_gone(rt);
+				free_room(rt);
+
+			}
+		}
+
+		rt = tmp_rt;
+	}
+}
+
 void 
 process_control_msg(int fd) {
 	struct control_msghdr *cmh;
@@ -615,11 +1531,18 @@ process_control_msg(int fd) {
 	/* Convert message header to host order and log it */
 	ntoh_control_header(cmh);
 	dump_control_msg(fd, buf, 1);
+	tenant->control_msgs++;
 
 	/* make sure the sender has a valid id */
 
-	if( cmh->msg_type >= ROOM_LIST_REQUEST && cmh->msg_type <= QUIT_REQUEST ) {
-		if((mt=find_member_with_id(cmh->member_id)) == NULL) {
+	if((cmh->msg_type >= ROOM_LIST_REQUEST && cmh->msg_type <= QUIT_REQUEST)
+	   || cmh->msg_type == SEARCH_REQUEST
+	   || cmh->msg_type == FILTER_REQUEST
+	   || cmh->msg_type == MOVE_ROOM_REQUEST
+	   || cmh->msg_type == SUBSCRIBE_REQUEST
+	   || cmh->msg_type == UNSUBSCRIBE_REQUEST
+	   || cmh->msg_type == DIRECTORY_REQUEST) {
+		if((mt=find_sender(cmh->member_id, cmh->reserved)) == NULL) {
 
 			/* no match, send fail message : invalid id*/
 			strcpy(err_str, "Member id invalid!");
@@ -632,6 +1555,12 @@ process_control_msg(int fd) {
 			/* member id valid */
 			mt->quiet_flag = 0;
 		}
+
+		/* its room went to another node */
+		if(mt->moved_id != 0) {
+			migrate_follow(fd, mt, buf);
+			return;
+		}
 	}
 
 
@@ -658,12 +1587,41 @@ process_control_msg(int fd) {
 		break;
 
 	case MEMBER_KEEP_ALIVE:
+		standby_announce(fd, mt);
 		break;
 
 	case QUIT_REQUEST: 
 		process_quit_request(fd, mt, buf);
 		break;
 
+	case SEARCH_REQUEST:
+		process_search_request(fd, mt, buf);
+		break;
+
+	case FILTER_REQUEST:
+		process_filter_request(fd, mt, buf);
+		break;
+
+	case MOVE_ROOM_REQUEST:
+		migrate_room_request(fd, mt, buf);
+		break;
+
+	case ROOM_TRANSFER:
+		migrate_transfer(fd, buf);
+		break;
+
+	case SUBSCRIBE_REQUEST:
+		process_subscribe_request(fd, mt, buf);
+		break;
+
+	case UNSUBSCRIBE_REQUEST:
+		process_unsubscribe_request(fd, mt, buf);
+		break;
+
+	case DIRECTORY_REQUEST:
+		process_directory_request(fd, mt, buf);
+		break;
+
 	default:
 		if(log_flag) {
 			fprintf(logfp, "Unrecognized message type!\n");
@@ -678,23 +1636,33 @@ process_control_msg(int fd) {
 
 /* Input parameters "type" and "id" should be in host byte order */
 void send_control_msg_reply(int fd, 
-			    u_int16_t type, u_int16_t id, char *data){
+			    u_int16_t type, u_int32_t id, char *data){
+	send_control_reply_caps(fd, type, id, 0, data);
+}
+
+/* Input parameters "type", "id" and "caps" should be in host byte order */
+void send_control_reply_caps(int fd, u_int16_t type, u_int32_t id,
+			     u_int16_t caps, char *data){
+	send_control_reply_data(fd, type, id, caps, data,
+				data != NULL ? strlen(data) : 0);
+}
+
+void send_control_reply_data(int fd, u_int16_t type, u_int32_t id,
+			     u_int16_t caps, char *data, int len){
 	struct control_msghdr *cmh;
-	int len;
 
 	bzero(msg_buf, MAX_MSG_LEN);
 	cmh = (struct control_msghdr *)msg_buf;
 
-
-	len = sizeof(struct control_msghdr);
-	if(data != NULL) {
-		strcpy((char *)cmh->msgdata, data);
-		len += strlen(data);
-	}
+	if(data != NULL)
+		memcpy(cmh->msgdata, data, len);
+	len += sizeof(struct control_msghdr);
 
 	cmh->msg_type = htons(type);
-	cmh->member_id = htons(id);
+	cmh->member_id = htons(id & 0xffff);
 	cmh->msg_len = htons(len);
+	/* the high half of a wide id, but the caps when registering */
+	cmh->reserved = htons(type == REGISTER_SUCC ? caps : id >> 16);
 
 	write(fd, msg_buf, len);
 
@@ -716,12 +1684,62 @@ void send_control_msg_reply(int fd,
  * message body.
  */
 
-void process_register_request(int fd, char *msg) {
-	struct register_msgdata *rdata;
+/* Answers a registration with the whole id and the session key. */
+static void send_register_v2(int fd, struct member_type *mt) {
+	struct register_v2 rv;
+
+	rv.member_id = htonl(mt->member_id);
+	rv.session_key = htonl(mt->session_key);
+	send_control_reply_data(fd, REGISTER_SUCC, mt->member_id, mt->caps,
+				(char *)&rv, sizeof(rv));
+}
+
+/* Takes back a member whose REGISTER_REQUEST carries a session_resume
+ * that matches. Returns 0 if it did. */
+static int resume_session(int fd, char *msg) {
+	struct control_msghdr *cmh = (struct control_msghdr *)msg;
+	struct register_msgdata *rdata = (struct register_msgdata *)cmh->msgdata;
+	struct session_resume sr;
 	struct member_type *mt;
+	struct sockaddr_in peer_addr;
+	socklen_t peer_addr_len;
+	char *name = (char *)rdata->member_name;
+	int len = (cmh->msg_len < MAX_MSG_LEN ? cmh->msg_len : MAX_MSG_LEN)
+		- (name - msg);
+	char *nul;
+
+	if(!(cmh->reserved & CAP_SESSION) || len <= 0
+	   || (nul = memchr(name, '\0', len)) == NULL
+	   || name + len - (nul + 1) < sizeof(sr))
+		return -1;
+	memcpy(&sr, nul + 1, sizeof(sr));
+
+	mt = find_member_with_id(ntohl(sr.member_id));
+	if(mt == NULL || mt->session_key == 0 || mt->moved_id != 0
+	   || mt->session_key != ntohl(sr.session_key))
+		return -1;
+
+	peer_addr_len = sizeof(peer_addr);
+	if(getpeername(fd, (struct sockaddr *)&peer_addr, &peer_addr_len) < 0 ) {
+		perror("getpeername");
+		return -1;
+	}
+	mt->member_udp_addr.sin_addr = peer_addr.sin_addr;
+	mt->member_udp_addr.sin_port = rdata->udp_port;
+	mt->quiet_flag = 0;
 
+	send_register_v2(fd, mt);
+	binlog_named_event(EV_MEMBER_JOIN, mt->member_id, 0, mt->member_name);
+	if(log_flag) {
+		fprintf(logfp, "Member [%s] resumed its session.\n", mt->member_name);
+		fflush(logfp);
+	}
+	return 0;
+}
 
-	struct member_type *tmp_ptr;
+void process_register_request(int fd, char *msg) {
+	struct register_msgdata *rdata;
+	struct member_type *mt;
 
 	struct sockaddr_in peer_addr;
 	socklen_t peer_addr_len;
@@ -730,15 +1748,27 @@ void process_register_request(int fd, char *msg) {
 	bzero(msg_buf, MAX_MSG_LEN);
 	rdata =(struct register_msgdata *)((struct control_msghdr *)msg)->msgdata;
 
+	/* someone we know, back from another address */
+	if(resume_session(fd, msg) == 0)
+		return;
+
 	/* all right, someone wants to register */
 
-	if(total_num_of_members == MAX_NUM_OF_MEMBERS) {
+	if(tenant->total_num_of_members >= tenant->max_members) {
 		/* can't take any more member */
+		tenant->refused++;
 		strcpy(err_str, "Number of members reached maximum!");
 		send_control_msg_reply(fd, REGISTER_FAIL, 0, err_str);
 		return;
 	}
 
+	/* compact chat messages start with this, see defs_ext.h */
+	if(*(u_int8_t *)rdata->member_name == CHAT_COMPACT_MARK) {
+		strcpy(err_str, "Name is not allowed!");
+		send_control_msg_reply(fd, REGISTER_FAIL, 0, err_str);
+		return;
+	}
+
 	if( (mt = (struct member_type *)malloc(sizeof(struct member_type))) ==
 	    NULL) {
 		printf("Memory used up when try to create member!\n");
@@ -750,6 +1780,12 @@ void process_register_request(int fd, char *msg) {
 
 	strncpy(mt->member_name, (char *)rdata->member_name, MAX_MEMBER_NAME_LEN);
 
+	/* accept the protocol extensions we know about, see defs_ext.h */
+	mt->caps = ((struct control_msghdr *)msg)->reserved & SERVER_CAPS;
+	/* a relay puts names where the high half of a wide id would go */
+	if(mt->caps & CAP_RELAY)
+		mt->caps &= ~CAP_WIDE_ID;
+
 	mt->member_udp_addr.sin_family = AF_INET;
 	/* Leave udp_port contained in message in network byte order */
 	mt->member_udp_addr.sin_port = rdata->udp_port;
@@ -766,62 +1802,52 @@ void process_register_request(int fd, char *msg) {
 
 	/* make sure the member name is not used before */
 
-	if(mem_list_head == NULL) {
-		/* no member yet */
-		mem_list_head = mt;
-		mem_list_tail = mt;
-		total_num_of_members ++;
-	} else {
-
-		tmp_ptr = mem_list_head;
-
-		while(tmp_ptr != NULL) {
-			if(!strcmp(tmp_ptr->member_name, mt->member_name)) {
-				/* return a reject message */
-				strcpy(err_str, "Name has already been used!");
-				send_control_msg_reply(fd, REGISTER_FAIL, 0, err_str);
-
-				return;
-			} else {
-				tmp_ptr = tmp_ptr->next_member;            
-			}
-		}	
-		if(tmp_ptr == NULL){
-			/* add to the tail */
-			mem_list_tail->next_member = mt;
-			mt->prev_member = mem_list_tail;
-			mem_list_tail = mem_list_tail->next_member;
-	
-			total_num_of_members ++;
-		}
+	if(find_member_with_name(mt->member_name) != NULL) {
+		/* return a reject message */
+		strcpy(err_str, "Name has already been used!");
+		send_control_msg_reply(fd, REGISTER_FAIL, 0, err_str);
 
+		return;
 	}
 
-	/* create an id */
-	for(;;) {
-		u_int16_t tmp_id;
-		tmp_ptr = mem_list_head;
-		tmp_id = 1 + (u_int16_t) (65535.0 * rand()/(RAND_MAX+1.0));
-		while(tmp_ptr != mem_list_tail) {
-			if(tmp_id != tmp_ptr->member_id)
-				tmp_ptr = tmp_ptr->next_member;
-			else
-				break;
-		}
-		if(tmp_ptr == mem_list_tail) {
-			mem_list_tail->member_id = tmp_id;
-			break;
+	if(tenant->mem_list_head == NULL) {
+		/* no member yet */
+		tenant->mem_list_head = mt;
+		tenant->mem_list_tail = mt;
+	} else {
+		/* add to the tail */
+		tenant->mem_list_tail->next_member = mt;
+		mt->prev_member = tenant->mem_list_tail;
+		tenant->mem_list_tail = tenant->mem_list_tail->next_member;
+	}
+	tenant->total_num_of_members ++;
+
+	/* create an id, and a key to resume the session with */
+	mt->member_id = new_member_id(mt->caps, 0);
+	if(mt->caps & CAP_SESSION) {
+		while(mt->session_key == 0) {
+			if(getrandom(&mt->session_key, sizeof(mt->session_key), 0)
+			   != sizeof(mt->session_key))
+				mt->session_key = rand();
 		}
 	}
+	index_member(mt);
 
     
 	/* send accept message */
 
-	send_control_msg_reply(fd, REGISTER_SUCC, mem_list_tail->member_id, NULL);
+	standby_log_register(tenant->mem_list_tail);
+
+	if(mt->caps & (CAP_WIDE_ID | CAP_SESSION))
+		send_register_v2(fd, mt);
+	else
+		send_control_reply_caps(fd, REGISTER_SUCC, mt->member_id, mt->caps, NULL);
+	binlog_named_event(EV_MEMBER_JOIN, tenant->mem_list_tail->member_id, 0,
+			   tenant->mem_list_tail->member_name);
 
 
 	if(log_flag) {
-		fprintf(logfp, "Total number of members:%d\n", total_num_of_members);
+		fprintf(logfp, "Total number of members:%d\n", tenant->total_num_of_members);
 		fflush(logfp);
 	}
 
@@ -836,6 +1862,10 @@ void process_create_room_request(int fd, struct member_type *mt, char *msg) {
 	/* all right, someone wants to create a room */
 	bzero(msg_buf, MAX_MSG_LEN);
 
+	if(cluster_redirect(fd, mt, (char *)((struct control_msghdr *)msg)->msgdata,
+			    CREATE_ROOM_FAIL))
+		return;
+
 	ret = create_room((char *)((struct control_msghdr *)msg)->msgdata);
 	if(ret == 1 ) {
 		strcpy(err_str, "Room name too long!");
@@ -851,16 +1881,30 @@ void process_create_room_request(int fd, struct member_type *mt, char *msg) {
 		strcpy(err_str, "Room exists!");
 		send_control_msg_reply(fd, CREATE_ROOM_FAIL, mt->member_id, err_str);
 
+		return;
+	} else if(ret == 4) {
+		strcpy(err_str, "Unknown room option!");
+		send_control_msg_reply(fd, CREATE_ROOM_FAIL, mt->member_id, err_str);
+
+		return;
+	} else if(ret == 5) {
+		strcpy(err_str, "Not enough history space!");
+		send_control_msg_reply(fd, CREATE_ROOM_FAIL, mt->member_id, err_str);
+
 		return;
 	}
 
 
+	/* new rooms go to the tail */
+	tenant->room_list_tail->owner_id = mt->member_id;
+	mt->rooms_created++;
+
 	/* send succ message */
 
 	send_control_msg_reply(fd, CREATE_ROOM_SUCC, mt->member_id, NULL);
 
 	if(log_flag){
-		fprintf(logfp, "Total number of rooms:%d\n", total_num_of_rooms);
+		fprintf(logfp, "Total number of rooms:%d\n", tenant->total_num_of_rooms);
 		fflush(logfp);
 	}
 
@@ -876,7 +1920,7 @@ void process_room_list_request(int fd, struct member_type *mt, char *msg) {
 	/* all right, someone wants to list rooms */
 	bzero(msg_buf, MAX_MSG_LEN);
 
-	if(total_num_of_rooms == 0 ) {
+	if(tenant->total_num_of_rooms == 0 ) {
 		strcpy(err_str, "No rooms available!");
 		send_control_msg_reply(fd, ROOM_LIST_FAIL, mt->member_id, err_str);
 		return;
@@ -886,11 +1930,11 @@ void process_room_list_request(int fd, struct member_type *mt, char *msg) {
 	bzero(list, MAX_MSG_LEN);
 	loc = (char *)&list;
 
-	for(tmp_rptr=room_list_head; tmp_rptr != NULL; tmp_rptr=tmp_rptr->next_room) {
+	for(tmp_rptr=tenant->room_list_head; tmp_rptr != NULL; tmp_rptr=tmp_rptr->next_room) {
 
 		sprintf(loc, "[%s (%d)]", tmp_rptr->room_name, tmp_rptr->num_of_members);
 
-		if(tmp_rptr != room_list_tail) {
+		if(tmp_rptr != tenant->room_list_tail) {
 			char *next_loc;
 			next_loc = loc + strlen(loc)+1;
 			loc[strlen(loc)] =' ';
@@ -905,6 +1949,7 @@ void process_room_list_request(int fd, struct member_type *mt, char *msg) {
 
 void process_switch_room_request(int fd, struct member_type *mt, char *msg) {
 	struct room_type *tmp_rptr;
+	struct mcast_group group;
 	char *to_room;
 
 	/* all right, someone wants to switch */
@@ -913,9 +1958,12 @@ void process_switch_room_request(int fd, struct member_type *mt, char *msg) {
 
 	to_room = (char *)((struct control_msghdr *)msg)->msgdata;
 
+	if(cluster_redirect(fd, mt, to_room, SWITCH_ROOM_FAIL))
+		return;
+
 	/* go through the room list and try to find the room */
 
-	if(room_list_head == NULL) {
+	if(tenant->room_list_head == NULL) {
 		/* no rooms yet, can't switch, send fail message */
 
 		strcpy(err_str, "No room available yet!");
@@ -923,7 +1971,7 @@ void process_switch_room_request(int fd, struct member_type *mt, char *msg) {
 		return;
 
 	} else {
-		for(tmp_rptr=room_list_head; 
+		for(tmp_rptr=tenant->room_list_head; 
 		    tmp_rptr != NULL; tmp_rptr=tmp_rptr->next_room){
 			if(!strcmp(to_room, tmp_rptr->room_name)) {
 				/* room found */
@@ -948,56 +1996,21 @@ void process_switch_room_request(int fd, struct member_type *mt, char *msg) {
 					return;
 				}
 
-				if(mt->current_room != NULL) {
-
-					/* remove the member from its current room */
-					if(mt->prev_room_member == NULL) {
-						/* this member is the first member in the room */
-						mt->current_room->member_list_head =
-							mt->next_room_member;
-						if(mt->current_room->member_list_head == NULL)
-							mt->current_room->member_list_tail =
-								mt->current_room->member_list_head;
-						else 
-							mt->current_room->member_list_head->prev_room_member =
-								NULL;
-					} else {
-
-						/* not the first member */
-						mt->prev_room_member->next_room_member = 
-							mt->next_room_member;
-						if( mt->next_room_member != NULL ) {
-							mt->next_room_member->prev_room_member = 
-								mt->prev_room_member;
-						} else {
-							mt->current_room->member_list_tail = 
-								mt->prev_room_member;
-						}
-					}
-		     
-					mt->current_room->num_of_members --;
-	    
-				}
-		
-				mt->next_room_member = NULL;
-				mt->prev_room_member = NULL;
-				mt->current_room = tmp_rptr;
-
-				/* put the member in the new room */
-				if(tmp_rptr->member_list_head == NULL) {
-					tmp_rptr->member_list_head = mt;
-					tmp_rptr->member_list_tail = tmp_rptr->member_list_head;
-				} else {
-					tmp_rptr->member_list_tail->next_room_member = mt;
-					mt->prev_room_member = tmp_rptr->member_list_tail;
-					tmp_rptr->member_list_tail= 
-						tmp_rptr->member_list_tail->next_room_member;
-				}
-
-				tmp_rptr->num_of_members ++;
-				tmp_rptr->empty_flag = 0; 
-
-				send_control_msg_reply(fd, SWITCH_ROOM_SUCC, mt->member_id, NULL);
+				move_member(mt, tmp_rptr);
+				standby_log_switch(mt);
+				binlog_event(EV_ROOM_SWITCH, 0, mt->member_id, tmp_rptr->room_id, 0, 0);
+
+				/* the member may join the room's group, and report back */
+				if((mt->caps & CAP_MCAST) && (mt->caps & CAP_EXT_HDR)
+				   && mcast_group_of(tmp_rptr, &group))
+					send_control_reply_data(fd, SWITCH_ROOM_SUCC, mt->member_id, 0,
+								(char *)&group, sizeof(group));
+				else
+					send_control_msg_reply(fd, SWITCH_ROOM_SUCC, mt->member_id, NULL);
+
+				/* after the reply, so the client is listening by now */
+				names_announce(mt);
+				history_catch_up(tenant->udp_socket_fd, mt, tmp_rptr);
 				return;
 		
 			}
@@ -1028,12 +2041,12 @@ void process_member_list_request(int fd, struct member_type *mt, char *msg) {
 
 	/* go through the room list and try to find the room */
 
-	if(room_list_head == NULL) {
+	if(tenant->room_list_head == NULL) {
 		strcpy(err_str, "No room available yet!");
 		send_control_msg_reply(fd, MEMBER_LIST_FAIL, mt->member_id, err_str);
 		return;
 	} else {
-		for(rt=room_list_head; rt != NULL; rt=rt->next_room){
+		for(rt=tenant->room_list_head; rt != NULL; rt=rt->next_room){
 			if(!strcmp(room, rt->room_name)) {
 				/* room found */			       
 				char *loc;
@@ -1084,6 +2097,7 @@ void process_quit_request(int fd, struct member_type *mt, char *msg) {
 	/* all right, someone wants to quit */
 
 	remove_member(mt);
+	binlog_event(EV_MEMBER_LEAVE, LEAVE_QUIT, mt->member_id, 0, 0, 0);
 
 	if(log_flag) { 
 		char *tp;
@@ -1092,7 +2106,7 @@ void process_quit_request(int fd, struct member_type *mt, char *msg) {
 		tp[strlen(tp)-1] = '\0'; /* Chop off newline */
  
 		fprintf(logfp, "%s member [%s] left the session\n", tp, mt->member_name);
-		fprintf(logfp, "Total number of members:%d\n", total_num_of_members);
+		fprintf(logfp, "Total number of members:%d\n", tenant->total_num_of_members);
 		fflush(logfp);
 	}
 
@@ -1101,3 +2115,79 @@ void process_quit_request(int fd, struct member_type *mt, char *msg) {
 	return;
 }
 
+void process_search_request(int fd, struct member_type *mt, char *msg) {
+	struct control_msghdr *cmh = (struct control_msghdr *)msg;
+	struct room_type *rt = mt->current_room;
+	char query[MAX_MSG_LEN];
+	char reply[MAX_MSG_LEN - sizeof(struct control_msghdr)];
+	int len, n;
+
+	/* the words need not be '\0' terminated */
+	len = cmh->msg_len - sizeof(struct control_msghdr);
+	if(len < 0)
+		len = 0;
+	if(len > MAX_MSG_LEN - sizeof(struct control_msghdr))
+		len = MAX_MSG_LEN - sizeof(struct control_msghdr);
+	memcpy(query, cmh->msgdata, len);
+	query[len] = '\0';
+
+	if(rt == NULL) {
+		strcpy(err_str, "Not in any room!");
+		send_control_msg_reply(fd, SEARCH_FAIL, mt->member_id, err_str);
+		return;
+	}
+	if(rt->index == NULL) {
+		strcpy(err_str, "Room keeps no history!");
+		send_control_msg_reply(fd, SEARCH_FAIL, mt->member_id, err_str);
+		return;
+	}
+
+	if((n = search_room(rt, query, reply, sizeof(reply))) < 0) {
+		strcpy(err_str, "Nothing to search for!");
+		send_control_msg_reply(fd, SEARCH_FAIL, mt->member_id, err_str);
+	} else if(n == 0) {
+		strcpy(err_str, "No match!");
+		send_control_msg_reply(fd, SEARCH_FAIL, mt->member_id, err_str);
+	} else {
+		send_control_msg_reply(fd, SEARCH_SUCC, mt->member_id, reply);
+	}
+}
+
+void process_filter_request(int fd, struct member_type *mt, char *msg) {
+	struct control_msghdr *cmh = (struct control_msghdr *)msg;
+	struct room_type *rt = mt->current_room;
+	char spec[MAX_MSG_LEN];
+	char reply[MAX_ROOM_NAME_LEN + 64];
+	int len, n;
+
+	/* the patterns need not be '\0' terminated */
+	len = cmh->msg_len - sizeof(struct control_msghdr);
+	if(len < 0)
+		len = 0;
+	if(len > MAX_MSG_LEN - sizeof(struct control_msghdr))
+		len = MAX_MSG_LEN - sizeof(struct control_msghdr);
+	memcpy(spec, cmh->msgdata, len);
+	spec[len] = '\0';
+
+	if(rt == NULL) {
+		strcpy(err_str, "Not in any room!");
+		send_control_msg_reply(fd, FILTER_FAIL, mt->member_id, err_str);
+		return;
+	}
+	if(rt->owner_id != mt->member_id) {
+		strcpy(err_str, "Only the member that created the room may set its filter!");
+		send_control_msg_reply(fd, FILTER_FAIL, mt->member_id, err_str);
+		return;
+	}
+
+	if((n = filter_set(rt, spec)) < 0) {
+		strcpy(err_str, "Too many filter patterns!");
+		send_control_msg_reply(fd, FILTER_FAIL, mt->member_id, err_str);
+	} else {
+		if(n == 0)
+			sprintf(reply, "Filter of room [%s] removed", rt->room_name);
+		else
+			sprintf(reply, "Filter of room [%s] set: %d patterns", rt->room_name, n);
+		send_control_msg_reply(fd, FILTER_SUCC, mt->member_id, reply);
+	}
+}
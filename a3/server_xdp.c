@@ -0,0 +1,621 @@
+/*
+ *      File:      server_xdp.c
+ *
+ * AF_XDP data path for chat datagrams, see server_xdp.h.
+ *
+ * No libbpf/libxdp is required: the redirect program is a handful of raw
+ * eBPF instructions, and the XSKMAP, program and link are created with the
+ * bpf(2) syscall directly. The UMEM is split in two halves: the first half
+ * is handed to the kernel through the fill ring for receiving, the second
+ * half is a stack of free frames used to build outgoing datagrams.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <linux/ip.h>
+#include <linux/udp.h>
+
+#include "server_xdp.h"
+#include "server_binlog.h"
+#include "server_reliable.h"
+#include "server_direct.h"
+#include "server_bulk.h"
+#include "server_subs.h"
+#include "server_coalesce.h"
+#include "server_mcast.h"
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+#define XDP_NUM_FRAMES    2048
+#define XDP_FRAME_SIZE    4096
+#define XDP_RING_SIZE     1024
+#define XDP_RX_BATCH      64
+
+/* eth + ipv4 without options + udp */
+#define XDP_HDR_LEN  (ETH_HLEN + sizeof(struct iphdr) + sizeof(struct udphdr))
+
+/* number of entries in the IPv4 -> MAC table; must be a power of two */
+#define XDP_NEIGH_SLOTS   256
+
+struct xdp_ring {
+	u_int32_t *producer;
+	u_int32_t *consumer;
+	void *desc;
+	u_int32_t mask;
+	void *map;
+	size_t map_len;
+};
+
+struct xdp_neigh {
+	u_int32_t ip;            /* network byte order, 0 means free */
+	unsigned char mac[ETH_ALEN];
+};
+
+static int xsk_fd = -1;
+static int xsk_map_fd = -1;
+static int xdp_prog_fd = -1;
+static int xdp_link_fd = -1;
+
+static char *umem_area;
+static struct xdp_ring fill_ring, comp_ring, rx_ring, tx_ring;
+
+/* stack of UMEM frame addresses available for transmitting */
+static u_int64_t tx_free[XDP_NUM_FRAMES / 2];
+static int tx_free_cnt;
+
+/* link-layer addresses learned from received frames */
+static struct xdp_neigh neigh_table[XDP_NEIGH_SLOTS];
+
+/* our own addresses, taken from the last received chat frame */
+static unsigned char local_mac[ETH_ALEN];
+static u_int32_t local_ip;
+static u_int16_t chat_port;    /* network byte order */
+static u_int16_t ip_id;
+
+static int sys_bpf(int cmd, union bpf_attr *attr) {
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+#define XDP_INSN(c, d, s, o, i) \
+	((struct bpf_insn){ .code = (c), .dst_reg = (d), .src_reg = (s), \
+			    .off = (o), .imm = (i) })
+
+/*
+ * Build and load the redirect program:
+ *
+ *   if the frame is an unfragmented IPv4 (no options) UDP datagram to
+ *   the chat port, redirect it to the XSK bound to its rx queue, and if
+ *   there is none, pass it up the stack; pass everything else.
+ */
+static int load_redirect_prog(int map_fd, u_int16_t port) {
+	struct bpf_insn prog[] = {
+		/* 0: r6 = ctx, r2 = data, r3 = data_end */
+		XDP_INSN(BPF_ALU64 | BPF_MOV | BPF_X, 6, 1, 0, 0),
+		XDP_INSN(BPF_LDX | BPF_MEM | BPF_W, 2, 6, 0, 0),
+		XDP_INSN(BPF_LDX | BPF_MEM | BPF_W, 3, 6, 4, 0),
+		/* 3: bounds check for eth + ip + udp */
+		XDP_INSN(BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0),
+		XDP_INSN(BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, XDP_HDR_LEN),
+		XDP_INSN(BPF_JMP | BPF_JGT | BPF_X, 4, 3, 17, 0),
+		/* 6: ethertype */
+		XDP_INSN(BPF_LDX | BPF_MEM | BPF_H, 5, 2, 12, 0),
+		XDP_INSN(BPF_JMP | BPF_JNE | BPF_K, 5, 0, 15, htons(ETH_P_IP)),
+		/* 8: version 4, 20 byte header */
+		XDP_INSN(BPF_LDX | BPF_MEM | BPF_B, 5, 2, 14, 0),
+		XDP_INSN(BPF_JMP | BPF_JNE | BPF_K, 5, 0, 13, 0x45),
+		/* 10: no fragments */
+		XDP_INSN(BPF_LDX | BPF_MEM | BPF_H, 5, 2, 20, 0),
+		XDP_INSN(BPF_ALU64 | BPF_AND | BPF_K, 5, 0, 0, htons(0x3fff)),
+		XDP_INSN(BPF_JMP | BPF_JNE | BPF_K, 5, 0, 10, 0),
+		/* 13: protocol */
+		XDP_INSN(BPF_LDX | BPF_MEM | BPF_B, 5, 2, 23, 0),
+		XDP_INSN(BPF_JMP | BPF_JNE | BPF_K, 5, 0, 8, IPPROTO_UDP),
+		/* 15: destination port */
+		XDP_INSN(BPF_LDX | BPF_MEM | BPF_H, 5, 2, 36, 0),
+		XDP_INSN(BPF_JMP | BPF_JNE | BPF_K, 5, 0, 6, htons(port)),
+		/* 17: return bpf_redirect_map(&xsks, ctx->rx_queue_index, XDP_PASS) */
+		XDP_INSN(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, map_fd),
+		XDP_INSN(0, 0, 0, 0, 0),
+		XDP_INSN(BPF_LDX | BPF_MEM | BPF_W, 2, 6,
+			 offsetof(struct xdp_md, rx_queue_index), 0),
+		XDP_INSN(BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, XDP_PASS),
+		XDP_INSN(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),
+		XDP_INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+		/* 23: pass */
+		XDP_INSN(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_PASS),
+		XDP_INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+	};
+	union bpf_attr attr;
+	char verifier_log[4096];
+
+	bzero(&attr, sizeof(attr));
+	bzero(verifier_log, sizeof(verifier_log));
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.insns = (u_int64_t)(unsigned long)prog;
+	attr.insn_cnt = sizeof(prog) / sizeof(prog[0]);
+	attr.license = (u_int64_t)(unsigned long)"GPL";
+	attr.log_buf = (u_int64_t)(unsigned long)verifier_log;
+	attr.log_size = sizeof(verifier_log);
+	attr.log_level = 1;
+
+	return sys_bpf(BPF_PROG_LOAD, &attr);
+}
+
+static int create_xsk_map(int max_queues) {
+	union bpf_attr attr;
+
+	bzero(&attr, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size = sizeof(u_int32_t);
+	attr.value_size = sizeof(u_int32_t);
+	attr.max_entries = max_queues;
+
+	return sys_bpf(BPF_MAP_CREATE, &attr);
+}
+
+static int map_ring(struct xdp_ring *r, struct xdp_ring_offset *off,
+		    size_t desc_size, off_t pgoff) {
+	r->map_len = off->desc + XDP_RING_SIZE * desc_size;
+	r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_POPULATE, xsk_fd, pgoff);
+	if(r->map == MAP_FAILED) {
+		r->map = NULL;
+		return -1;
+	}
+	r->producer = (u_int32_t *)((char *)r->map + off->producer);
+	r->consumer = (u_int32_t *)((char *)r->map + off->consumer);
+	r->desc = (char *)r->map + off->desc;
+	r->mask = XDP_RING_SIZE - 1;
+	return 0;
+}
+
+static void unmap_ring(struct xdp_ring *r) {
+	if(r->map != NULL)
+		munmap(r->map, r->map_len);
+	bzero(r, sizeof(*r));
+}
+
+static void xdp_log_failure(char *what) {
+	char err_buf[MAX_ERR_STR_LEN];
+
+	snprintf(err_buf, MAX_ERR_STR_LEN, "%s: %s", what, strerror(errno));
+	printf("AF_XDP path disabled (%s), using UDP socket\n", err_buf);
+	if(log_flag) {
+		fprintf(logfp, "AF_XDP path disabled (%s), using UDP socket\n",
+			err_buf);
+		fflush(logfp);
+	}
+}
+
+static int open_xsk(int ifindex, int queue_id) {
+	struct xdp_umem_reg umem_reg;
+	struct xdp_mmap_offsets off;
+	struct sockaddr_xdp sxdp;
+	socklen_t optlen;
+	int ring_size = XDP_RING_SIZE;
+	u_int64_t *fill;
+	int i;
+
+	if((xsk_fd = socket(AF_XDP, SOCK_RAW, 0)) < 0) {
+		xdp_log_failure("socket(AF_XDP)");
+		return -1;
+	}
+
+	umem_area = mmap(NULL, XDP_NUM_FRAMES * XDP_FRAME_SIZE,
+			 PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(umem_area == MAP_FAILED) {
+		umem_area = NULL;
+		xdp_log_failure("mmap umem");
+		return -1;
+	}
+
+	bzero(&umem_reg, sizeof(umem_reg));
+	umem_reg.addr = (u_int64_t)(unsigned long)umem_area;
+	umem_reg.len = XDP_NUM_FRAMES * XDP_FRAME_SIZE;
+	umem_reg.chunk_size = XDP_FRAME_SIZE;
+	umem_reg.headroom = 0;
+
+	if(setsockopt(xsk_fd, SOL_XDP, XDP_UMEM_REG, &umem_reg, sizeof(umem_reg)) < 0
+	   || setsockopt(xsk_fd, SOL_XDP, XDP_UMEM_FILL_RING, &ring_size, sizeof(int)) < 0
+	   || setsockopt(xsk_fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ring_size, sizeof(int)) < 0
+	   || setsockopt(xsk_fd, SOL_XDP, XDP_RX_RING, &ring_size, sizeof(int)) < 0
+	   || setsockopt(xsk_fd, SOL_XDP, XDP_TX_RING, &ring_size, sizeof(int)) < 0) {
+		xdp_log_failure("setsockopt(SOL_XDP)");
+		return -1;
+	}
+
+	optlen = sizeof(off);
+	if(getsockopt(xsk_fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0) {
+		xdp_log_failure("getsockopt(XDP_MMAP_OFFSETS)");
+		return -1;
+	}
+
+	if(map_ring(&fill_ring, &off.fr, sizeof(u_int64_t), XDP_UMEM_PGOFF_FILL_RING) < 0
+	   || map_ring(&comp_ring, &off.cr, sizeof(u_int64_t), XDP_UMEM_PGOFF_COMPLETION_RING) < 0
+	   || map_ring(&rx_ring, &off.rx, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) < 0
+	   || map_ring(&tx_ring, &off.tx, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING) < 0) {
+		xdp_log_failure("mmap rings");
+		return -1;
+	}
+
+	/* first half of the UMEM is for receiving */
+	fill = (u_int64_t *)fill_ring.desc;
+	for(i = 0; i < XDP_RING_SIZE; i++)
+		fill[i] = (u_int64_t)i * XDP_FRAME_SIZE;
+	__atomic_store_n(fill_ring.producer, XDP_RING_SIZE, __ATOMIC_RELEASE);
+
+	/* second half is for transmitting */
+	tx_free_cnt = 0;
+	for(i = XDP_NUM_FRAMES / 2; i < XDP_NUM_FRAMES; i++)
+		tx_free[tx_free_cnt++] = (u_int64_t)i * XDP_FRAME_SIZE;
+
+	/* generic mode only supports copy mode */
+	bzero(&sxdp, sizeof(sxdp));
+	sxdp.sxdp_family = AF_XDP;
+	sxdp.sxdp_ifindex = ifindex;
+	sxdp.sxdp_queue_id = queue_id;
+	sxdp.sxdp_flags = XDP_COPY;
+
+	if(bind(xsk_fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) < 0) {
+		xdp_log_failure("bind(AF_XDP)");
+		return -1;
+	}
+
+	return 0;
+}
+
+int xdp_init(char *ifname, int queue_id, u_int16_t udp_port) {
+	union bpf_attr attr;
+	u_int32_t key;
+	u_int32_t value;
+	int ifindex;
+
+	chat_port = htons(udp_port);
+
+	if((ifindex = if_nametoindex(ifname)) == 0) {
+		xdp_log_failure(ifname);
+		return -1;
+	}
+
+	if((xsk_map_fd = create_xsk_map(queue_id + 1)) < 0) {
+		xdp_log_failure("bpf(BPF_MAP_CREATE)");
+		goto fail;
+	}
+
+	if((xdp_prog_fd = load_redirect_prog(xsk_map_fd, udp_port)) < 0) {
+		xdp_log_failure("bpf(BPF_PROG_LOAD)");
+		goto fail;
+	}
+
+	if(open_xsk(ifindex, queue_id) < 0)
+		goto fail;
+
+	key = queue_id;
+	value = xsk_fd;
+	bzero(&attr, sizeof(attr));
+	attr.map_fd = xsk_map_fd;
+	attr.key = (u_int64_t)(unsigned long)&key;
+	attr.value = (u_int64_t)(unsigned long)&value;
+	if(sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0) {
+		xdp_log_failure("bpf(BPF_MAP_UPDATE_ELEM)");
+		goto fail;
+	}
+
+	/*
+	 * attach through a bpf link so the program goes away with the
+	 * process, whichever way it exits
+	 */
+	bzero(&attr, sizeof(attr));
+	attr.link_create.prog_fd = xdp_prog_fd;
+	attr.link_create.target_ifindex = ifindex;
+	attr.link_create.attach_type = BPF_XDP;
+	attr.link_create.flags = XDP_FLAGS_SKB_MODE;
+	if((xdp_link_fd = sys_bpf(BPF_LINK_CREATE, &attr)) < 0) {
+		xdp_log_failure("bpf(BPF_LINK_CREATE)");
+		goto fail;
+	}
+
+	printf("Chat server AF_XDP path on %s queue %d (generic mode)\n",
+	       ifname, queue_id);
+	if(log_flag) {
+		fprintf(logfp, "Chat server AF_XDP path on %s queue %d (generic mode)\n",
+			ifname, queue_id);
+		fflush(logfp);
+	}
+
+	return xsk_fd;
+
+ fail:
+	xdp_shutdown();
+	return -1;
+}
+
+void xdp_shutdown() {
+	if(xdp_link_fd >= 0)
+		close(xdp_link_fd);
+	if(xdp_prog_fd >= 0)
+		close(xdp_prog_fd);
+
+	unmap_ring(&fill_ring);
+	unmap_ring(&comp_ring);
+	unmap_ring(&rx_ring);
+	unmap_ring(&tx_ring);
+
+	if(xsk_fd >= 0)
+		close(xsk_fd);
+	if(xsk_map_fd >= 0)
+		close(xsk_map_fd);
+	if(umem_area != NULL)
+		munmap(umem_area, XDP_NUM_FRAMES * XDP_FRAME_SIZE);
+
+	xdp_link_fd = xdp_prog_fd = xsk_fd = xsk_map_fd = -1;
+	umem_area = NULL;
+}
+
+static struct xdp_neigh *neigh_slot(u_int32_t ip) {
+	u_int32_t h = ntohl(ip);
+	int i;
+
+	h ^= h >> 16;
+	h *= 0x45d9f3b;
+	h ^= h >> 16;
+
+	for(i = 0; i < XDP_NEIGH_SLOTS; i++) {
+		struct xdp_neigh *n = &neigh_table[(h + i) & (XDP_NEIGH_SLOTS - 1)];
+		if(n->ip == ip || n->ip == 0)
+			return n;
+	}
+	/* table full: overwrite the home slot */
+	return &neigh_table[h & (XDP_NEIGH_SLOTS - 1)];
+}
+
+static void neigh_learn(u_int32_t ip, unsigned char *mac) {
+	struct xdp_neigh *n = neigh_slot(ip);
+
+	n->ip = ip;
+	memcpy(n->mac, mac, ETH_ALEN);
+}
+
+static struct xdp_neigh *neigh_lookup(u_int32_t ip) {
+	struct xdp_neigh *n = neigh_slot(ip);
+
+	return (n->ip == ip) ? n : NULL;
+}
+
+static u_int16_t ip_checksum(struct iphdr *iph) {
+	u_int16_t *p = (u_int16_t *)iph;
+	u_int32_t sum = 0;
+	int i;
+
+	for(i = 0; i < sizeof(struct iphdr) / 2; i++)
+		sum += p[i];
+	while(sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return ~sum;
+}
+
+/* move frames the kernel has finished sending back to the free stack */
+static void reap_completions() {
+	u_int32_t prod = __atomic_load_n(comp_ring.producer, __ATOMIC_ACQUIRE);
+	u_int32_t cons = *comp_ring.consumer;
+	u_int64_t *addrs = (u_int64_t *)comp_ring.desc;
+
+	while(cons != prod)
+		tx_free[tx_free_cnt++] = addrs[cons++ & comp_ring.mask];
+	__atomic_store_n(comp_ring.consumer, cons, __ATOMIC_RELEASE);
+}
+
+/*
+ * Build one outgoing datagram to the given member in a UMEM frame and
+ * queue it on the tx ring. Returns -1 if the caller has to fall back to
+ * the socket.
+ */
+static int xdp_send_to_member(struct member_type *mt, char *msg, int len) {
+	struct xdp_neigh *n;
+	struct xdp_desc *desc;
+	struct ethhdr *eth;
+	struct iphdr *iph;
+	struct udphdr *udph;
+	u_int32_t prod, cons;
+	u_int64_t addr;
+
+	if((n = neigh_lookup(mt->member_udp_addr.sin_addr.s_addr)) == NULL)
+		return -1;
+
+	if(len + XDP_HDR_LEN > XDP_FRAME_SIZE || tx_free_cnt == 0)
+		return -1;
+
+	prod = *tx_ring.producer;
+	cons = __atomic_load_n(tx_ring.consumer, __ATOMIC_ACQUIRE);
+	if(prod - cons >= XDP_RING_SIZE)
+		return -1;
+
+	addr = tx_free[--tx_free_cnt];
+
+	eth = (struct ethhdr *)(umem_area + addr);
+	memcpy(eth->h_dest, n->mac, ETH_ALEN);
+	memcpy(eth->h_source, local_mac, ETH_ALEN);
+	eth->h_proto = htons(ETH_P_IP);
+
+	iph = (struct iphdr *)(eth + 1);
+	iph->version = 4;
+	iph->ihl = 5;
+	iph->tos = 0;
+	iph->tot_len = htons(sizeof(struct iphdr) + sizeof(struct udphdr) + len);
+	iph->id = htons(ip_id++);
+	iph->frag_off = htons(0x4000);    /* DF */
+	iph->ttl = 64;
+	iph->protocol = IPPROTO_UDP;
+	iph->check = 0;
+	iph->saddr = local_ip;
+	iph->daddr = mt->member_udp_addr.sin_addr.s_addr;
+	iph->check = ip_checksum(iph);
+
+	udph = (struct udphdr *)(iph + 1);
+	udph->source = chat_port;
+	udph->dest = mt->member_udp_addr.sin_port;
+	udph->len = htons(sizeof(struct udphdr) + len);
+	udph->check = 0;                  /* optional for IPv4 */
+
+	memcpy(udph + 1, msg, len);
+
+	desc = &((struct xdp_desc *)tx_ring.desc)[prod & tx_ring.mask];
+	desc->addr = addr;
+	desc->len = XDP_HDR_LEN + len;
+	desc->options = 0;
+	__atomic_store_n(tx_ring.producer, prod + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/* Parse one received frame and distribute the chat message it carries. */
+static void xdp_handle_frame(int udp_socket_fd, char *frame, u_int32_t frame_len) {
+	char buf[MAX_MSG_LEN];
+	struct ethhdr *eth;
+	struct iphdr *iph;
+	struct udphdr *udph;
+	struct member_type *mt;
+	struct member_type *tmp_mptr;
+	struct chat_out co;
+	char *msg;
+	int copies = 0;
+	int mcast;
+	int n, len;
+
+	eth = (struct ethhdr *)frame;
+	iph = (struct iphdr *)(eth + 1);
+	udph = (struct udphdr *)(iph + 1);
+
+	if(frame_len < XDP_HDR_LEN)
+		return;
+
+	n = ntohs(udph->len) - sizeof(struct udphdr);
+	if(n < 0 || n > frame_len - XDP_HDR_LEN)
+		return;
+	if(n > MAX_MSG_LEN)
+		n = MAX_MSG_LEN;
+
+	/* the frame goes back to the fill ring, so work on a copy */
+	bzero(buf, MAX_MSG_LEN);
+	memcpy(buf, udph + 1, n);
+
+	memcpy(local_mac, eth->h_dest, ETH_ALEN);
+	local_ip = iph->daddr;
+	neigh_learn(iph->saddr, eth->h_source);
+
+	if(is_chat_bulk(buf, n)) {
+		process_bulk_chunk(buf, n);
+		return;
+	}
+	if(is_chat_nack(buf, n) || is_chat_direct(buf, n)) {
+		struct sockaddr_in from;
+
+		bzero(&from, sizeof(from));
+		from.sin_family = AF_INET;
+		from.sin_addr.s_addr = iph->saddr;
+		from.sin_port = udph->source;
+		if(is_chat_nack(buf, n))
+			process_chat_nack(udp_socket_fd, buf, n, &from);
+		else
+			process_direct_msg(udp_socket_fd, buf, n, &from);
+		return;
+	}
+
+	/* no kernel timestamp on this path, admit stamps the current time */
+	if((mt = admit_chat_msg(buf, n, NULL, &co)) == NULL)
+		return;
+
+	/* one datagram for the group, through the socket */
+	mcast = mcast_send(co.rt, &co);
+	copies += mcast;
+
+	for(tmp_mptr = co.rt->member_list_head; tmp_mptr != NULL;
+	    tmp_mptr = tmp_mptr->next_room_member) {
+		if(tmp_mptr->mcast && mcast)
+			continue;
+		copies++;
+		len = chat_msg_for(&co, tmp_mptr, &msg);
+		if(coalesce_add(tmp_mptr, msg, len))
+			continue;
+		if(xdp_send_to_member(tmp_mptr, msg, len) == 0)
+			continue;
+
+		if(sendto(udp_socket_fd, msg, len, 0,
+			  (struct sockaddr *)&tmp_mptr->member_udp_addr,
+			  sizeof(struct sockaddr_in)) < 0) {
+			perror("send to");
+			return;
+		}
+	}
+	copies += subs_send(udp_socket_fd, &co);
+
+	binlog_event(EV_CHAT, copies, mt->member_id, co.rt->room_id, n, 0);
+
+	if(log_flag) {
+		fprintf(logfp, "Chat message is broadcast to room [%s(%d)].\n",
+			co.rt->room_name, co.rt->num_of_members);
+		fflush(logfp);
+	}
+}
+
+void process_xdp_chat_msgs(int udp_socket_fd) {
+	struct xdp_desc *descs = (struct xdp_desc *)rx_ring.desc;
+	u_int64_t *fill = (u_int64_t *)fill_ring.desc;
+	u_int32_t rx_prod, rx_cons, fill_prod;
+	int handled = 0;
+
+	reap_completions();
+
+	rx_prod = __atomic_load_n(rx_ring.producer, __ATOMIC_ACQUIRE);
+	rx_cons = *rx_ring.consumer;
+	fill_prod = *fill_ring.producer;
+
+	while(rx_cons != rx_prod && handled < XDP_RX_BATCH) {
+		struct xdp_desc *d = &descs[rx_cons & rx_ring.mask];
+
+		xdp_handle_frame(udp_socket_fd, umem_area + d->addr, d->len);
+
+		/*
+		 * the fill ring is as large as the rx half of the UMEM, so
+		 * there is always room to give the frame back
+		 */
+		fill[fill_prod++ & fill_ring.mask] = d->addr & ~(u_int64_t)(XDP_FRAME_SIZE - 1);
+		rx_cons++;
+		handled++;
+	}
+
+	__atomic_store_n(rx_ring.consumer, rx_cons, __ATOMIC_RELEASE);
+	__atomic_store_n(fill_ring.producer, fill_prod, __ATOMIC_RELEASE);
+
+	/*
+	 * kick the kernel to transmit whatever we queued; in copy mode it
+	 * only sends a small batch per call
+	 */
+	for(handled = 0; handled < XDP_RING_SIZE / 32; handled++) {
+		if(*tx_ring.producer == __atomic_load_n(tx_ring.consumer, __ATOMIC_ACQUIRE))
+			break;
+		if(sendto(xsk_fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0
+		   && errno != EAGAIN && errno != ENOBUFS && errno != EBUSY)
+			break;
+	}
+}
@@ -0,0 +1,70 @@
+/*
+ *      File:      server_xdp.h
+ *
+ * Optional AF_XDP data path for chat datagrams. A small XDP program
+ * redirects IPv4/UDP datagrams addressed to the chat UDP port into an
+ * AF_XDP socket; the chatserver parses them straight out of the UMEM and
+ * builds the fan-out frames in the UMEM as well, bypassing the socket
+ * layer in both directions. Everything else on the interface (ARP, TCP
+ * control connections, fragments) is passed up the regular stack.
+ *
+ * The program is attached in generic (SKB) mode so that it works on any
+ * interface, including veth pairs.
+ */
+
+#ifndef _SERVER_XDP_H
+#define _SERVER_XDP_H
+
+#include "server.h"
+
+/*
+ *  FUNCTION: xdp_init
+ *
+ *  SYNOPSIS: Load the redirect program on an interface and open an AF_XDP
+ *            socket on one of its receive queues
+ *
+ *  PASS:     ifname ==> interface carrying the chat traffic
+ *            queue_id ==> receive queue to bind to
+ *            udp_port ==> chat UDP port (host byte order)
+ *
+ *  RETURN:   the AF_XDP socket fd (pollable for input) on success,
+ *            -1 if any step failed; in that case everything that was set
+ *            up has been torn down again and chat traffic keeps flowing
+ *            through udp_socket_fd.
+ *
+ *  NOTE:     Information will be logged.
+ *
+ */
+int xdp_init(char *ifname, int queue_id, u_int16_t udp_port);
+
+/*
+ *  FUNCTION: process_xdp_chat_msgs
+ *
+ *  SYNOPSIS: drain the AF_XDP receive ring and distribute every chat
+ *            message to the members of the sender's room
+ *
+ *  PASS:     udp_socket_fd ==> socket used for recipients that cannot be
+ *                              reached through the UMEM transmit ring
+ *
+ *  RETURN:   void
+ *
+ *  NOTE:     Recipients whose link-layer address has not been learned yet,
+ *            or that arrive while the transmit ring is full, are sent to
+ *            through the regular UDP socket.
+ *
+ */
+void process_xdp_chat_msgs(int udp_socket_fd);
+
+/*
+ *  FUNCTION: xdp_shutdown
+ *
+ *  SYNOPSIS: detach the XDP program and release the AF_XDP socket and UMEM
+ *
+ *  PASS:     none
+ *
+ *  RETURN:   void
+ *
+ */
+void xdp_shutdown();
+
+#endif
@@ -0,0 +1,98 @@
+/*
+ *      File:      test_chat_fmt.c
+ *
+ * Checks the copies chat_msg_fmt() builds of the largest chat message a
+ * member can send: a compressed one whose text comes out to
+ * MSGZIP_MAX_TEXT bytes, sent on in every header format, the compact one
+ * with the longest slot and the sender's name inline. Each copy must
+ * come whole, and survive the others being built. Built with
+ * AddressSanitizer by "make test", so a copy that runs past all the
+ * buffers fails it too.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "server.h"
+#include "msgzip.h"
+
+char optstr[] = "";
+
+static char text[MSGZIP_MAX_TEXT + 1];
+static char msg[MAX_MSG_LEN];
+
+int
+main() {
+	struct chat_msghdr *cmh = (struct chat_msghdr *)msg;
+	struct chat_ext_hdr *ext = (struct chat_ext_hdr *)cmh->msgdata;
+	struct chat_out co;
+	char name[MAX_MEMBER_NAME_LEN];
+	char *out, *p;
+	int zlen, fmt, len, hdr_len, text_len;
+	int failed = 0;
+	int i;
+
+	/* text that compresses well, so the message is far shorter than it */
+	for(i = 0; i < MSGZIP_MAX_TEXT; i++)
+		text[i] = "chat text "[i % 10];
+	zlen = msgzip_compress(text, MSGZIP_MAX_TEXT, (char *)ext->msgdata,
+			       MAX_MSG_LEN - sizeof(struct chat_msghdr)
+			       - sizeof(struct chat_ext_hdr));
+	if(zlen <= 0) {
+		printf("FAIL: text did not compress\n");
+		return 1;
+	}
+
+	/* as admit_chat_msg() leaves a compressed message with the extended header */
+	bzero(&co, sizeof(co));
+	memset(name, 'n', MAX_MEMBER_NAME_LEN - 1);
+	name[MAX_MEMBER_NAME_LEN - 1] = '\0';
+	cmh->msg_len = htons(CHAT_EXT_FLAG | CHAT_ZIP_FLAG | zlen);
+	ext->sender_seq = htonl(1);
+	co.hdr = cmh;
+	co.name = name;
+	co.slot = 0x7fffffff;
+	co.name_inline = 1;
+	co.text = text;
+	co.text_len = MSGZIP_MAX_TEXT;
+	co.ztext = (char *)ext->msgdata;
+	co.ztext_len = zlen;
+	co.ext = *ext;
+	co.msg[CHAT_FMT_EXT | CHAT_FMT_ZIP] = msg;
+	co.len[CHAT_FMT_EXT | CHAT_FMT_ZIP] = sizeof(struct chat_msghdr)
+		+ sizeof(struct chat_ext_hdr) + zlen;
+
+	/* all of them first: one running into the next is spoilt by it */
+	for(fmt = 0; fmt < CHAT_FMTS; fmt++)
+		chat_msg_fmt(&co, fmt, &out);
+
+	for(fmt = 0; fmt < CHAT_FMTS; fmt++) {
+		len = chat_msg_fmt(&co, fmt, &out);
+
+		if(fmt & CHAT_FMT_COMPACT)
+			hdr_len = 2 + 5 + MAX_MEMBER_NAME_LEN;
+		else
+			hdr_len = sizeof(struct chat_msghdr);
+		if(fmt & CHAT_FMT_EXT)
+			hdr_len += sizeof(struct chat_ext_hdr);
+		text_len = (fmt & CHAT_FMT_ZIP) ? zlen : MSGZIP_MAX_TEXT;
+		p = (fmt & CHAT_FMT_ZIP) ? co.ztext : text;
+
+		if(len != hdr_len + text_len) {
+			printf("FAIL: format %d: %d bytes, expected %d\n",
+			       fmt, len, hdr_len + text_len);
+			failed = 1;
+		} else if(memcmp(out + hdr_len, p, text_len)) {
+			printf("FAIL: format %d: text spoilt\n", fmt);
+			failed = 1;
+		} else {
+			printf("ok: format %d: %d bytes\n", fmt, len);
+		}
+	}
+	return failed;
+}